@@ -1815,6 +1815,7 @@ static void audio_init (void)
     if (!s->ts) {
         hw_error("Could not create audio timer\n");
     }
+    qemu_timer_set_name (s->ts, "audio");
 
     audio_process_options ("AUDIO", audio_options);
 
@@ -1899,6 +1900,7 @@ void AUD_register_card (const char *name, QEMUSoundCard *card)
 {
     audio_init ();
     card->name = qemu_strdup (name);
+    card->info = NULL;
     memset (&card->entries, 0, sizeof (card->entries));
     QLIST_INSERT_HEAD (&glob_audio_state.card_head, card, entries);
 }
@@ -1909,6 +1911,22 @@ void AUD_remove_card (QEMUSoundCard *card)
     qemu_free (card->name);
 }
 
+void do_info_audio (Monitor *mon)
+{
+    QEMUSoundCard *card;
+
+    if (QLIST_EMPTY (&glob_audio_state.card_head)) {
+        monitor_printf (mon, "No sound cards\n");
+        return;
+    }
+    QLIST_FOREACH (card, &glob_audio_state.card_head, entries) {
+        monitor_printf (mon, "%s:\n", card->name);
+        if (card->info) {
+            card->info (mon, card->info_opaque);
+        }
+    }
+}
+
 
 CaptureVoiceOut *AUD_add_capture (
     struct audsettings *as,
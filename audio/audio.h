@@ -79,6 +79,9 @@ typedef struct SWVoiceIn SWVoiceIn;
 
 typedef struct QEMUSoundCard {
     char *name;
+    /* optional, prints the card's state for "info audio" */
+    void (*info) (Monitor *mon, void *opaque);
+    void *info_opaque;
     QLIST_ENTRY (QEMUSoundCard) entries;
 } QEMUSoundCard;
 
@@ -96,6 +99,7 @@ void AUD_log (const char *cap, const char *fmt, ...)
 void AUD_help (void);
 void AUD_register_card (const char *name, QEMUSoundCard *card);
 void AUD_remove_card (QEMUSoundCard *card);
+void do_info_audio (Monitor *mon);
 CaptureVoiceOut *AUD_add_capture (
     struct audsettings *as,
     struct audio_capture_ops *ops,
@@ -48,6 +48,15 @@ void do_info_mice_print(Monitor *mon, const QObject *data);
 void do_info_mice(Monitor *mon, QObject **ret_data);
 void do_mouse_set(Monitor *mon, const QDict *qdict);
 
+/* hw/touch_input.c */
+QEMUPutMouseEntry *touch_input_add_mouse(QEMUPutMouseEvent *func,
+                                         void *opaque, const char *name);
+void touch_input_add_kbd(QEMUPutKBDEvent *func, void *opaque);
+void touch_input_set_period(int64_t period);
+void do_touch_record(Monitor *mon, const QDict *qdict);
+void do_touch_replay(Monitor *mon, const QDict *qdict);
+void do_info_touch(Monitor *mon);
+
 /* keysym is a unicode code except for special keys (see QEMU_KEY_xxx
    constants) */
 #define QEMU_KEY_ESC1(c) ((c) | 0xe100)
@@ -905,6 +905,8 @@ int cpu_physical_sync_dirty_bitmap(target_phys_addr_t start_addr,
 
 void dump_exec_info(FILE *f,
                     int (*cpu_fprintf)(FILE *f, const char *fmt, ...));
+void dump_tlb_info(CPUState *env, FILE *f,
+                   int (*cpu_fprintf)(FILE *f, const char *fmt, ...));
 
 /* Coalesced MMIO regions are areas where write operations can be reordered.
  * This usually implies that write operations are side-effect free.  This allows
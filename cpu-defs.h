@@ -72,9 +72,17 @@ typedef uint64_t target_ulong;
 #define TB_JMP_ADDR_MASK (TB_JMP_PAGE_SIZE - 1)
 #define TB_JMP_PAGE_MASK (TB_JMP_CACHE_SIZE - TB_JMP_PAGE_SIZE)
 
+#ifdef CONFIG_TLB_BITS
+#define CPU_TLB_BITS CONFIG_TLB_BITS
+#else
 #define CPU_TLB_BITS 8
+#endif
 #define CPU_TLB_SIZE (1 << CPU_TLB_BITS)
 
+/* Fully associative TLB holding the last entries evicted from the
+   direct mapped one.  It is searched before walking the page tables.  */
+#define CPU_VTLB_SIZE 8
+
 #if TARGET_PHYS_ADDR_BITS == 32 && TARGET_LONG_BITS == 32
 #define CPU_TLB_ENTRY_BITS 4
 #else
@@ -153,6 +161,9 @@ typedef struct CPUWatchpoint {
     /* The meaning of the MMU modes is defined in the target code. */   \
     CPUTLBEntry tlb_table[NB_MMU_MODES][CPU_TLB_SIZE];                  \
     target_phys_addr_t iotlb[NB_MMU_MODES][CPU_TLB_SIZE];               \
+    CPUTLBEntry tlb_v_table[NB_MMU_MODES][CPU_VTLB_SIZE];               \
+    target_phys_addr_t iotlb_v[NB_MMU_MODES][CPU_VTLB_SIZE];            \
+    int vtlb_index; /* next victim TLB entry to replace */              \
     struct TranslationBlock *tb_jmp_cache[TB_JMP_CACHE_SIZE];           \
     /* buffer for temporaries in the code generator */                  \
     long temp_buf[CPU_TEMP_BUF_NLONGS];                                 \
@@ -168,6 +179,13 @@ typedef struct CPUWatchpoint {
     uint32_t can_do_io; /* nonzero if memory mapped IO is safe.  */     \
                                                                         \
     /* from this point: preserved by CPU reset */                       \
+    /* softmmu TLB statistics, hits are handled by the generated code   \
+       and not counted */                                               \
+    uint64_t tlb_miss_count;                                            \
+    uint64_t tlb_victim_hit_count;                                      \
+    /* indirect jumps looked up by the generated code */                \
+    uint64_t tb_lookup_count;                                           \
+    uint64_t tb_lookup_hit_count;                                       \
     /* ice debug support */                                             \
     QTAILQ_HEAD(breakpoints_head, CPUBreakpoint) breakpoints;            \
     int singlestep_enabled;                                             \
@@ -187,6 +187,72 @@ static inline TranslationBlock *tb_find_fast(void)
     return tb;
 }
 
+/* Like tb_find_slow, but neither fills the TLB nor translates, so it
+   is safe to call from a helper.  TBs spanning two pages are skipped. */
+static TranslationBlock *tb_find_nofault(CPUState *env1, target_ulong pc,
+                                         target_ulong cs_base, uint64_t flags)
+{
+    TranslationBlock *tb;
+    target_ulong phys_pc;
+#if !defined(CONFIG_USER_ONLY)
+    CPUTLBEntry *te;
+
+    /* Code in an I/O page has TLB_MMIO set in addr_code and never
+       matches, so a hit is always RAM or ROM */
+    te = &env1->tlb_table[cpu_mmu_index(env1)]
+                         [(pc >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1)];
+    if (te->addr_code != (pc & TARGET_PAGE_MASK))
+        return NULL;
+    phys_pc = qemu_ram_addr_from_host((void *)(unsigned long)pc + te->addend);
+#else
+    phys_pc = pc;
+#endif
+
+    for (tb = tb_phys_hash[tb_phys_hash_func(phys_pc)]; tb;
+         tb = tb->phys_hash_next) {
+        if (tb->pc == pc &&
+            tb->page_addr[0] == (phys_pc & TARGET_PAGE_MASK) &&
+            tb->page_addr[1] == -1 &&
+            tb->cs_base == cs_base &&
+            tb->flags == flags)
+            return tb;
+    }
+    return NULL;
+}
+
+/* Called by the generated code at the end of a TB whose successor is
+   only known at run time, e.g. a function return.  Returns the host
+   code of the next TB if it is already translated and cpu_exec has
+   nothing to do before running it, otherwise NULL and the TB returns
+   to cpu_exec.  */
+void *tb_lookup_ptr(CPUState *env1)
+{
+    TranslationBlock *tb;
+    target_ulong cs_base, pc;
+    unsigned int h;
+    int flags;
+
+    env1->tb_lookup_count++;
+    cpu_get_tb_cpu_state(env1, &pc, &cs_base, &flags);
+    h = tb_jmp_cache_hash_func(pc);
+    tb = env1->tb_jmp_cache[h];
+    if (unlikely(!tb || tb->pc != pc || tb->cs_base != cs_base ||
+                 tb->flags != flags)) {
+        tb = tb_find_nofault(env1, pc, cs_base, flags);
+        if (!tb)
+            return NULL;
+        env1->tb_jmp_cache[h] = tb;
+    }
+
+    /* Chained TBs are only unlinked by cpu_interrupt from the current
+       one, so it must be set before checking for a request */
+    env1->current_tb = tb;
+    if (unlikely(env1->interrupt_request || env1->exit_request))
+        return NULL;
+    env1->tb_lookup_hit_count++;
+    return tb->tc_ptr;
+}
+
 static CPUDebugExcpHandler *debug_excp_handler;
 
 CPUDebugExcpHandler *cpu_set_debug_excp_handler(CPUDebugExcpHandler *handler)
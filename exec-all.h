@@ -73,7 +73,13 @@ int cpu_restore_state(struct TranslationBlock *tb,
 int cpu_restore_state_copy(struct TranslationBlock *tb,
                            CPUState *env, unsigned long searched_pc,
                            void *puc);
+int tb_cache_open(const char *filename);
+int tb_cache_load(CPUState *env, struct TranslationBlock *tb);
+void tb_cache_store(CPUState *env, struct TranslationBlock *tb);
+void tb_cache_dump_info(FILE *f,
+                        int (*cpu_fprintf)(FILE *f, const char *fmt, ...));
 void cpu_resume_from_signal(CPUState *env1, void *puc);
+void *tb_lookup_ptr(CPUState *env1);
 void cpu_io_recompile(CPUState *env, void *retaddr);
 TranslationBlock *tb_gen_code(CPUState *env, 
                               target_ulong pc, target_ulong cs_base, int flags,
@@ -97,6 +103,8 @@ static inline int tlb_set_page(CPUState *env1, target_ulong vaddr,
         prot |= PAGE_EXEC;
     return tlb_set_page_exec(env1, vaddr, paddr, prot, mmu_idx, is_softmmu);
 }
+int tlb_victim_lookup(CPUState *env, target_ulong addr, int mmu_idx,
+                      int access_type);
 
 #define CODE_GEN_ALIGN           16 /* must be >= of the size of a icache line */
 
@@ -81,7 +81,6 @@
 static TranslationBlock *tbs;
 int code_gen_max_blocks;
 TranslationBlock *tb_phys_hash[CODE_GEN_PHYS_HASH_SIZE];
-static int nb_tbs;
 /* any access to the tbs or the page table must use this lock */
 spinlock_t tb_lock = SPIN_LOCK_UNLOCKED;
 
@@ -104,10 +103,33 @@ spinlock_t tb_lock = SPIN_LOCK_UNLOCKED;
 uint8_t code_gen_prologue[1024] code_gen_section;
 static uint8_t *code_gen_buffer;
 static unsigned long code_gen_buffer_size;
-/* threshold to flush the translated code buffer */
-static unsigned long code_gen_buffer_max_size;
 uint8_t *code_gen_ptr;
 
+/* The code buffer and the TB array are split in regions which are
+   filled in turn.  When the last one is full the oldest region is
+   emptied, so that only its TBs need to be translated again instead of
+   all the code.  */
+#define CODE_GEN_MAX_REGIONS 8
+
+typedef struct CodeGenRegion {
+    uint8_t *start;
+    uint8_t *end;               /* no TB may start past this */
+    uint8_t *ptr;               /* end of the code, once not filled */
+    TranslationBlock *tbs;
+    int nb_tbs;
+    int max_tbs;
+    uint64_t generation;        /* when it was last started, 0 if empty */
+} CodeGenRegion;
+
+static CodeGenRegion code_gen_regions[CODE_GEN_MAX_REGIONS];
+static int nb_code_gen_regions;
+static unsigned long code_gen_region_size;
+static CodeGenRegion *code_gen_region;   /* region being filled */
+static uint64_t code_gen_generation;
+static int code_gen_evict_count;
+
+static void code_gen_init_regions(void);
+
 #if !defined(CONFIG_USER_ONLY)
 int phys_ram_fd;
 uint8_t *phys_ram_dirty;
@@ -497,10 +519,39 @@ static void code_gen_alloc(unsigned long tb_size)
 #endif
 #endif /* !USE_STATIC_CODE_GEN_BUFFER */
     map_exec(code_gen_prologue, sizeof(code_gen_prologue));
-    code_gen_buffer_max_size = code_gen_buffer_size - 
-        code_gen_max_block_size();
     code_gen_max_blocks = code_gen_buffer_size / CODE_GEN_AVG_BLOCK_SIZE;
     tbs = qemu_malloc(code_gen_max_blocks * sizeof(TranslationBlock));
+    code_gen_init_regions();
+}
+
+/* Split the buffer in regions big enough for many TBs each; a small
+   buffer gets a single region, which is flushed as a whole */
+static void code_gen_init_regions(void)
+{
+    unsigned long max_block_size = code_gen_max_block_size();
+    CodeGenRegion *r;
+    int i, n;
+
+    n = code_gen_buffer_size / (8 * max_block_size);
+    nb_code_gen_regions = MAX(1, MIN(n, CODE_GEN_MAX_REGIONS));
+    code_gen_region_size = code_gen_buffer_size / nb_code_gen_regions;
+
+    for (i = 0; i < nb_code_gen_regions; i++) {
+        r = &code_gen_regions[i];
+        r->start = code_gen_buffer + i * code_gen_region_size;
+        r->end = r->start + code_gen_region_size - max_block_size;
+        r->ptr = r->start;
+        r->max_tbs = code_gen_max_blocks / nb_code_gen_regions;
+        r->tbs = tbs + i * r->max_tbs;
+        r->nb_tbs = 0;
+        r->generation = 0;
+    }
+    /* the last one gets what is left over */
+    r->end = code_gen_buffer + code_gen_buffer_size - max_block_size;
+    r->max_tbs = code_gen_max_blocks - (r->tbs - tbs);
+
+    code_gen_region = code_gen_regions;
+    code_gen_region->generation = ++code_gen_generation;
 }
 
 /* Must be called before using the QEMU cpus. 'tb_size' is the size
@@ -637,16 +688,23 @@ static void page_flush_tb(void)
 void tb_flush(CPUState *env1)
 {
     CPUState *env;
+    CodeGenRegion *r;
+
 #if defined(DEBUG_FLUSH)
-    printf("qemu: flush code_size=%ld nb_tbs=%d avg_tb_size=%ld\n",
-           (unsigned long)(code_gen_ptr - code_gen_buffer),
-           nb_tbs, nb_tbs > 0 ?
-           ((unsigned long)(code_gen_ptr - code_gen_buffer)) / nb_tbs : 0);
+    printf("qemu: flush code_size=%ld\n",
+           (unsigned long)(code_gen_ptr - code_gen_buffer));
 #endif
     if ((unsigned long)(code_gen_ptr - code_gen_buffer) > code_gen_buffer_size)
         cpu_abort(env1, "Internal error: code buffer overflow\n");
 
-    nb_tbs = 0;
+    for (r = code_gen_regions; r < code_gen_regions + nb_code_gen_regions;
+         r++) {
+        r->ptr = r->start;
+        r->nb_tbs = 0;
+        r->generation = 0;
+    }
+    code_gen_region = code_gen_regions;
+    code_gen_region->generation = ++code_gen_generation;
 
     for(env = first_cpu; env != NULL; env = env->next_cpu) {
         memset (env->tb_jmp_cache, 0, TB_JMP_CACHE_SIZE * sizeof (void *));
@@ -767,7 +825,9 @@ static inline void tb_reset_jump(TranslationBlock *tb, int n)
     tb_set_jmp_target(tb, n, (unsigned long)(tb->tc_ptr + tb->tb_next_offset[n]));
 }
 
-void tb_phys_invalidate(TranslationBlock *tb, target_ulong page_addr)
+/* Unlink the TB from everything that leads to it.  page_addr[0] is set
+   to -1 to tell that it is done.  */
+static void tb_unlink(TranslationBlock *tb, target_ulong page_addr)
 {
     CPUState *env;
     PageDesc *p;
@@ -819,10 +879,48 @@ void tb_phys_invalidate(TranslationBlock *tb, target_ulong page_addr)
         tb1 = tb2;
     }
     tb->jmp_first = (TranslationBlock *)((long)tb | 2); /* fail safe */
+    tb->page_addr[0] = -1;
+}
 
+void tb_phys_invalidate(TranslationBlock *tb, target_ulong page_addr)
+{
+    tb_unlink(tb, page_addr);
     tb_phys_invalidate_count++;
 }
 
+/* Start filling the region after the current one.  If it holds code
+   it is the oldest, so its TBs are dropped.  */
+static void code_gen_next_region(CPUState *env)
+{
+    CodeGenRegion *r;
+    int i;
+
+    if (nb_code_gen_regions == 1) {
+        tb_flush(env);
+        return;
+    }
+
+    code_gen_region->ptr = code_gen_ptr;
+    r = code_gen_region + 1;
+    if (r == code_gen_regions + nb_code_gen_regions)
+        r = code_gen_regions;
+
+    if (r->nb_tbs) {
+        /* newest first: TBs are added at the head of the hash and page
+           lists, so they are found right away */
+        for (i = r->nb_tbs - 1; i >= 0; i--) {
+            if (r->tbs[i].page_addr[0] != -1)
+                tb_unlink(&r->tbs[i], -1);
+        }
+        r->nb_tbs = 0;
+        code_gen_evict_count++;
+    }
+    r->ptr = r->start;
+    r->generation = ++code_gen_generation;
+    code_gen_region = r;
+    code_gen_ptr = r->start;
+}
+
 static inline void set_bits(uint8_t *tab, int start, int len)
 {
     int end, mask, end1;
@@ -890,8 +988,8 @@ TranslationBlock *tb_gen_code(CPUState *env,
     phys_pc = get_phys_addr_code(env, pc);
     tb = tb_alloc(pc);
     if (!tb) {
-        /* flush must be done */
-        tb_flush(env);
+        /* make room in the next region, or flush everything */
+        code_gen_next_region(env);
         /* cannot fail at this point */
         tb = tb_alloc(pc);
         /* Don't forget to invalidate previous TB info.  */
@@ -1169,16 +1267,16 @@ static inline void tb_alloc_page(TranslationBlock *tb,
 #endif /* TARGET_HAS_SMC */
 }
 
-/* Allocate a new translation block. Flush the translation buffer if
-   too many translation blocks or too much generated code. */
+/* Allocate a new translation block.  Return NULL if the current region
+   has too many translation blocks or too much generated code. */
 TranslationBlock *tb_alloc(target_ulong pc)
 {
+    CodeGenRegion *r = code_gen_region;
     TranslationBlock *tb;
 
-    if (nb_tbs >= code_gen_max_blocks ||
-        (code_gen_ptr - code_gen_buffer) >= code_gen_buffer_max_size)
+    if (r->nb_tbs >= r->max_tbs || code_gen_ptr >= r->end)
         return NULL;
-    tb = &tbs[nb_tbs++];
+    tb = &r->tbs[r->nb_tbs++];
     tb->pc = pc;
     tb->cflags = 0;
     return tb;
@@ -1189,9 +1287,11 @@ void tb_free(TranslationBlock *tb)
     /* In practice this is mostly used for single use temporary TB
        Ignore the hard cases and just back up if this TB happens to
        be the last one generated.  */
-    if (nb_tbs > 0 && tb == &tbs[nb_tbs - 1]) {
+    CodeGenRegion *r = code_gen_region;
+
+    if (r->nb_tbs > 0 && tb == &r->tbs[r->nb_tbs - 1]) {
         code_gen_ptr = tb->tc_ptr;
-        nb_tbs--;
+        r->nb_tbs--;
     }
 }
 
@@ -1242,18 +1342,23 @@ TranslationBlock *tb_find_pc(unsigned long tc_ptr)
     int m_min, m_max, m;
     unsigned long v;
     TranslationBlock *tb;
+    CodeGenRegion *r;
+    uint8_t *end;
 
-    if (nb_tbs <= 0)
-        return NULL;
     if (tc_ptr < (unsigned long)code_gen_buffer ||
-        tc_ptr >= (unsigned long)code_gen_ptr)
+        tc_ptr >= (unsigned long)code_gen_buffer + code_gen_buffer_size)
+        return NULL;
+    m = (tc_ptr - (unsigned long)code_gen_buffer) / code_gen_region_size;
+    r = &code_gen_regions[MIN(m, nb_code_gen_regions - 1)];
+    end = r == code_gen_region ? code_gen_ptr : r->ptr;
+    if (r->nb_tbs <= 0 || tc_ptr >= (unsigned long)end)
         return NULL;
     /* binary search (cf Knuth) */
     m_min = 0;
-    m_max = nb_tbs - 1;
+    m_max = r->nb_tbs - 1;
     while (m_min <= m_max) {
         m = (m_min + m_max) >> 1;
-        tb = &tbs[m];
+        tb = &r->tbs[m];
         v = (unsigned long)tb->tc_ptr;
         if (v == tc_ptr)
             return tb;
@@ -1263,7 +1368,7 @@ TranslationBlock *tb_find_pc(unsigned long tc_ptr)
             m_min = m + 1;
         }
     }
-    return &tbs[m_max];
+    return &r->tbs[m_max];
 }
 
 static void tb_reset_jump_recursive(TranslationBlock *tb);
@@ -1607,7 +1712,7 @@ const CPULogItem cpu_log_items[] = {
 #ifdef TARGET_I386
       "before eflags optimization and "
 #endif
-      "after liveness analysis" },
+      "after optimization and liveness analysis" },
     { CPU_LOG_INT, "int",
       "show interrupts/exceptions in short format" },
     { CPU_LOG_EXEC, "exec",
@@ -1761,7 +1866,7 @@ static CPUTLBEntry s_cputlb_empty_entry = {
    implemented yet) */
 void tlb_flush(CPUState *env, int flush_global)
 {
-    int i;
+    int i, mmu_idx;
 
 #if defined(DEBUG_TLB)
     printf("tlb_flush:\n");
@@ -1771,32 +1876,42 @@ void tlb_flush(CPUState *env, int flush_global)
     env->current_tb = NULL;
 
     for(i = 0; i < CPU_TLB_SIZE; i++) {
-        int mmu_idx;
         for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
             env->tlb_table[mmu_idx][i] = s_cputlb_empty_entry;
         }
     }
+    for(i = 0; i < CPU_VTLB_SIZE; i++) {
+        for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
+            env->tlb_v_table[mmu_idx][i] = s_cputlb_empty_entry;
+        }
+    }
 
     memset (env->tb_jmp_cache, 0, TB_JMP_CACHE_SIZE * sizeof (void *));
 
     tlb_flush_count++;
 }
 
+/* Return true if the entry maps page ADDR for any kind of access */
+static inline int tlb_entry_is_page(CPUTLBEntry *tlb_entry, target_ulong addr)
+{
+    return addr == (tlb_entry->addr_read &
+                    (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
+           addr == (tlb_entry->addr_write &
+                    (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
+           addr == (tlb_entry->addr_code &
+                    (TARGET_PAGE_MASK | TLB_INVALID_MASK));
+}
+
 static inline void tlb_flush_entry(CPUTLBEntry *tlb_entry, target_ulong addr)
 {
-    if (addr == (tlb_entry->addr_read &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
-        addr == (tlb_entry->addr_write &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK)) ||
-        addr == (tlb_entry->addr_code &
-                 (TARGET_PAGE_MASK | TLB_INVALID_MASK))) {
+    if (tlb_entry_is_page(tlb_entry, addr)) {
         *tlb_entry = s_cputlb_empty_entry;
     }
 }
 
 void tlb_flush_page(CPUState *env, target_ulong addr)
 {
-    int i;
+    int i, k;
     int mmu_idx;
 
 #if defined(DEBUG_TLB)
@@ -1808,8 +1923,11 @@ void tlb_flush_page(CPUState *env, target_ulong addr)
 
     addr &= TARGET_PAGE_MASK;
     i = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++)
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         tlb_flush_entry(&env->tlb_table[mmu_idx][i], addr);
+        for (k = 0; k < CPU_VTLB_SIZE; k++)
+            tlb_flush_entry(&env->tlb_v_table[mmu_idx][k], addr);
+    }
 
     tlb_flush_jmp_cache(env, addr);
 }
@@ -1880,6 +1998,9 @@ void cpu_physical_memory_reset_dirty(ram_addr_t start, ram_addr_t end,
             for(i = 0; i < CPU_TLB_SIZE; i++)
                 tlb_reset_dirty_range(&env->tlb_table[mmu_idx][i],
                                       start1, length);
+            for(i = 0; i < CPU_VTLB_SIZE; i++)
+                tlb_reset_dirty_range(&env->tlb_v_table[mmu_idx][i],
+                                      start1, length);
         }
     }
 }
@@ -1931,6 +2052,8 @@ void cpu_tlb_update_dirty(CPUState *env)
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         for(i = 0; i < CPU_TLB_SIZE; i++)
             tlb_update_dirty(&env->tlb_table[mmu_idx][i]);
+        for(i = 0; i < CPU_VTLB_SIZE; i++)
+            tlb_update_dirty(&env->tlb_v_table[mmu_idx][i]);
     }
 }
 
@@ -1944,13 +2067,57 @@ static inline void tlb_set_dirty1(CPUTLBEntry *tlb_entry, target_ulong vaddr)
    so that it is no longer dirty */
 static inline void tlb_set_dirty(CPUState *env, target_ulong vaddr)
 {
-    int i;
+    int i, k;
     int mmu_idx;
 
     vaddr &= TARGET_PAGE_MASK;
     i = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++)
+    for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         tlb_set_dirty1(&env->tlb_table[mmu_idx][i], vaddr);
+        for (k = 0; k < CPU_VTLB_SIZE; k++)
+            tlb_set_dirty1(&env->tlb_v_table[mmu_idx][k], vaddr);
+    }
+}
+
+/* Called on a miss in the direct mapped TLB: if the victim TLB holds
+   ADDR for ACCESS_TYPE (0 read, 1 write, 2 code, as for tlb_fill), swap
+   the two entries and return 1.  Otherwise the page tables have to be
+   walked. */
+int tlb_victim_lookup(CPUState *env, target_ulong addr, int mmu_idx,
+                      int access_type)
+{
+    unsigned int index;
+    int k;
+    target_ulong tlb_addr;
+    target_phys_addr_t iotlb;
+    CPUTLBEntry *te, *ve, tmp;
+
+    env->tlb_miss_count++;
+    addr &= TARGET_PAGE_MASK;
+    for (k = 0; k < CPU_VTLB_SIZE; k++) {
+        ve = &env->tlb_v_table[mmu_idx][k];
+        if (access_type == 0)
+            tlb_addr = ve->addr_read;
+        else if (access_type == 1)
+            tlb_addr = ve->addr_write;
+        else
+            tlb_addr = ve->addr_code;
+        if (addr == (tlb_addr & (TARGET_PAGE_MASK | TLB_INVALID_MASK)))
+            break;
+    }
+    if (k == CPU_VTLB_SIZE)
+        return 0;
+
+    index = (addr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
+    te = &env->tlb_table[mmu_idx][index];
+    tmp = *te;
+    *te = *ve;
+    *ve = tmp;
+    iotlb = env->iotlb[mmu_idx][index];
+    env->iotlb[mmu_idx][index] = env->iotlb_v[mmu_idx][k];
+    env->iotlb_v[mmu_idx][k] = iotlb;
+    env->tlb_victim_hit_count++;
+    return 1;
 }
 
 /* add a new TLB entry. At most one entry for a given virtual address
@@ -2025,8 +2192,19 @@ int tlb_set_page_exec(CPUState *env, target_ulong vaddr,
     }
 
     index = (vaddr >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1);
-    env->iotlb[mmu_idx][index] = iotlb - vaddr;
     te = &env->tlb_table[mmu_idx][index];
+
+    /* Keep the entry for another page in the victim TLB.  Entries with
+       all fields invalid have nothing worth keeping.  */
+    if (!(te->addr_read & te->addr_write & te->addr_code & TLB_INVALID_MASK)
+        && !tlb_entry_is_page(te, vaddr & TARGET_PAGE_MASK)) {
+        int k = env->vtlb_index++ % CPU_VTLB_SIZE;
+
+        env->tlb_v_table[mmu_idx][k] = *te;
+        env->iotlb_v[mmu_idx][k] = env->iotlb[mmu_idx][index];
+    }
+
+    env->iotlb[mmu_idx][index] = iotlb - vaddr;
     te->addend = addend - vaddr;
     if (prot & PAGE_READ) {
         te->addr_read = address;
@@ -3629,39 +3807,51 @@ void dump_exec_info(FILE *f,
 {
     int i, target_code_size, max_target_code_size;
     int direct_jmp_count, direct_jmp2_count, cross_page;
+    int nb_tbs;
+    long code_size, region_size;
+    uint64_t lookups, lookup_hits;
     TranslationBlock *tb;
+    CodeGenRegion *r;
+    CPUState *cpu;
 
     target_code_size = 0;
     max_target_code_size = 0;
     cross_page = 0;
     direct_jmp_count = 0;
     direct_jmp2_count = 0;
-    for(i = 0; i < nb_tbs; i++) {
-        tb = &tbs[i];
-        target_code_size += tb->size;
-        if (tb->size > max_target_code_size)
-            max_target_code_size = tb->size;
-        if (tb->page_addr[1] != -1)
-            cross_page++;
-        if (tb->tb_next_offset[0] != 0xffff) {
-            direct_jmp_count++;
-            if (tb->tb_next_offset[1] != 0xffff) {
-                direct_jmp2_count++;
+    nb_tbs = 0;
+    code_size = 0;
+    for (r = code_gen_regions; r < code_gen_regions + nb_code_gen_regions;
+         r++) {
+        nb_tbs += r->nb_tbs;
+        code_size += (r == code_gen_region ? code_gen_ptr : r->ptr) - r->start;
+        for(i = 0; i < r->nb_tbs; i++) {
+            tb = &r->tbs[i];
+            target_code_size += tb->size;
+            if (tb->size > max_target_code_size)
+                max_target_code_size = tb->size;
+            if (tb->page_addr[1] != -1)
+                cross_page++;
+            if (tb->tb_next_offset[0] != 0xffff) {
+                direct_jmp_count++;
+                if (tb->tb_next_offset[1] != 0xffff) {
+                    direct_jmp2_count++;
+                }
             }
         }
     }
     /* XXX: avoid using doubles ? */
     cpu_fprintf(f, "Translation buffer state:\n");
     cpu_fprintf(f, "gen code size       %ld/%ld\n",
-                code_gen_ptr - code_gen_buffer, code_gen_buffer_max_size);
+                code_size, code_gen_buffer_size);
     cpu_fprintf(f, "TB count            %d/%d\n", 
                 nb_tbs, code_gen_max_blocks);
     cpu_fprintf(f, "TB avg target size  %d max=%d bytes\n",
                 nb_tbs ? target_code_size / nb_tbs : 0,
                 max_target_code_size);
-    cpu_fprintf(f, "TB avg host size    %d bytes (expansion ratio: %0.1f)\n",
-                nb_tbs ? (code_gen_ptr - code_gen_buffer) / nb_tbs : 0,
-                target_code_size ? (double) (code_gen_ptr - code_gen_buffer) / target_code_size : 0);
+    cpu_fprintf(f, "TB avg host size    %ld bytes (expansion ratio: %0.1f)\n",
+                nb_tbs ? code_size / nb_tbs : 0,
+                target_code_size ? (double) code_size / target_code_size : 0);
     cpu_fprintf(f, "cross page TB count %d (%d%%)\n",
             cross_page,
             nb_tbs ? (cross_page * 100) / nb_tbs : 0);
@@ -3670,10 +3860,32 @@ void dump_exec_info(FILE *f,
                 nb_tbs ? (direct_jmp_count * 100) / nb_tbs : 0,
                 direct_jmp2_count,
                 nb_tbs ? (direct_jmp2_count * 100) / nb_tbs : 0);
+    cpu_fprintf(f, "code regions        %d x %ld KB\n",
+                nb_code_gen_regions, code_gen_region_size >> 10);
+    for (r = code_gen_regions; r < code_gen_regions + nb_code_gen_regions;
+         r++) {
+        region_size = (r == code_gen_region ? code_gen_ptr : r->ptr) - r->start;
+        cpu_fprintf(f, "  region %d%c         %3ld%% code %3d%% TBs, "
+                    "generation %" PRIu64 "\n",
+                    (int) (r - code_gen_regions),
+                    r == code_gen_region ? '*' : ' ',
+                    region_size * 100 / (r->end - r->start),
+                    r->nb_tbs * 100 / r->max_tbs, r->generation);
+    }
     cpu_fprintf(f, "\nStatistics:\n");
     cpu_fprintf(f, "TB flush count      %d\n", tb_flush_count);
+    cpu_fprintf(f, "region evict count  %d\n", code_gen_evict_count);
     cpu_fprintf(f, "TB invalidate count %d\n", tb_phys_invalidate_count);
     cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
+    lookups = lookup_hits = 0;
+    for (cpu = first_cpu; cpu; cpu = cpu->next_cpu) {
+        lookups += cpu->tb_lookup_count;
+        lookup_hits += cpu->tb_lookup_hit_count;
+    }
+    cpu_fprintf(f, "indirect jumps      %" PRIu64 " (%d%% chained in "
+                "generated code)\n", lookups,
+                lookups ? (int) (lookup_hits * 100 / lookups) : 0);
+    tb_cache_dump_info(f, cpu_fprintf);
     tcg_dump_info(f, cpu_fprintf);
 }
 
@@ -3698,4 +3910,19 @@ void dump_exec_info(FILE *f,
 
 #undef env
 
+void dump_tlb_info(CPUState *env, FILE *f,
+                   int (*cpu_fprintf)(FILE *f, const char *fmt, ...))
+{
+    uint64_t misses = env->tlb_miss_count;
+    uint64_t victim_hits = env->tlb_victim_hit_count;
+
+    cpu_fprintf(f, "TLB size            %d x %d MMU modes, %d victim entries\n",
+                CPU_TLB_SIZE, NB_MMU_MODES, CPU_VTLB_SIZE);
+    cpu_fprintf(f, "TLB miss count      %" PRIu64 "\n", misses);
+    cpu_fprintf(f, "victim hit count    %" PRIu64 " (%d%%)\n", victim_hits,
+                misses ? (int) (victim_hits * 100 / misses) : 0);
+    cpu_fprintf(f, "page walk count     %" PRIu64 "\n", misses - victim_hits);
+    cpu_fprintf(f, "TLB flush count     %d\n", tlb_flush_count);
+}
+
 #endif
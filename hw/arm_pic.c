@@ -10,6 +10,7 @@
 #include "hw.h"
 #include "pc.h"
 #include "arm-misc.h"
+#include "primecell.h"
 
 /* Stub functions for hardware that doesn't exist.  */
 void pic_info(Monitor *mon)
@@ -18,6 +19,7 @@ void pic_info(Monitor *mon)
 
 void irq_info(Monitor *mon)
 {
+    pl192_irq_info(mon);
 }
 
 
@@ -16,6 +16,24 @@ pflash_t *pflash_cfi02_register(target_phys_addr_t base, ram_addr_t off,
                                 uint16_t id2, uint16_t id3,
                                 uint16_t unlock_addr0, uint16_t unlock_addr1);
 
+/* flash_cache.c */
+typedef struct FlashCache FlashCache;
+FlashCache *flash_cache_new(BlockDriverState *bs, int line_size, int nb_lines);
+void flash_cache_delete(FlashCache *fc);
+int flash_cache_read(FlashCache *fc, int64_t offset, uint8_t *buf, int len);
+int flash_cache_write(FlashCache *fc, int64_t offset,
+                const uint8_t *buf, int len);
+int flash_cache_erase(FlashCache *fc, int64_t offset, int len);
+typedef void FlashCacheCompletionFunc(void *opaque, int ret);
+int flash_cache_aio_read(FlashCache *fc, int64_t offset, uint8_t *buf,
+                int len, FlashCacheCompletionFunc *cb, void *opaque);
+int flash_cache_aio_write(FlashCache *fc, int64_t offset, const uint8_t *buf,
+                int len, FlashCacheCompletionFunc *cb, void *opaque);
+int flash_cache_aio_erase(FlashCache *fc, int64_t offset, int len,
+                FlashCacheCompletionFunc *cb, void *opaque);
+int flash_cache_flush(FlashCache *fc);
+void flash_cache_invalidate(FlashCache *fc);
+
 /* nand.c */
 typedef struct NANDFlashState NANDFlashState;
 NANDFlashState *nand_init(int manf_id, int chip_id);
@@ -38,6 +56,8 @@ uint8_t nand_getio(NANDFlashState *s);
 /* onenand.c */
 void onenand_base_update(void *opaque, target_phys_addr_t new);
 void onenand_base_unmap(void *opaque);
+/* Complete the array operation in progress, if any */
+void onenand_sync(void *opaque);
 /* id = XXYYZZ (XX - Manufacturer, YY - device properties, ZZ - version)
    regshift = 1 in most cases
    page_size = 10 (for 1kB-page chips), 11 (for 2kB-page chips),
@@ -0,0 +1,515 @@
+/*
+ * Write-back cache for NAND/OneNAND flash images.
+ *
+ * The image is cached in lines of one erase block (or a few, when the
+ * erase block is not a whole number of sectors).  Accesses are served
+ * from memory.  Misses fill the line, and dirty lines are written back,
+ * through the asynchronous block layer: a request that has to wait for
+ * either is queued and completed from the I/O callbacks, in order.
+ * Dirty lines go back to the image shortly after they were modified,
+ * and all of them are written when the VM stops or QEMU exits.  Erasing
+ * a whole line only records that it is blank; the 0xff fill happens
+ * when the line is next partially written.
+ *
+ * This code is licensed under the GNU GPL v2.
+ */
+
+#include "hw.h"
+#include "flash.h"
+#include "block.h"
+#include "sysemu.h"
+#include "qemu-timer.h"
+#include "qemu-queue.h"
+
+/* How long a line may stay dirty before it is written back (ms) */
+#define FLASH_CACHE_WB_DELAY	200
+
+enum {
+    FLASH_CACHE_READ,
+    FLASH_CACHE_WRITE,
+    FLASH_CACHE_ERASE,
+};
+
+typedef struct FlashCacheLine FlashCacheLine;
+typedef struct FlashCacheReq FlashCacheReq;
+
+struct FlashCacheLine {
+    FlashCache *fc;
+    int64_t tag;		/* Line number in the image, -1 if unused */
+    uint8_t *data;
+    int dirty;
+    int erased;			/* All 0xff, DATA not filled in */
+    int filling;		/* DATA is being read from the image */
+    int evicting;		/* Written back to make room for a miss */
+    int64_t lru;
+    BlockDriverAIOCB *aiocb;	/* Fill or write-back in flight */
+    QEMUIOVector qiov;
+    struct iovec iov;
+};
+
+/* An access waiting for a line to be filled or evicted */
+struct FlashCacheReq {
+    int type;
+    int64_t offset;
+    uint8_t *buf;		/* Private copy of the data for a write */
+    int len;
+    int ret;
+    FlashCacheCompletionFunc *cb;
+    void *opaque;
+    QSIMPLEQ_ENTRY(FlashCacheReq) entry;
+};
+
+struct FlashCache {
+    BlockDriverState *bs;
+    int64_t size;
+    int line_size;
+    int nb_lines;
+    FlashCacheLine *lines;
+    FlashCacheLine *last;
+    int64_t lru_clock;
+    uint8_t *blank;
+    QEMUTimer *wb_timer;
+    VMChangeStateEntry *vmstate;
+    QSIMPLEQ_HEAD(, FlashCacheReq) queue;
+    QLIST_ENTRY(FlashCache) list;
+};
+
+static QLIST_HEAD(, FlashCache) flash_caches =
+    QLIST_HEAD_INITIALIZER(flash_caches);
+
+static void flash_cache_run(FlashCache *fc);
+
+/* Bytes of line L that exist in the image */
+static int flash_cache_line_len(FlashCache *fc, FlashCacheLine *l)
+{
+    int64_t start = l->tag * fc->line_size;
+
+    return MIN(fc->line_size, fc->size - start);
+}
+
+/* The request at the head of the queue is the one that started any
+   fill or eviction, so it is the one an I/O error fails.  */
+static void flash_cache_fail_head(FlashCache *fc)
+{
+    FlashCacheReq *req = QSIMPLEQ_FIRST(&fc->queue);
+
+    if (req)
+        req->ret = -EIO;
+}
+
+static void flash_cache_wb_cb(void *opaque, int ret)
+{
+    FlashCacheLine *l = (FlashCacheLine *) opaque;
+    FlashCache *fc = l->fc;
+
+    l->aiocb = NULL;
+    if (ret < 0) {
+        fprintf(stderr, "%s: write error at line %" PRId64 "\n",
+                        __FUNCTION__, l->tag);
+        l->dirty = 1;
+        if (l->evicting)
+            flash_cache_fail_head(fc);
+    }
+    l->evicting = 0;
+    flash_cache_run(fc);
+}
+
+static void flash_cache_wb_start(FlashCacheLine *l)
+{
+    FlashCache *fc = l->fc;
+
+    l->iov.iov_base = l->erased ? fc->blank : l->data;
+    l->iov.iov_len = flash_cache_line_len(fc, l);
+    qemu_iovec_init_external(&l->qiov, &l->iov, 1);
+    l->dirty = 0;
+    l->aiocb = bdrv_aio_writev(fc->bs, (l->tag * fc->line_size) >> 9,
+                    &l->qiov, l->iov.iov_len >> 9, flash_cache_wb_cb, l);
+    if (!l->aiocb) {
+        fprintf(stderr, "%s: write error at line %" PRId64 "\n",
+                        __FUNCTION__, l->tag);
+        l->dirty = 1;
+        if (l->evicting)
+            flash_cache_fail_head(fc);
+        l->evicting = 0;
+    }
+}
+
+static void flash_cache_wb_timer(void *opaque)
+{
+    FlashCache *fc = (FlashCache *) opaque;
+    FlashCacheLine *l;
+    int again = 0;
+
+    for (l = fc->lines; l < fc->lines + fc->nb_lines; l++) {
+        if (!l->dirty)
+            continue;
+        /* Keep writes to one line in order */
+        if (l->aiocb)
+            again = 1;
+        else
+            flash_cache_wb_start(l);
+    }
+    if (again)
+        qemu_mod_timer(fc->wb_timer,
+                        qemu_get_clock(rt_clock) + FLASH_CACHE_WB_DELAY);
+}
+
+static void flash_cache_dirty(FlashCache *fc, FlashCacheLine *l)
+{
+    l->dirty = 1;
+    if (!qemu_timer_pending(fc->wb_timer))
+        qemu_mod_timer(fc->wb_timer,
+                        qemu_get_clock(rt_clock) + FLASH_CACHE_WB_DELAY);
+}
+
+static void flash_cache_fill_cb(void *opaque, int ret)
+{
+    FlashCacheLine *l = (FlashCacheLine *) opaque;
+    FlashCache *fc = l->fc;
+
+    l->aiocb = NULL;
+    l->filling = 0;
+    if (ret < 0) {
+        l->tag = -1;
+        l->lru = 0;
+        flash_cache_fail_head(fc);
+    }
+    flash_cache_run(fc);
+}
+
+/* Find line TAG.  On a miss, take the least recently used line that
+   has no I/O in flight: a dirty one is written back first, then it is
+   filled from the image unless FILL is clear because the caller is
+   about to overwrite the whole line.  Returns NULL while that I/O is
+   pending.  */
+static FlashCacheLine *flash_cache_get(FlashCache *fc, FlashCacheReq *req,
+                                       int64_t tag, int fill)
+{
+    FlashCacheLine *l, *victim;
+
+    if (fc->last->tag == tag && !fc->last->filling) {
+        l = fc->last;
+        goto hit;
+    }
+
+    victim = NULL;
+    for (l = fc->lines; l < fc->lines + fc->nb_lines; l++) {
+        if (l->tag == tag) {
+            if (l->filling)
+                return NULL;
+            goto hit;
+        }
+        if (!l->aiocb && (!victim || l->lru < victim->lru))
+            victim = l;
+    }
+
+    /* Every line is busy, one of the callbacks retries */
+    if (!victim)
+        return NULL;
+
+    l = victim;
+    if (l->dirty) {
+        l->evicting = 1;
+        flash_cache_wb_start(l);
+        return NULL;
+    }
+
+    l->tag = tag;
+    l->erased = 0;
+    l->lru = ++fc->lru_clock;
+    if (!fill)
+        goto hit;
+
+    l->filling = 1;
+    l->iov.iov_base = l->data;
+    l->iov.iov_len = flash_cache_line_len(fc, l);
+    qemu_iovec_init_external(&l->qiov, &l->iov, 1);
+    l->aiocb = bdrv_aio_readv(fc->bs, (tag * fc->line_size) >> 9,
+                    &l->qiov, l->iov.iov_len >> 9, flash_cache_fill_cb, l);
+    if (!l->aiocb) {
+        l->filling = 0;
+        l->tag = -1;
+        l->lru = 0;
+        req->ret = -EIO;
+    }
+    return NULL;
+
+hit:
+    l->lru = ++fc->lru_clock;
+    fc->last = l;
+    return l;
+}
+
+/* Carry out as much of REQ as the cached lines allow.  Returns 1 when
+   it is complete, 0 while it waits for a fill or an eviction.  */
+static int flash_cache_step(FlashCache *fc, FlashCacheReq *req)
+{
+    FlashCacheLine *l;
+    int64_t tag;
+    int off, n, whole;
+
+    while (req->len && req->ret == 0) {
+        tag = req->offset / fc->line_size;
+        off = req->offset % fc->line_size;
+        n = MIN(req->len, fc->line_size - off);
+        whole = !off && n == MIN(fc->line_size, fc->size - req->offset);
+        l = flash_cache_get(fc, req, tag,
+                        req->type == FLASH_CACHE_READ || !whole);
+        if (!l)
+            return req->ret != 0;
+
+        switch (req->type) {
+        case FLASH_CACHE_READ:
+            if (l->erased)
+                memset(req->buf, 0xff, n);
+            else
+                memcpy(req->buf, l->data + off, n);
+            req->buf += n;
+            break;
+
+        case FLASH_CACHE_ERASE:
+            if (whole) {
+                l->erased = 1;
+                flash_cache_dirty(fc, l);
+                break;
+            }
+            /* Fall through */
+        case FLASH_CACHE_WRITE:
+            if (l->erased) {
+                memset(l->data, 0xff, fc->line_size);
+                l->erased = 0;
+            }
+            if (req->type == FLASH_CACHE_WRITE) {
+                memcpy(l->data + off, req->buf, n);
+                req->buf += n;
+            } else {
+                memset(l->data + off, 0xff, n);
+            }
+            flash_cache_dirty(fc, l);
+            break;
+        }
+        req->offset += n;
+        req->len -= n;
+    }
+    return 1;
+}
+
+/* Complete queued requests in order, as far as the lines allow */
+static void flash_cache_run(FlashCache *fc)
+{
+    FlashCacheReq *req;
+
+    while ((req = QSIMPLEQ_FIRST(&fc->queue)) && flash_cache_step(fc, req)) {
+        QSIMPLEQ_REMOVE_HEAD(&fc->queue, entry);
+        req->cb(req->opaque, req->ret);
+        qemu_free(req);
+    }
+}
+
+/* Start an access to LEN bytes at OFFSET.  Returns 0 if it was carried
+   out at once, in which case CB is not called, 1 if it was queued and
+   CB will report its result, or -1 if the range is invalid.  The data
+   of a queued write is copied, so BUF may be reused straight away.  */
+static int flash_cache_submit(FlashCache *fc, int type, int64_t offset,
+                uint8_t *buf, int len,
+                FlashCacheCompletionFunc *cb, void *opaque)
+{
+    FlashCacheReq *req, tmp;
+
+    if (offset < 0 || offset + len > fc->size)
+        return -1;
+
+    /* A hit never needs the queue */
+    if (QSIMPLEQ_EMPTY(&fc->queue)) {
+        tmp.type = type;
+        tmp.offset = offset;
+        tmp.buf = buf;
+        tmp.len = len;
+        tmp.ret = 0;
+        if (flash_cache_step(fc, &tmp))
+            return tmp.ret < 0 ? -1 : 0;
+        offset = tmp.offset;
+        buf = tmp.buf;
+        len = tmp.len;
+    }
+
+    req = qemu_malloc(sizeof(*req) + (type == FLASH_CACHE_WRITE ? len : 0));
+    req->type = type;
+    req->offset = offset;
+    req->buf = buf;
+    if (type == FLASH_CACHE_WRITE)
+        req->buf = memcpy(req + 1, buf, len);
+    req->len = len;
+    req->ret = 0;
+    req->cb = cb;
+    req->opaque = opaque;
+    QSIMPLEQ_INSERT_TAIL(&fc->queue, req, entry);
+    return 1;
+}
+
+int flash_cache_aio_read(FlashCache *fc, int64_t offset, uint8_t *buf,
+                int len, FlashCacheCompletionFunc *cb, void *opaque)
+{
+    return flash_cache_submit(fc, FLASH_CACHE_READ, offset, buf, len,
+                    cb, opaque);
+}
+
+int flash_cache_aio_write(FlashCache *fc, int64_t offset, const uint8_t *buf,
+                int len, FlashCacheCompletionFunc *cb, void *opaque)
+{
+    return flash_cache_submit(fc, FLASH_CACHE_WRITE, offset, (uint8_t *) buf,
+                    len, cb, opaque);
+}
+
+int flash_cache_aio_erase(FlashCache *fc, int64_t offset, int len,
+                FlashCacheCompletionFunc *cb, void *opaque)
+{
+    return flash_cache_submit(fc, FLASH_CACHE_ERASE, offset, NULL, len,
+                    cb, opaque);
+}
+
+static void flash_cache_sync_cb(void *opaque, int ret)
+{
+    *(int *) opaque = ret < 0 ? -1 : 0;
+}
+
+/* Synchronous access for callers that need the data right away */
+static int flash_cache_sync(FlashCache *fc, int type, int64_t offset,
+                uint8_t *buf, int len)
+{
+    int ret = 1;
+
+    switch (flash_cache_submit(fc, type, offset, buf, len,
+                            flash_cache_sync_cb, &ret)) {
+    case 0:
+        return 0;
+    case 1:
+        while (ret > 0)
+            qemu_aio_wait();
+        return ret;
+    default:
+        return -1;
+    }
+}
+
+int flash_cache_read(FlashCache *fc, int64_t offset, uint8_t *buf, int len)
+{
+    return flash_cache_sync(fc, FLASH_CACHE_READ, offset, buf, len);
+}
+
+int flash_cache_write(FlashCache *fc, int64_t offset,
+                const uint8_t *buf, int len)
+{
+    return flash_cache_sync(fc, FLASH_CACHE_WRITE, offset,
+                    (uint8_t *) buf, len);
+}
+
+int flash_cache_erase(FlashCache *fc, int64_t offset, int len)
+{
+    return flash_cache_sync(fc, FLASH_CACHE_ERASE, offset, NULL, len);
+}
+
+/* Finish all queued requests and write all dirty lines back */
+int flash_cache_flush(FlashCache *fc)
+{
+    FlashCacheLine *l;
+    int ret = 0;
+
+    while (!QSIMPLEQ_EMPTY(&fc->queue))
+        qemu_aio_wait();
+
+    qemu_del_timer(fc->wb_timer);
+    for (l = fc->lines; l < fc->lines + fc->nb_lines; l++) {
+        /* Keep writes to one line in order */
+        while (l->aiocb)
+            qemu_aio_wait();
+        if (!l->dirty)
+            continue;
+        flash_cache_wb_start(l);
+        while (l->aiocb)
+            qemu_aio_wait();
+        if (l->dirty)
+            ret = -1;
+    }
+    return ret;
+}
+
+/* Drop all lines, e.g. because the image changed under us */
+void flash_cache_invalidate(FlashCache *fc)
+{
+    FlashCacheLine *l;
+
+    flash_cache_flush(fc);
+    for (l = fc->lines; l < fc->lines + fc->nb_lines; l++) {
+        l->tag = -1;
+        l->lru = 0;
+        l->dirty = 0;
+    }
+}
+
+static void flash_cache_vm_state_change(void *opaque, int running, int reason)
+{
+    FlashCache *fc = (FlashCache *) opaque;
+
+    /* Snapshots, migration and "commit" all look at the image while the
+       VM is stopped.  */
+    if (!running)
+        flash_cache_flush(fc);
+}
+
+static void flash_cache_flush_all(void)
+{
+    FlashCache *fc;
+
+    QLIST_FOREACH(fc, &flash_caches, list)
+        flash_cache_flush(fc);
+}
+
+FlashCache *flash_cache_new(BlockDriverState *bs, int line_size, int nb_lines)
+{
+    FlashCache *fc = qemu_mallocz(sizeof(*fc));
+    int i;
+
+    if (QLIST_EMPTY(&flash_caches))
+        atexit(flash_cache_flush_all);
+
+    /* Lines are read and written as whole sectors */
+    while (line_size & 511)
+        line_size <<= 1;
+
+    fc->bs = bs;
+    fc->size = bdrv_getlength(bs) & ~511LL;
+    fc->line_size = line_size;
+    fc->nb_lines = nb_lines;
+    fc->lines = qemu_mallocz(nb_lines * sizeof(*fc->lines));
+    for (i = 0; i < nb_lines; i++) {
+        fc->lines[i].fc = fc;
+        fc->lines[i].tag = -1;
+        fc->lines[i].data = qemu_memalign(512, line_size);
+    }
+    fc->last = fc->lines;
+    fc->blank = memset(qemu_memalign(512, line_size), 0xff, line_size);
+    fc->wb_timer = qemu_new_timer(rt_clock, flash_cache_wb_timer, fc);
+    qemu_timer_set_name(fc->wb_timer, "flash-cache");
+    fc->vmstate =
+        qemu_add_vm_change_state_handler(flash_cache_vm_state_change, fc);
+    QSIMPLEQ_INIT(&fc->queue);
+    QLIST_INSERT_HEAD(&flash_caches, fc, list);
+
+    return fc;
+}
+
+void flash_cache_delete(FlashCache *fc)
+{
+    int i;
+
+    flash_cache_flush(fc);
+    QLIST_REMOVE(fc, list);
+    qemu_del_vm_change_state_handler(fc->vmstate);
+    qemu_free_timer(fc->wb_timer);
+    for (i = 0; i < fc->nb_lines; i++)
+        qemu_vfree(fc->lines[i].data);
+    qemu_free(fc->lines);
+    qemu_vfree(fc->blank);
+    qemu_free(fc);
+}
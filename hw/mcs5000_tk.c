@@ -178,7 +178,7 @@ static int mcs5000_init(I2CAddressableState *s, int keycodes[])
     MCS5000State *t = FROM_I2CADDR_SLAVE(MCS5000State, s);
 
     qdev_init_gpio_out(&s->i2c.qdev, &t->irq, 1);
-    qemu_add_kbd_event_handler(mcs5000_tk_event, t);
+    touch_input_add_kbd(mcs5000_tk_event, t);
 
     mcs5000_reset(t);
     mcs5000_init_keymap(keycodes);
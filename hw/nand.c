@@ -45,12 +45,16 @@
 # define MAX_PAGE		0x800
 # define MAX_OOB		0x40
 
+/* Erase blocks of the image kept in memory */
+# define NAND_CACHE_BLOCKS	64
+
 struct NANDFlashState {
     uint8_t manf_id, chip_id;
     int size, pages;
     int page_shift, oob_shift, erase_shift, addr_shift;
     uint8_t *storage;
     BlockDriverState *bdrv;
+    FlashCache *cache;
     int mem_oob;
 
     int cle, ale, ce, wp, gnd;
@@ -485,7 +489,11 @@ NANDFlashState *nand_init(int manf_id, int chip_id)
         s->mem_oob = 0;
     }
 
-    if (!s->bdrv)
+    if (s->bdrv)
+        s->cache = flash_cache_new(s->bdrv, ((s->mem_oob ? 0 :
+                                1 << s->oob_shift) + (1 << s->page_shift))
+                        << s->erase_shift, NAND_CACHE_BLOCKS);
+    else
         pagesize += 1 << s->page_shift;
     if (pagesize)
         s->storage = (uint8_t *) memset(qemu_malloc(s->pages * pagesize),
@@ -502,6 +510,7 @@ NANDFlashState *nand_init(int manf_id, int chip_id)
 void nand_done(NANDFlashState *s)
 {
     if (s->bdrv) {
+        flash_cache_delete(s->cache);
         bdrv_close(s->bdrv);
         bdrv_delete(s->bdrv);
     }
@@ -518,44 +527,31 @@ void nand_done(NANDFlashState *s)
 static void glue(nand_blk_write_, PAGE_SIZE)(NANDFlashState *s)
 {
     uint32_t off, page, sector, soff;
-    uint8_t iobuf[(PAGE_SECTORS + 2) * 0x200];
     if (PAGE(s->addr) >= s->pages)
         return;
 
-    if (!s->bdrv) {
+    if (!s->cache) {
         memcpy(s->storage + PAGE_START(s->addr) + (s->addr & PAGE_MASK) +
                         s->offset, s->io, s->iolen);
     } else if (s->mem_oob) {
         sector = SECTOR(s->addr);
         off = (s->addr & PAGE_MASK) + s->offset;
         soff = SECTOR_OFFSET(s->addr);
-        if (bdrv_read(s->bdrv, sector, iobuf, PAGE_SECTORS) == -1) {
-            printf("%s: read error in sector %i\n", __FUNCTION__, sector);
-            return;
-        }
+        if (off < PAGE_SIZE &&
+                        flash_cache_write(s->cache, ((int64_t) sector << 9) +
+                                (soff | off), s->io,
+                                MIN(s->iolen, PAGE_SIZE - off)))
+            printf("%s: write error in sector %i\n", __FUNCTION__, sector);
 
-        memcpy(iobuf + (soff | off), s->io, MIN(s->iolen, PAGE_SIZE - off));
         if (off + s->iolen > PAGE_SIZE) {
             page = PAGE(s->addr);
             memcpy(s->storage + (page << OOB_SHIFT), s->io + PAGE_SIZE - off,
                             MIN(OOB_SIZE, off + s->iolen - PAGE_SIZE));
         }
-
-        if (bdrv_write(s->bdrv, sector, iobuf, PAGE_SECTORS) == -1)
-            printf("%s: write error in sector %i\n", __FUNCTION__, sector);
     } else {
         off = PAGE_START(s->addr) + (s->addr & PAGE_MASK) + s->offset;
-        sector = off >> 9;
-        soff = off & 0x1ff;
-        if (bdrv_read(s->bdrv, sector, iobuf, PAGE_SECTORS + 2) == -1) {
-            printf("%s: read error in sector %i\n", __FUNCTION__, sector);
-            return;
-        }
-
-        memcpy(iobuf + soff, s->io, s->iolen);
-
-        if (bdrv_write(s->bdrv, sector, iobuf, PAGE_SECTORS + 2) == -1)
-            printf("%s: write error in sector %i\n", __FUNCTION__, sector);
+        if (flash_cache_write(s->cache, off, s->io, s->iolen))
+            printf("%s: write error in sector %i\n", __FUNCTION__, off >> 9);
     }
     s->offset = 0;
 }
@@ -563,46 +559,27 @@ static void glue(nand_blk_write_, PAGE_SIZE)(NANDFlashState *s)
 /* Erase a single block */
 static void glue(nand_blk_erase_, PAGE_SIZE)(NANDFlashState *s)
 {
-    uint32_t i, page, addr;
-    uint8_t iobuf[0x200] = { [0 ... 0x1ff] = 0xff, };
+    uint32_t addr;
     addr = s->addr & ~((1 << (ADDR_SHIFT + s->erase_shift)) - 1);
 
     if (PAGE(addr) >= s->pages)
         return;
 
-    if (!s->bdrv) {
+    if (!s->cache) {
         memset(s->storage + PAGE_START(addr),
                         0xff, (PAGE_SIZE + OOB_SIZE) << s->erase_shift);
     } else if (s->mem_oob) {
         memset(s->storage + (PAGE(addr) << OOB_SHIFT),
                         0xff, OOB_SIZE << s->erase_shift);
-        i = SECTOR(addr);
-        page = SECTOR(addr + (ADDR_SHIFT + s->erase_shift));
-        for (; i < page; i ++)
-            if (bdrv_write(s->bdrv, i, iobuf, 1) == -1)
-                printf("%s: write error in sector %i\n", __FUNCTION__, i);
+        if (flash_cache_erase(s->cache, (int64_t) SECTOR(addr) << 9,
+                                PAGE_SIZE << s->erase_shift))
+            printf("%s: write error in sector %i\n",
+                            __FUNCTION__, SECTOR(addr));
     } else {
-        addr = PAGE_START(addr);
-        page = addr >> 9;
-        if (bdrv_read(s->bdrv, page, iobuf, 1) == -1)
-            printf("%s: read error in sector %i\n", __FUNCTION__, page);
-        memset(iobuf + (addr & 0x1ff), 0xff, (~addr & 0x1ff) + 1);
-        if (bdrv_write(s->bdrv, page, iobuf, 1) == -1)
-            printf("%s: write error in sector %i\n", __FUNCTION__, page);
-
-        memset(iobuf, 0xff, 0x200);
-        i = (addr & ~0x1ff) + 0x200;
-        for (addr += ((PAGE_SIZE + OOB_SIZE) << s->erase_shift) - 0x200;
-                        i < addr; i += 0x200)
-            if (bdrv_write(s->bdrv, i >> 9, iobuf, 1) == -1)
-                printf("%s: write error in sector %i\n", __FUNCTION__, i >> 9);
-
-        page = i >> 9;
-        if (bdrv_read(s->bdrv, page, iobuf, 1) == -1)
-            printf("%s: read error in sector %i\n", __FUNCTION__, page);
-        memset(iobuf, 0xff, ((addr - 1) & 0x1ff) + 1);
-        if (bdrv_write(s->bdrv, page, iobuf, 1) == -1)
-            printf("%s: write error in sector %i\n", __FUNCTION__, page);
+        if (flash_cache_erase(s->cache, PAGE_START(addr),
+                                (PAGE_SIZE + OOB_SIZE) << s->erase_shift))
+            printf("%s: write error in sector %i\n",
+                            __FUNCTION__, PAGE_START(addr) >> 9);
     }
 }
 
@@ -612,9 +589,10 @@ static void glue(nand_blk_load_, PAGE_SIZE)(NANDFlashState *s,
     if (PAGE(addr) >= s->pages)
         return;
 
-    if (s->bdrv) {
+    if (s->cache) {
         if (s->mem_oob) {
-            if (bdrv_read(s->bdrv, SECTOR(addr), s->io, PAGE_SECTORS) == -1)
+            if (flash_cache_read(s->cache, (int64_t) SECTOR(addr) << 9,
+                                    s->io, PAGE_SECTORS << 9))
                 printf("%s: read error in sector %i\n",
                                 __FUNCTION__, SECTOR(addr));
             memcpy(s->io + SECTOR_OFFSET(s->addr) + PAGE_SIZE,
@@ -622,11 +600,11 @@ static void glue(nand_blk_load_, PAGE_SIZE)(NANDFlashState *s,
                             OOB_SIZE);
             s->ioaddr = s->io + SECTOR_OFFSET(s->addr) + offset;
         } else {
-            if (bdrv_read(s->bdrv, PAGE_START(addr) >> 9,
-                                    s->io, (PAGE_SECTORS + 2)) == -1)
+            if (flash_cache_read(s->cache, PAGE_START(addr),
+                                    s->io, PAGE_SIZE + OOB_SIZE))
                 printf("%s: read error in sector %i\n",
                                 __FUNCTION__, PAGE_START(addr) >> 9);
-            s->ioaddr = s->io + (PAGE_START(addr) & 0x1ff) + offset;
+            s->ioaddr = s->io + offset;
         }
     } else {
         memcpy(s->io, s->storage + PAGE_START(s->addr) +
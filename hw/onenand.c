@@ -23,6 +23,16 @@
 #include "irq.h"
 #include "sysemu.h"
 #include "block.h"
+#include "qemu-timer.h"
+
+/* Array operation times of a typical 4kB-page part: the INT bit is only
+   set once these have passed, even if the data was already there.  */
+#define ONEN_LOAD_TIME      30000       /* tRD, ns */
+#define ONEN_PROG_TIME      220000      /* tPROG, ns */
+#define ONEN_ERASE_TIME     2000000     /* tBERS, ns */
+
+/* Erase blocks of the image kept in memory */
+#define ONEN_CACHE_BLOCKS   64
 
 typedef struct {
     uint32_t id;
@@ -30,8 +40,8 @@ typedef struct {
     target_phys_addr_t base;
     qemu_irq intr;
     qemu_irq rdy;
-    BlockDriverState *bdrv;
-    BlockDriverState *bdrv_cur;
+    FlashCache *cache;
+    FlashCache *cache_cur;
     uint8_t *image;
     uint8_t *otp;
     uint8_t *current;
@@ -65,6 +75,18 @@ typedef struct {
     int dbuf_num;
 
     int superload;
+
+    /* Command in progress: the array is busy until its image accesses
+       have completed and BUSY_UNTIL has passed */
+    int busy;
+    int64_t busy_until;
+    uint16_t busy_int;
+    uint16_t busy_err;
+    uint16_t busy_errbits;
+    int io_pending;
+    QEMUTimer *busy_timer;
+    /* DataRAM is mapped as plain RAM only while the array is idle */
+    int mapped;
 } OneNANDState;
 
 enum {
@@ -76,6 +98,7 @@ enum {
 };
 
 enum {
+    ONEN_ONGO = 1 << 15,
     ONEN_ERR_CMD = 1 << 10,
     ONEN_ERR_ERASE = 1 << 11,
     ONEN_ERR_PROG = 1 << 12,
@@ -96,6 +119,31 @@ enum {
     ONEN_LOCK_UNLOCKED = 1 << 2,
 };
 
+/* Map the fast part of the DataRAM directly while the array is idle.
+   While an operation is in progress its accesses go through
+   onenand_read/onenand_write, which wait for the operation first.  */
+static void onenand_data_map(OneNANDState *s)
+{
+    int buf_data_size = (0x7e50 << s->shift);
+    int buf_boot_size = (0x0200 << s->shift);
+    int slow_buf_size = buf_data_size % TARGET_PAGE_SIZE ?
+                           buf_data_size % TARGET_PAGE_SIZE :
+                           TARGET_PAGE_SIZE;
+    int fast_buf_size = buf_data_size - slow_buf_size;
+
+    if (!s->mapped)
+        return;
+
+    if (s->busy)
+        cpu_register_physical_memory_offset(s->base + buf_boot_size,
+                                            fast_buf_size, s->iomemtype,
+                                            buf_boot_size);
+    else
+        cpu_register_physical_memory(s->base + buf_boot_size,
+                        fast_buf_size,
+                        (s->ram + buf_boot_size) | IO_MEM_RAM);
+}
+
 void onenand_base_update(void *opaque, target_phys_addr_t new)
 {
     OneNANDState *s = (OneNANDState *) opaque;
@@ -107,15 +155,14 @@ void onenand_base_update(void *opaque, target_phys_addr_t new)
     int fast_buf_size = buf_data_size - slow_buf_size;
 
     s->base = new;
+    s->mapped = 1;
 
     /* XXX: We should use IO_MEM_ROMD but we broke it earlier...
      * Both 0x0000 ... 0x01ff and 0x8000 ... 0x800f can be used to
      * write boot commands.  Also take note of the BWPS bit.  */
     cpu_register_physical_memory(s->base, buf_boot_size, s->iomemtype);
 
-    cpu_register_physical_memory(s->base + buf_boot_size,
-                    fast_buf_size,
-                    (s->ram + buf_boot_size) | IO_MEM_RAM);
+    onenand_data_map(s);
 
     cpu_register_physical_memory_offset(s->base + buf_boot_size + fast_buf_size,
                                         slow_buf_size, s->iomemtype,
@@ -132,6 +179,7 @@ void onenand_base_unmap(void *opaque)
 {
     OneNANDState *s = (OneNANDState *) opaque;
 
+    s->mapped = 0;
     cpu_register_physical_memory(s->base,
                     0x10000 << s->shift, IO_MEM_UNASSIGNED);
 }
@@ -141,9 +189,22 @@ static void onenand_intr_update(OneNANDState *s)
     qemu_set_irq(s->intr, ((s->intstatus >> 15) ^ (~s->config[0] >> 6)) & 1);
 }
 
+static void onenand_cancel(OneNANDState *s)
+{
+    /* Requests queued in the cache can't be withdrawn */
+    while (s->io_pending)
+        qemu_aio_wait();
+    qemu_del_timer(s->busy_timer);
+    if (s->busy) {
+        s->busy = 0;
+        onenand_data_map(s);
+    }
+}
+
 /* Hot reset (Reset OneNAND command) or warm reset (RP pin low) */
 static void onenand_reset(OneNANDState *s, int cold)
 {
+    onenand_cancel(s);
     memset(&s->addr, 0, sizeof(s->addr));
     s->command = 0;
     s->count = 1;
@@ -159,7 +220,7 @@ static void onenand_reset(OneNANDState *s, int cold)
     s->wpstatus = 0x0002;
     s->cycle = 0;
     s->otpmode = 0;
-    s->bdrv_cur = s->bdrv;
+    s->cache_cur = s->cache;
     s->current = s->image;
     s->secs_cur = s->secs;
     s->superload = 0;
@@ -168,16 +229,97 @@ static void onenand_reset(OneNANDState *s, int cold)
         /* Lock the whole flash */
         memset(s->blockwp, ONEN_LOCK_LOCKED, s->blocks);
 
-        if (s->bdrv && bdrv_read(s->bdrv, 0, s->boot[0], 8) < 0)
+        if (s->cache && flash_cache_read(s->cache, 0, s->boot[0], 8 << 9))
             hw_error("%s: Loading the BootRAM failed.\n", __FUNCTION__);
     }
 }
 
+static void onenand_busy_finish(void *opaque)
+{
+    OneNANDState *s = (OneNANDState *) opaque;
+
+    s->busy = 0;
+    onenand_data_map(s);
+    s->status &= ~ONEN_ONGO;
+    s->status |= s->busy_err;
+    s->intstatus |= ONEN_INT | s->busy_int;
+    onenand_intr_update(s);
+}
+
+/* Start a timed array operation.  Image accesses issued while the
+   array is busy may complete asynchronously.  */
+static void onenand_busy_start(OneNANDState *s, uint16_t intr, uint16_t err,
+                int64_t time)
+{
+    if (!s->busy) {
+        s->busy = 1;
+        onenand_data_map(s);
+    }
+    s->busy_int = intr;
+    s->busy_errbits = err;
+    s->busy_err = 0;
+    s->busy_until = qemu_get_clock(vm_clock) + time;
+    s->status |= ONEN_ONGO;
+}
+
+/* Raise INT once the accesses have completed and the operation time
+   has passed */
+static void onenand_busy_check(OneNANDState *s)
+{
+    if (s->io_pending)
+        return;
+    if (qemu_get_clock(vm_clock) < s->busy_until)
+        qemu_mod_timer(s->busy_timer, s->busy_until);
+    else
+        onenand_busy_finish(s);
+}
+
+/* Complete the current operation at once, e.g. because the next command
+   has already arrived.  */
+static void onenand_wait(OneNANDState *s)
+{
+    if (!s->busy)
+        return;
+    while (s->io_pending)
+        qemu_aio_wait();
+    qemu_del_timer(s->busy_timer);
+    onenand_busy_finish(s);
+}
+
+void onenand_sync(void *opaque)
+{
+    onenand_wait((OneNANDState *) opaque);
+}
+
+static void onenand_io_cb(void *opaque, int ret)
+{
+    OneNANDState *s = (OneNANDState *) opaque;
+
+    if (ret < 0)
+        s->busy_err |= ONEN_ERR_CMD | s->busy_errbits;
+    s->io_pending--;
+    onenand_busy_check(s);
+}
+
+/* Result of a flash cache access: one started while the array is busy
+   may still be pending and completes in onenand_io_cb().  */
+static int onenand_io(OneNANDState *s, int ret)
+{
+    if (ret > 0)
+        s->io_pending++;
+    return ret < 0;
+}
+
 static inline int onenand_load_main(OneNANDState *s, int sec, int secn,
                 void *dest)
 {
-    if (s->bdrv_cur)
-        return bdrv_read(s->bdrv_cur, sec, dest, secn) < 0;
+    if (s->cache_cur && s->busy)
+        return onenand_io(s, flash_cache_aio_read(s->cache_cur,
+                        (int64_t) sec << 9, dest, secn << 9,
+                        onenand_io_cb, s));
+    else if (s->cache_cur)
+        return flash_cache_read(s->cache_cur, (int64_t) sec << 9,
+                        dest, secn << 9);
     else if (sec + secn > s->secs_cur)
         return 1;
 
@@ -189,8 +331,13 @@ static inline int onenand_load_main(OneNANDState *s, int sec, int secn,
 static inline int onenand_prog_main(OneNANDState *s, int sec, int secn,
                 void *src)
 {
-    if (s->bdrv_cur)
-        return bdrv_write(s->bdrv_cur, sec, src, secn) < 0;
+    if (s->cache_cur && s->busy)
+        return onenand_io(s, flash_cache_aio_write(s->cache_cur,
+                        (int64_t) sec << 9, src, secn << 9,
+                        onenand_io_cb, s));
+    else if (s->cache_cur)
+        return flash_cache_write(s->cache_cur, (int64_t) sec << 9,
+                        src, secn << 9);
     else if (sec + secn > s->secs_cur)
         return 1;
 
@@ -202,17 +349,18 @@ static inline int onenand_prog_main(OneNANDState *s, int sec, int secn,
 static inline int onenand_load_spare(OneNANDState *s, int sec, int secn,
                 void *dest)
 {
-    uint8_t buf[512];
-
-    if (s->bdrv_cur) {
-        if (bdrv_read(s->bdrv_cur, s->secs_cur + (sec >> 5), buf, 1) < 0)
-            return 1;
-        memcpy(dest, buf + ((sec & 31) << 4), secn << 4);
-    } else if (sec + secn > s->secs_cur) {
+    if (s->cache_cur && s->busy)
+        return onenand_io(s, flash_cache_aio_read(s->cache_cur,
+                        ((int64_t) s->secs_cur << 9) + (sec << 4),
+                        dest, secn << 4, onenand_io_cb, s));
+    else if (s->cache_cur)
+        return flash_cache_read(s->cache_cur,
+                        ((int64_t) s->secs_cur << 9) + (sec << 4),
+                        dest, secn << 4);
+    else if (sec + secn > s->secs_cur)
         return 1;
-    } else {
-        memcpy(dest, s->current + (s->secs_cur << 9) + (sec << 4), secn << 4);
-    }
+
+    memcpy(dest, s->current + (s->secs_cur << 9) + (sec << 4), secn << 4);
 
     return 0;
 }
@@ -220,16 +368,16 @@ static inline int onenand_load_spare(OneNANDState *s, int sec, int secn,
 static inline int onenand_prog_spare(OneNANDState *s, int sec, int secn,
                 void *src)
 {
-    uint8_t buf[512];
-
-    if (s->bdrv_cur) {
-        if (bdrv_read(s->bdrv_cur, s->secs_cur + (sec >> 5), buf, 1) < 0)
-            return 1;
-        memcpy(buf + ((sec & 31) << 4), src, secn << 4);
-        return bdrv_write(s->bdrv_cur, s->secs_cur + (sec >> 5), buf, 1) < 0;
-    } else if (sec + secn > s->secs_cur) {
+    if (s->cache_cur && s->busy)
+        return onenand_io(s, flash_cache_aio_write(s->cache_cur,
+                        ((int64_t) s->secs_cur << 9) + (sec << 4),
+                        src, secn << 4, onenand_io_cb, s));
+    else if (s->cache_cur)
+        return flash_cache_write(s->cache_cur,
+                        ((int64_t) s->secs_cur << 9) + (sec << 4),
+                        src, secn << 4);
+    else if (sec + secn > s->secs_cur)
         return 1;
-    }
 
     memcpy(s->current + (s->secs_cur << 9) + (sec << 4), src, secn << 4);
 
@@ -238,16 +386,17 @@ static inline int onenand_prog_spare(OneNANDState *s, int sec, int secn,
 
 static inline int onenand_erase(OneNANDState *s, int sec, int num)
 {
-    /* TODO: optimise */
-    uint8_t buf[512];
-
-    memset(buf, 0xff, sizeof(buf));
-    for (; num > 0; num--, sec++) {
-        if (onenand_prog_main(s, sec, 1, buf))
-            return 1;
-        if (onenand_prog_spare(s, sec, 1, buf))
-            return 1;
-    }
+    if (s->cache_cur)
+        return onenand_io(s, flash_cache_aio_erase(s->cache_cur,
+                        (int64_t) sec << 9, num << 9, onenand_io_cb, s)) ||
+               onenand_io(s, flash_cache_aio_erase(s->cache_cur,
+                        ((int64_t) s->secs_cur << 9) + (sec << 4), num << 4,
+                        onenand_io_cb, s));
+    else if (sec + num > s->secs_cur)
+        return 1;
+
+    memset(s->current + (sec << 9), 0xff, num << 9);
+    memset(s->current + (s->secs_cur << 9) + (sec << 4), 0xff, num << 4);
 
     return 0;
 }
@@ -273,8 +422,11 @@ static void onenand_command(OneNANDState *s, int cmd)
     buf += (s->bufaddr & 3) << 4;
 #define IS_SAMSUNG_ONENAND() (((s->id >> 16) & 0xff) == 0xEC)
 
+    onenand_wait(s);
+
     switch (cmd) {
     case 0x00:	/* Load single/multiple sector data unit into buffer */
+        onenand_busy_start(s, ONEN_INT_LOAD, ONEN_ERR_LOAD, ONEN_LOAD_TIME);
         SETADDR(ONEN_BUF_BLOCK, ONEN_BUF_PAGE)
 
         SETBUF_M()
@@ -291,12 +443,13 @@ static void onenand_command(OneNANDState *s, int cmd)
          * or    if (s->bufaddr & 1) + s->count was > 2 (1k-pages)
          * then we need two split the read/write into two chunks.
          */
-        s->intstatus |= ONEN_INT | ONEN_INT_LOAD;
+        onenand_busy_check(s);
         break;
     case 0x03:  /* Superload */
         s->superload = 1;
         break;
     case 0x13:	/* Load single/multiple spare sector into buffer */
+        onenand_busy_start(s, ONEN_INT_LOAD, ONEN_ERR_LOAD, ONEN_LOAD_TIME);
         SETADDR(ONEN_BUF_BLOCK, ONEN_BUF_PAGE)
 
         SETBUF_S()
@@ -307,9 +460,10 @@ static void onenand_command(OneNANDState *s, int cmd)
          * or    if (s->bufaddr & 1) + s->count was > 2 (1k-pages)
          * then we need two split the read/write into two chunks.
          */
-        s->intstatus |= ONEN_INT | ONEN_INT_LOAD;
+        onenand_busy_check(s);
         break;
     case 0x80:	/* Program single/multiple sector data unit from buffer */
+        onenand_busy_start(s, ONEN_INT_PROG, ONEN_ERR_PROG, ONEN_PROG_TIME);
         SETADDR(ONEN_BUF_BLOCK, ONEN_BUF_PAGE)
 
         SETBUF_M()
@@ -326,9 +480,10 @@ static void onenand_command(OneNANDState *s, int cmd)
          * or    if (s->bufaddr & 1) + s->count was > 2 (1k-pages)
          * then we need two split the read/write into two chunks.
          */
-        s->intstatus |= ONEN_INT | ONEN_INT_PROG;
+        onenand_busy_check(s);
         break;
     case 0x1a:	/* Program single/multiple spare area sector from buffer */
+        onenand_busy_start(s, ONEN_INT_PROG, ONEN_ERR_PROG, ONEN_PROG_TIME);
         SETADDR(ONEN_BUF_BLOCK, ONEN_BUF_PAGE)
 
         SETBUF_S()
@@ -339,7 +494,7 @@ static void onenand_command(OneNANDState *s, int cmd)
          * or    if (s->bufaddr & 1) + s->count was > 2 (1k-pages)
          * then we need two split the read/write into two chunks.
          */
-        s->intstatus |= ONEN_INT | ONEN_INT_PROG;
+        onenand_busy_check(s);
         break;
     case 0x1b:	/* Copy-back program */
         SETBUF_S()
@@ -354,7 +509,8 @@ static void onenand_command(OneNANDState *s, int cmd)
 
         /* TODO: spare areas */
 
-        s->intstatus |= ONEN_INT | ONEN_INT_PROG;
+        onenand_busy_start(s, ONEN_INT_PROG, ONEN_ERR_PROG, ONEN_PROG_TIME);
+        onenand_busy_check(s);
         break;
 
     case 0x23:	/* Unlock NAND array block(s) */
@@ -426,10 +582,11 @@ static void onenand_command(OneNANDState *s, int cmd)
         sec = ((s->addr[ONEN_BUF_BLOCK] & 0xfff) |
                         (s->addr[ONEN_BUF_BLOCK] >> 15 ? s->density_mask : 0))
                 << (s->block_shift - 9);
+        onenand_busy_start(s, ONEN_INT_ERASE, ONEN_ERR_ERASE, ONEN_ERASE_TIME);
         if (onenand_erase(s, sec, 1 << (s->block_shift - 9)))
             s->status |= ONEN_ERR_CMD | ONEN_ERR_ERASE;
 
-        s->intstatus |= ONEN_INT | ONEN_INT_ERASE;
+        onenand_busy_check(s);
         break;
     case 0xb0:	/* Erase suspend */
         break;
@@ -446,7 +603,7 @@ static void onenand_command(OneNANDState *s, int cmd)
 
     case 0x65:	/* OTP Access */
         s->intstatus |= ONEN_INT;
-        s->bdrv_cur = NULL;
+        s->cache_cur = NULL;
         s->current = s->otp;
         s->secs_cur = 1 << (s->block_shift - 9);
         s->addr[ONEN_BUF_BLOCK] = 0;
@@ -471,11 +628,15 @@ static uint32_t onenand_read(void *opaque, target_phys_addr_t addr)
 
     switch (offset) {
     case 0x0000 ... 0x804e:
+        onenand_wait(s);
         return lduw_le_p(s->boot[0] + addr);
     case 0x804f:
+        onenand_wait(s);
         res = lduw_le_p(s->boot[0] + addr);
         if (s->superload) {
+            /* The next page is streamed out right away */
             onenand_command(s, 0x00); /* Read */
+            onenand_wait(s);
         }
         s->superload = 0;
         return res;
@@ -558,6 +719,7 @@ static void onenand_write(void *opaque, target_phys_addr_t addr, uint32_t value)
             s->cycle = 0;
 
             if (value == 0x0000) {
+                onenand_wait(s);
                 SETADDR(ONEN_BUF_BLOCK, ONEN_BUF_PAGE)
                 onenand_load_main(s, sec,
                                 1 << (s->page_shift - 9), s->data[0][0]);
@@ -591,6 +753,8 @@ static void onenand_write(void *opaque, target_phys_addr_t addr, uint32_t value)
 
     case 0x0200 ... 0x7fff:
     case 0x8010 ... 0x804f:
+        /* Don't change the data under a program still in progress */
+        onenand_wait(s);
         stw_le_p(s->boot[0] + addr, (uint16_t)value);
         break;
 
@@ -609,6 +773,9 @@ static void onenand_write(void *opaque, target_phys_addr_t addr, uint32_t value)
         break;
 
     case 0xf220:	/* Command */
+        /* A command issued while the array is busy finds INT set, as
+           it would have if the previous one had completed at once.  */
+        onenand_wait(s);
         if (s->intstatus & (1 << 15))
             break;
         s->command = value;
@@ -654,6 +821,22 @@ static void onenand_write_32(void *opaque, target_phys_addr_t addr,
     onenand_write(opaque, addr + 2, value >> 16);
 }
 
+/* Byte stores reach here for the DataRAM while it is unmapped */
+static void onenand_write_8(void *opaque, target_phys_addr_t addr,
+                            uint32_t value)
+{
+    OneNANDState *s = (OneNANDState *) opaque;
+    int offset = addr >> s->shift;
+
+    if ((offset >= 0x0200 && offset <= 0x7fff) ||
+        (offset >= 0x8010 && offset <= 0x804f)) {
+        onenand_wait(s);
+        s->boot[0][addr] = value;
+    } else {
+        onenand_write(opaque, addr, value);
+    }
+}
+
 static CPUReadMemoryFunc * const onenand_readfn[] = {
     onenand_read,	/* TODO */
     onenand_read,
@@ -661,7 +844,7 @@ static CPUReadMemoryFunc * const onenand_readfn[] = {
 };
 
 static CPUWriteMemoryFunc * const onenand_writefn[] = {
-    onenand_write,	/* TODO */
+    onenand_write_8,
     onenand_write,
     onenand_write_32,
 };
@@ -688,6 +871,8 @@ void *onenand_init(uint32_t id, int regshift, qemu_irq irq,
     s->blocks = size >> s->block_shift;
     s->secs = size >> 9;
     s->blockwp = qemu_malloc(s->blocks);
+    s->busy_timer = qemu_new_timer(vm_clock, onenand_busy_finish, s);
+    qemu_timer_set_name(s->busy_timer, "onenand");
     s->density_mask = (id & (1 << 11)) ? (1 << (6 + ((id >> 12) & 7))) : 0;
     s->iomemtype = cpu_register_io_memory(onenand_readfn,
                     onenand_writefn, s);
@@ -695,7 +880,8 @@ void *onenand_init(uint32_t id, int regshift, qemu_irq irq,
         s->image = memset(qemu_malloc(size + (size >> 5)),
                         0xff, size + (size >> 5));
     else
-        s->bdrv = dinfo->bdrv;
+        s->cache = flash_cache_new(dinfo->bdrv, 1 << s->block_shift,
+                        ONEN_CACHE_BLOCKS);
     s->otp = memset(qemu_malloc((64 + 2) << s->page_shift),
                     0xff, (64 + 2) << s->page_shift);
     s->ram = qemu_ram_alloc(0xc000 << s->shift);
@@ -7,6 +7,10 @@
 
 #include "sysbus.h"
 #include "primecell.h"
+#include "qemu-timer.h"
+#include "qemu-queue.h"
+#include "monitor.h"
+#include "host-utils.h"
 
 
 #define PL192_INT_SOURCES   32
@@ -51,6 +55,9 @@ typedef struct pl192_state_s {
     uint32_t vect_priority[PL192_INT_SOURCES];
     uint32_t address;
 
+    /* Sources configured to each priority level */
+    uint32_t prio_mask[PL192_PRIO_LEVELS];
+
     /* Currently processed interrupt and
        highest priority interrupt */
     uint32_t current;
@@ -67,15 +74,31 @@ typedef struct pl192_state_s {
     uint32_t daisy_priority;
     struct pl192_state_s *daisy_callback;
     uint8_t  daisy_input;
+    uint8_t  daisy_fiq;
 
-    /* Parent interrupts */
+    /* Parent interrupts and the levels last driven on them */
     qemu_irq irq;
     qemu_irq fiq;
+    uint8_t  irq_out;
+    uint8_t  fiq_out;
 
     /* Next controller in chain */
     struct pl192_state_s *daisy;
+
+    /* Per-source statistics for "info irq": assertions, and time from
+       assertion until the device deasserted the line again */
+    int      index;
+    int64_t  assert_time[PL192_INT_SOURCES];
+    uint64_t count[PL192_INT_SOURCES];
+    int64_t  latency_total[PL192_INT_SOURCES];
+    int64_t  latency_max[PL192_INT_SOURCES];
+    QTAILQ_ENTRY(pl192_state_s) list;
 } pl192_state;
 
+static QTAILQ_HEAD(, pl192_state_s) pl192_list =
+    QTAILQ_HEAD_INITIALIZER(pl192_list);
+static int pl192_count;
+
 const unsigned char pl192_id[] =
 { 0x92, 0x11, 0x04, 0x00, 0x0D, 0xF0, 0x05, 0xB1 };
 
@@ -85,40 +108,60 @@ static void pl192_update(pl192_state *);
 static void pl192_raise(pl192_state *s, int is_fiq)
 {
     if (is_fiq) {
+        if (s->fiq_out)
+            return;
         if (s->fiq) {
             /* Raise parent FIQ */
             qemu_irq_raise(s->fiq);
         } else {
             if (s->daisy) {
                 /* FIQ is directly propagated through daisy chain */
-                pl192_raise(s->daisy, is_fiq);
+                s->daisy->daisy_fiq = 1;
+                pl192_update(s->daisy);
             } else {
                 hw_error("pl192: cannot raise FIQ. This usually means that "
                          "initialization was done incorrectly.\n");
             }
         }
+        s->fiq_out = 1;
     } else {
         if (s->irq) {
             /* Raise parent IRQ */
-            qemu_irq_raise(s->irq);
+            if (!s->irq_out)
+                qemu_irq_raise(s->irq);
         } else {
             if (s->daisy) {
                 /* Setup daisy input of the next chained contorller and force
-                   it to update it's state */
-                s->daisy->daisy_vectaddr = s->address;
-                s->daisy->daisy_callback = s;
-                s->daisy->daisy_input = 1;
-                pl192_update(s->daisy);
+                   it to update it's state, unless it already sees us with
+                   the same vector */
+                if (!s->irq_out || s->daisy->daisy_vectaddr != s->address ||
+                    s->daisy->daisy_callback != s) {
+                    s->daisy->daisy_vectaddr = s->address;
+                    s->daisy->daisy_callback = s;
+                    s->daisy->daisy_input = 1;
+                    pl192_update(s->daisy);
+                }
             } else {
                 hw_error("pl192: cannot raise IRQ. This usually means that "
                          "initialization was done incorrectly.\n");
             }
         }
+        s->irq_out = 1;
     }
 }
 
 static void pl192_lower(pl192_state *s, int is_fiq)
 {
+    /* Nothing to do unless the line is actually up */
+    if (is_fiq) {
+        if (!s->fiq_out)
+            return;
+        s->fiq_out = 0;
+    } else {
+        if (!s->irq_out)
+            return;
+        s->irq_out = 0;
+    }
     /* Lower parrent interrupt if there is one */
     if (is_fiq && s->fiq)
         qemu_irq_lower(s->fiq);
@@ -128,32 +171,31 @@ static void pl192_lower(pl192_state *s, int is_fiq)
     if (s->daisy) {
         if (!is_fiq) {
             s->daisy->daisy_input = 0;
-            pl192_update(s->daisy);
         } else {
-            pl192_lower(s->daisy, is_fiq);
+            s->daisy->daisy_fiq = 0;
         }
+        pl192_update(s->daisy);
     }
 }
 
-/* Find interrupt of the highest priority */
+/* Find interrupt of the highest priority.  Only the priority levels of
+   pending sources are looked at; within the best enabled level the
+   lowest numbered source wins, then the daisy chain input. */
 static uint32_t pl192_priority_sorter(pl192_state *s)
 {
-    int i;
-    uint32_t prio_irq[PL192_PRIO_LEVELS];
+    uint32_t pending, levels = 0;
+    int level;
 
-    for (i = 0; i < PL192_PRIO_LEVELS; i++)
-        prio_irq[i] = PL192_NO_IRQ;
     if (s->daisy_input)
-        prio_irq[s->daisy_priority] = PL192_DAISY_IRQ;
-    for (i = PL192_INT_SOURCES - 1; i >= 0; i--)
-        if (s->irq_status & (1 << i))
-            prio_irq[s->vect_priority[i]] = i;
-    for (i = 0; i < PL192_PRIO_LEVELS; i++) {
-        if ((s->sw_priority_mask & (1 << i)) && prio_irq[i] <= PL192_DAISY_IRQ) {
-            return prio_irq[i];
-        }
-    }
-    return PL192_NO_IRQ;
+        levels |= 1 << s->daisy_priority;
+    for (pending = s->irq_status; pending; pending &= pending - 1)
+        levels |= 1 << s->vect_priority[ctz32(pending)];
+    levels &= s->sw_priority_mask;
+    if (!levels)
+        return PL192_NO_IRQ;
+    level = ctz32(levels);
+    pending = s->irq_status & s->prio_mask[level];
+    return pending ? ctz32(pending) : PL192_DAISY_IRQ;
 }
 
 static void pl192_update(pl192_state *s)
@@ -161,7 +203,7 @@ static void pl192_update(pl192_state *s)
     /* TODO: does SOFTINT affects IRQ_STATUS??? */
     s->irq_status = (s->rawintr | s->softint) & s->intenable & ~s->intselect;
     s->fiq_status = (s->rawintr | s->softint) & s->intenable & s->intselect;
-    if (s->fiq_status) {
+    if (s->fiq_status || s->daisy_fiq) {
         pl192_raise(s, 1);
     } else {
         pl192_lower(s, 1);
@@ -306,6 +348,7 @@ static void pl192_write(void *opaque, target_phys_addr_t offset,
                         uint32_t value)
 {
     pl192_state *s = (pl192_state *) opaque;
+    int i;
 
     if (offset & 3) {
         hw_error("pl192: bad write offset " TARGET_FMT_plx "\n", offset);
@@ -321,7 +364,10 @@ static void pl192_write(void *opaque, target_phys_addr_t offset,
         return;
     }
     if (offset >= 0x200 && offset < 0x280) {
-        s->vect_priority[(offset - 0x200) >> 2] = value & 0xf;
+        i = (offset - 0x200) >> 2;
+        s->prio_mask[s->vect_priority[i]] &= ~(1 << i);
+        s->vect_priority[i] = value & 0xf;
+        s->prio_mask[s->vect_priority[i]] |= 1 << i;
         pl192_update(s);
         return;
     }
@@ -379,12 +425,47 @@ static void pl192_write(void *opaque, target_phys_addr_t offset,
 static void pl192_irq_handler(void *opaque, int irq, int level)
 {
     pl192_state *s = (pl192_state *) opaque;
+    int64_t now, latency;
 
-    if (level)
+    if (!(s->rawintr & (1 << irq)) == !level)
+        return;
+
+    now = qemu_get_clock(vm_clock);
+    if (level) {
         s->rawintr |= 1 << irq;
-    else
+        s->assert_time[irq] = now;
+        s->count[irq]++;
+    } else {
         s->rawintr &= ~(1 << irq);
-    pl192_update(opaque);
+        latency = now - s->assert_time[irq];
+        s->latency_total[irq] += latency;
+        if (latency > s->latency_max[irq])
+            s->latency_max[irq] = latency;
+    }
+    pl192_update(s);
+}
+
+void pl192_irq_info(Monitor *mon)
+{
+    pl192_state *s;
+    int i;
+
+    if (QTAILQ_EMPTY(&pl192_list))
+        return;
+    monitor_printf(mon, "source   raised  avg latency  max latency\n");
+    QTAILQ_FOREACH(s, &pl192_list, list) {
+        for (i = 0; i < PL192_INT_SOURCES; i++) {
+            if (!s->count[i])
+                continue;
+            /* A source still up is not counted in the average */
+            monitor_printf(mon, "VIC%d.%-2d %8" PRIu64 " %9" PRId64 " us"
+                           " %9" PRId64 " us%s\n", s->index, i, s->count[i],
+                           s->latency_total[i] / 1000 /
+                           (s->count[i] - ((s->rawintr >> i) & 1) ?: 1),
+                           s->latency_max[i] / 1000,
+                           (s->rawintr & (1 << i)) ? "  (raised)" : "");
+        }
+    }
 }
 
 static void pl192_reset(pl192_state *s)
@@ -394,6 +475,8 @@ static void pl192_reset(pl192_state *s)
     for (i = 0; i < PL192_INT_SOURCES; i++) {
         s->vect_priority[i] = 0xf;
     }
+    memset(s->prio_mask, 0, sizeof(s->prio_mask));
+    s->prio_mask[0xf] = 0xffffffff;
     s->sw_priority_mask = 0xffff;
     s->daisy_priority = 0xf;
     s->current = PL192_NO_IRQ;
@@ -435,6 +518,9 @@ static int pl192_init1(SysBusDevice *dev)
     /* TODO: savevm??? */
     pl192_reset(s);
 
+    s->index = pl192_count++;
+    QTAILQ_INSERT_TAIL(&pl192_list, s, list);
+
     return 0;
 }
 
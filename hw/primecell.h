@@ -10,6 +10,7 @@ void *pl080_init(uint32_t base, qemu_irq irq, int nchannels);
 
 /* pl192.c */
 void pl192_chain(void *first, void *next);
+void pl192_irq_info(Monitor *mon);
 
 /* pl330.c */
 DeviceState *pl330_init(target_phys_addr_t base, const uint32_t *cfg,
@@ -379,8 +379,7 @@ static int qt602240_init(I2CAddressableState *s)
 
     qdev_init_gpio_out(&s->i2c.qdev, &t->irq, 1);
 
-    qemu_add_mouse_event_handler(qt602240_ts_event, t, 1,
-                                 "AT42QT602240 Touchscreen");
+    touch_input_add_mouse(qt602240_ts_event, t, "AT42QT602240 Touchscreen");
     qt602240_reset(t);
 
     return 0;
@@ -203,6 +203,8 @@
 #define S5PC1XX_AK8973_IRQ       GPIOEXT_IRQ(29)
 
 /* pl330 peripheral numbers */
+#define PL330_PERIPH_NUM_UART_RX(n)  (2 * (n))
+#define PL330_PERIPH_NUM_UART_TX(n)  (2 * (n) + 1)
 #define PL330_PERIPH_NUM_I2S1    10
 #define PL330_PERIPH_NUM_I2S2    11
 
@@ -275,7 +277,7 @@ static qemu_irq *irq_multiplexer(qemu_irq irq, int n)
 {
     struct irq_multiplexer_s *s =
         qemu_mallocz(sizeof(struct irq_multiplexer_s) +
-                ((n + 7) << 3) * sizeof(uint8_t));
+                ((n + 7) >> 3) * sizeof(uint8_t));
     s->parent = irq;
     return qemu_allocate_irqs(irq_mult_handler, s, n);
 }
@@ -515,13 +517,25 @@ static void s5pc110_init(ram_addr_t ram_size, const char *boot_device,
     chr3 =
         qemu_chr_open("AT_socket", "tcp:localhost:7776,server,nowait", NULL);
     s5pc1xx_uart_init(S5PC1XX_UART_BASE, 0, 256,
-                      s5pc1xx_get_irq(s, S5PC1XX_IRQ_UART0), chr2);//lfeng,change Null->chr2
+                      s5pc1xx_get_irq(s, S5PC1XX_IRQ_UART0),
+                      qdev_get_gpio_in(dma0, PL330_PERIPH_NUM_UART_RX(0)),
+                      qdev_get_gpio_in(dma0, PL330_PERIPH_NUM_UART_TX(0)),
+                      chr2);//lfeng,change Null->chr2
     s5pc1xx_uart_init(S5PC1XX_UART_BASE + S5PC1XX_UART_SHIFT, 1, 64,
-                      s5pc1xx_get_irq(s, S5PC1XX_IRQ_UART1), NULL);
+                      s5pc1xx_get_irq(s, S5PC1XX_IRQ_UART1),
+                      qdev_get_gpio_in(dma0, PL330_PERIPH_NUM_UART_RX(1)),
+                      qdev_get_gpio_in(dma0, PL330_PERIPH_NUM_UART_TX(1)),
+                      NULL);
     s5pc1xx_uart_init(S5PC1XX_UART_BASE + S5PC1XX_UART_SHIFT * 2, 2, 16,
-                      s5pc1xx_get_irq(s, S5PC1XX_IRQ_UART2), NULL);//lfeng,change chr2->NUlL
+                      s5pc1xx_get_irq(s, S5PC1XX_IRQ_UART2),
+                      qdev_get_gpio_in(dma0, PL330_PERIPH_NUM_UART_RX(2)),
+                      qdev_get_gpio_in(dma0, PL330_PERIPH_NUM_UART_TX(2)),
+                      NULL);//lfeng,change chr2->NUlL
     s5pc1xx_uart_init(S5PC1XX_UART_BASE + S5PC1XX_UART_SHIFT * 3, 3, 16,
-                      s5pc1xx_get_irq(s, S5PC1XX_IRQ_UART3), chr3);
+                      s5pc1xx_get_irq(s, S5PC1XX_IRQ_UART3),
+                      qdev_get_gpio_in(dma0, PL330_PERIPH_NUM_UART_RX(3)),
+                      qdev_get_gpio_in(dma0, PL330_PERIPH_NUM_UART_TX(3)),
+                      chr3);
 
     /* S3C Touchscreen */
     s5pc1xx_tsadc_init(S5PC1XX_TSADC0_BASE,
@@ -15,6 +15,7 @@
 
 
 typedef struct Clk *S5pc1xxClk;
+typedef struct S5pc1xxAudioClk S5pc1xxAudioClk;
 typedef void GPIOWriteMemoryFunc(void *opaque, int io_index, uint32_t value);
 typedef uint32_t GPIOReadMemoryFunc(void *opaque, int io_index);
 
@@ -53,6 +54,19 @@ DeviceState *s5pc1xx_i2c_gpio_init(int instance);
 /* s5pc1xx_clk.c */
 S5pc1xxClk s5pc1xx_findclk(const char *name);
 int64_t s5pc1xx_clk_getrate(S5pc1xxClk clk);
+void s5pc1xx_clk_subscribe(S5pc1xxClk clk, void (*cb)(void *opaque),
+                           void *opaque);
+
+/* s5pc1xx_audio_clk.c */
+S5pc1xxAudioClk *s5pc1xx_audio_clk_new(const char *name,
+                                       void (*cb)(void *opaque),
+                                       void *opaque);
+void s5pc1xx_audio_clk_start(S5pc1xxAudioClk *clk, uint32_t freq);
+void s5pc1xx_audio_clk_stop(S5pc1xxAudioClk *clk);
+void s5pc1xx_audio_clk_set_freq(S5pc1xxAudioClk *clk, uint32_t freq);
+uint64_t s5pc1xx_audio_clk_advance(S5pc1xxAudioClk *clk);
+int64_t s5pc1xx_audio_clk_frame_start(S5pc1xxAudioClk *clk);
+void s5pc1xx_audio_clk_wake(S5pc1xxAudioClk *clk, uint64_t n);
 
 /* s5pc1xx_pmu.c */
 DeviceState *max17040_init(i2c_bus *bus, int addr);
@@ -68,6 +82,7 @@ qemu_irq s5pc1xx_gpoint_irq(DeviceState *d, int irq_num);
 /* s5pc1xx_uart.c */
 DeviceState *s5pc1xx_uart_init(target_phys_addr_t base, int instance,
                                int queue_size, qemu_irq irq,
+                               qemu_irq dma_rx_stop, qemu_irq dma_tx_stop,
                                CharDriverState *chr);
 
 /* s5pc1xx_onenand.c */
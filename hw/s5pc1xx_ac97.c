@@ -96,7 +96,7 @@ typedef struct S5pc1xxAC97State {
     unsigned reset   : 1;
 
     qemu_irq  irq;
-    QEMUTimer *ac97_timer;
+    S5pc1xxAudioClk *clk;
     uint64_t  last_ac97_time;
 } S5pc1xxAC97State;
 
@@ -109,6 +109,7 @@ static void s5pc1xx_ac97_reset(S5pc1xxAC97State *s)
     s->delay      = 2;
     s->stream     = 0;
     s->sync_en    = 0;
+    s5pc1xx_audio_clk_stop(s->clk);
 
     s->glbctrl    = 0;
     s->glbstat    = 0;
@@ -179,20 +180,14 @@ static void s5pc1xx_ac97_outfifo_control(S5pc1xxAC97State *s)
         s5pc1xx_ac97_irq(s, PCM_OUT_TH_INT, 0);
 }
 
-/* Sync timer */
-static void s5pc1xx_ac97_sync(void *opaque)
+/* Catch up with the frames started since the last access.  Only the
+ * beginning of the latest one matters, the frame itself is exchanged
+ * on BITCLK, so no timer is needed. */
+static void s5pc1xx_ac97_sync(S5pc1xxAC97State *s)
 {
-    S5pc1xxAC97State *s = (S5pc1xxAC97State *)opaque;
-    uint64_t next_ac97_time;
-
-    if (s->sync_en) {
+    if (s->sync_en && s5pc1xx_audio_clk_advance(s->clk)) {
         s->delay = 0;   /* used for 1/12MHz delay */
-        s->last_ac97_time = qemu_get_clock(vm_clock);
-        next_ac97_time = s->last_ac97_time +
-            muldiv64(1, get_ticks_per_sec(), 48000);  /* 48 KHz cycle */
-        qemu_mod_timer(s->ac97_timer, next_ac97_time);
-    } else {
-        qemu_del_timer(s->ac97_timer);
+        s->last_ac97_time = s5pc1xx_audio_clk_frame_start(s->clk);
     }
 }
 
@@ -292,6 +287,8 @@ static uint32_t s5pc1xx_ac97_gpio_read(void *opaque, int io_index)
     S5pc1xxAC97State *s = (S5pc1xxAC97State *)opaque;
     uint8_t ret_val;
 
+    s5pc1xx_ac97_sync(s);
+
     switch (io_index) {
     case GPIO_AC97RESETn:
         return s->reset;
@@ -322,6 +319,8 @@ static void s5pc1xx_ac97_gpio_write(void *opaque, int io_index, uint32_t value)
 {
     S5pc1xxAC97State *s = (S5pc1xxAC97State *)opaque;
 
+    s5pc1xx_ac97_sync(s);
+
     switch (io_index) {
     case GPIO_AC97BITCLK:
         if (value) {
@@ -423,11 +422,14 @@ static void s5pc1xx_ac97_write(void *opaque, target_phys_addr_t offset,
 
         if ((value & AC_LINK_ON) > (s->glbctrl & AC_LINK_ON)) {
             s->sync_en = 1;
+            s5pc1xx_audio_clk_start(s->clk, 48000);  /* 48 KHz cycle */
             s5pc1xx_ac97_sync(s);
         }
+        if ((value & AC_LINK_ON) < (s->glbctrl & AC_LINK_ON)) {
+            s->sync_en = 0;
+            s5pc1xx_audio_clk_stop(s->clk);
+        }
 
-        /* the value is set high above */
-        s->sync_en = (value & AC_LINK_ON) ? : 0;
         s->stream = (value & TRANSFER_EN) ? 1 : 0;
 
         if (value & ALL_CLEAR)
@@ -488,7 +490,7 @@ static int s5pc1xx_ac97_init(SysBusDevice *dev)
 
     s5pc1xx_gpio_register_io_memory(GPIO_IDX_AC97, 0, s5pc1xx_ac97_gpio_readfn,
                                     s5pc1xx_ac97_gpio_writefn, NULL, s);
-    s->ac97_timer = qemu_new_timer(vm_clock, s5pc1xx_ac97_sync, s);
+    s->clk = s5pc1xx_audio_clk_new("s5pc1xx,ac97", NULL, s);
 
     s5pc1xx_ac97_reset(s);
 
@@ -0,0 +1,109 @@
+/*
+ * Frame clock for S5PC110 serial audio interfaces (PCM, AC97, SPDIF)
+ *
+ * Rather than taking a timer event for every frame, an interface asks
+ * the clock how many frames have passed whenever the guest looks at it,
+ * and arms the clock only for the frame at which it will next do
+ * something the guest can observe.
+ *
+ * This code is licensed under the GNU GPL v2.
+ */
+
+#include "s5pc1xx.h"
+#include "qemu-timer.h"
+
+
+struct S5pc1xxAudioClk {
+    QEMUTimer *timer;
+    uint32_t  freq;         /* frames per second */
+    int       running;
+    int64_t   base;         /* vm_clock time at which frame 0 started */
+    uint64_t  done;         /* frames already handed out */
+};
+
+/* Start time of frame N */
+static int64_t s5pc1xx_audio_clk_time(S5pc1xxAudioClk *clk, uint64_t n)
+{
+    return clk->base + muldiv64(n, get_ticks_per_sec(), clk->freq);
+}
+
+/* Frame 0 starts right now and is handed out by the next advance call */
+void s5pc1xx_audio_clk_start(S5pc1xxAudioClk *clk, uint32_t freq)
+{
+    clk->freq    = freq;
+    clk->running = 1;
+    clk->base    = qemu_get_clock(vm_clock);
+    clk->done    = 0;
+}
+
+void s5pc1xx_audio_clk_stop(S5pc1xxAudioClk *clk)
+{
+    clk->running = 0;
+    if (clk->timer)
+        qemu_del_timer(clk->timer);
+}
+
+/* The current frame keeps its start time, the following ones come at the
+ * new rate.  Frames passed at the old rate must be collected before. */
+void s5pc1xx_audio_clk_set_freq(S5pc1xxAudioClk *clk, uint32_t freq)
+{
+    if (clk->running && clk->done) {
+        clk->base = s5pc1xx_audio_clk_time(clk, clk->done - 1);
+        clk->done = 1;
+    }
+    clk->freq = freq;
+}
+
+/* Number of frames started since the previous call */
+uint64_t s5pc1xx_audio_clk_advance(S5pc1xxAudioClk *clk)
+{
+    uint64_t started, ret;
+
+    if (!clk->running || !clk->freq)
+        return 0;
+
+    started = muldiv64(qemu_get_clock(vm_clock) - clk->base,
+                       clk->freq, get_ticks_per_sec()) + 1;
+    ret = started - clk->done;
+    clk->done = started;
+    return ret;
+}
+
+/* Start time of the last frame handed out */
+int64_t s5pc1xx_audio_clk_frame_start(S5pc1xxAudioClk *clk)
+{
+    if (!clk->done || !clk->freq)
+        return clk->base;
+    return s5pc1xx_audio_clk_time(clk, clk->done - 1);
+}
+
+/* Call back when the N-th frame after the last one handed out starts;
+ * 0 means no frame is of interest */
+void s5pc1xx_audio_clk_wake(S5pc1xxAudioClk *clk, uint64_t n)
+{
+    if (!clk->timer)
+        return;
+
+    if (!n || !clk->running || !clk->freq) {
+        qemu_del_timer(clk->timer);
+        return;
+    }
+    /* One tick late so that advance is sure to see the frame started */
+    qemu_mod_timer(clk->timer,
+                   s5pc1xx_audio_clk_time(clk, clk->done - 1 + n) + 1);
+}
+
+/* CB may be NULL if the interface never needs to be woken up.  NAME is
+ * what its wakeups are reported as in "info idle". */
+S5pc1xxAudioClk *s5pc1xx_audio_clk_new(const char *name,
+                                       void (*cb)(void *opaque),
+                                       void *opaque)
+{
+    S5pc1xxAudioClk *clk = qemu_mallocz(sizeof(*clk));
+
+    if (cb) {
+        clk->timer = qemu_new_timer(vm_clock, cb, opaque);
+        qemu_timer_set_name(clk->timer, name);
+    }
+    return clk;
+}
@@ -149,6 +149,12 @@ typedef struct {
     uint32_t mux_stat[2];       /* Clock MUX status */
 } CmuStat;
 
+typedef struct ClkSubscriber {
+    void (*cb)(void *opaque);
+    void *opaque;
+    struct ClkSubscriber *next;
+} ClkSubscriber;
+
 typedef struct Clk {
     const char *name;           /* Clock name */
     const char *alias;          /* Clock notes */
@@ -167,6 +173,9 @@ typedef struct Clk {
 
     unsigned short src_reg_num; /* See above (default value = 0) */
     unsigned short div_reg_num; /* See above (default value = 0) */
+
+    ClkSubscriber *subscribers; /* Told when .rate changes */
+    unsigned short changed;     /* .rate changed in the current update */
 } Clk;
 
 
@@ -458,7 +467,8 @@ static Clk *onchip_clks[] = {
     0
 };
 
-/* Find a clock by its name and return the clk structure */
+/* Find a clock by its name and return the clk structure.  This is a
+ * string search: devices look their clocks up once, at init time. */
 Clk *s5pc1xx_findclk(const char *name)
 {
     Clk **i, *cur;
@@ -478,6 +488,18 @@ int64_t s5pc1xx_clk_getrate(Clk *clk)
     return clk->rate;
 }
 
+/* Have CB called whenever the rate of CLK changes.  It runs once the
+ * whole tree has its new rates. */
+void s5pc1xx_clk_subscribe(Clk *clk, void (*cb)(void *opaque), void *opaque)
+{
+    ClkSubscriber *sub = qemu_mallocz(sizeof(*sub));
+
+    sub->cb = cb;
+    sub->opaque = opaque;
+    sub->next = clk->subscribers;
+    clk->subscribers = sub;
+}
+
 /* Update parents flow */
 static void s5pc1xx_clk_reparent(CmuStat *cmu_stat)
 {
@@ -499,7 +521,11 @@ static void s5pc1xx_clk_reparent(CmuStat *cmu_stat)
 static void s5pc1xx_clk_rate_update(CmuStat *cmu_stat)
 {
     Clk **i, *cur;
+    ClkSubscriber *sub;
+    unsigned long rate;
+    int changed = 0;
 
+    /* Parents come before their children in onchip_clks */
     for (i = onchip_clks; *i; i++) {
         cur = *i;
 
@@ -513,8 +539,26 @@ static void s5pc1xx_clk_rate_update(CmuStat *cmu_stat)
                 (cmu_stat->clk_div[cur->div_reg_num]  >> cur->div_shift & 0xf) + 1;
 
         /* update frequencies for all the clocks except the oscillators */
-        if (cur->parent)
-            cur->rate = muldiv64(cur->parent->rate, cur->mult_val, cur->div_val);
+        if (cur->parent) {
+            rate = muldiv64(cur->parent->rate, cur->mult_val, cur->div_val);
+            if (rate != cur->rate) {
+                cur->rate = rate;
+                cur->changed = 1;
+                changed = 1;
+            }
+        }
+    }
+
+    if (!changed)
+        return;
+
+    for (i = onchip_clks; *i; i++) {
+        cur = *i;
+        if (!cur->changed)
+            continue;
+        cur->changed = 0;
+        for (sub = cur->subscribers; sub; sub = sub->next)
+            sub->cb(sub->opaque);
     }
 }
 
@@ -661,6 +705,7 @@ static void register_write(void *opaque, target_phys_addr_t offset,
         s->clk_src[5] &= ALL_MUX_BITS_5;
 
         s5pc1xx_clk_reparent(s);
+        s5pc1xx_clk_rate_update(s);
 
         break;
     case 0x280 ... 0x284:
@@ -39,6 +39,13 @@ typedef struct S5pc1xxGPIOState {
     uint32_t ext_int_mask[4];
     uint32_t ext_int_pend[4];
 
+    /* Pins that latch an interrupt when asserted: configured as
+     * interrupt sources and not masked, one bit per pin */
+    uint8_t int_armed[GPJ4 + 1];
+    /* Groups with interrupts pending, one bit per group */
+    uint32_t int_pend_groups;
+    uint32_t ext_int_pend_groups;
+
     /* Parent Interrupt for GPIO interrupts */
     qemu_irq gpioint;
     /* Parent Extended Interrupt */
@@ -173,6 +180,7 @@ static void s5pc1xx_gpio_reset(S5pc1xxGPIOState *s)
         s->ext_int_mask[group] = 0xFF;
         s->ext_int_pend[group] = 0x0;
     }
+    s->ext_int_pend_groups = 0;
 
     for (group = GPA0; group <= GPJ4; group++) {
         s->int_con[group] = 0x0;
@@ -181,7 +189,9 @@ static void s5pc1xx_gpio_reset(S5pc1xxGPIOState *s)
         s->int_mask[group] = 0xFF; /* other values in documentation */
         s->int_pend[group] = 0x0;
         s->int_fixpri[group] = 0x0;
+        s->int_armed[group] = 0x0;
     }
+    s->int_pend_groups = 0;
 
     s->int_grppri    = 0x0;
     s->int_priority  = 0x0;
@@ -190,77 +200,99 @@ static void s5pc1xx_gpio_reset(S5pc1xxGPIOState *s)
     s->int_grpfixpri = 0x0;
 }
 
+/* Pins of GROUP configured as GIPIO_CONF_INT (0xF), all eight decoded
+ * at once */
+static uint8_t s5pc1xx_gpio_int_pins(S5pc1xxGPIOState *s, unsigned int group)
+{
+    uint32_t x = s->con[group];
+
+    /* Bit 4*n is set when nibble n is 0xF, then squeeze them together */
+    x &= x >> 1;
+    x &= x >> 2;
+    x &= 0x11111111;
+    x = (x | x >> 3) & 0x03030303;
+    x = (x | x >> 6) & 0x000F000F;
+    return (x | x >> 12) & 0xFF;
+}
+
+static void s5pc1xx_gpio_arm(S5pc1xxGPIOState *s, unsigned int group)
+{
+    if (group <= GPJ4)
+        s->int_armed[group] =
+            s5pc1xx_gpio_int_pins(s, group) & ~s->int_mask[group];
+}
+
 static void s5pc1xx_gpio_irq_lower(S5pc1xxGPIOState *s,
                                    unsigned int group, uint32_t pinmask)
 {
-    unsigned int i = 0;
     s->int_pend[group] &= ~pinmask;
-    for (i = GPA0; i <= GPJ4; i++)
-        if (s->int_pend[i])
-            return;
+    if (s->int_pend[group] || !s->int_pend_groups)
+        return;
 
-    qemu_irq_lower(s->gpioint);
+    s->int_pend_groups &= ~(1 << group);
+    if (!s->int_pend_groups)
+        qemu_irq_lower(s->gpioint);
 }
 
 static void s5pc1xx_gpio_extended_irq_lower(S5pc1xxGPIOState *s,
                                             unsigned int group, uint32_t pinmask)
 {
-    unsigned int i = 0;
     s->ext_int_pend[group] &= ~pinmask;
-    for (i = 0; i < 4; i++)
-        if (s->ext_int_pend[i])
-            return;
+    if (s->ext_int_pend[group] || !s->ext_int_pend_groups)
+        return;
 
-    qemu_irq_lower(s->extend);
+    s->ext_int_pend_groups &= ~(1 << group);
+    if (!s->ext_int_pend_groups)
+        qemu_irq_lower(s->extend);
 }
 
+/* An asserted pin latches its pending bit, which stays until the guest
+ * clears it: several device models signal every event by asserting the
+ * line without ever deasserting it, so each assertion counts as a new
+ * one.  Deasserting an armed pin that is not pending goes through the
+ * lower path, which drops the parent line once nothing is pending. */
 static void s5pc1xx_gpio_irq_handler(void *opaque, int irq, int level)
 {
     S5pc1xxGPIOState *s = (S5pc1xxGPIOState *)opaque;
-    unsigned int group = GPIOINT_GROUP(irq);
-    unsigned int pin   = GPIOINT_PIN  (irq);
+    unsigned int group;
+    uint32_t bit;
 
     /* Special case of extended IRQs */
     if (irq < IRQ_EXTEND_NUM) {
         group = irq >> 3;
-        pin   = irq & 0x7;
+        bit   = 1 << (irq & 0x7);
 
         /* FIXME: IRQs 0~15 are not supported */
         if (irq < 16)
             hw_error("s5pc1xx_gpio: "
                      "extended IRQs 0-15 through GPIO are not supported");
 
-        if (s->ext_int_mask[group] & (1 << pin))
-            return;
-
-        if (s->ext_int_pend[group] & (1 << pin))
+        if ((s->ext_int_mask[group] | s->ext_int_pend[group]) & bit)
             return;
 
         if (level) {
-            s->ext_int_pend[group] |= (1 << pin);
-            qemu_irq_raise(s->extend);
+            s->ext_int_pend[group] |= bit;
+            if (!s->ext_int_pend_groups)
+                qemu_irq_raise(s->extend);
+            s->ext_int_pend_groups |= 1 << group;
         } else {
-            s5pc1xx_gpio_extended_irq_lower(s, group, (1 << pin));
+            s5pc1xx_gpio_extended_irq_lower(s, group, bit);
         }
-
         return;
     }
 
-    if (GPIO_PIN_CONF(s, group, pin) != GIPIO_CONF_INT)
-        return;
-
-    if (s->int_mask[group] & (1 << pin))
-        return;
-
-    /* if the interrupt has already happened */
-    if (s->int_pend[group] & (1 << pin))
+    group = GPIOINT_GROUP(irq);
+    bit   = 1 << GPIOINT_PIN(irq);
+    if (!(s->int_armed[group] & ~s->int_pend[group] & bit))
         return;
 
     if (level) {
-        s->int_pend[group] |= (1 << pin);
-        qemu_irq_raise(s->gpioint);
+        s->int_pend[group] |= bit;
+        if (!s->int_pend_groups)
+            qemu_irq_raise(s->gpioint);
+        s->int_pend_groups |= 1 << group;
     } else {
-        s5pc1xx_gpio_irq_lower(s, group, (1 << pin));
+        s5pc1xx_gpio_irq_lower(s, group, bit);
     }
 }
 
@@ -396,6 +428,7 @@ static void s5pc1xx_gpio_write(void *opaque,
                 }
             }
             s->con[group] = value;
+            s5pc1xx_gpio_arm(s, group);
             return;
         }
 
@@ -450,7 +483,9 @@ static void s5pc1xx_gpio_write(void *opaque,
     }
 
     if (offset >= INT_MASK_BASE && offset < INT_MASK_BASE + INT_REGS_SIZE) {
-        s->int_mask[GET_GROUP_INT_MASK(offset)] = value;
+        group = GET_GROUP_INT_MASK(offset);
+        s->int_mask[group] = value;
+        s5pc1xx_gpio_arm(s, group);
         return;
     }
 
@@ -491,7 +526,7 @@ static void s5pc1xx_gpio_write(void *opaque,
         }
         /* EINT Pend Register */
         if (offset == EXT_INT_PEND(n)) {
-            s5pc1xx_gpio_extended_irq_lower(s, group, value);
+            s5pc1xx_gpio_extended_irq_lower(s, n, value);
             return;
         }
     }
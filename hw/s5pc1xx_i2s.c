@@ -9,10 +9,16 @@
 
 #include "sysbus.h"
 #include "i2c.h"
+#include "monitor.h"
 #include "s5pc1xx.h"
 
 
-#define AUDIO_WORDS_SEND  0x800
+/* How much data is kept queued ahead of the audio backend before the DMA
+ * is held off.  It follows the largest request the backend made lately,
+ * so a host that calls back late gets more slack. */
+#define I2S_WATERMARK_MIN   0x800
+#define I2S_WATERMARK_INIT  0x2000
+#define I2S_WATERMARK_MAX   0x20000
 
 /*Magic size*/
 #define AUDIO_BUFFER_SIZE 0x100000
@@ -166,6 +172,16 @@ typedef struct S5pc1xxI2SState {
     uint play_pos;
     uint last_free;
 
+    uint32_t watermark;
+    uint32_t peak_request;
+    int playing;
+
+    /* statistics */
+    uint32_t avg_queued;
+    uint64_t played;
+    uint64_t underruns;
+    uint64_t underrun_bytes;
+
     qemu_irq irq;
     qemu_irq dma_irq_stop1;
     qemu_irq dma_irq_stop2;
@@ -205,6 +221,10 @@ static void s5pc1xx_i2s_reset(S5pc1xxI2SState *s)
 
     s->play_pos    = 0;
     s->last_free   = 0;
+
+    s->watermark    = I2S_WATERMARK_INIT;
+    s->peak_request = 0;
+    s->playing      = 0;
 }
 
 static int s5pc1xx_i2s_pause(S5pc1xxI2SState *s) {
@@ -215,46 +235,82 @@ static int s5pc1xx_i2s_transmit(S5pc1xxI2SState *s) {
     return S5PC1XX_IISMOD_TX_SET(s->iismod);
 }
 
-static void s5pc1xx_i2s_audio_callback(void *opaque, int free_out)
+static uint32_t s5pc1xx_i2s_queued(S5pc1xxI2SState *s)
 {
-    S5pc1xxI2SState *s = (S5pc1xxI2SState *)opaque;
-    int8_t *codec_buffer = NULL;
-    int block_size = 0;
+    return (s->last_free + s->buf_size - s->play_pos) % s->buf_size;
+}
 
+/* Adjust the watermark after a request for FREE_OUT bytes was served
+ * from QUEUED ones */
+static void s5pc1xx_i2s_watermark_update(S5pc1xxI2SState *s,
+                                         uint32_t free_out, uint32_t queued)
+{
+    uint32_t target;
 
-    if (free_out <= 0) {
+    s->peak_request -= s->peak_request / 64;
+    s->peak_request = MAX(s->peak_request, free_out);
+
+    if (queued < free_out && s->playing &&
+        (s->iiscon & S5PC1XX_IISCON_TXDMACTIVE)) {
+        s->underruns++;
+        s->underrun_bytes += free_out - queued;
+        s->watermark = MIN(s->watermark * 2, I2S_WATERMARK_MAX);
         return;
     }
-    if (free_out > AUDIO_WORDS_SEND) {
-        free_out = AUDIO_WORDS_SEND;
+
+    target = MIN(MAX(2 * s->peak_request, I2S_WATERMARK_MIN),
+                 I2S_WATERMARK_MAX) & ~3;
+    if (target > s->watermark) {
+        s->watermark = target;
+    } else {
+        /* Give latency back slowly */
+        s->watermark -= ((s->watermark - target) / 8) & ~3;
     }
+}
 
-    block_size = 4 * free_out;
+/* The codec's voice takes data straight from the ring */
+static void s5pc1xx_i2s_audio_callback(void *opaque, int free_out)
+{
+    S5pc1xxI2SState *s = (S5pc1xxI2SState *)opaque;
+    uint32_t queued, len, done;
 
-    if (s5pc1xx_i2s_pause(s)) {
+    if (free_out <= 0 || s5pc1xx_i2s_pause(s)) {
         return;
     }
 
-    if (s->play_pos > s->last_free &&
-        s->play_pos + block_size > s->buf_size &&
-        s->play_pos + block_size - s->buf_size > s->last_free) {
-        s5pc1xx_i2s_resume(s);
-        return;
+    queued = s5pc1xx_i2s_queued(s);
+    s->avg_queued += queued / 16 - s->avg_queued / 16;
+    s5pc1xx_i2s_watermark_update(s, free_out, queued);
+
+    s->playing = 0;
+    while (queued && free_out) {
+        len = MIN(MIN(queued, free_out), s->buf_size - s->play_pos);
+        done = wm8994_dac_write(s->wm8994, s->buffer + s->play_pos, len);
+        if (!done) {
+            break;
+        }
+        s->play_pos = (s->play_pos + done) % s->buf_size;
+        s->played += done;
+        queued -= done;
+        free_out -= done;
+        s->playing = 1;
     }
 
-    if (s->play_pos <= s->last_free &&
-        s->play_pos + block_size > s->last_free) {
+    if (queued < s->watermark) {
         s5pc1xx_i2s_resume(s);
-        return;
     }
+}
 
-    codec_buffer = wm8994_dac_buffer(s->wm8994, block_size);
-    memcpy(codec_buffer, s->buffer + s->play_pos, block_size);
-    s->play_pos = (s->play_pos + block_size) % s->buf_size;
-
-    s5pc1xx_i2s_resume(s);
+static void s5pc1xx_i2s_print_info(Monitor *mon, void *opaque)
+{
+    S5pc1xxI2SState *s = (S5pc1xxI2SState *)opaque;
 
-    wm8994_dac_commit(s->wm8994);
+    monitor_printf(mon, "  i2s: %u bytes queued (%u on average), "
+                   "watermark %u bytes\n",
+                   s5pc1xx_i2s_queued(s), s->avg_queued, s->watermark);
+    monitor_printf(mon, "  i2s: %" PRIu64 " bytes played, %" PRIu64
+                   " underruns, %" PRIu64 " bytes short\n",
+                   s->played, s->underruns, s->underrun_bytes);
 }
 
 /* I2S write function */
@@ -282,6 +338,10 @@ static void s5pc1xx_i2s_write(void *opaque, target_phys_addr_t offset,
             /*TODO: stop dma if (value & S5PC1XX_IISCON_TXSDMACTIVE) is 0*/
         }
 
+        if (I2S_TOGGLE_BIT(s->iiscon, value, S5PC1XX_IISCON_I2SACTIVE)) {
+            wm8994_set_active(s->wm8994, value & S5PC1XX_IISCON_I2SACTIVE);
+        }
+
         s->iiscon = (s->iiscon & ~S5PC1XX_IISCON_WRITE_MASK) |
                     (value & S5PC1XX_IISCON_WRITE_MASK);
 
@@ -325,7 +385,7 @@ static void s5pc1xx_i2s_write(void *opaque, target_phys_addr_t offset,
             use_buf = s->buf_size + use_buf;
         }
 
-        if (use_buf >= AUDIO_WORDS_SEND*4) {
+        if (use_buf >= s->watermark) {
             s5pc1xx_i2s_stop(s);
         }
         break;
@@ -454,7 +514,8 @@ static int s5pc1xx_i2s_init1(SysBusDevice *dev)
     s->buffer = qemu_malloc(s->buf_size);
 
     s5pc1xx_i2s_reset(s);
-    wm8994_data_req_set(s->wm8994, s5pc1xx_i2s_audio_callback, s);
+    wm8994_data_req_set(s->wm8994, s5pc1xx_i2s_audio_callback,
+                        s5pc1xx_i2s_print_info, s);
 
     return 0;
 }
@@ -6,11 +6,16 @@
  */
 
 #include "qemu-common.h"
+#include "qemu-char.h"
 #include "sysbus.h"
 
 #ifdef CONFIG_JPEG
 #include <stdio.h>
+#include <setjmp.h>
+#include <signal.h>
 #include <jpeglib.h>
+#include <jerror.h>
+#include "qemu-thread.h"
 #endif
 
 /* Control registers */
@@ -126,6 +131,12 @@ typedef struct Dummy_DInfo {
     JDIMENSION      image_height;
     J_COLOR_SPACE   out_color_space;
 } Dummy_DInfo;
+
+/* libjpeg error handler returning control to the codec function */
+typedef struct S5pc1xxJpegError {
+    struct jpeg_error_mgr pub;
+    jmp_buf jmp;
+} S5pc1xxJpegError;
 #endif
 
 typedef struct S5pc1xxJpegState {
@@ -182,15 +193,92 @@ typedef struct S5pc1xxJpegState {
 
     CInfo *cinfo;
     DInfo *dinfo;
+
+    struct jpeg_source_mgr src_mgr;
+    struct jpeg_destination_mgr dst_mgr;
+
+    /* Coding is done by a worker thread: JSTART hands the job over and
+     * the main loop is notified through a pipe when it is finished */
+    QemuThread thread;
+    QemuMutex lock;
+    QemuCond cond;
+    int notify_fd[2];
+    int worker_started;
+    int job_active;     /* started and not yet completed (main thread) */
+    int job_pending;    /* not yet finished by the worker (under lock) */
+    uint8_t job_mode;
+    int job_failed;
+    uint32_t job_written;
 #endif
 } S5pc1xxJpegState;
 
 static void s5pc1xx_jpeg_irq(S5pc1xxJpegState *s,
                              uint8_t irq_stat, short to_clear);
+#ifdef CONFIG_JPEG
+static void s5pc1xx_jpeg_done(void *opaque);
+#endif
 
 ////////// Special code (only when configured with libjpeg support) //////////
 
 #ifdef CONFIG_JPEG
+/* Do not let libjpeg exit the process on errors, go back to the caller */
+static void s5pc1xx_jpeg_error_exit(j_common_ptr cinfo)
+{
+    S5pc1xxJpegError *err = (S5pc1xxJpegError *) cinfo->err;
+
+    (*cinfo->err->output_message)(cinfo);
+    longjmp(err->jmp, 1);
+}
+
+/* Compressed data source: guest memory mapped at src_base */
+static void s5pc1xx_jpeg_init_source(j_decompress_ptr dinfo)
+{
+}
+
+static boolean s5pc1xx_jpeg_fill_input(j_decompress_ptr dinfo)
+{
+    static const JOCTET eoi[2] = { 0xFF, JPEG_EOI };
+
+    /* Input is over, insert a fake EOI marker as libjpeg suggests */
+    dinfo->src->next_input_byte = eoi;
+    dinfo->src->bytes_in_buffer = 2;
+    return TRUE;
+}
+
+static void s5pc1xx_jpeg_skip_input(j_decompress_ptr dinfo, long num_bytes)
+{
+    struct jpeg_source_mgr *src = dinfo->src;
+
+    if (num_bytes <= 0) {
+        return;
+    }
+    if ((size_t) num_bytes > src->bytes_in_buffer) {
+        s5pc1xx_jpeg_fill_input(dinfo);
+    } else {
+        src->next_input_byte += num_bytes;
+        src->bytes_in_buffer -= num_bytes;
+    }
+}
+
+static void s5pc1xx_jpeg_term_source(j_decompress_ptr dinfo)
+{
+}
+
+/* Compressed data destination: guest memory mapped at dst_base */
+static void s5pc1xx_jpeg_init_destination(j_compress_ptr cinfo)
+{
+}
+
+static boolean s5pc1xx_jpeg_empty_output(j_compress_ptr cinfo)
+{
+    ERREXIT(cinfo, JERR_BUFFER_SIZE);
+    return FALSE;
+}
+
+static void s5pc1xx_jpeg_term_destination(j_compress_ptr cinfo)
+{
+}
+
 /* Combine image properties before compression */
 static void s5pc1xx_jpeg_pre_coding(S5pc1xxJpegState *s)
 {
@@ -361,7 +449,7 @@ static int s5pc1xx_jpeg_mem_map(S5pc1xxJpegState *s)
     dst_len = s->dst_len;
 
     s->src_base = cpu_physical_memory_map(s->src_addr, &src_len, 0);
-    s->dst_base = cpu_physical_memory_map(s->dst_addr, &dst_len, 0);
+    s->dst_base = cpu_physical_memory_map(s->dst_addr, &dst_len, 1);
 
     if (!s->src_base || !s->dst_base) {
         fprintf(stderr, "s5pc1xx_jpeg: bad image address\n");
@@ -374,29 +462,38 @@ static int s5pc1xx_jpeg_mem_map(S5pc1xxJpegState *s)
         return 0;
 
     cpu_physical_memory_unmap(s->src_base, src_len, 0, 0);
-    cpu_physical_memory_unmap(s->dst_base, dst_len, 0, 0);
+    cpu_physical_memory_unmap(s->dst_base, dst_len, 1, 0);
     fprintf(stderr, "s5pc1xx_jpeg: not enough memory for image\n");
     /* Raise result interrupt as NOT OK */
     s5pc1xx_jpeg_irq(s, JUST_RAISE_IRQ, NONE);
     return 1;
 }
 
-/* JPEG compression */
-static void s5pc1xx_jpeg_coding(S5pc1xxJpegState *s)
+/* JPEG compression, returns non-zero on failure */
+static int s5pc1xx_jpeg_coding(S5pc1xxJpegState *s)
 {
     int row_stride, i;
-    struct jpeg_error_mgr jerr;
+    S5pc1xxJpegError jerr;
     JSAMPROW row_pointer[1];
 
     CInfo *cinfo = s->cinfo;
     Dummy_CInfo *dummy_cinfo = s->dummy_cinfo;
 
     /* Allocate and initialize JPEG compression object */
-    cinfo->err = jpeg_std_error(&jerr);
+    cinfo->err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = s5pc1xx_jpeg_error_exit;
+    if (setjmp(jerr.jmp)) {
+        jpeg_destroy_compress(cinfo);
+        return 1;
+    }
     jpeg_create_compress(cinfo);
 
-    cinfo->dest->next_output_byte = (JSAMPLE *) s->dst_base;
-    cinfo->dest->free_in_buffer   = s->dst_len;
+    s->dst_mgr.init_destination    = s5pc1xx_jpeg_init_destination;
+    s->dst_mgr.empty_output_buffer = s5pc1xx_jpeg_empty_output;
+    s->dst_mgr.term_destination    = s5pc1xx_jpeg_term_destination;
+    s->dst_mgr.next_output_byte    = (JOCTET *) s->dst_base;
+    s->dst_mgr.free_in_buffer      = s->dst_len;
+    cinfo->dest = &s->dst_mgr;
 
     /* RGB or YCbCr (3 components) can be used as compressor input color space
      * according to s5pc1xx specification */
@@ -464,26 +561,40 @@ static void s5pc1xx_jpeg_coding(S5pc1xxJpegState *s)
 
     /* Finish compression */
     jpeg_finish_compress(cinfo);
+    s->job_written = s->dst_len - s->dst_mgr.free_in_buffer;
     jpeg_destroy_compress(cinfo);
+    return 0;
 }
 
-/* JPEG decompression */
-static void s5pc1xx_jpeg_decoding(S5pc1xxJpegState *s)
+/* JPEG decompression, returns non-zero on failure */
+static int s5pc1xx_jpeg_decoding(S5pc1xxJpegState *s)
 {
-    struct jpeg_error_mgr jerr;
-    JSAMPARRAY buffer;  /* Output row buffer */
-    int row_stride;     /* Physical row width in output buffer */
-    int i, count;
+    S5pc1xxJpegError jerr;
+    JSAMPROW row_pointer[1];
+    JSAMPARRAY buffer = NULL;   /* Row buffer for rows not fitting dst */
+    int row_stride;             /* Physical row width in output buffer */
+    uint32_t count;
 
     DInfo *dinfo = s->dinfo;
     Dummy_DInfo *dummy_dinfo = s->dummy_dinfo;
 
     /* Allocate and initialize JPEG decompression object */
-    dinfo->err = jpeg_std_error(&jerr);
+    dinfo->err = jpeg_std_error(&jerr.pub);
+    jerr.pub.error_exit = s5pc1xx_jpeg_error_exit;
+    if (setjmp(jerr.jmp)) {
+        jpeg_destroy_decompress(dinfo);
+        return 1;
+    }
     jpeg_create_decompress(dinfo);
 
-    dinfo->src->next_input_byte = (JSAMPLE *) s->src_base;
-    dinfo->src->bytes_in_buffer = s->src_len;
+    s->src_mgr.init_source       = s5pc1xx_jpeg_init_source;
+    s->src_mgr.fill_input_buffer = s5pc1xx_jpeg_fill_input;
+    s->src_mgr.skip_input_data   = s5pc1xx_jpeg_skip_input;
+    s->src_mgr.resync_to_restart = jpeg_resync_to_restart;
+    s->src_mgr.term_source       = s5pc1xx_jpeg_term_source;
+    s->src_mgr.next_input_byte   = (JOCTET *) s->src_base;
+    s->src_mgr.bytes_in_buffer   = s->src_len;
+    dinfo->src = &s->src_mgr;
 
     (void) jpeg_read_header(dinfo, TRUE);
 
@@ -494,22 +605,143 @@ static void s5pc1xx_jpeg_decoding(S5pc1xxJpegState *s)
     /* JSAMPLEs per row in output buffer */
     row_stride = dinfo->output_width * dinfo->output_components;
 
-    /* Make a one-row-high sample array
-     * that will go away when done with image */
-    buffer = (*(dinfo->mem->alloc_sarray))
-        ((j_common_ptr) dinfo, JPOOL_IMAGE, row_stride, 1);
-
+    /* Rows are decoded straight into the mapped guest buffer, only a row
+     * crossing its end goes through the row buffer */
     count = 0;
     while (dinfo->output_scanline < dinfo->output_height) {
-        (void) jpeg_read_scanlines(dinfo, buffer, 1);
-
-        for (i = 0; i < row_stride; i++, count++)
-            s->dst_base[count] = (char) buffer[0][i];
+        if (count + row_stride <= s->dst_len) {
+            row_pointer[0] = (JSAMPROW) &s->dst_base[count];
+            (void) jpeg_read_scanlines(dinfo, row_pointer, 1);
+        } else {
+            if (!buffer) {
+                buffer = (*(dinfo->mem->alloc_sarray))
+                    ((j_common_ptr) dinfo, JPOOL_IMAGE, row_stride, 1);
+            }
+            (void) jpeg_read_scanlines(dinfo, buffer, 1);
+            if (count < s->dst_len) {
+                memcpy(&s->dst_base[count], buffer[0], s->dst_len - count);
+            }
+        }
+        count += row_stride;
     }
+    s->job_written = MIN(count, s->dst_len);
 
     /* Finish decompression */
     (void) jpeg_finish_decompress(dinfo);
     jpeg_destroy_decompress(dinfo);
+    return 0;
+}
+
+/* Worker thread running one codec job at a time */
+static void *s5pc1xx_jpeg_worker(void *opaque)
+{
+    S5pc1xxJpegState *s = (S5pc1xxJpegState *)opaque;
+    sigset_t set;
+    char byte = 0;
+
+    /* Leave all signals to the main thread */
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+    for (;;) {
+        qemu_mutex_lock(&s->lock);
+        while (!s->job_pending) {
+            qemu_cond_wait(&s->cond, &s->lock);
+        }
+        qemu_mutex_unlock(&s->lock);
+
+        if (s->job_mode == COMPR) {
+            s->job_failed = s5pc1xx_jpeg_coding(s);
+        } else {
+            s->job_failed = s5pc1xx_jpeg_decoding(s);
+        }
+
+        qemu_mutex_lock(&s->lock);
+        s->job_pending = 0;
+        qemu_cond_broadcast(&s->cond);
+        qemu_mutex_unlock(&s->lock);
+
+        while (write(s->notify_fd[1], &byte, 1) < 0 && errno == EINTR) {
+        }
+    }
+    return NULL;
+}
+
+/* Hand the mapped job over to the worker thread */
+static void s5pc1xx_jpeg_start_job(S5pc1xxJpegState *s)
+{
+    if (!s->worker_started) {
+        if (qemu_pipe(s->notify_fd) < 0) {
+            hw_error("s5pc1xx_jpeg: failed to create pipe\n");
+        }
+        fcntl(s->notify_fd[0], F_SETFL, O_NONBLOCK);
+        qemu_set_fd_handler(s->notify_fd[0], s5pc1xx_jpeg_done, NULL, s);
+        qemu_mutex_init(&s->lock);
+        qemu_cond_init(&s->cond);
+        qemu_thread_create(&s->thread, s5pc1xx_jpeg_worker, s);
+        s->worker_started = 1;
+    }
+
+    s->job_mode = s->proc_mode;
+    s->job_written = 0;
+    s->job_active = 1;
+    qemu_mutex_lock(&s->lock);
+    s->job_pending = 1;
+    qemu_cond_broadcast(&s->cond);
+    qemu_mutex_unlock(&s->lock);
+}
+
+/* Finish the job in the main thread: release guest memory, report result */
+static void s5pc1xx_jpeg_complete(S5pc1xxJpegState *s)
+{
+    s->job_active = 0;
+    cpu_physical_memory_unmap(s->src_base, s->src_len, 0, 0);
+    cpu_physical_memory_unmap(s->dst_base, s->dst_len, 1, s->job_written);
+    if (s->job_mode == COMPR) {
+        s->byte_cnt = s->job_written;
+    }
+    s->jpgopr = 0x0;
+    if (s->job_failed) {
+        fprintf(stderr, "s5pc1xx_jpeg: bad image data\n");
+        /* Raise stream interrupt as NOT OK */
+        s5pc1xx_jpeg_irq(s, STREAM_INT, HIGH);
+    } else {
+        /* Raise result interrupt as OK */
+        s5pc1xx_jpeg_irq(s, RESULT_INT, HIGH);
+    }
+}
+
+/* Worker notification handler */
+static void s5pc1xx_jpeg_done(void *opaque)
+{
+    S5pc1xxJpegState *s = (S5pc1xxJpegState *)opaque;
+    char bytes[16];
+    int pending;
+
+    while (read(s->notify_fd[0], bytes, sizeof(bytes)) > 0) {
+    }
+
+    qemu_mutex_lock(&s->lock);
+    pending = s->job_pending;
+    qemu_mutex_unlock(&s->lock);
+
+    if (s->job_active && !pending) {
+        s5pc1xx_jpeg_complete(s);
+    }
+}
+
+/* Block until the current job (if any) is finished */
+static void s5pc1xx_jpeg_wait(S5pc1xxJpegState *s)
+{
+    if (!s->job_active) {
+        return;
+    }
+    qemu_mutex_lock(&s->lock);
+    while (s->job_pending) {
+        qemu_cond_wait(&s->cond, &s->lock);
+    }
+    qemu_mutex_unlock(&s->lock);
+    s5pc1xx_jpeg_complete(s);
 }
 #endif
 
@@ -792,7 +1024,8 @@ static void s5pc1xx_jpeg_write(void *opaque, target_phys_addr_t offset,
         s->jpgclkcon = value;
         break;
     case JSTART:
-        if (!value)
+        /* Only one job at a time, the codec is busy until JPGOPR clears */
+        if (!value || s->jpgopr)
             break;
         s->jpgopr = 0x1;
 #ifdef CONFIG_JPEG
@@ -801,27 +1034,25 @@ static void s5pc1xx_jpeg_write(void *opaque, target_phys_addr_t offset,
             s5pc1xx_jpeg_pre_coding(s);
             if (s5pc1xx_jpeg_mem_map(s))
                 break;
-            s5pc1xx_jpeg_coding(s);
-            s->byte_cnt = s5pc1xx_jpeg_data_size(s);
-            /* Raise result interrupt as OK */
-            s5pc1xx_jpeg_irq(s, RESULT_INT, HIGH);
-            break;
+            s5pc1xx_jpeg_start_job(s);
+            return;
         case DECOMPR:
             s5pc1xx_jpeg_pre_decoding(s);
             if (!s->src_len)
                 break;
             if (s5pc1xx_jpeg_mem_map(s))
                 break;
-            s5pc1xx_jpeg_decoding(s);
-            /* Raise result interrupt as OK */
-            s5pc1xx_jpeg_irq(s, RESULT_INT, HIGH);
-            break;
+            s5pc1xx_jpeg_start_job(s);
+            return;
         }
 #endif
         s->jpgopr = 0x0;
         break;
     case SW_RESET:
         if (value) {
+#ifdef CONFIG_JPEG
+            s5pc1xx_jpeg_wait(s);
+#endif
             s->sw_reset = 0x1;
             s5pc1xx_jpeg_reset(s);
         }
@@ -26,6 +26,13 @@
 #define WSWP    0x1
 
 
+/* Intermediate framebuffer rows are aligned to a host cache line */
+#define IFB_ALIGN   64
+
+/* Maximum number of rectangles reported to the console per frame */
+#define MAX_DAMAGE_RECTS    16
+
+
 typedef struct {
     uint8_t r, g, b;
     uint32_t a;
@@ -34,16 +41,17 @@ typedef struct {
 struct DrawConfig;
 
 typedef void pixel_to_rgb_func(uint32_t pixel, rgba *p);
-typedef void draw_line_func(struct DrawConfig *cfg, uint8_t *src,
-                            uint8_t *dst, uint8_t *ifb);
+typedef void decode_line_func(const struct DrawConfig *cfg, const uint8_t *src,
+                              uint32_t *rgb, uint32_t *alpha);
+typedef void blend_line_func(struct DrawConfig *cfg,
+                             uint32_t *rgb, uint32_t *alpha,
+                             const uint32_t *fg_rgb, const uint32_t *fg_alpha);
 typedef uint32_t coef_func(const struct DrawConfig *cfg, rgba pa, rgba pb);
 
 typedef struct DrawConfig {
     pixel_to_rgb_func *pixel_to_rgb;
-    draw_line_func *draw_line;
-    int (*put_pixel)(rgba p, uint8_t *pixel);
-    int (*get_pixel)(uint8_t *src, rgba *p);
-    void (*blend)(struct DrawConfig *cfg, rgba p_old, rgba p_new, rgba *p);
+    decode_line_func *decode_line;
+    blend_line_func *blend_line;
     coef_func *coef_p, *coef_q, *coef_a, *coef_b;
     uint8_t is_palletized;
     uint32_t bg_alpha[2], fg_alpha[2];
@@ -52,11 +60,20 @@ typedef struct DrawConfig {
     int width;
     int bpp;
     uint32_t *palette;
+    /* Palette converted to the intermediate framebuffer format */
+    uint32_t pal_rgb[256], pal_alpha[256];
+    /* Blending coefficients when they do not depend on pixel values */
+    uint32_t const_p, const_q, const_a, const_b;
     uint8_t swap;
     uint8_t fg_pixel_blending, bg_pixel_blending;
     uint8_t fg_alpha_sel, bg_alpha_sel;
 } DrawConfig;
 
+/* Horizontal span [x0, x1) of a screen line, empty if x0 >= x1 */
+typedef struct {
+    uint16_t x0, x1;
+} S5pc1xxLcdSpan;
+
 typedef struct S5pc1xxLcdWindow {
     uint32_t wincon;
     uint32_t vidosd[4];
@@ -90,9 +107,19 @@ typedef struct {
     uint32_t ldi_cmd[12];
 
     S5pc1xxLcdWindow window[5];
-    uint8_t *ifb;
-    uint8_t *valid_line;
-    uint8_t *valid_line_prev;
+    /* Intermediate framebuffer: packed 0x00RRGGBB colour plane and
+       per-channel alpha plane, one 32-bit word per pixel each */
+    uint32_t *ifb;
+    uint32_t *ifb_alpha;
+    /* Scratch line for windows blended on top of the lower ones */
+    uint32_t *line_rgb;
+    uint32_t *line_alpha;
+    /* Set when the last frame bypassed IFB and went to the console directly */
+    uint8_t ifb_stale;
+    /* Per-line damage in this and the previous frame, and spans to redraw */
+    S5pc1xxLcdSpan *damage;
+    S5pc1xxLcdSpan *damage_prev;
+    S5pc1xxLcdSpan *redraw;
     DisplayState *console;
     uint8_t invalidate;
     qemu_irq irq[3];
@@ -138,6 +165,7 @@ DEF_PIXEL_TO_RGB(pixel_8888_to_rgb, 8, 8, 8, 8)
 static void pixel_1555_to_rgb(uint32_t pixel, rgba *p)
 {
     uint8_t u = (pixel >> 15) & 1;
+    p->a = 0;
     p->b = (((pixel & 0x1F) << 1) | u) << 2;
     pixel >>= 5;
     p->g = (((pixel & 0x3F) << 1) | u) << 2;
@@ -146,64 +174,22 @@ static void pixel_1555_to_rgb(uint32_t pixel, rgba *p)
 }
 
 
-/* Write RGB to QEMU's GraphicConsole framebuffer */
-
-static int put_pixel8(rgba p, uint8_t *d)
-{
-    uint32_t pixel = rgb_to_pixel8(p.r, p.g, p.b);
-    *(uint8_t *)d = pixel;
-    return 1;
-}
-
-static int put_pixel15(rgba p, uint8_t *d)
-{
-    uint32_t pixel = rgb_to_pixel15(p.r, p.g, p.b);
-    *(uint16_t *)d = pixel;
-    return 2;
-}
-
-static int put_pixel16(rgba p, uint8_t *d)
-{
-    uint32_t pixel = rgb_to_pixel16(p.r, p.g, p.b);
-    *(uint16_t *)d = pixel;
-    return 2;
-}
-
-static int put_pixel24(rgba p, uint8_t *d)
-{
-    uint32_t pixel = rgb_to_pixel24(p.r, p.g, p.b);
-    *(uint8_t *)d++ = (pixel >>  0) & 0xFF;
-    *(uint8_t *)d++ = (pixel >>  8) & 0xFF;
-    *(uint8_t *)d++ = (pixel >> 16) & 0xFF;
-    return 3;
-}
+/* Convert between rgba and intermediate framebuffer representation */
 
-static int put_pixel32(rgba p, uint8_t *d)
+static inline uint32_t rgba_to_packed(rgba p)
 {
-    uint32_t pixel = rgb_to_pixel24(p.r, p.g, p.b);
-    *(uint32_t *)d = pixel;
-    return 4;
+    return (p.r << 16) | (p.g << 8) | p.b;
 }
 
-
-/* Put/get pixel to/from internal LCD Controller framebuffer */
-
-static int put_rgba(rgba p, uint8_t *d)
+static inline rgba packed_to_rgba(uint32_t rgb, uint32_t alpha)
 {
-    *(uint8_t *)d++ = p.r;
-    *(uint8_t *)d++ = p.g;
-    *(uint8_t *)d++ = p.b;
-    *(uint32_t *)d = p.a;
-    return 7;
-}
+    rgba p;
 
-static int get_rgba(uint8_t *s, rgba *p)
-{
-    p->r = *(uint8_t *)s++;
-    p->g = *(uint8_t *)s++;
-    p->b = *(uint8_t *)s++;
-    p->a = *(uint32_t *)s;
-    return 7;
+    p.r = (rgb >> 16) & 0xFF;
+    p.g = (rgb >> 8) & 0xFF;
+    p.b = rgb & 0xFF;
+    p.a = alpha;
+    return p;
 }
 
 
@@ -534,53 +520,179 @@ static void blend_colorkey(DrawConfig *cfg,
 }
 
 
-/* Draw line functions */
+/* Line decoding functions: guest framebuffer line to intermediate format.
+   Pixel conversion is expanded inline for every mode so the inner loop
+   does not go through function pointers. */
 
-#define DEF_DRAW_LINE(N) \
-static void glue(draw_line, N)(DrawConfig *cfg, uint8_t *src, \
-                               uint8_t *dst, uint8_t *ifb) \
+#define DEF_DECODE_LINE(N, NAME, PIXEL) \
+static void glue(decode_line_, NAME)(const DrawConfig *cfg, \
+                                     const uint8_t *src, \
+                                     uint32_t *rgb, uint32_t *alpha) \
 { \
-    rgba p, p_old; \
     uint64_t data; \
+    uint32_t pixel; \
     int width = cfg->width; \
-    int i; \
+    int i, n; \
     do { \
         data = ldq_raw((void *)src); \
         src += 8; \
         data = swap_data(cfg, data); \
-        for (i = 0; i < (64 / (N)); i++) { \
-            cfg->pixel_to_rgb(cfg->is_palletized ? \
-                                  cfg->palette[data & ((1ULL << (N)) - 1)] : \
-                                  data & ((1ULL << (N)) - 1), &p); \
-            if (cfg->blend) { \
-                ifb += cfg->get_pixel(ifb, &p_old); \
-                cfg->blend(cfg, p_old, p, &p); \
-            } \
-            dst += cfg->put_pixel(p, dst); \
+        n = MIN(64 / (N), width); \
+        for (i = 0; i < n; i++) { \
+            pixel = data & ((1ULL << (N)) - 1); \
+            PIXEL; \
             data >>= (N); \
         } \
-        width -= (64 / (N)); \
+        width -= n; \
     } while (width > 0); \
 }
 
-DEF_DRAW_LINE(1)
-DEF_DRAW_LINE(2)
-DEF_DRAW_LINE(4)
-DEF_DRAW_LINE(8)
-DEF_DRAW_LINE(16)
-DEF_DRAW_LINE(32)
-
-static void draw_line_copy(DrawConfig *cfg, uint8_t *src, uint8_t *dst,
-                           uint8_t *ifb)
+#define DEF_DECODE_LINE_PAL(N) \
+    DEF_DECODE_LINE(N, glue(pal, N), \
+                    *rgb++ = cfg->pal_rgb[pixel]; \
+                    *alpha++ = cfg->pal_alpha[pixel])
+
+#define DEF_DECODE_LINE_RGB(N, F) \
+    DEF_DECODE_LINE(N, F, { \
+                        rgba p; \
+                        glue(glue(pixel_, F), _to_rgb)(pixel, &p); \
+                        *rgb++ = rgba_to_packed(p); \
+                        *alpha++ = p.a; \
+                    })
+
+DEF_DECODE_LINE_PAL(1)
+DEF_DECODE_LINE_PAL(2)
+DEF_DECODE_LINE_PAL(4)
+DEF_DECODE_LINE_PAL(8)
+DEF_DECODE_LINE_RGB(8,  a232)
+DEF_DECODE_LINE_RGB(16, 565)
+DEF_DECODE_LINE_RGB(16, a555)
+DEF_DECODE_LINE_RGB(16, 1555)
+DEF_DECODE_LINE_RGB(16, a444)
+DEF_DECODE_LINE_RGB(16, 4444)
+DEF_DECODE_LINE_RGB(16, 555)
+DEF_DECODE_LINE_RGB(32, 666)
+DEF_DECODE_LINE_RGB(32, a665)
+DEF_DECODE_LINE_RGB(32, a666)
+DEF_DECODE_LINE_RGB(32, 888)
+DEF_DECODE_LINE_RGB(32, a887)
+DEF_DECODE_LINE_RGB(32, a888)
+DEF_DECODE_LINE_RGB(32, 8888)
+
+
+/* Line blending functions: blend decoded line FG_* over RGB/ALPHA in place */
+
+/* Any blending mode, per-pixel coefficient evaluation */
+static void blend_line_generic(DrawConfig *cfg,
+                               uint32_t *rgb, uint32_t *alpha,
+                               const uint32_t *fg_rgb, const uint32_t *fg_alpha)
 {
     rgba p;
-    int width = cfg->width;
+    int i;
+
+    for (i = 0; i < cfg->width; i++) {
+        blend_colorkey(cfg, packed_to_rgba(rgb[i], alpha[i]),
+                       packed_to_rgba(fg_rgb[i], fg_alpha[i]), &p);
+        rgb[i] = rgba_to_packed(p);
+        alpha[i] = p.a;
+    }
+}
+
+/* Colour key selection without key blending */
+static void blend_line_colorkey(DrawConfig *cfg,
+                                uint32_t *rgb, uint32_t *alpha,
+                                const uint32_t *fg_rgb, const uint32_t *fg_alpha)
+{
+    uint32_t mask = ~cfg->color_mask & 0xFFFFFF;
+    uint32_t key = cfg->color_key & mask;
+    int i;
+
+    if (cfg->color_ctl & 1) {
+        for (i = 0; i < cfg->width; i++) {
+            if ((fg_rgb[i] & mask) != key) {
+                rgb[i] = fg_rgb[i];
+                alpha[i] = fg_alpha[i];
+            }
+        }
+    } else {
+        for (i = 0; i < cfg->width; i++) {
+            if ((rgb[i] & mask) == key) {
+                rgb[i] = fg_rgb[i];
+                alpha[i] = fg_alpha[i];
+            }
+        }
+    }
+}
+
+static inline uint32_t blend_channels(uint32_t x, uint32_t cx,
+                                      uint32_t y, uint32_t cy)
+{
+    uint32_t res = 0, v;
+    int sh;
+
+    for (sh = 0; sh < 24; sh += 8) {
+        v = (((x >> sh) & 0xFF) * ((cx >> sh) & 0xFF) +
+             ((y >> sh) & 0xFF) * ((cy >> sh) & 0xFF)) / 0xFF;
+        res |= MIN(v, 0xFF) << sh;
+    }
+    return res;
+}
+
+/* Alpha blending with coefficients that are constant over the window
+   (see blend_alpha for the reference per-pixel version) */
+static void blend_line_alpha_const(DrawConfig *cfg,
+                                   uint32_t *rgb, uint32_t *alpha,
+                                   const uint32_t *fg_rgb,
+                                   const uint32_t *fg_alpha)
+{
+    uint32_t fga = cfg->fg_alpha[cfg->fg_alpha_sel];
+    int i;
 
-    do {
-        src += cfg->get_pixel(src, &p);
-        dst += cfg->put_pixel(p, dst);
-        width--;
-    } while (width > 0);
+    for (i = 0; i < cfg->width; i++) {
+        /* Only zero and one coefficients are constant with per-pixel
+           blending, the alpha that is blended still comes per pixel */
+        if (cfg->fg_pixel_blending) {
+            fga = cfg->fg_alpha_pix ? fg_alpha[i] : cfg->fg_alpha[fg_alpha[i]];
+        }
+        rgb[i] = blend_channels(rgb[i], cfg->const_b, fg_rgb[i], cfg->const_a);
+        alpha[i] = blend_channels(alpha[i], cfg->const_p, fga, cfg->const_q);
+    }
+}
+
+
+/* Write intermediate framebuffer line to QEMU's GraphicConsole framebuffer */
+
+#define DEF_COPY_LINE(N, TYPE) \
+static void glue(copy_line, N)(uint8_t *d, const uint32_t *rgb, int width) \
+{ \
+    TYPE *dst = (TYPE *)d; \
+    int i; \
+    for (i = 0; i < width; i++) { \
+        dst[i] = glue(rgb_to_pixel, N)((rgb[i] >> 16) & 0xFF, \
+                                       (rgb[i] >> 8) & 0xFF, \
+                                       rgb[i] & 0xFF); \
+    } \
+}
+
+DEF_COPY_LINE(8,  uint8_t)
+DEF_COPY_LINE(15, uint16_t)
+DEF_COPY_LINE(16, uint16_t)
+
+static void copy_line24(uint8_t *d, const uint32_t *rgb, int width)
+{
+    int i;
+
+    for (i = 0; i < width; i++) {
+        *d++ = rgb[i] & 0xFF;
+        *d++ = (rgb[i] >> 8) & 0xFF;
+        *d++ = (rgb[i] >> 16) & 0xFF;
+    }
+}
+
+/* Intermediate format is the same as 32-bit console pixel format */
+static void copy_line32(uint8_t *d, const uint32_t *rgb, int width)
+{
+    memcpy(d, rgb, width * sizeof(uint32_t));
 }
 
 
@@ -611,6 +723,28 @@ static void s5pc1xx_lcd_update_irq(S5pc1xxLcdState *s)
     }
 }
 
+static uint32_t s5pc1xx_lcd_read(void *opaque, target_phys_addr_t offset);
+
+/* Registers which define what windows are shown and how */
+static int s5pc1xx_lcd_layout_reg(target_phys_addr_t offset)
+{
+    switch (offset) {
+    case 0x018:
+    case 0x020 ... 0x030:
+    case 0x040 ... 0x088:
+    case 0x0A0 ... 0x0C0:
+    case 0x100 ... 0x110:
+    case 0x140 ... 0x15C:
+    case 0x19C ... 0x1A0:
+    case 0x200 ... 0x224:
+    case 0x244 ... 0x250:
+    case 0x2400 ... 0x37FC:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
 static void s5pc1xx_lcd_write(void *opaque, target_phys_addr_t offset,
                               uint32_t val)
 {
@@ -621,6 +755,13 @@ static void s5pc1xx_lcd_write(void *opaque, target_phys_addr_t offset,
         hw_error("s5pc1xx_lcd: bad write offset " TARGET_FMT_plx "\n", offset);
     }
 
+    /* Damage tracking only follows framebuffer memory, so a layout change
+       has to redraw the whole screen */
+    if (s5pc1xx_lcd_layout_reg(offset) &&
+        s5pc1xx_lcd_read(opaque, offset) != val) {
+        s->invalidate = 1;
+    }
+
     switch (offset) {
         case 0x000 ... 0x008:
             s->vidcon[(offset - 0x000) >> 2] = val;
@@ -858,6 +999,32 @@ static CPUWriteMemoryFunc *s5pc1xx_lcd_writefn[] = {
     s5pc1xx_lcd_write
 };
 
+static void s5pc1xx_lcd_free_buffers(S5pc1xxLcdState *s)
+{
+    if (s->ifb != NULL) {
+        qemu_vfree(s->ifb);
+    }
+    s->ifb = NULL;
+    if (s->ifb_alpha != NULL) {
+        qemu_vfree(s->ifb_alpha);
+    }
+    s->ifb_alpha = NULL;
+    if (s->line_rgb != NULL) {
+        qemu_vfree(s->line_rgb);
+    }
+    s->line_rgb = NULL;
+    if (s->line_alpha != NULL) {
+        qemu_vfree(s->line_alpha);
+    }
+    s->line_alpha = NULL;
+    qemu_free(s->damage);
+    s->damage = NULL;
+    qemu_free(s->damage_prev);
+    s->damage_prev = NULL;
+    qemu_free(s->redraw);
+    s->redraw = NULL;
+}
+
 static void s5pc1xx_update_resolution(S5pc1xxLcdState *s)
 {
     uint32_t width, height;
@@ -868,12 +1035,18 @@ static void s5pc1xx_update_resolution(S5pc1xxLcdState *s)
         ds_get_height(s->console) != height) {
 
         qemu_console_resize(s->console, width, height);
-        s->ifb = qemu_realloc(s->ifb, width * height * 7);
-        s->valid_line =
-            qemu_realloc(s->valid_line, (height >> 3) * sizeof(uint8_t));
-        s->valid_line_prev =
-            qemu_realloc(s->valid_line_prev, (height >> 3) * sizeof(uint8_t));
-        memset(s->ifb, 0, width * height * 7);
+        s5pc1xx_lcd_free_buffers(s);
+        s->ifb = qemu_memalign(IFB_ALIGN, width * height * sizeof(uint32_t));
+        s->ifb_alpha =
+            qemu_memalign(IFB_ALIGN, width * height * sizeof(uint32_t));
+        s->line_rgb = qemu_memalign(IFB_ALIGN, width * sizeof(uint32_t));
+        s->line_alpha = qemu_memalign(IFB_ALIGN, width * sizeof(uint32_t));
+        s->damage = qemu_mallocz(height * sizeof(S5pc1xxLcdSpan));
+        s->damage_prev = qemu_mallocz(height * sizeof(S5pc1xxLcdSpan));
+        s->redraw = qemu_mallocz(height * sizeof(S5pc1xxLcdSpan));
+        memset(s->ifb, 0, width * height * sizeof(uint32_t));
+        memset(s->ifb_alpha, 0, width * height * sizeof(uint32_t));
+        s->ifb_stale = 0;
         s->invalidate = 1;
     }
 }
@@ -904,107 +1077,95 @@ static void s5pc1xx_parse_win_bppmode(S5pc1xxLcdState *s,
 {
     switch ((s->window[window].wincon >> 2) & 0xF) {
     case 0:
-        cfg->draw_line = draw_line1;
+        cfg->decode_line = decode_line_pal1;
         cfg->is_palletized = 1;
         cfg->bpp = 1;
         break;
     case 1:
-        cfg->draw_line = draw_line2;
+        cfg->decode_line = decode_line_pal2;
         cfg->is_palletized = 1;
         cfg->bpp = 2;
         break;
     case 2:
-        cfg->draw_line = draw_line4;
+        cfg->decode_line = decode_line_pal4;
         cfg->is_palletized = 1;
         cfg->bpp = 4;
         break;
     case 3:
-        cfg->draw_line = draw_line8;
+        cfg->decode_line = decode_line_pal8;
         cfg->is_palletized = 1;
         cfg->bpp = 8;
         break;
     case 4:
-        cfg->draw_line = draw_line8;
+        cfg->decode_line = decode_line_a232;
         cfg->is_palletized = 0;
-        cfg->pixel_to_rgb = pixel_a232_to_rgb;
         cfg->bpp = 8;
         break;
     case 5:
-        cfg->draw_line = draw_line16;
+        cfg->decode_line = decode_line_565;
         cfg->is_palletized = 0;
-        cfg->pixel_to_rgb = pixel_565_to_rgb;
         cfg->bpp = 16;
         break;
     case 6:
-        cfg->draw_line = draw_line16;
+        cfg->decode_line = decode_line_a555;
         cfg->is_palletized = 0;
-        cfg->pixel_to_rgb = pixel_a555_to_rgb;
         cfg->bpp = 16;
         break;
     case 7:
-        cfg->draw_line = draw_line16;
+        cfg->decode_line = decode_line_1555;
         cfg->is_palletized = 0;
-        cfg->pixel_to_rgb = pixel_1555_to_rgb;
         cfg->bpp = 16;
         break;
     case 8:
-        cfg->draw_line = draw_line32;
+        cfg->decode_line = decode_line_666;
         cfg->is_palletized = 0;
-        cfg->pixel_to_rgb = pixel_666_to_rgb;
         cfg->bpp = 32;
         break;
     case 9:
-        cfg->draw_line = draw_line32;
+        cfg->decode_line = decode_line_a665;
         cfg->is_palletized = 0;
-        cfg->pixel_to_rgb = pixel_a665_to_rgb;
         cfg->bpp = 32;
         break;
     case 10:
-        cfg->draw_line = draw_line32;
+        cfg->decode_line = decode_line_a666;
         cfg->is_palletized = 0;
-        cfg->pixel_to_rgb = pixel_a666_to_rgb;
         cfg->bpp = 32;
         break;
     case 11:
-        cfg->draw_line = draw_line32;
+        cfg->decode_line = decode_line_888;
         cfg->is_palletized = 0;
-        cfg->pixel_to_rgb = pixel_888_to_rgb;
         cfg->bpp = 32;
         break;
     case 12:
-        cfg->draw_line = draw_line32;
+        cfg->decode_line = decode_line_a887;
         cfg->is_palletized = 0;
-        cfg->pixel_to_rgb = pixel_a887_to_rgb;
         cfg->bpp = 32;
         break;
     case 13:
-        cfg->draw_line = draw_line32;
         cfg->is_palletized = 0;
         if ((s->window[window].wincon & (1 << 6)) &&
             (s->window[window].wincon & 2)) {
-            cfg->pixel_to_rgb = pixel_8888_to_rgb;
+            cfg->decode_line = decode_line_8888;
             cfg->fg_alpha_pix = 1;
         } else {
-            cfg->pixel_to_rgb = pixel_a888_to_rgb;
+            cfg->decode_line = decode_line_a888;
         }
         cfg->bpp = 32;
         break;
     case 14:
-        cfg->draw_line = draw_line16;
         cfg->is_palletized = 0;
         if ((s->window[window].wincon & (1 << 6)) &&
             (s->window[window].wincon & 2)) {
-            cfg->pixel_to_rgb = pixel_4444_to_rgb;
+            cfg->decode_line = decode_line_4444;
             cfg->fg_alpha_pix = 1;
         } else {
-            cfg->pixel_to_rgb = pixel_a444_to_rgb;
+            cfg->decode_line = decode_line_a444;
         }
         cfg->bpp = 16;
         break;
     case 15:
-        cfg->draw_line = draw_line16;
+        cfg->decode_line = decode_line_555;
         cfg->is_palletized = 0;
-        cfg->pixel_to_rgb = pixel_555_to_rgb;
         cfg->bpp = 16;
         break;
     }
@@ -1054,46 +1215,375 @@ static coef_func *coef_decode(uint32_t x)
     }
 }
 
-static inline void putpixel_by_bpp(DrawConfig *cfg, int bpp)
+static inline int coef_is_const(const DrawConfig *cfg, coef_func *coef)
+{
+    return coef == coef_zero || coef == coef_one ||
+        (!cfg->fg_pixel_blending &&
+         (coef == coef_alphaa || coef == coef_one_minus_alphaa));
+}
+
+/* Select line blending function for a window drawn over the lower ones */
+static blend_line_func *s5pc1xx_choose_blend(DrawConfig *cfg)
+{
+    rgba dummy;
+
+    if (!(cfg->color_ctl & 6)) {
+        return blend_line_colorkey;
+    }
+    if ((cfg->color_ctl & 2) &&
+        coef_is_const(cfg, cfg->coef_p) && coef_is_const(cfg, cfg->coef_q) &&
+        coef_is_const(cfg, cfg->coef_a) && coef_is_const(cfg, cfg->coef_b)) {
+        memset(&dummy, 0, sizeof(dummy));
+        cfg->const_p = cfg->coef_p(cfg, dummy, dummy);
+        cfg->const_q = cfg->coef_q(cfg, dummy, dummy);
+        cfg->const_a = cfg->coef_a(cfg, dummy, dummy);
+        cfg->const_b = cfg->coef_b(cfg, dummy, dummy);
+        return blend_line_alpha_const;
+    }
+    return blend_line_generic;
+}
+
+static inline void (*copy_line_by_bpp(int bpp))(uint8_t *, const uint32_t *,
+                                                int)
 {
     switch (bpp) {
     case 8:
-        cfg->put_pixel = put_pixel8;
-        break;
+        return copy_line8;
     case 15:
-        cfg->put_pixel = put_pixel15;
-        break;
+        return copy_line15;
     case 16:
-        cfg->put_pixel = put_pixel16;
-        break;
+        return copy_line16;
     case 24:
-        cfg->put_pixel = put_pixel24;
-        break;
+        return copy_line24;
     case 32:
-        cfg->put_pixel = put_pixel32;
-        break;
+        return copy_line32;
     default:
         hw_error("s5pc1xx_lcd: unsupported BPP (%d)", bpp);
     }
 }
 
+/* Window is drawn directly into console surface if it is the only one,
+   covers the whole screen and the surface has the intermediate format */
+static int s5pc1xx_lcd_direct(S5pc1xxLcdState *s,
+                              int global_width, int global_height)
+{
+    int i, n = 0, win = 0;
+
+    for (i = 0; i < 5; i++) {
+        if (s->window[i].wincon & 1) {
+            win = i;
+            n++;
+        }
+    }
+    return n == 1 && ds_get_bits_per_pixel(s->console) == 32 &&
+        (s->window[win].vidosd[0] & 0x3FFFFF) == 0 &&
+        ((s->window[win].vidosd[1] >> 11) & 0x7FF) + 1 >= global_width &&
+        (s->window[win].vidosd[1] & 0x7FF) + 1 >= global_height;
+}
+
+/* Screen-space geometry of an enabled window */
+typedef struct {
+    int x, y;               /* left top corner */
+    int width, height;      /* clipped by the screen borders */
+    int bpp;
+    target_phys_addr_t base;
+    target_phys_addr_t stride;
+    target_phys_addr_t line_size;
+} S5pc1xxLcdWinGeom;
+
+static const uint8_t bppmode_to_bpp[16] = {
+    1, 2, 4, 8, 8, 16, 16, 16, 32, 32, 32, 32, 32, 32, 16, 16
+};
+
+/* Returns 0 if window WIN is disabled or lies off the screen */
+static int s5pc1xx_lcd_win_geom(S5pc1xxLcdState *s, int win,
+                                int global_width, int global_height,
+                                S5pc1xxLcdWinGeom *g)
+{
+    S5pc1xxLcdWindow *w = &s->window[win];
+    int buf_id = 0;
+
+    if (!(w->wincon & 1)) {
+        return 0;
+    }
+    g->x = (w->vidosd[0] >> 11) & 0x7FF;
+    g->y = (w->vidosd[0] >>  0) & 0x7FF;
+    if (g->x >= global_width || g->y >= global_height) {
+        return 0;
+    }
+    g->width = MIN(((w->vidosd[1] >> 11) & 0x7FF) + 1, global_width) - g->x;
+    g->height = MIN((w->vidosd[1] & 0x7FF) + 1, global_height) - g->y;
+    if (g->width <= 0 || g->height <= 0) {
+        return 0;
+    }
+    if (win <= 1) {
+        buf_id = (w->wincon >> 20) & 1;
+    }
+    /* According to documentation framebuffer is always located in
+       single bank of DRAM. Bits [31:24] of BUF_START encode bank
+       number, and [23:0] - address of the buffer in bank. We will
+       assume that DRAM Controller uses linear memory mapping so
+       BUF_START will be just address of the framebuffer. In the
+       other case framebuffer will be dispersed all over the system
+       memory so it is unclear how such system will work.
+
+       Moreover, we will ignore absence of carry bit bitween bits 23
+       and 24 while incrementing address in the hope that no
+       programmer will use such hack. */
+    g->base = w->buf_start[buf_id];
+    g->line_size = w->buf_size & 0x1FFF;
+    g->stride = g->line_size + ((w->buf_size >> 13) & 0x1FFF);
+    g->bpp = bppmode_to_bpp[(w->wincon >> 2) & 0xF];
+    return 1;
+}
+
+/* Window hides everything below it if its colour and alpha do not depend
+   on the background: alpha blending with zero background coefficients
+   and foreground coefficients taken from the window itself. */
+static int s5pc1xx_lcd_win_opaque(S5pc1xxLcdState *s, int win)
+{
+    uint32_t blendeq = s->window[win].blendeq;
+    uint32_t a = blendeq & 0xF, b = (blendeq >> 6) & 0xF;
+    uint32_t p = (blendeq >> 12) & 0xF, q = (blendeq >> 18) & 0xF;
+
+    if (!(s->window[win].keycon[0] & (2 << 24))) {
+        return 0;
+    }
+    return b == 0 && p == 0 &&
+        a != 4 && a != 5 && a != 12 && a != 13 &&
+        q != 4 && q != 5 && q != 12 && q != 13;
+}
+
+static inline void damage_add(S5pc1xxLcdSpan *d, int x0, int x1)
+{
+    if (x0 >= x1) {
+        return;
+    }
+    if (d->x0 >= d->x1) {
+        d->x0 = x0;
+        d->x1 = x1;
+    } else {
+        d->x0 = MIN(d->x0, x0);
+        d->x1 = MAX(d->x1, x1);
+    }
+}
+
+/* Add damaged span [X0, X1) of window WIN on screen line LINE, leaving out
+   the parts covered by opaque windows above it */
+static void s5pc1xx_lcd_add_win_damage(S5pc1xxLcdState *s, int win,
+                                       S5pc1xxLcdWinGeom *geom,
+                                       int line, int x0, int x1)
+{
+    int j;
+
+    for (j = win + 1; j < 5 && x0 < x1; j++) {
+        if (!geom[j].width || !s5pc1xx_lcd_win_opaque(s, j) ||
+            line < geom[j].y || line >= geom[j].y + geom[j].height) {
+            continue;
+        }
+        if (x0 >= geom[j].x && x0 < geom[j].x + geom[j].width) {
+            x0 = geom[j].x + geom[j].width;
+        }
+        if (x1 > geom[j].x && x1 <= geom[j].x + geom[j].width) {
+            x1 = geom[j].x;
+        }
+    }
+    damage_add(&s->damage[line], x0, x1);
+}
+
+/* Collect damaged spans of window WIN from the dirty bitmap of guest
+   memory, one target page at a time */
+static void s5pc1xx_lcd_win_damage(S5pc1xxLcdState *s, int win,
+                                   S5pc1xxLcdWinGeom *geom)
+{
+    S5pc1xxLcdWinGeom *g = &geom[win];
+    target_phys_addr_t scanline, page, end, pd, b0, b1;
+    int line, x0, x1;
+
+    scanline = g->base;
+    cpu_physical_sync_dirty_bitmap(scanline, scanline + g->height * g->stride);
+    for (line = 0; line < g->height; line++) {
+        end = scanline + g->line_size;
+        for (page = scanline & TARGET_PAGE_MASK; page < end;
+             page += TARGET_PAGE_SIZE) {
+            pd = cpu_get_physical_page_desc(page) & TARGET_PAGE_MASK;
+            if (!cpu_physical_memory_get_dirty(pd, VGA_DIRTY_FLAG)) {
+                continue;
+            }
+            b0 = MAX(page, scanline) - scanline;
+            b1 = MIN(page + TARGET_PAGE_SIZE, end) - scanline;
+            x0 = (b0 << 3) / g->bpp;
+            x1 = MIN(((b1 << 3) + g->bpp - 1) / g->bpp, g->width);
+            s5pc1xx_lcd_add_win_damage(s, win, geom, g->y + line,
+                                       g->x + x0, g->x + x1);
+        }
+        scanline += g->stride;
+    }
+    pd = (cpu_get_physical_page_desc(g->base) & TARGET_PAGE_MASK) +
+         (g->base & ~TARGET_PAGE_MASK);
+    cpu_physical_memory_reset_dirty(pd, pd + g->stride * g->height,
+                                    VGA_DIRTY_FLAG);
+}
+
+/* Set up CFG for drawing window WIN */
+static void s5pc1xx_lcd_win_config(S5pc1xxLcdState *s, DrawConfig *cfg,
+                                   int win, int is_first_window)
+{
+    S5pc1xxLcdWindow *w = &s->window[win];
+    uint32_t tmp;
+    rgba p;
+    int x;
+
+    cfg->fg_alpha_pix = 0;
+    s5pc1xx_parse_win_bppmode(s, cfg, win);
+    /* If we have mode with palletized color then we need to parse
+       palette color mode and set pixel-to-rgb conversion function
+       accordingly. */
+    if (cfg->is_palletized) {
+        tmp = s5pc1xx_wxpal(s, win);
+        /* Different windows have different mapping WxPAL to palette
+           pixel format. This transform happens to unify them all. */
+        if (win < 2 && tmp < 7) {
+            tmp = 6 - tmp;
+        }
+        cfg->pixel_to_rgb = wxpal_to_rgb[tmp];
+        if (tmp == 7) {
+            cfg->fg_alpha_pix = 1;
+        }
+        /* Convert the palette once instead of every pixel */
+        for (x = 0; x < (1 << cfg->bpp); x++) {
+            cfg->pixel_to_rgb(w->palette[x], &p);
+            cfg->pal_rgb[x] = rgba_to_packed(p);
+            cfg->pal_alpha[x] = p.a;
+        }
+    }
+    cfg->bg_alpha_pix = 1;
+    cfg->color_mask = w->keycon[0] & 0xFFFFFF;
+    cfg->color_key = w->keycon[1];
+    cfg->color_ctl = (w->keycon[0] >> 24) & 7;
+    if (win == 0) {
+        cfg->fg_alpha[0] = w->vidw_alpha[0];
+        cfg->fg_alpha[1] = w->vidw_alpha[1];
+    } else {
+        cfg->fg_alpha[0] =
+            unpack_by_4((w->vidosd[3] & 0xFFF000) >> 12) |
+            (w->vidw_alpha[0] & 0xF0F0F);
+        cfg->fg_alpha[1] =
+            unpack_by_4(w->vidosd[3] & 0xFFF) |
+            (w->vidw_alpha[0] & 0xF0F0F);
+    }
+    cfg->bg_pixel_blending = 1;
+    cfg->fg_pixel_blending = w->wincon & (1 << 6);
+    cfg->fg_alpha_sel = (w->wincon >> 1) & 1;
+    cfg->palette = w->palette;
+    cfg->swap = (w->wincon >> 15) & 0xF;
+    cfg->coef_q = coef_decode((w->blendeq >> 18) & 0xF);
+    cfg->coef_p = coef_decode((w->blendeq >> 12) & 0xF);
+    cfg->coef_b = coef_decode((w->blendeq >>  6) & 0xF);
+    cfg->coef_a = coef_decode((w->blendeq >>  0) & 0xF);
+    if (is_first_window) {
+        cfg->blend_line = NULL;
+    } else {
+        cfg->blend_line = s5pc1xx_choose_blend(cfg);
+    }
+}
+
+/* Draw pixels [X0, X1) of a window line starting at SRC into RGB/ALPHA.
+   Decoding starts at a 64-bit word boundary of the source line. */
+static void s5pc1xx_lcd_draw_span(S5pc1xxLcdState *s, DrawConfig *cfg,
+                                  const uint8_t *src, int x0, int x1,
+                                  uint32_t *rgb, uint32_t *alpha)
+{
+    int ax0 = x0 - x0 % (64 / cfg->bpp);
+
+    src += (ax0 * cfg->bpp) >> 3;
+    if (!cfg->blend_line && ax0 == x0) {
+        cfg->width = x1 - x0;
+        cfg->decode_line(cfg, src, rgb, alpha);
+        return;
+    }
+    cfg->width = x1 - ax0;
+    cfg->decode_line(cfg, src, s->line_rgb, s->line_alpha);
+    cfg->width = x1 - x0;
+    if (cfg->blend_line) {
+        cfg->blend_line(cfg, rgb, alpha,
+                        s->line_rgb + x0 - ax0, s->line_alpha + x0 - ax0);
+    } else {
+        memcpy(rgb, s->line_rgb + x0 - ax0, cfg->width * sizeof(uint32_t));
+        memcpy(alpha, s->line_alpha + x0 - ax0, cfg->width * sizeof(uint32_t));
+    }
+}
+
+/* Report redrawn spans to the console as a few rectangles: vertically
+   adjacent overlapping spans are merged, and if there are too many
+   rectangles their bounding box is reported instead. */
+static void s5pc1xx_lcd_flush_damage(S5pc1xxLcdState *s, int global_height)
+{
+    struct {
+        int x0, x1, y0, y1;
+    } r[MAX_DAMAGE_RECTS + 1];
+    S5pc1xxLcdSpan *d;
+    int n = 0, line, i;
+
+    for (line = 0; line < global_height; line++) {
+        d = &s->redraw[line];
+        if (d->x0 >= d->x1) {
+            continue;
+        }
+        if (n && r[n - 1].y1 == line &&
+            d->x0 <= r[n - 1].x1 && d->x1 >= r[n - 1].x0) {
+            r[n - 1].x0 = MIN(r[n - 1].x0, d->x0);
+            r[n - 1].x1 = MAX(r[n - 1].x1, d->x1);
+            r[n - 1].y1 = line + 1;
+            continue;
+        }
+        if (n == MAX_DAMAGE_RECTS) {
+            for (i = 1; i < n; i++) {
+                r[0].x0 = MIN(r[0].x0, r[i].x0);
+                r[0].x1 = MAX(r[0].x1, r[i].x1);
+            }
+            r[0].x0 = MIN(r[0].x0, d->x0);
+            r[0].x1 = MAX(r[0].x1, d->x1);
+            r[0].y1 = line + 1;
+            n = 1;
+            /* Everything below goes into the bounding box too */
+            for (line++; line < global_height; line++) {
+                d = &s->redraw[line];
+                if (d->x0 < d->x1) {
+                    r[0].x0 = MIN(r[0].x0, d->x0);
+                    r[0].x1 = MAX(r[0].x1, d->x1);
+                    r[0].y1 = line + 1;
+                }
+            }
+            break;
+        }
+        r[n].x0 = d->x0;
+        r[n].x1 = d->x1;
+        r[n].y0 = line;
+        r[n].y1 = line + 1;
+        n++;
+    }
+    for (i = 0; i < n; i++) {
+        dpy_update(s->console, r[i].x0, r[i].y0,
+                   r[i].x1 - r[i].x0, r[i].y1 - r[i].y0);
+    }
+}
+
 static void s5pc1xx_lcd_update(void *opaque)
 {
     S5pc1xxLcdState *s = (S5pc1xxLcdState *)opaque;
     DrawConfig cfg;
-    int i, dirty[2], x;
-    int line;
-    target_phys_addr_t scanline, newline, map_len, pd, inc_size;
-    uint8_t *mapline, *startline, *valid_line_tmp;
-    int lefttop_x, lefttop_y, rightbottom_x, rightbottom_y;
-    int ext_line_size;
-    int width, height;
-    uint32_t tmp;
-    int buf_id;
-    int need_redraw;
+    S5pc1xxLcdWinGeom geom[5], *g;
+    S5pc1xxLcdSpan *span, *tmp;
+    target_phys_addr_t map_len;
+    uint8_t *mapline, *startline;
+    int i, line, x0, x1;
     int global_width, global_height;
-    int bpp;
+    int direct, bypp;
     uint8_t *d;
+    int linesize;
+    uint32_t *rgb, *alpha;
+    void (*copy_line)(uint8_t *, const uint32_t *, int);
     uint8_t is_first_window;
 
     if (!s || !s->console || !ds_get_bits_per_pixel(s->console)) {
@@ -1107,184 +1597,104 @@ static void s5pc1xx_lcd_update(void *opaque)
     memset(&cfg, 0, sizeof(cfg));
 
     s5pc1xx_update_resolution(s);
-
-    /* First we will mark lines of the display which need to be redrawn */
-    memset(s->valid_line, 0xFF,
-           ((((s->vidtcon[2] >> 11) & 0x7FF) + 1 + 7) >> 3) * sizeof(uint8_t));
+    global_width = (s->vidtcon[2] & 0x7FF) + 1;
+    global_height = ((s->vidtcon[2] >> 11) & 0x7FF) + 1;
+    d = ds_get_data(s->console);
+    linesize = ds_get_linesize(s->console);
+    bypp = ds_get_bytes_per_pixel(s->console);
+
+    /* First we will find out which parts of every window were changed by
+       the guest, ignoring those hidden by opaque windows above */
+    memset(s->damage, 0, global_height * sizeof(S5pc1xxLcdSpan));
     for (i = 0; i < 5; i++) {
-        if (s->window[i].wincon & 1) {
-            lefttop_x = (s->window[i].vidosd[0] >> 11) & 0x7FF;
-            lefttop_y = (s->window[i].vidosd[0] >>  0) & 0x7FF;
-            rightbottom_x = (s->window[i].vidosd[1] >> 11) & 0x7FF;
-            rightbottom_y = (s->window[i].vidosd[1] >>  0) & 0x7FF;
-            height = rightbottom_y - lefttop_y + 1;
-            width = rightbottom_x - lefttop_x + 1;
-            ext_line_size = s->window[i].buf_size & 0x1FFF;
-            buf_id = 0;
-            if (i <= 1) {
-                buf_id = (s->window[i].wincon >> 20) & 1;
-            }
-            /* According to documentation framebuffer is always located in
-               single bank of DRAM. Bits [31:24] of BUF_START encode bank
-               number, and [23:0] - address of the buffer in bank. We will
-               assume that DRAM Controller uses linear memory mapping so
-               BUF_START will be just address of the framebuffer. In the
-               other case framebuffer will be dispersed all over the system
-               memory so it is unclear how such system will work.
-
-               Moreover, we will ignore absence of carry bit bitween bits 23
-               and 24 while incrementing address in the hope that no
-               programmer will use such hack. */
-            scanline = s->window[i].buf_start[buf_id];
-            inc_size = (s->window[i].buf_size & 0x1FFF) +
-                       ((s->window[i].buf_size >> 13) & 0x1FFF);
-            cpu_physical_sync_dirty_bitmap(scanline,
-                                           scanline + height * inc_size);
-            pd = (cpu_get_physical_page_desc(scanline) & TARGET_PAGE_MASK) +
-                 (scanline & ~TARGET_PAGE_MASK);
-            dirty[0] = dirty[1] =
-                cpu_physical_memory_get_dirty(scanline, VGA_DIRTY_FLAG);
-            cpu_physical_memory_reset_dirty(scanline, scanline, VGA_DIRTY_FLAG);
-            for (line = 0; line < height; line++) {
-                newline = scanline + ext_line_size;
-                for (x = scanline;
-                     x < newline;
-                     x += TARGET_PAGE_SIZE) {
-                    pd = (cpu_get_physical_page_desc(x) & TARGET_PAGE_MASK) +
-                         (x & ~TARGET_PAGE_MASK);
-                    dirty[1] = cpu_physical_memory_get_dirty(pd, VGA_DIRTY_FLAG);
-                    dirty[0] |= dirty[1];
-                }
-                if (dirty[0]) {
-                    tmp = line + lefttop_y;
-                    s->valid_line[tmp >> 3] &= ~(1 << (tmp & 0x7));
-                }
-                dirty[0] = dirty[1] = 0;
-                scanline += (s->window[i].buf_size & 0x1FFF) +
-                    ((s->window[i].buf_size >> 13) & 0x1FFF);
-            }
-            scanline = s->window[i].buf_start[buf_id];
-            pd = (cpu_get_physical_page_desc(scanline) & TARGET_PAGE_MASK) +
-                 (scanline & ~TARGET_PAGE_MASK);
-            cpu_physical_memory_reset_dirty(pd, pd + inc_size * height,
-                                            VGA_DIRTY_FLAG);
+        if (!s5pc1xx_lcd_win_geom(s, i, global_width, global_height,
+                                  &geom[i])) {
+            geom[i].width = 0;
+        }
+    }
+    for (i = 0; i < 5; i++) {
+        if (geom[i].width) {
+            s5pc1xx_lcd_win_damage(s, i, geom);
+        }
+    }
+
+    /* Intermediate framebuffer is not updated while drawing directly
+       to the console, so compose everything again once we stop doing it */
+    direct = s5pc1xx_lcd_direct(s, global_width, global_height);
+    if (direct) {
+        s->ifb_stale = 1;
+    } else if (s->ifb_stale) {
+        s->ifb_stale = 0;
+        s->invalidate = 1;
+    }
+
+    /* Redraw the spans damaged in this or the previous frame */
+    for (line = 0; line < global_height; line++) {
+        span = &s->redraw[line];
+        if (s->invalidate) {
+            span->x0 = 0;
+            span->x1 = global_width;
+        } else {
+            *span = s->damage[line];
+            damage_add(span, s->damage_prev[line].x0,
+                       s->damage_prev[line].x1);
         }
     }
 
-    need_redraw = 0;
     is_first_window = 1;
     for (i = 0; i < 5; i++) {
-        if (s->window[i].wincon & 1) {
-            cfg.fg_alpha_pix = 0;
-            s5pc1xx_parse_win_bppmode(s, &cfg, i);
-            /* If we have mode with palletized color then we need to parse
-               palette color mode and set pixel-to-rgb conversion function
-               accordingly. */
-            if (cfg.is_palletized) {
-                tmp = s5pc1xx_wxpal(s, i);
-                /* Different windows have different mapping WxPAL to palette
-                   pixel format. This transform happens to unify them all. */
-                if (i < 2 && tmp < 7) {
-                    tmp = 6 - tmp;
-                }
-                cfg.pixel_to_rgb = wxpal_to_rgb[tmp];
-                if (tmp == 7) {
-                    cfg.fg_alpha_pix = 1;
-                }
-            }
-            cfg.put_pixel = put_rgba;
-            cfg.get_pixel = get_rgba;
-            cfg.bg_alpha_pix = 1;
-            cfg.color_mask = s->window[i].keycon[0] & 0xFFFFFF;
-            cfg.color_key = s->window[i].keycon[1];
-            cfg.color_ctl = (s->window[i].keycon[0] >> 24) & 7;
-            if (i == 0) {
-                cfg.fg_alpha[0] = s->window[i].vidw_alpha[0];
-                cfg.fg_alpha[1] = s->window[i].vidw_alpha[1];
-            } else {
-                cfg.fg_alpha[0] =
-                    unpack_by_4((s->window[i].vidosd[3] & 0xFFF000) >> 12) |
-                    (s->window[i].vidw_alpha[0] & 0xF0F0F);
-                cfg.fg_alpha[1] =
-                    unpack_by_4(s->window[i].vidosd[3] & 0xFFF) |
-                    (s->window[i].vidw_alpha[0] & 0xF0F0F);
-            }
-            cfg.bg_pixel_blending = 1;
-            cfg.fg_pixel_blending = s->window[i].wincon & (1 << 6);
-            cfg.fg_alpha_sel = (s->window[i].wincon >> 1) & 1;
-            cfg.palette = s->window[i].palette;
-            cfg.swap = (s->window[i].wincon >> 15) & 0xF;
-            cfg.coef_q = coef_decode((s->window[i].blendeq >> 18) & 0xF);
-            cfg.coef_p = coef_decode((s->window[i].blendeq >> 12) & 0xF);
-            cfg.coef_b = coef_decode((s->window[i].blendeq >>  6) & 0xF);
-            cfg.coef_a = coef_decode((s->window[i].blendeq >>  0) & 0xF);
-            if (is_first_window) {
-                cfg.blend = NULL;
-            } else {
-                cfg.blend = blend_colorkey;
-            }
-            is_first_window = 0;
-            /* At this point CFG is fully set up except WIDTH. We can proceed
-               with drawing. */
-            lefttop_x = (s->window[i].vidosd[0] >> 11) & 0x7FF;
-            lefttop_y = (s->window[i].vidosd[0] >>  0) & 0x7FF;
-            rightbottom_x = (s->window[i].vidosd[1] >> 11) & 0x7FF;
-            rightbottom_y = (s->window[i].vidosd[1] >>  0) & 0x7FF;
-            height = rightbottom_y - lefttop_y + 1;
-            width = rightbottom_x - lefttop_x + 1;
-            cfg.width = width;
-            ext_line_size = (width * cfg.bpp) >> 3;
-            buf_id = 0;
-            if (i <= 1) {
-                buf_id = (s->window[i].wincon >> 20) & 1;
-            }
-            scanline = s->window[i].buf_start[buf_id];
-            global_width = (s->vidtcon[2] & 0x7FF) + 1;
-            global_height = ((s->vidtcon[2] >> 11) & 0x7FF) + 1;
-            /* See comment above about DRAM Controller memory mapping. */
-            map_len = ((s->window[i].buf_size & 0x1FFF) +
-                    ((s->window[i].buf_size >> 13) & 0x1FFF)) * height;
-            mapline = cpu_physical_memory_map(scanline, &map_len, 0);
-            if (!mapline) {
-                return;
-            }
-            startline = mapline;
-            for (line = 0; line < height; line++) {
-                tmp = line + lefttop_y;
-                if (s->invalidate ||
-                    !(s->valid_line[tmp >> 3] & (1 << (tmp & 7))) ||
-                    !(s->valid_line_prev[tmp >> 3] & (1 << (tmp & 7)))) {
-                    need_redraw = 1;
-                    cfg.draw_line(&cfg, mapline,
-                                  s->ifb + lefttop_x * 7 +
-                                      (lefttop_y + line) * global_width * 7,
-                                  s->ifb + lefttop_x * 7 +
-                                      (lefttop_y + line) * global_width * 7);
+        g = &geom[i];
+        if (!g->width) {
+            continue;
+        }
+        s5pc1xx_lcd_win_config(s, &cfg, i, is_first_window);
+        is_first_window = 0;
+        /* See comment in s5pc1xx_lcd_win_geom about DRAM Controller
+           memory mapping. */
+        map_len = g->stride * g->height;
+        mapline = cpu_physical_memory_map(g->base, &map_len, 0);
+        if (!mapline) {
+            return;
+        }
+        startline = mapline;
+        for (line = g->y; line < g->y + g->height; line++) {
+            span = &s->redraw[line];
+            x0 = MAX(span->x0, g->x);
+            x1 = MIN(span->x1, g->x + g->width);
+            if (x0 < x1) {
+                /* IFB alpha is not used in direct mode but still
+                   serves as a sink for decoded alpha values */
+                alpha = s->ifb_alpha + line * global_width + x0;
+                if (direct) {
+                    rgb = (uint32_t *)(d + line * linesize) + x0;
+                } else {
+                    rgb = s->ifb + line * global_width + x0;
                 }
-                mapline += (s->window[i].buf_size & 0x1FFF) +
-                    ((s->window[i].buf_size >> 13) & 0x1FFF);
+                s5pc1xx_lcd_draw_span(s, &cfg, mapline,
+                                      x0 - g->x, x1 - g->x, rgb, alpha);
             }
-            cpu_physical_memory_unmap(startline, map_len, 0, 0);
+            mapline += g->stride;
         }
+        cpu_physical_memory_unmap(startline, map_len, 0, 0);
     }
+
     /* Last pass: copy resulting image to QEMU_CONSOLE. */
-    if (need_redraw) {
-        width = (s->vidtcon[2] & 0x7FF) + 1;
-        height = ((s->vidtcon[2] >> 11) & 0x7FF) + 1;
-        cfg.get_pixel = get_rgba;
-        bpp = ds_get_bits_per_pixel(s->console);
-        putpixel_by_bpp(&cfg, bpp);
-        bpp = (bpp + 1) >> 3;
-        d = ds_get_data(s->console);
-        for (line = 0; line < height; line++) {
-            draw_line_copy(&cfg, s->ifb + width * line * 7,
-                           d + width * line * bpp, NULL);
+    if (!direct) {
+        copy_line = copy_line_by_bpp(ds_get_bits_per_pixel(s->console));
+        for (line = 0; line < global_height; line++) {
+            span = &s->redraw[line];
+            if (span->x0 < span->x1) {
+                copy_line(d + line * linesize + span->x0 * bypp,
+                          s->ifb + line * global_width + span->x0,
+                          span->x1 - span->x0);
+            }
         }
-        dpy_update(s->console, 0, 0, width, height);
     }
-    valid_line_tmp = s->valid_line;
-    s->valid_line = s->valid_line_prev;
-    s->valid_line_prev = valid_line_tmp;
+    s5pc1xx_lcd_flush_damage(s, global_height);
+
+    tmp = s->damage;
+    s->damage = s->damage_prev;
+    s->damage_prev = tmp;
     s->invalidate = 0;
     s->vidintcon[1] |= 2;
     s5pc1xx_lcd_update_irq(s);
@@ -1311,18 +1721,8 @@ static void s5pc1xx_lcd_reset(S5pc1xxLcdState *s)
     for (i = 0; i < 5; i++) {
         s5pc1xx_window_reset(&s->window[i]);
     }
-    if (s->ifb != NULL) {
-        qemu_free(s->ifb);
-    }
-    s->ifb = NULL;
-    if (s->valid_line != NULL) {
-        qemu_free(s->valid_line);
-    }
-    s->valid_line = NULL;
-    if (s->valid_line_prev != NULL) {
-        qemu_free(s->valid_line_prev);
-    }
-    s->valid_line_prev = NULL;
+    s5pc1xx_lcd_free_buffers(s);
+    s->ifb_stale = 0;
 }
 
 static int s5pc1xx_lcd_init(SysBusDevice *dev)
@@ -1331,8 +1731,12 @@ static int s5pc1xx_lcd_init(SysBusDevice *dev)
     S5pc1xxLcdState *s = FROM_SYSBUS(S5pc1xxLcdState, dev);
 
     s->ifb = NULL;
-    s->valid_line = NULL;
-    s->valid_line_prev = NULL;
+    s->ifb_alpha = NULL;
+    s->line_rgb = NULL;
+    s->line_alpha = NULL;
+    s->damage = NULL;
+    s->damage_prev = NULL;
+    s->redraw = NULL;
     s5pc1xx_lcd_reset(s);
 
     sysbus_init_irq(dev, &s->irq[0]);
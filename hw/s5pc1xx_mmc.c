@@ -14,6 +14,7 @@
 #include "s5pc1xx_hsmmc_regs.h"
 #include "block_int.h"
 #include "sysbus.h"
+#include "dma.h"
 
 #include "qemu-timer.h"
 
@@ -65,6 +66,15 @@ typedef struct S5pc1xxMMCState {
     QEMUTimer *insert_timer; /* timer for 'changing' sd card. */
 
     qemu_irq eject;
+
+    /* Asynchronous SDMA transfer in flight.  */
+    BlockDriverState *bs;
+    BlockDriverAIOCB *aiocb;
+    QEMUSGList sg;
+    uint32_t dma_len;
+    uint32_t dma_nblk;
+    int dma_is_read;
+    int cmdcmp_deferred;    /* CMDCMP held back until the transfer ends */
 } S5pc1xxMMCState;
 
 
@@ -77,27 +87,176 @@ static void mmc_dmaInt(S5pc1xxMMCState *s)
     qemu_set_irq(s->irq, 1);
 }
 
-static void mmc_fifo_push(S5pc1xxMMCState *s, uint32_t pos, uint32_t value)
+/* Move LEN bytes between the card and guest memory at ADDR.  The range
+   is mapped in as few pieces as possible so that whole blocks go to the
+   card in one call; a bounce buffer is used when mapping fails.  */
+static void mmc_dma_copy(S5pc1xxMMCState *s, target_phys_addr_t addr,
+                         uint32_t len, int is_read)
 {
-    cpu_physical_memory_write(s->sysad + pos, (uint8_t *)(&value), 4);
+    target_phys_addr_t plen;
+    uint8_t bounce[512];
+    uint8_t *buf;
+
+    if (!s->card)
+        return;
+
+    while (len) {
+        plen = len;
+        buf = cpu_physical_memory_map(addr, &plen, is_read);
+        if (buf) {
+            if (is_read)
+                sd_read_block(s->card, buf, plen);
+            else
+                sd_write_block(s->card, buf, plen);
+            cpu_physical_memory_unmap(buf, plen, is_read, plen);
+        } else {
+            plen = MIN(len, sizeof(bounce));
+            if (is_read) {
+                sd_read_block(s->card, bounce, plen);
+                cpu_physical_memory_write(addr, bounce, plen);
+            } else {
+                cpu_physical_memory_read(addr, bounce, plen);
+                sd_write_block(s->card, bounce, plen);
+            }
+        }
+        addr += plen;
+        len -= plen;
+    }
 }
 
-static uint32_t mmc_fifo_pop(S5pc1xxMMCState *s, uint32_t pos)
+static void mmc_dma_finish(S5pc1xxMMCState *s)
 {
-    uint32_t value = 0;
-
-    cpu_physical_memory_read(s->sysad + pos, (uint8_t *)(&value), 4);
-    return value;
+    s->sysad += s->dma_len;
+    s->blkcnt -= s->dma_nblk;
+    s->prnsts &= ~S5C_HSMMC_DATA_INHIBIT;
 }
 
 static void s5pc1xx_mmc_raise_end_command_irq(void *opaque)
 {
     S5pc1xxMMCState *s = (S5pc1xxMMCState *)opaque;
+
+    /* As with a transfer done at once, the command completes after
+       its data.  */
+    if (s->aiocb) {
+        s->cmdcmp_deferred = 1;
+        return;
+    }
     DPRINTF("raise IRQ response\n");
     qemu_irq_raise(s->irq);
     s->norintsts |= S5C_HSMMC_NIS_CMDCMP;
 }
 
+static void mmc_dma_done(void *opaque, int ret)
+{
+    S5pc1xxMMCState *s = (S5pc1xxMMCState *)opaque;
+
+    s->aiocb = NULL;
+    if (ret < 0) {
+        DPRINTF("%s error on host side\n", s->dma_is_read ? "read" : "write");
+        qemu_sglist_destroy(&s->sg);
+        s->prnsts &= ~S5C_HSMMC_DATA_INHIBIT;
+        s->errintsts |= S5C_HSMMC_EIS_DATAERR;
+        s->norintsts |= S5C_HSMMC_NIS_ERR;
+        qemu_set_irq(s->irq, 1);
+    } else {
+        /* Whatever the card could not hand out as whole blocks.  */
+        if (s->sg.size < s->dma_len)
+            mmc_dma_copy(s, s->sysad + s->sg.size, s->dma_len - s->sg.size,
+                         s->dma_is_read);
+        qemu_sglist_destroy(&s->sg);
+
+        mmc_dma_finish(s);
+        s->dma_transcpt = (s->blkcnt == 0);
+        mmc_dmaInt(s);
+    }
+
+    if (s->cmdcmp_deferred) {
+        s->cmdcmp_deferred = 0;
+        s5pc1xx_mmc_raise_end_command_irq(s);
+    }
+}
+
+/* Hand the whole-block part of the transfer to the block layer.  The
+   scatter-gather list follows the SDMA buffer boundaries.  Returns 0
+   if the card cannot serve the transfer in bulk.  */
+static int mmc_dma_submit(S5pc1xxMMCState *s, uint32_t boundary_chk)
+{
+    target_phys_addr_t addr = s->sysad;
+    uint32_t seg, len;
+    int64_t sector;
+
+    if (!s->card || !s->bs)
+        return 0;
+    len = sd_claim_blocks(s->card, !s->dma_is_read, s->dma_len, &sector);
+    if (!len)
+        return 0;
+
+    qemu_sglist_init(&s->sg, len / boundary_chk + 2);
+    while (len) {
+        seg = MIN(len, boundary_chk - (addr % boundary_chk));
+        qemu_sglist_add(&s->sg, addr, seg);
+        addr += seg;
+        len -= seg;
+    }
+
+    s->prnsts |= S5C_HSMMC_DATA_INHIBIT;
+    if (s->dma_is_read)
+        s->aiocb = dma_bdrv_read(s->bs, &s->sg, sector, mmc_dma_done, s);
+    else
+        s->aiocb = dma_bdrv_write(s->bs, &s->sg, sector, mmc_dma_done, s);
+    return 1;
+}
+
+/* Wait for an earlier transfer so that commands reach the card in
+   order.  */
+static void mmc_dma_wait(S5pc1xxMMCState *s)
+{
+    while (s->aiocb)
+        qemu_aio_wait();
+}
+
+static void mmc_dma_cancel(S5pc1xxMMCState *s)
+{
+    if (s->aiocb) {
+        bdrv_aio_cancel(s->aiocb);
+        s->aiocb = NULL;
+        qemu_sglist_destroy(&s->sg);
+        s->prnsts &= ~S5C_HSMMC_DATA_INHIBIT;
+    }
+    s->cmdcmp_deferred = 0;
+}
+
+/* Run SDMA from SYSAD up to the next buffer boundary (or to the end of
+   the transfer if the DMA interrupt is masked).  Returns 1 if the
+   transfer went to the block layer, in which case mmc_dma_done()
+   raises the interrupt later; otherwise the data has already been
+   moved.  */
+static int mmc_dma_run(S5pc1xxMMCState *s)
+{
+    uint32_t bsize = s->blksize & 0x0fff;
+    uint32_t boundary_chk, boundary_count;
+    uint32_t nblk = s->blkcnt;
+
+    boundary_chk = 1 << (((s->blksize & 0xf000) >> 12) + 12);
+    boundary_count = boundary_chk - (s->sysad % boundary_chk);
+
+    /* The transfer only stops at a boundary that falls exactly on a
+       block edge.  */
+    if ((s->norintstsen & 0x8) && bsize && !(boundary_count % bsize) &&
+        boundary_count / bsize < nblk)
+        nblk = boundary_count / bsize;
+
+    s->dma_len = nblk * bsize;
+    s->dma_nblk = nblk;
+    s->dma_is_read = (s->trnmod & S5C_HSMMC_TRNS_READ) != 0;
+    if (mmc_dma_submit(s, boundary_chk))
+        return 1;
+
+    mmc_dma_copy(s, s->sysad, s->dma_len, s->dma_is_read);
+    mmc_dma_finish(s);
+    return 0;
+}
+
 static void mmc_send_command(S5pc1xxMMCState *s)
 {
     SDRequest request;
@@ -146,97 +305,26 @@ error:
     s->errintsts |= S5C_HSMMC_EIS_CMDTIMEOUT;
 }
 
-/* Transfer data between the card and the FIFO.  This is complicated by
-   the FIFO holding 32-bit words and the card taking data in single byte
-   chunks.  FIFO bytes are transferred in little-endian order.  */
+/* Transfer data between the card and guest memory for a command that
+   was just issued.  */
 static void mmc_fifo_run(S5pc1xxMMCState *s)
 {
-    uint32_t value;
-    int n;
-    uint32_t pos;
     int is_read;
-    uint32_t datacnt, boundary_chk, boundary_count;
-    uint8_t dma_buf_boundary, dma_mask_flag;
 
     is_read = (s->trnmod & S5C_HSMMC_TRNS_READ) != 0;
 
     if (s->blkcnt != 0 && (!is_read || sd_data_ready(s->card))) {
-        n = 0;
-        value = 0;
-
         if (s->blkcnt > 1) {
             /* multi block */
-            if (s->norintstsen & 0x8)
-                dma_mask_flag = 1;  /* DMA enable */
-            else
-                dma_mask_flag = 0;  /* DMA disable */
-
-            dma_buf_boundary = (s->blksize & 0xf000) >> 12;
-            boundary_chk = 1 << (dma_buf_boundary+12);
-            boundary_count = boundary_chk - (s->sysad % boundary_chk);
-            while (s->blkcnt) {
-                datacnt = s->blksize & 0x0fff;
-                pos = 0;
-                while (datacnt) {
-                    if (is_read) {
-                        value |= (uint32_t)sd_read_data(s->card) << (n * 8);
-                        n++;
-                        if (n == 4) {
-                            mmc_fifo_push(s, pos, value);
-                            value = 0;
-                            n = 0;
-                            pos += 4;
-                        }
-                    } else {
-                        if (n == 0) {
-                            value = mmc_fifo_pop(s, pos);
-                            n = 4;
-                            pos += 4;
-                        }
-                        sd_write_data(s->card, value & 0xff);
-                        value >>= 8;
-                        n--;
-                    }
-                    datacnt--;
-                }
-                s->sysad += s->blksize & 0x0fff;
-                boundary_count -= s->blksize & 0x0fff;
-                s->blkcnt--;
-
-                if ((boundary_count == 0) && dma_mask_flag)
-                    break;
-            }
+            if (mmc_dma_run(s))
+                return;
             if (s->blkcnt == 0)
                 s->norintsts |= S5C_HSMMC_NIS_TRSCMP;
             else
                 s->norintsts |= S5C_HSMMC_NIS_DMA;
         } else {
             /* single block */
-            datacnt = s->blksize & 0x0fff;
-            pos = 0;
-            while (datacnt) {
-                if (is_read) {
-                    value |=
-                        (uint32_t)sd_read_data(s->card) << (n * 8);
-                    n++;
-                    if (n == 4) {
-                        mmc_fifo_push(s, pos, value);
-                        value = 0;
-                        n = 0;
-                        pos += 4;
-                    }
-                } else {
-                    if (n == 0) {
-                        value = mmc_fifo_pop(s, pos);
-                        n = 4;
-                        pos += 4;
-                    }
-                sd_write_data(s->card, value & 0xff);
-                    value >>= 8;
-                    n--;
-                }
-                datacnt--;
-            }
+            mmc_dma_copy(s, s->sysad, s->blksize & 0x0fff, is_read);
             s->blkcnt--;
             s->norintsts |= S5C_HSMMC_NIS_TRSCMP;
         }
@@ -384,6 +472,7 @@ static void mmc_writew(void *opaque, target_phys_addr_t offset, uint32_t value)
         break;
     case S5C_HSMMC_CMDREG: /* Command */
         s->cmdreg = value;
+        mmc_dma_wait(s);
         mmc_send_command(s);
         mmc_fifo_run(s);
         if (s->errintsts)
@@ -393,6 +482,8 @@ static void mmc_writew(void *opaque, target_phys_addr_t offset, uint32_t value)
             s->norintsts &= ~S5C_HSMMC_NIS_CMDCMP;
         if (s->norintsts & S5C_HSMMC_NIS_DMA)
             s->norintsts &= ~S5C_HSMMC_NIS_CMDCMP;
+        if (s->aiocb)
+            s->norintsts &= ~S5C_HSMMC_NIS_CMDCMP;
         break;
     case S5C_HSMMC_CLKCON:
         s->clkcon = value;
@@ -425,68 +516,14 @@ static void mmc_writew(void *opaque, target_phys_addr_t offset, uint32_t value)
 static void mmc_writel(void *opaque, target_phys_addr_t offset, uint32_t value)
 {
     S5pc1xxMMCState *s = (S5pc1xxMMCState *)opaque;
-    int datacnt;
-    int is_read;
-    int value1, n;
-    uint32_t pos;
-    uint32_t boundary_chk, boundary_count;
-    uint32_t dma_buf_boundary;
-    uint8_t dma_mask_flag;
 
     switch (offset) {
     case S5C_HSMMC_SYSAD:
+        mmc_dma_wait(s);
         s->sysad = value;
-        if (s->blkcnt != 0) {
-            n = 0;
-            value1 = 0;
-            is_read = (s->trnmod & S5C_HSMMC_TRNS_READ) != 0;
-            dma_buf_boundary = (s->blksize & 0xf000) >> 12;
-            boundary_chk = 1 << (dma_buf_boundary + 12);
-
-            if (s->norintstsen & 0x8)
-                dma_mask_flag = 1; /* DMA enable */
-            else
-                dma_mask_flag = 0; /* DMA disable */
-
-            boundary_count = boundary_chk - (s->sysad % boundary_chk);
-            while (s->blkcnt) {
-                pos = 0;
-                datacnt = s->blksize & 0x0fff;
-                while (datacnt) {
-                    if (is_read) {
-                        value1 |= (uint32_t)sd_read_data(s->card) << (n * 8);
-                        n++;
-                        if (n == 4) {
-                            mmc_fifo_push(s, pos, value1);
-                            value1 = 0;
-                            n = 0;
-                            pos += 4;
-                        }
-                    } else {
-                        if (n == 0) {
-                            value1 = mmc_fifo_pop(s, pos);
-                            n = 4;
-                            pos += 4;
-                        }
-                        sd_write_data(s->card, value1 & 0xff);
-                        value1 >>= 8;
-                        n--;
-                    }
-                    datacnt--;
-                }
-                s->sysad += s->blksize & 0x0fff;
-                boundary_count -= s->blksize & 0x0fff;
-                s->blkcnt--;
-                if ((boundary_count == 0) && dma_mask_flag)
-                    break;
-            }
-            if (s->blkcnt == 0) {
-                s->dma_transcpt = 1;
-                mmc_dmaInt(s);
-            } else {
-                s->dma_transcpt = 0;
-                mmc_dmaInt(s);
-            }
+        if (s->blkcnt != 0 && !mmc_dma_run(s)) {
+            s->dma_transcpt = (s->blkcnt == 0);
+            mmc_dmaInt(s);
         }
         break;
     case S5C_HSMMC_ARGUMENT:
@@ -541,6 +578,7 @@ static void mmc_reset(void *opaque)
 {
     S5pc1xxMMCState *s = (S5pc1xxMMCState *)opaque;
 
+    mmc_dma_cancel(s);
     if (s->card) {
         s->prnsts = 0x1ff0000;
         s->norintsts |= 0x0040;
@@ -610,6 +648,7 @@ static int s5pc1xx_mmc_init(SysBusDevice *dev)
         DPRINTF("name = %s, sectors = %ld\n",
                 bd->device_name, bd->total_sectors);
 
+        s->bs = bd;
         s->card = sd_init(bd, 0);
         sd_set_cb(s->card, NULL, s->eject);
     }
@@ -622,6 +661,8 @@ static int s5pc1xx_mmc_init(SysBusDevice *dev)
 
     s->insert_timer =
         qemu_new_timer(vm_clock, s5pc1xx_mmc_raise_insertion_irq, s);
+    qemu_timer_set_name(s->response_timer, "s5pc1xx,mmc");
+    qemu_timer_set_name(s->insert_timer, "s5pc1xx,mmc");
 
     /* ??? Save/restore.  */
 
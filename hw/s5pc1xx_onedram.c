@@ -4,11 +4,14 @@
  * Contributed by Kefeng Li <li.kefeng@samsung.com>
  */
 
-#include "s5pc1xx_onedram.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
 
-#define TICK_COUNTDOWN  50
+#include "qemu-char.h"
+#include "s5pc1xx_onedram.h"
 
-uint32_t sem_retry = 50;
+/* Orders ring data against the HEAD/TAIL updates seen by the vmodem */
+#define ONEDRAM_RING_BARRIER()  __sync_synchronize()
 
 
 /* Command handler */
@@ -33,36 +36,28 @@ static int onedram_smp_req_handler(S5pc1xxOneDRAMState *s)
 }
 
 
-/* timer for waiting the semaphore for sem_retry times try */
-static void onedram_wait_semaphore(void *opaque)
+/* The semaphore was written: carry on with what was waiting for it */
+static void onedram_sem_update(S5pc1xxOneDRAMState *s)
 {
-    S5pc1xxOneDRAMState *s = (S5pc1xxOneDRAMState *)opaque;
-    int64_t timeout;
+    if (s->sem)
+        return;
 
-    if(sem_retry <= 0) {
-        fprintf(stderr, "time out to wait semaphore from AP\n");
-        qemu_del_timer(s->sem_timer);
-        sem_retry = 100;
-    } else if(onedram_read_sem(s)) {
-        sem_retry--;
-        timeout = get_ticks_per_sec();
-        qemu_mod_timer(s->sem_timer, qemu_get_clock(vm_clock) + TICK_COUNTDOWN);
-    } else {
-        sem_retry = 100;
-        qemu_del_timer(s->sem_timer);
+    if (s->send_pending) {
+        s->send_pending = 0;
         onedram_fmt_send_cmd(s);
     }
+    if (s->ring_rx && s->vmodem_connected)
+        onedram_ring_receive(s);
 }
 
-/* try to see if we have semaphore for sending, if not, request it from AP */
+/* try to see if we have semaphore for sending, if not, send as soon as
+ * the AP gives it back */
 static int onedram_fmt_try_send_cmd(S5pc1xxOneDRAMState *s)
 {
-    if(onedram_read_sem(s)) {
-        fprintf(stderr, "onedram_fmt_try_send_cmd - can't get anthority\n");
-        qemu_mod_timer(s->sem_timer, qemu_get_clock(vm_clock) + TICK_COUNTDOWN);
-    } else {
+    if (onedram_read_sem(s))
+        s->send_pending = 1;
+    else
         onedram_fmt_send_cmd(s);
-    }
     return 1;
 }
 
@@ -70,7 +65,7 @@ static int onedram_fmt_try_send_cmd(S5pc1xxOneDRAMState *s)
 static int onedram_fmt_send_cmd(S5pc1xxOneDRAMState *s)
 {
     int psrc = -1;
-    uint32_t len;
+    uint32_t len, n;
     int ret = 0;
 
     onedram_disable_interrupt(s);
@@ -87,8 +82,16 @@ static int onedram_fmt_send_cmd(S5pc1xxOneDRAMState *s)
             ret = 0;
             break;
         }
-        if (!onedram_insert_socket(s, psrc, len))
-            break;
+        n = onedram_insert_socket(s, psrc, len);
+        if (n < len) {
+            /* The rest stays in the FMT buffer: with the ring it is sent
+             * once the vmodem has made room, otherwise right away */
+            onedram_write_outtail(s, psrc - s->fmt_info->out_buff_addr + n);
+            if (s->ring_tx) {
+                s->ring_tx_full = 1;
+                break;
+            }
+        }
     } while (1);
 
     onedram_socket_push(s);
@@ -396,29 +399,61 @@ done_onedram_read_fmt:
     return psrc;
 }
 
-static int onedram_insert_socket(S5pc1xxOneDRAMState *s,
-                                 uint32_t psrc, uint16_t size)
+/* Copy up to SIZE bytes at PSRC of the shared memory straight into the
+ * AP->CP ring and return how many fit; SOCKET_LEN counts what is waiting
+ * for a doorbell */
+static uint32_t onedram_ring_insert(S5pc1xxOneDRAMState *s,
+                                    uint32_t psrc, uint32_t size)
 {
-    uint8_t *buf;
+    OneDRAMRing *r = s->ring_tx;
+    uint32_t head = r->head, off, n, room, ret;
+
+    ONEDRAM_RING_BARRIER();
+    room = ONEDRAM_RING_SIZE - (head - r->tail);
+    size = MIN(size, room);
+    ret = size;
+
+    s->socket_len += size;
+    while (size) {
+        off = head & (ONEDRAM_RING_SIZE - 1);
+        n = MIN(size, ONEDRAM_RING_SIZE - off);
+        onedram_read_shm(s, r->data + off, psrc, n);
+        psrc += n;
+        head += n;
+        size -= n;
+    }
 
-    if ((s->socket_len + size) >= SOCKET_BUFFER_MAX_SIZE) {
-        fprintf(stderr, "the socket buffer is overflow!\n");
+    ONEDRAM_RING_BARRIER();
+    r->head = head;
+    return ret;
+}
 
-        onedram_read_shm(s, (s->socket_buffer + s->socket_len), psrc,
-                         SOCKET_BUFFER_MAX_SIZE - s->socket_len);
-        s->socket_len = SOCKET_BUFFER_MAX_SIZE;
-        return 0;
-    } else {
-        buf = s->socket_buffer + s->socket_len;
-        onedram_read_shm(s, buf, psrc, size);
-        s->socket_len += size;
-        return 1;
-    }
+/* Queue up to SIZE bytes at PSRC for the vmodem, returns how many */
+static uint32_t onedram_insert_socket(S5pc1xxOneDRAMState *s,
+                                      uint32_t psrc, uint32_t size)
+{
+    if (s->ring_tx)
+        return onedram_ring_insert(s, psrc, size);
+
+    /* A full socket buffer is sent before taking more */
+    if (s->socket_len + size > SOCKET_BUFFER_MAX_SIZE)
+        onedram_socket_push(s);
+    size = MIN(size, SOCKET_BUFFER_MAX_SIZE);
+    onedram_read_shm(s, s->socket_buffer + s->socket_len, psrc, size);
+    s->socket_len += size;
+    return size;
 }
 
 void onedram_socket_push(S5pc1xxOneDRAMState *s)
 {
-    onedram_tcp_write(s, s->socket_buffer, s->socket_len);
+    uint8_t doorbell = 0;
+
+    if (s->ring_tx) {
+        if (s->socket_len)
+            onedram_chr_write(s, &doorbell, 1);
+    } else {
+        onedram_chr_write(s, s->socket_buffer, s->socket_len);
+    }
     s->socket_len = 0;
 }
 
@@ -795,6 +830,7 @@ static void onedram_io_writeb(void *opaque, target_phys_addr_t offset,
     switch (offset) {
     case 0x00:
         s->sem = val;
+        onedram_sem_update(s);
         break;
     case 0x20:
         (s->mbx_ab) = (val & 0x000000FF);
@@ -844,6 +880,7 @@ static void onedram_io_writel(void *opaque, target_phys_addr_t offset,
     switch (offset) {
     case 0x00:
         s->sem = val;
+        onedram_sem_update(s);
         break;
     case 0x20:
         s->mbx_ab = val;
@@ -886,13 +923,79 @@ static CPUWriteMemoryFunc * const onedram_mm_write[] = {
     onedram_io_writel
 };
 
-/* Socket for Vmodem operation*/
-static int onedram_tcp_can_read(void *opaque)
+/* Shared memory ring for Vmodem operation */
+/* Hand what the vmodem put into the CP->AP ring to the AP, as far as the
+ * FMT buffer and the semaphore allow; the rest waits in the ring */
+static void onedram_ring_receive(S5pc1xxOneDRAMState *s)
+{
+    OneDRAMRing *r = s->ring_rx;
+    uint32_t head, tail, off, len;
+    int ret;
+
+    while (onedram_writable(s) && onedram_can_access_shm(s)) {
+        head = r->head;
+        ONEDRAM_RING_BARRIER();
+        tail = r->tail;
+        if (head == tail)
+            break;
+
+        off = tail & (ONEDRAM_RING_SIZE - 1);
+        len = MIN(head - tail, ONEDRAM_RING_SIZE - off);
+        ret = onedram_write_fmt(s, r->data + off, len);
+        if (ret <= 0)
+            break;
+
+        ONEDRAM_RING_BARRIER();
+        r->tail = tail + ret;
+    }
+}
+
+static void onedram_ring_reset(OneDRAMRing *r)
+{
+    memset(r, 0, ONEDRAM_RING_HDR);
+    r->size = ONEDRAM_RING_SIZE;
+    ONEDRAM_RING_BARRIER();
+    r->magic = ONEDRAM_RING_MAGIC;
+}
+
+static void onedram_ring_init(S5pc1xxOneDRAMState *s)
+{
+    struct stat st;
+    void *p;
+    int fd, created = 1;
+
+    fd = shm_open(s->shm_path, O_RDWR | O_CREAT | O_EXCL, 0600);
+    if (fd < 0 && errno == EEXIST) {
+        fd = shm_open(s->shm_path, O_RDWR, 0600);
+        created = 0;
+    }
+    if (fd < 0 || fstat(fd, &st) < 0)
+        hw_error("onedram: could not open shared memory %s\n", s->shm_path);
+    if (st.st_size < (off_t) (2 * sizeof(OneDRAMRing)) &&
+        ftruncate(fd, 2 * sizeof(OneDRAMRing)) < 0)
+        hw_error("onedram: could not size shared memory %s\n", s->shm_path);
+    p = mmap(NULL, 2 * sizeof(OneDRAMRing), PROT_READ | PROT_WRITE,
+             MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        hw_error("onedram: could not map shared memory %s\n", s->shm_path);
+
+    /* A vmodem that attached first may already be using the rings */
+    s->ring_tx = p;
+    s->ring_rx = s->ring_tx + 1;
+    if (created || s->ring_tx->magic != ONEDRAM_RING_MAGIC)
+        onedram_ring_reset(s->ring_tx);
+    if (created || s->ring_rx->magic != ONEDRAM_RING_MAGIC)
+        onedram_ring_reset(s->ring_rx);
+}
+
+/* Character device for Vmodem operation */
+static int onedram_chr_can_read(void *opaque)
 {
     return MAX_BUFFER;
 }
 
-static void onedram_tcp_read(void *opaque, const uint8_t *buf,
+static void onedram_chr_read(void *opaque, const uint8_t *buf,
                              int size)
 {
     S5pc1xxOneDRAMState *s = (S5pc1xxOneDRAMState *)opaque;
@@ -903,7 +1006,7 @@ static void onedram_tcp_read(void *opaque, const uint8_t *buf,
     if (!s->vmodem_connected) {
         if (((uint32_t *)buf)[0] == IPC_CP_CONNECT_APP) {
             send_cmd = IPC_AP_CONNECT_ACK;
-            onedram_tcp_write(s, (uint8_t *)&send_cmd, CONNECT_LENGTH);
+            onedram_chr_write(s, (uint8_t *)&send_cmd, CONNECT_LENGTH);
             s->vmodem_connected = 1;
             /* put the anthority to AP,
              * because AP will try to load the modem image for CP */
@@ -916,6 +1019,14 @@ static void onedram_tcp_read(void *opaque, const uint8_t *buf,
             qemu_mod_timer(s->bootup_timer,
                            qemu_get_clock(vm_clock) + timeout/10);
         }
+    } else if (s->ring_rx) {
+        /* Doorbell: the data is in the ring, or there is room again in
+         * the other one */
+        onedram_ring_receive(s);
+        if (s->ring_tx_full) {
+            s->ring_tx_full = 0;
+            onedram_fmt_try_send_cmd(s);
+        }
     } else {
         /* The connection to Vmodem has been set up,
          * so now we only exchange IPC */
@@ -928,31 +1039,32 @@ static void onedram_tcp_read(void *opaque, const uint8_t *buf,
     }
 }
 
-void onedram_tcp_write(void *opaque, const uint8_t *buf, uint32_t size)
+void onedram_chr_write(void *opaque, const uint8_t *buf, uint32_t size)
 {
     S5pc1xxOneDRAMState *s = (S5pc1xxOneDRAMState *)opaque;
 
-    s->socket->chr_write(s->socket, buf, size);
+    qemu_chr_write(s->socket, buf, size);
 }
 
-static void onedram_tcp_event(void *opaque, int event)
+static void onedram_chr_event(void *opaque, int event)
 {
     /* not implemented yet */
 }
 
-static void onedram_tcp_init(void *opaque)
+static void onedram_chr_init(void *opaque)
 {
     S5pc1xxOneDRAMState *s = (S5pc1xxOneDRAMState *)opaque;
 
-    /* open a socket to communicate with vmodem */
-    const char *p = "tcp:localhost:7777,server,nowait";
-    s->socket= qemu_chr_open("onedram_socket", p, NULL);
+    /* open a socket to communicate with vmodem, unless one was given */
+    if (!s->socket)
+        s->socket = qemu_chr_open("onedram_socket", ONEDRAM_DEFAULT_CHR,
+                                  NULL);
 
     if (!s->socket)
         hw_error("onedram: could not open onedram socket\n");
 
-    qemu_chr_add_handlers(s->socket, onedram_tcp_can_read,
-                          onedram_tcp_read, onedram_tcp_event,
+    qemu_chr_add_handlers(s->socket, onedram_chr_can_read,
+                          onedram_chr_read, onedram_chr_event,
                           s);
 }
 
@@ -1010,10 +1122,12 @@ static int s5pc1xx_onedram_init1(SysBusDevice *dev, ModemPlatformData *mp)
     s->onedram_state.writable = 1;
 
     onedram_register_modem(s, mp);
-    onedram_tcp_init(s);
+    if (s->shm_path)
+        onedram_ring_init(s);
+    onedram_chr_init(s);
 
     s->bootup_timer = qemu_new_timer(vm_clock, onedram_bootup, s);
-    s->sem_timer = qemu_new_timer(vm_clock, onedram_wait_semaphore, s);
+    qemu_timer_set_name(s->bootup_timer, "s5pc1xx,onedram");
 
     return 0;
 }
@@ -1022,11 +1136,21 @@ static int s5pc1xx_onedram_aquila_xmm_init(SysBusDevice *dev)
 {
     return s5pc1xx_onedram_init1(dev, &aquila_xmm_modem_data);
 }
+
+static SysBusDeviceInfo s5pc1xx_onedram_aquila_xmm_info = {
+    .init = s5pc1xx_onedram_aquila_xmm_init,
+    .qdev.name = "s5pc1xx,onedram,aquila,xmm",
+    .qdev.size = sizeof(S5pc1xxOneDRAMState),
+    .qdev.props = (Property[]) {
+        DEFINE_PROP_CHR("chardev", S5pc1xxOneDRAMState, socket),
+        DEFINE_PROP_STRING("shm", S5pc1xxOneDRAMState, shm_path),
+        DEFINE_PROP_END_OF_LIST(),
+    }
+};
+
 static void s5pc1xx_onedram_register_devices(void)
 {
-    sysbus_register_dev("s5pc1xx,onedram,aquila,xmm",
-                        sizeof(S5pc1xxOneDRAMState),
-                        s5pc1xx_onedram_aquila_xmm_init);
+    sysbus_register_withprop(&s5pc1xx_onedram_aquila_xmm_info);
 }
 
 device_init(s5pc1xx_onedram_register_devices)
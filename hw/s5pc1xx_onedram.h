@@ -265,6 +265,34 @@ typedef struct ModemPlatformData {
 
 #define SOCKET_BUFFER_MAX_SIZE          SZ_1K
 
+/* Default vmodem connection when no "chardev" property is given */
+#define ONEDRAM_DEFAULT_CHR             "tcp:localhost:7777,server,nowait"
+
+/*
+ * Shared memory vmodem transport ("shm" property): a POSIX shared memory
+ * object holding two single-producer single-consumer byte rings, AP->CP
+ * first.  They carry the same byte stream as the chardev does otherwise.
+ * HEAD and TAIL are free running and only written by the producer and
+ * the consumer respectively.  Whichever side creates the object fills in
+ * both headers, MAGIC last; the other side leaves headers that carry the
+ * magic alone.  The chardev is still used for the connect handshake;
+ * after that every byte received on it is a doorbell, and one byte is
+ * sent after each batch written to the AP->CP ring.  A doorbell from the
+ * vmodem also tells that it has made room in the AP->CP ring.
+ */
+#define ONEDRAM_RING_SIZE               0x10000 /* power of two */
+#define ONEDRAM_RING_HDR                64
+#define ONEDRAM_RING_MAGIC              0x4f445247  /* "ODRG" */
+
+typedef struct OneDRAMRing {
+    uint32_t head;
+    uint32_t tail;
+    uint32_t size;
+    uint32_t magic;
+    uint8_t  reserved[ONEDRAM_RING_HDR - 16];
+    uint8_t  data[ONEDRAM_RING_SIZE];
+} OneDRAMRing;
+
 typedef struct OneDRAMState {
     uint16_t waiting_authority;
     uint16_t waiting_sem_rep;
@@ -296,7 +324,15 @@ typedef struct S5pc1xxOneDRAMState {
     uint32_t vmodem_connected;
     uint32_t vmodem_bootup;
     QEMUTimer *bootup_timer;
-    QEMUTimer *sem_timer;
+
+    /* FMT data to send once the AP releases the semaphore */
+    uint32_t send_pending;
+
+    char *shm_path;
+    OneDRAMRing *ring_tx;
+    OneDRAMRing *ring_rx;
+    /* FMT data left in OneDRAM until the vmodem drains the AP->CP ring */
+    uint32_t ring_tx_full;
 
     /* OneDRAM memory addresses */
     ModemInfo* fmt_info;
@@ -354,8 +390,8 @@ static int onedram_write_shm(S5pc1xxOneDRAMState *s,
                                 uint32_t *len);
 /*static*/ void onedram_read_fmt_wrapup(S5pc1xxOneDRAMState *s,
                                         const uint16_t non_cmd);
-static int onedram_insert_socket(S5pc1xxOneDRAMState *s,
-                                 uint32_t psrc, uint16_t size);
+static uint32_t onedram_insert_socket(S5pc1xxOneDRAMState *s,
+                                      uint32_t psrc, uint32_t size);
 void onedram_socket_push(S5pc1xxOneDRAMState *s);
 int onedram_write_fmt(S5pc1xxOneDRAMState *s, const uint8_t *buf,
                       uint32_t len);
@@ -387,11 +423,13 @@ static void onedram_io_writeb(void *opaque, target_phys_addr_t offset,
                               uint32_t val);
 static void onedram_io_writel(void *opaque, target_phys_addr_t offset,
                               uint32_t val);
-static int onedram_tcp_can_read(void *opaque);
-static void onedram_tcp_read(void *opaque, const uint8_t *buf,
+static void onedram_ring_receive(S5pc1xxOneDRAMState *s);
+static void onedram_ring_init(S5pc1xxOneDRAMState *s);
+static int onedram_chr_can_read(void *opaque);
+static void onedram_chr_read(void *opaque, const uint8_t *buf,
                              int size);
-void onedram_tcp_write(void *opaque, const uint8_t *buf, uint32_t size);
-static void onedram_tcp_event(void *opaque, int event);
-static void onedram_tcp_init(void *opaque);
+void onedram_chr_write(void *opaque, const uint8_t *buf, uint32_t size);
+static void onedram_chr_event(void *opaque, int event);
+static void onedram_chr_init(void *opaque);
 
 #endif
@@ -31,6 +31,7 @@
 typedef struct S5pc1xxOneNANDState {
     SysBusDevice busdev;
     target_phys_addr_t base;
+    void *onenand;
 
     /* OneNAND Interface Control register */
     uint32_t onenand_if_clrt;
@@ -147,7 +148,9 @@ static void s5pc1xx_onenand_write(void *opaque, target_phys_addr_t offset,
                                   uint32_t val)
 {
     S5pc1xxOneNANDState *s = (S5pc1xxOneNANDState *)opaque;
-    uint8_t *buf = NULL;
+    target_phys_addr_t src, dst, len, plen;
+    uint8_t buf[512];
+    void *p;
     /* for compatibility with documentation */
     int test_offset = offset + ONENAND_CONTR_REG_BASE;
 
@@ -180,10 +183,30 @@ static void s5pc1xx_onenand_write(void *opaque, target_phys_addr_t offset,
                      s->dma_trans_size);
         }
 
-        buf = qemu_malloc(s->dma_trans_size);
-        cpu_physical_memory_read (s->dma_src_addr, buf, s->dma_trans_size);
-        cpu_physical_memory_write(s->dma_dst_addr, buf, s->dma_trans_size);
-        qemu_free(buf);
+        /* The DataRAM is read or written below behind the back of the
+           OneNAND, so let the operation in progress finish first */
+        onenand_sync(s->onenand);
+
+        /* Copy straight into the mapped destination; fall back to a small
+           bounce buffer when it is not RAM */
+        src = s->dma_src_addr;
+        dst = s->dma_dst_addr;
+        len = s->dma_trans_size;
+        while (len) {
+            plen = len;
+            p = cpu_physical_memory_map(dst, &plen, 1);
+            if (p) {
+                cpu_physical_memory_read(src, p, plen);
+                cpu_physical_memory_unmap(p, plen, 1, plen);
+            } else {
+                plen = MIN(len, sizeof(buf));
+                cpu_physical_memory_read(src, buf, plen);
+                cpu_physical_memory_write(dst, buf, plen);
+            }
+            src += plen;
+            dst += plen;
+            len -= plen;
+        }
         break;
     case 0x0060041C: /*RO DMA Transfer Status Register*/
         break;
@@ -301,6 +324,7 @@ DeviceState *s5pc1xx_onenand_init(target_phys_addr_t base)
     onenand_dev =
         onenand_init(ONENAND_DEVICE_ID, 1, NULL, ONENAND_4KB_PAGE, 1);
     onenand_base_update(onenand_dev, base);
+    FROM_SYSBUS(S5pc1xxOneNANDState, s)->onenand = onenand_dev;
 
     return dev;
 }
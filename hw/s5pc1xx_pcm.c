@@ -114,7 +114,8 @@ typedef struct S5pc1xxPCMState {
         uint8_t delay;
     } tx;
 
-    QEMUTimer *pcm_timer;
+    S5pc1xxAudioClk *clk;
+    S5pc1xxClk pclk;
     uint16_t  sync_div;
     uint32_t  sync_freq;
     uint32_t  sclk_freq;
@@ -168,76 +169,62 @@ static void s5pc1xx_pcm_irq(S5pc1xxPCMState *s,
     }
 }
 
-/* Controls RXFIFO stage */
-static void s5pc1xx_pcm_rx_control(S5pc1xxPCMState *s)
+/* RXFIFO interrupt conditions at given depth */
+static uint32_t s5pc1xx_pcm_rx_stat(S5pc1xxPCMState *s, int rx_depth)
 {
-    uint8_t rx_depth;
-
-    rx_depth = (s->rx.write_idx - s->rx.read_idx) % 33;
+    uint32_t stat = 0;
+
+    if (rx_depth == 0)
+        stat |= RXFIFO_EMPTY;
+    if (rx_depth == 32)
+        stat |= RXFIFO_FULL;
+    if (rx_depth < s->rx.fifo_dipstick)
+        stat |= RXFIFO_ALMOST_EMPTY;
+    if (rx_depth > (32 - s->rx.fifo_dipstick))
+        stat |= RXFIFO_ALMOST_FULL;
+
+    return stat;
+}
 
-    if (rx_depth == 0) {
-        s5pc1xx_pcm_irq(s, RXFIFO_EMPTY, 0);
-        s->fifo_stat |= RXFIFO_EMPTY_FLAG;
-    } else {
-        s->fifo_stat &= ~(RXFIFO_EMPTY_FLAG);
-    }
+/* TXFIFO interrupt conditions at given depth */
+static uint32_t s5pc1xx_pcm_tx_stat(S5pc1xxPCMState *s, int tx_depth)
+{
+    uint32_t stat = 0;
+
+    if (tx_depth == 0)
+        stat |= TXFIFO_EMPTY;
+    if (tx_depth == 32)
+        stat |= TXFIFO_FULL;
+    if (tx_depth < s->tx.fifo_dipstick)
+        stat |= TXFIFO_ALMOST_EMPTY;
+    if (tx_depth > (32 - s->tx.fifo_dipstick))
+        stat |= TXFIFO_ALMOST_FULL;
+
+    return stat;
+}
 
-    if (rx_depth == 32) {
-        s5pc1xx_pcm_irq(s, RXFIFO_FULL, 0);
-        s->fifo_stat |= RXFIFO_FULL_FLAG;
-    } else {
-        s->fifo_stat &= ~(RXFIFO_FULL_FLAG);
-    }
+/* Controls RXFIFO stage */
+static void s5pc1xx_pcm_rx_control(S5pc1xxPCMState *s)
+{
+    uint32_t stat;
 
-    if (rx_depth < s->rx.fifo_dipstick) {
-        s5pc1xx_pcm_irq(s, RXFIFO_ALMOST_EMPTY, 0);
-        s->fifo_stat |= RXFIFO_ALMOST_EMPTY_FLAG;
-    } else {
-        s->fifo_stat &= ~(RXFIFO_ALMOST_EMPTY_FLAG);
-    }
+    stat = s5pc1xx_pcm_rx_stat(s, (s->rx.write_idx - s->rx.read_idx) % 33);
 
-    if (rx_depth > (32 - s->rx.fifo_dipstick)) {
-        s5pc1xx_pcm_irq(s, RXFIFO_ALMOST_FULL, 0);
-        s->fifo_stat |= RXFIFO_ALMOST_FULL_FLAG;
-    } else {
-        s->fifo_stat &= ~(RXFIFO_ALMOST_FULL_FLAG);
-    }
+    /* RXFIFO flags are the interrupt bits shifted down by two */
+    s->fifo_stat = (s->fifo_stat & ~ALL_BITS(3, 0)) | (stat >> 2);
+    s5pc1xx_pcm_irq(s, stat, 0);
 }
 
 /* Controls TXFIFO stage */
 static void s5pc1xx_pcm_tx_control(S5pc1xxPCMState *s)
 {
-    uint8_t tx_depth;
-
-    tx_depth = (s->tx.write_idx - s->tx.read_idx) % 33;
-
-    if (tx_depth ==  0) {
-        s5pc1xx_pcm_irq(s, TXFIFO_EMPTY, 0);
-        s->fifo_stat |= TXFIFO_EMPTY_FLAG;
-    } else {
-        s->fifo_stat &= ~(TXFIFO_EMPTY_FLAG);
-    }
-
-    if (tx_depth == 32) {
-        s5pc1xx_pcm_irq(s, TXFIFO_FULL, 0);
-        s->fifo_stat |= TXFIFO_FULL_FLAG;
-    } else {
-        s->fifo_stat &= ~(TXFIFO_FULL_FLAG);
-    }
+    uint32_t stat;
 
-    if (tx_depth < s->tx.fifo_dipstick) {
-        s5pc1xx_pcm_irq(s, TXFIFO_ALMOST_EMPTY, 0);
-        s->fifo_stat |= TXFIFO_ALMOST_EMPTY_FLAG;
-    } else {
-        s->fifo_stat &= ~(TXFIFO_ALMOST_EMPTY_FLAG);
-    }
+    stat = s5pc1xx_pcm_tx_stat(s, (s->tx.write_idx - s->tx.read_idx) % 33);
 
-    if (tx_depth > (32 - s->tx.fifo_dipstick)) {
-        s5pc1xx_pcm_irq(s, TXFIFO_ALMOST_FULL, 0);
-        s->fifo_stat |= TXFIFO_ALMOST_FULL_FLAG;
-    } else {
-        s->fifo_stat &= ~(TXFIFO_ALMOST_FULL_FLAG);
-    }
+    /* TXFIFO flags are the interrupt bits shifted up by two */
+    s->fifo_stat = (s->fifo_stat & ~ALL_BITS(13, 10)) | (stat << 2);
+    s5pc1xx_pcm_irq(s, stat, 0);
 }
 
 /* Increase fifo indexes */
@@ -259,43 +246,89 @@ static void s5pc1xx_pcm_next_frame(S5pc1xxPCMState *s)
 /* Determine sclk/sync_freq and sync_div */
 static void s5pc1xx_pcm_sclk_update(S5pc1xxPCMState *s)
 {
-    S5pc1xxClk clk;
     uint16_t sclk_div;
 
-    clk = s5pc1xx_findclk("pclk_66");
-
     if (!(s->pcm_io_en))
         s->clk_ctl = 0x40000;
 
     sclk_div = 2 * ((s->clk_ctl >> SCLK_DIV_SHIFT & ALL_BITS(8, 0)) + 1);
-    s->sclk_freq = s5pc1xx_clk_getrate(clk) / sclk_div;
+    s->sclk_freq = s5pc1xx_clk_getrate(s->pclk) / sclk_div;
 
     if (!(s->sclk_freq))
         hw_error("s5pc1xx_pcm: timer frequency is zero\n");
 
     s->sync_div = (s->clk_ctl >> SYNC_DIV_SHIFT & ALL_BITS(8, 0)) + 1;
     s->sync_freq = s->sclk_freq / s->sync_div;
+
+    s5pc1xx_audio_clk_set_freq(s->clk, s->sync_freq);
+}
+
+/* Frames until the FIFOs get to a state which raises an interrupt
+ * that is not pending yet, 0 if this never happens on its own */
+static uint64_t s5pc1xx_pcm_next_event(S5pc1xxPCMState *s)
+{
+    int rx_depth = (s->rx.write_idx - s->rx.read_idx) % 33;
+    int tx_depth = (s->tx.write_idx - s->tx.read_idx) % 33;
+    uint32_t stat;
+    int i;
+
+    /* Both FIFOs are settled after 33 frames */
+    for (i = 1; i <= 33; i++) {
+        stat = 0;
+        if (s->ctl & PCM_RXFIFO_EN) {
+            rx_depth = MIN(rx_depth + 1, 32);
+            stat |= s5pc1xx_pcm_rx_stat(s, rx_depth);
+        }
+        if (s->ctl & PCM_TXFIFO_EN) {
+            tx_depth = MAX(tx_depth - 1, 0);
+            stat |= s5pc1xx_pcm_tx_stat(s, tx_depth);
+        }
+        if (stat & ~s->irq_stat)
+            return i;
+    }
+    return 0;
+}
+
+/* Catch up with the frames passed since the last update */
+static void s5pc1xx_pcm_update(S5pc1xxPCMState *s)
+{
+    uint64_t frames;
+
+    if (!s->sclk_en)
+        return;
+
+    frames = s5pc1xx_audio_clk_advance(s->clk);
+    if (!frames)
+        return;
+    s->last_pcm_time = s5pc1xx_audio_clk_frame_start(s->clk);
+
+    /* Frames after the FIFOs are settled change nothing */
+    frames = MIN(frames, 33);
+    while (frames--)
+        s5pc1xx_pcm_next_frame(s);
 }
 
 /* Sync timer */
 static void s5pc1xx_pcm_sync(void *opaque)
 {
     S5pc1xxPCMState *s = (S5pc1xxPCMState *)opaque;
-    uint64_t next_pcm_time;
 
-    if (s->sclk_en) {
-        if (!(s->sync_freq))
-            s5pc1xx_pcm_sclk_update(s);
+    s5pc1xx_pcm_update(s);
+    s5pc1xx_audio_clk_wake(s->clk, s5pc1xx_pcm_next_event(s));
+}
 
-        s5pc1xx_pcm_next_frame(s);
+/* pclk_66 changed: frames are collected at the old rate first */
+static void s5pc1xx_pcm_pclk_changed(void *opaque)
+{
+    S5pc1xxPCMState *s = (S5pc1xxPCMState *)opaque;
 
-        s->last_pcm_time = qemu_get_clock(vm_clock);
-        next_pcm_time =
-            s->last_pcm_time + muldiv64(1, get_ticks_per_sec(), s->sync_freq);
-        qemu_mod_timer(s->pcm_timer, next_pcm_time);
-    } else {
-        qemu_del_timer(s->pcm_timer);
-    }
+    /* with PCM off CLKCTL is at its reset value until enabled */
+    if (!s->pcm_io_en || !s5pc1xx_clk_getrate(s->pclk))
+        return;
+
+    s5pc1xx_pcm_update(s);
+    s5pc1xx_pcm_sclk_update(s);
+    s5pc1xx_audio_clk_wake(s->clk, s5pc1xx_pcm_next_event(s));
 }
 
 /* SCLK x2 cycles counter */
@@ -383,6 +416,8 @@ static uint32_t s5pc1xx_pcm_gpio_read(void *opaque, int io_index)
     if (!(s->pcm_io_en))
         return 0;
 
+    s5pc1xx_pcm_update(s);
+
     if (io_index == PCM_SCLK(s->instance))
         return s5pc1xx_pcm_sclk_s(s);
 
@@ -405,6 +440,7 @@ static void s5pc1xx_pcm_gpio_write(void *opaque, int io_index, uint32_t value)
         return;
 
     if (io_index == PCM_SIN(s->instance)) {
+        s5pc1xx_pcm_update(s);
         s5pc1xx_write_rxfifo(s, value);
     }
 }
@@ -419,6 +455,8 @@ static uint32_t s5pc1xx_pcm_read(void *opaque, target_phys_addr_t offset)
     uint8_t rx_depth, tx_depth;
     uint32_t ret_val;
 
+    s5pc1xx_pcm_update(s);
+
     switch(offset) {
     case PCM_CTL:
         return s->ctl;
@@ -446,6 +484,7 @@ static uint32_t s5pc1xx_pcm_read(void *opaque, target_phys_addr_t offset)
             s->rx.read_idx++;
 
         s5pc1xx_pcm_rx_control(s);
+        s5pc1xx_pcm_sync(s);
 
         return ret_val;
 
@@ -473,6 +512,8 @@ static void s5pc1xx_pcm_write(void *opaque, target_phys_addr_t offset,
 {
     S5pc1xxPCMState *s = (S5pc1xxPCMState *)opaque;
 
+    s5pc1xx_pcm_update(s);
+
     switch(offset) {
     case PCM_CTL:
         if ((value & PCM_PCM_ENABLE) < (s->ctl & PCM_PCM_ENABLE)) {
@@ -503,15 +544,20 @@ static void s5pc1xx_pcm_write(void *opaque, target_phys_addr_t offset,
     case PCM_CLKCTL:
         if ((value & CTL_SERCLK_EN) > (s->clk_ctl & CTL_SERCLK_EN)) {
             s->sclk_en = 1;
-            s5pc1xx_pcm_sync(s);
+            if (!(s->sync_freq))
+                s5pc1xx_pcm_sclk_update(s);
+            s5pc1xx_audio_clk_start(s->clk, s->sync_freq);
+            s5pc1xx_pcm_update(s);
+        }
+        if ((value & CTL_SERCLK_EN) < (s->clk_ctl & CTL_SERCLK_EN)) {
+            s->sclk_en = 0;
+            s5pc1xx_audio_clk_stop(s->clk);
         }
-        /* the value is set high above */
-        s->sclk_en = (value & CTL_SERCLK_EN) ? : 0;
 
-        if (value != s->clk_ctl)
+        if (value != s->clk_ctl) {
+            s->clk_ctl = value;
             s5pc1xx_pcm_sclk_update(s);
-
-        s->clk_ctl = value;
+        }
         break;
 
     case PCM_TXFIFO:
@@ -541,7 +587,9 @@ static void s5pc1xx_pcm_write(void *opaque, target_phys_addr_t offset,
 
     case PCM_IRQ_CTL:
         s->irq_ctl = value;
-        break;
+        /* Let the next frame raise what is pending and now enabled */
+        s5pc1xx_audio_clk_wake(s->clk, 1);
+        return;
 
     case PCM_CLRINT:
         /* clear all irq stats and lower the interrupt */
@@ -552,6 +600,7 @@ static void s5pc1xx_pcm_write(void *opaque, target_phys_addr_t offset,
         hw_error("s5pc1xx_pcm: bad write offset 0x" TARGET_FMT_plx "\n",
                  offset);
     }
+    s5pc1xx_audio_clk_wake(s->clk, s5pc1xx_pcm_next_event(s));
 }
 
 static CPUReadMemoryFunc * const s5pc1xx_pcm_readfn[] = {
@@ -592,7 +641,9 @@ static int s5pc1xx_pcm_init1(SysBusDevice *dev)
     s5pc1xx_gpio_register_io_memory(GPIO_IDX_PCM, s->instance,
                                     s5pc1xx_pcm_gpio_readfn,
                                     s5pc1xx_pcm_gpio_writefn, NULL, s);
-    s->pcm_timer = qemu_new_timer(vm_clock, s5pc1xx_pcm_sync, s);
+    s->clk = s5pc1xx_audio_clk_new("s5pc1xx,pcm", s5pc1xx_pcm_sync, s);
+    s->pclk = s5pc1xx_findclk("pclk_66");
+    s5pc1xx_clk_subscribe(s->pclk, s5pc1xx_pcm_pclk_changed, s);
 
     s5pc1xx_pcm_reset(s);
 
@@ -819,22 +819,19 @@ typedef struct MAX8998RTCState {
 
     uint16_t  regs[RTC_CON + 1];
 
-    /* seconds update */
-    QEMUTimer *seconds_timer;
+    /* seconds are counted when the time is read */
+    int64_t   seconds_base;     /* vm_clock time at which current_tm began */
     struct tm current_tm;
 } MAX8998RTCState;
 
-static void max8998_rtc_seconds_update(void *opaque);
-
 
 /* Set default values for all fields */
 static void max8998_rtc_reset(MAX8998RTCState *s)
 {
     short i;
 
-    /* stop seconds timer */
+    /* stop counting seconds */
     s->regs[RTC_CON] = 0x0;
-    max8998_rtc_seconds_update(s);
 
     for (i = RTC_SEC; i <= RTC_CEN; i++)
         s->regs[MAX8998_REG(i, MAX8998_RTC)] = 0;
@@ -893,18 +890,17 @@ static void max8998_rtc_next_second(struct tm *tm)
     }
 }
 
-/* Using of qemu_timer to increase seconds */
-static void max8998_rtc_seconds_update(void *opaque)
+/* Add the seconds passed since the time was last looked at */
+static void max8998_rtc_seconds_update(MAX8998RTCState *s)
 {
-    MAX8998RTCState *s = (MAX8998RTCState *)opaque;
-    uint64_t next_seconds_time;
+    int64_t now = qemu_get_clock(vm_clock);
+
+    if (!(s->regs[RTC_CON] & RTC_EN))
+        return;
 
-    if (s->regs[RTC_CON] & RTC_EN) {
+    while (now - s->seconds_base >= get_ticks_per_sec()) {
         max8998_rtc_next_second(&(s->current_tm));
-        next_seconds_time = qemu_get_clock(vm_clock) + get_ticks_per_sec();
-        qemu_mod_timer(s->seconds_timer, next_seconds_time);
-    } else {
-        qemu_del_timer(s->seconds_timer);
+        s->seconds_base += get_ticks_per_sec();
     }
 }
 
@@ -946,6 +942,8 @@ static void max8998_rtc_write(SMBusDevice *dev, uint8_t cmd,
     uint16_t *reg = NULL;
     int i;
 
+    max8998_rtc_seconds_update(s);
+
     switch (cmd) {
     case MAX8998_REG(RTC_SEC, MAX8998_RTC) ...
          MAX8998_REG(RTC_CEN, MAX8998_RTC):
@@ -982,6 +980,7 @@ static uint8_t max8998_rtc_read(SMBusDevice *dev, uint8_t cmd, int n)
     switch (cmd) {
     case MAX8998_REG(RTC_SEC, MAX8998_RTC) ...
          MAX8998_REG(RTC_CEN, MAX8998_RTC):
+        max8998_rtc_seconds_update(s);
         max8998_rtc_read_time(s);
     case MAX8998_ALRM0_CONF:
     case MAX8998_ALRM1_CONF:
@@ -1011,18 +1010,15 @@ static int max8998_rtc_init1(SMBusDevice *dev)
 {
     MAX8998RTCState *s = (MAX8998RTCState *) dev;
 
-    s->seconds_timer =
-            qemu_new_timer(vm_clock, max8998_rtc_seconds_update, s);
-
     /* initialize values */
     max8998_rtc_reset(s);
 
     /* get time from host */
     qemu_get_timedate(&s->current_tm, 0);
 
-    /* start seconds timer */
+    /* start counting seconds */
     s->regs[RTC_CON] |= RTC_EN;
-    max8998_rtc_seconds_update(s);
+    s->seconds_base = qemu_get_clock(vm_clock);
 
     return 0;
 }
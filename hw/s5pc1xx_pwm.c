@@ -62,6 +62,8 @@ typedef struct S5pc1xxPWMTimerState {
     QEMUTimer *pwm_timer;
     uint32_t  freq_out;
     uint64_t  last_pwm_time;
+    int64_t   next_pwm_time;    /* next expiry, -1 if not counting */
+    uint8_t   irq_level;
 
     uint32_t  tcntb;            /* count buffer value */
     uint64_t  tcntb_in_qemu;    /* tcntb measured in 1/(9GHz) units */
@@ -81,6 +83,8 @@ typedef struct S5pc1xxPWMState {
     uint32_t     tcfg1;
     uint32_t     tcon;
     uint32_t     tint_cstat;
+    S5pc1xxClk   clk_tclk;      /* sclk_pwm */
+    S5pc1xxClk   clk_pclk;      /* pclk_66 */
     S5pc1xxPWMTimerState tmr[5]; /* timers settings */
 } S5pc1xxPWMState;
 
@@ -103,34 +107,65 @@ static void s5pc1xx_pwm_timer_renew(S5pc1xxPWMTimerState *t)
 static void s5pc1xx_pwm_timer_start(S5pc1xxPWMTimerState *t)
 {
     t->last_pwm_time = qemu_get_clock(vm_clock);
-    qemu_mod_timer(t->pwm_timer, t->last_pwm_time + t->tcnt_in_qemu);
+    t->next_pwm_time = t->last_pwm_time + t->tcnt_in_qemu;
 }
 
 /* Stop timer */
 static void s5pc1xx_pwm_timer_stop(S5pc1xxPWMTimerState *t)
 {
-    qemu_del_timer(t->pwm_timer);
+    t->next_pwm_time = -1;
 }
 
-/* Events when timer riches zero */
-static void s5pc1xx_pwm_timer_expiry(void *opaque)
+/* Events when timer riches zero.  Expiries are handled when the guest
+ * looks at the timer or when the interrupt line has to go up, so this
+ * catches up with all of them that passed: the first one reloads the
+ * buffers, the following ones just repeat it. */
+static void s5pc1xx_pwm_timer_update(S5pc1xxPWMTimerState *t)
 {
-    S5pc1xxPWMTimerState *t = (S5pc1xxPWMTimerState *)opaque;
     uint8_t num = t->tag;
+    int64_t now = qemu_get_clock(vm_clock);
 
     if (t->tag > 4)
-        hw_error("s5pc1xx_pwm_timer_expiry: wrong param (tag = %u)\n",
+        hw_error("s5pc1xx_pwm_timer_update: wrong param (tag = %u)\n",
                  t->tag);
 
+    if (t->next_pwm_time < 0 || now < t->next_pwm_time)
+        return;
+
     /* Interrupt raising */
     t->regs->tint_cstat |= INT_STAT(num);
-    if (t->regs->tint_cstat & INT_EN(num))
+    if (t->regs->tint_cstat & INT_EN(num)) {
         qemu_irq_raise(t->irq_inst);
+        t->irq_level = 1;
+    }
 
-    if (t->regs->tcon & S5C_TCON_RELOAD[num]) {
-        s5pc1xx_pwm_timer_renew(t);
-        s5pc1xx_pwm_timer_start(t);
+    if (!(t->regs->tcon & S5C_TCON_RELOAD[num]) || !t->tcntb_in_qemu) {
+        t->next_pwm_time = -1;
+        return;
     }
+
+    s5pc1xx_pwm_timer_renew(t);
+    t->last_pwm_time = t->next_pwm_time +
+        (now - t->next_pwm_time) / t->tcnt_in_qemu * t->tcnt_in_qemu;
+    t->next_pwm_time = t->last_pwm_time + t->tcnt_in_qemu;
+}
+
+/* Only expiries which raise the interrupt line need a host timer */
+static void s5pc1xx_pwm_timer_arm(S5pc1xxPWMTimerState *t)
+{
+    if (t->next_pwm_time >= 0 && !t->irq_level &&
+        (t->regs->tint_cstat & INT_EN(t->tag)))
+        qemu_mod_timer(t->pwm_timer, t->next_pwm_time);
+    else
+        qemu_del_timer(t->pwm_timer);
+}
+
+static void s5pc1xx_pwm_timer_expiry(void *opaque)
+{
+    S5pc1xxPWMTimerState *t = (S5pc1xxPWMTimerState *)opaque;
+
+    s5pc1xx_pwm_timer_update(t);
+    s5pc1xx_pwm_timer_arm(t);
 }
 
 /* Update timer frequency */
@@ -146,12 +181,12 @@ static void s5pc1xx_pwm_timer_freq(S5pc1xxPWMTimerState *t)
 
     switch (t->regs->tcfg1 >> S5C_TCFG1_DIV_SHIFT(t->tag) & 0xf) {
         case TCLK:
-            clk = s5pc1xx_findclk("sclk_pwm");
+            clk = t->regs->clk_tclk;
             prescaler = 0;
             divisor = 1;
             break;
         default:
-            clk = s5pc1xx_findclk("pclk_66");
+            clk = t->regs->clk_pclk;
             switch (t->tag) {
                 case 0 ... 1:
                     prescaler =
@@ -167,6 +202,37 @@ static void s5pc1xx_pwm_timer_freq(S5pc1xxPWMTimerState *t)
     t->freq_out = s5pc1xx_clk_getrate(clk) / (prescaler + 1) / divisor;
 }
 
+/* Input clock rate changed: the count buffers are kept in vm_clock
+ * units, so they are converted again.  A running timer keeps the counts
+ * it has done and does the rest at the new rate. */
+static void s5pc1xx_pwm_clk_changed(void *opaque)
+{
+    S5pc1xxPWMState *s = (S5pc1xxPWMState *)opaque;
+    S5pc1xxPWMTimerState *t;
+    uint32_t old_freq, done;
+    int64_t now = qemu_get_clock(vm_clock);
+
+    for (t = s->tmr; t < s->tmr + 5; t++) {
+        s5pc1xx_pwm_timer_update(t);
+        old_freq = t->freq_out;
+        s5pc1xx_pwm_timer_freq(t);
+        if (t->freq_out && t->freq_out != old_freq) {
+            t->tcntb_in_qemu =
+                muldiv64(t->tcntb, get_ticks_per_sec(), t->freq_out);
+            if (t->next_pwm_time >= 0 && old_freq) {
+                done = s5pc1xx_pwm_convert_term(now - t->last_pwm_time,
+                                                old_freq);
+                t->tcnt_in_qemu =
+                    muldiv64(t->tcnt, get_ticks_per_sec(), t->freq_out);
+                t->last_pwm_time =
+                    now - muldiv64(done, get_ticks_per_sec(), t->freq_out);
+                t->next_pwm_time = t->last_pwm_time + t->tcnt_in_qemu;
+            }
+        }
+        s5pc1xx_pwm_timer_arm(t);
+    }
+}
+
 /* Read PWM by GPIO */
 static uint32_t s5pc1xx_pwm_gpio_read(void *opaque,
                                       int io_index)
@@ -180,6 +246,7 @@ static uint32_t s5pc1xx_pwm_gpio_read(void *opaque,
 
     for (i = 0; i < 4; i++)
         if (io_index == GPIO_PWM_TOUT(i)) {
+            s5pc1xx_pwm_timer_update(&s->tmr[i]);
             tout = (s->tcon & S5C_TCON_INVERT[i]) ? 0 : 1;
 
             if (s5pc1xx_pwm_convert_term(qemu_get_clock(vm_clock) - s->tmr[i].last_pwm_time,
@@ -204,6 +271,9 @@ static uint32_t s5pc1xx_pwm_read(void *opaque, target_phys_addr_t offset)
         hw_error("s5pc1xx_pwm_read: wrong param (tag = %u)\n",
                  s->tag);
 
+    for (num = 0; num < 5; num++)
+        s5pc1xx_pwm_timer_update(&tmr[num]);
+
     switch (offset) {
         case S5C_TCFG0:
             return s->tcfg0;
@@ -269,6 +339,9 @@ static void s5pc1xx_pwm_write(void *opaque, target_phys_addr_t offset,
         hw_error("s5pc1xx_pwm_write: wrong param (tag = %u)\n",
                  s->tag);
 
+    for (num = 0; num < 5; num++)
+        s5pc1xx_pwm_timer_update(&tmr[num]);
+
     switch (offset) {
         case S5C_TCFG0:
             s->tcfg0 = value;
@@ -303,8 +376,10 @@ static void s5pc1xx_pwm_write(void *opaque, target_phys_addr_t offset,
 
         case S5C_TINT_CSTAT:
             for (num = 0; num < 5; num++)
-                if (value & INT_STAT(num))
+                if (value & INT_STAT(num)) {
                     qemu_irq_lower(tmr[num].irq_inst);
+                    tmr[num].irq_level = 0;
+                }
             /* set TINT_CSTAT as value except *_STAT bits */
             s->tint_cstat =
                 (s->tint_cstat & ALL_STAT) | (value & ~ALL_STAT);
@@ -337,6 +412,9 @@ static void s5pc1xx_pwm_write(void *opaque, target_phys_addr_t offset,
             hw_error("s5pc1xx_pwm: bad write offset " TARGET_FMT_plx "\n",
                      offset);
     }
+
+    for (num = 0; num < 5; num++)
+        s5pc1xx_pwm_timer_arm(&tmr[num]);
 }
 
 static CPUReadMemoryFunc * const s5pc1xx_pwm_readfn[] = {
@@ -359,12 +437,18 @@ static int s5pc1xx_pwm_init(SysBusDevice *dev)
     S5pc1xxPWMTimerState *tmr = s->tmr;
 
     s->tag = 255;
+    s->clk_tclk = s5pc1xx_findclk("sclk_pwm");
+    s->clk_pclk = s5pc1xx_findclk("pclk_66");
+    s5pc1xx_clk_subscribe(s->clk_tclk, s5pc1xx_pwm_clk_changed, s);
+    s5pc1xx_clk_subscribe(s->clk_pclk, s5pc1xx_pwm_clk_changed, s);
 
     for (i = 0; i < 5; i++) {
         tmr[i].tag      = i;
         tmr[i].regs     = s;
+        tmr[i].next_pwm_time = -1;
         sysbus_init_irq(dev, &tmr[i].irq_inst);
         tmr[i].pwm_timer = qemu_new_timer(vm_clock, s5pc1xx_pwm_timer_expiry, &tmr[i]);
+        qemu_timer_set_name(tmr[i].pwm_timer, "s5pc1xx,pwm");
     }
 
     s5pc1xx_pwm_write(s, S5C_TCFG0, 0x00000101);
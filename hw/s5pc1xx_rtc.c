@@ -66,21 +66,21 @@ typedef struct S5pc1xxRTCState {
     /* periodic timer */
     QEMUTimer *periodic_timer;
     uint32_t  freq_out;
-    uint64_t  last_tick;
+    int64_t   tick_base;        /* start of the first tick period */
     uint64_t  cur_tic_cnt;
     qemu_irq  tick_irq;
 
-    /* second update */
-    QEMUTimer *second_timer;
+    /* seconds are counted when the time is read, the timer only expires
+     * for the alarm */
+    QEMUTimer *alarm_timer;
+    int64_t   second_base;      /* vm_clock time at which current_tm began */
+    int       alarm_due;        /* alarm_timer expires on a matching second */
     struct tm current_tm;
     qemu_irq  alm_irq;
 
 } S5pc1xxRTCState;
 
 
-static void s5pc1xx_rtc_periodic_tick(void *opaque);
-static void s5pc1xx_rtc_second_update(void *opaque);
-
 static void s5pc1xx_rtc_get_date(S5pc1xxRTCState *s)
 {
     struct tm *tm = &(s->current_tm);
@@ -120,29 +120,36 @@ static void s5pc1xx_rtc_reset(S5pc1xxRTCState *s)
 {
     short i;
 
-    /* stop tick timer */
-    s->regs[RTC_CON] &= ~TIC_EN;
-    s5pc1xx_rtc_periodic_tick(s);
-
-    /* stop second timer */
-    s->regs[RTC_CON] &= ~RTC_EN;
-    s5pc1xx_rtc_second_update(s);
+    /* stop timers */
+    qemu_del_timer(s->periodic_timer);
+    qemu_del_timer(s->alarm_timer);
 
-    for (i = 0x30; i < 0x90; i += 0x4)
+    for (i = INT_PEND; i <= BCD_YEAR; i += 0x4)
         s->regs[i] = 0;
 
-    s->last_tick = 0;
+    s->tick_base = 0;
     s->freq_out  = 0;
 }
 
-/* Setup next timer tick */
+/* Setup next timer tick.  A tick that comes while the previous one is still
+ * pending changes nothing the guest can see, so the timer is only armed for
+ * the end of the current period once INT_TIC has been cleared. */
 static void s5pc1xx_rtc_set_timer(S5pc1xxRTCState *s)
 {
-    uint64_t next_periodic_time, last = qemu_get_clock(vm_clock);
-    s->last_tick = last;
-    next_periodic_time = last +
-        muldiv64(s->regs[TIC_CNT], get_ticks_per_sec(), s->freq_out);
-    qemu_mod_timer(s->periodic_timer, next_periodic_time);
+    uint64_t period;
+
+    if (!(s->regs[RTC_CON] & TIC_EN) || !s->freq_out || !s->regs[TIC_CNT] ||
+        (s->regs[INT_PEND] & INT_TIC)) {
+        qemu_del_timer(s->periodic_timer);
+        return;
+    }
+
+    period = muldiv64(qemu_get_clock(vm_clock) - s->tick_base,
+                      s->freq_out, get_ticks_per_sec()) / s->regs[TIC_CNT];
+    /* One ns late so that the period has surely ended by then */
+    qemu_mod_timer(s->periodic_timer, s->tick_base + 1 +
+                   muldiv64((period + 1) * s->regs[TIC_CNT],
+                            get_ticks_per_sec(), s->freq_out));
 }
 
 /* Send periodic interrupt */
@@ -150,16 +157,8 @@ static void s5pc1xx_rtc_periodic_tick(void *opaque)
 {
     S5pc1xxRTCState *s = (S5pc1xxRTCState *)opaque;
 
-    /* tick actually happens not every CUR_TIC_CNT but rather at irq time;
-     * if current ticnto value is needed it is calculated in s5pc1xx_rtc_read */
-    if (s->regs[RTC_CON] & TIC_EN) {
-        qemu_irq_raise(s->tick_irq);
-        s->regs[INT_PEND] |= INT_TIC;
-        s5pc1xx_rtc_set_timer(s);
-    } else {
-        s->last_tick = 0;
-        qemu_del_timer(s->periodic_timer);
-    }
+    qemu_irq_raise(s->tick_irq);
+    s->regs[INT_PEND] |= INT_TIC;
 }
 
 /* Update tick timer frequency */
@@ -228,63 +227,83 @@ static void s5pc1xx_rtc_next_second(struct tm *tm)
     }
 }
 
-/* Working with up-to-date time and check alarm */
-static void s5pc1xx_rtc_second_update(void *opaque)
+/* Bring current_tm and the BCD registers up to date */
+static void s5pc1xx_rtc_catch_up(S5pc1xxRTCState *s)
 {
-    S5pc1xxRTCState *s = (S5pc1xxRTCState *)opaque;
-    uint64_t next_second_time;
-
-    if (s->regs[RTC_CON] & RTC_EN) {
-        /* check if the alarm is generally enabled */
-        /* then check if an alarm of at least one kind is enabled */
-        if (s->regs[RTC_ALM] & ALM_EN &&
-            (s->regs[RTC_ALM] & SEC_EN ||
-             s->regs[RTC_ALM] & MIN_EN ||
-             s->regs[RTC_ALM] & HOUR_EN ||
-             s->regs[RTC_ALM] & DAY_EN ||
-             s->regs[RTC_ALM] & MON_EN ||
-             s->regs[RTC_ALM] & YEAR_EN)) {
-
-            /* check alarm values together with corresponding permissive bits */
-            if (((s->regs[ALM_SEC] & 0x7F) ==
-                    to_bcd(s->current_tm.tm_sec) ||
-                 !(s->regs[RTC_ALM] & SEC_EN)) &&
-
-                ((s->regs[ALM_MIN] & 0x7F) ==
-                    to_bcd(s->current_tm.tm_min) ||
-                 !(s->regs[RTC_ALM] & MIN_EN)) &&
-
-                ((s->regs[ALM_HOUR] & 0x3F) ==
-                    to_bcd(s->current_tm.tm_hour) ||
-                 !(s->regs[RTC_ALM] & HOUR_EN)) &&
-
-                ((s->regs[ALM_DAY] & 0x3F) ==
-                    to_bcd(s->current_tm.tm_mday) ||
-                 !(s->regs[RTC_ALM] & DAY_EN)) &&
-
-                ((s->regs[ALM_MON]  & 0x1F) ==
-                    to_bcd(s->current_tm.tm_mon) ||
-                 !(s->regs[RTC_ALM] & MON_EN)) &&
-
-                (((s->regs[ALM_YEAR] & 0xFF) ==
-                    to_bcd((s->current_tm.tm_year - 100) % 100) &&
-                  ((s->regs[ALM_YEAR] >> 8) & 0xF) ==
-                    to_bcd((s->current_tm.tm_year - 100) % 1000 / 100)) ||
-                 !(s->regs[RTC_ALM] & YEAR_EN))) {
-
-                qemu_irq_raise(s->alm_irq);
-                s->regs[INT_PEND] |= INT_ALM;
-            }
-        }
+    int64_t now = qemu_get_clock(vm_clock);
+
+    if (!(s->regs[RTC_CON] & RTC_EN) ||
+        now - s->second_base < get_ticks_per_sec())
+        return;
 
+    while (now - s->second_base >= get_ticks_per_sec()) {
         s5pc1xx_rtc_next_second(&(s->current_tm));
-        s5pc1xx_rtc_set_date(s, &(s->current_tm));
+        s->second_base += get_ticks_per_sec();
+    }
+    s5pc1xx_rtc_set_date(s, &(s->current_tm));
+}
+
+/* Check alarm values together with corresponding permissive bits */
+static int s5pc1xx_rtc_alarm_match(S5pc1xxRTCState *s, const struct tm *tm)
+{
+    return ((s->regs[ALM_SEC] & 0x7F) == to_bcd(tm->tm_sec) ||
+            !(s->regs[RTC_ALM] & SEC_EN)) &&
+
+           ((s->regs[ALM_MIN] & 0x7F) == to_bcd(tm->tm_min) ||
+            !(s->regs[RTC_ALM] & MIN_EN)) &&
+
+           ((s->regs[ALM_HOUR] & 0x3F) == to_bcd(tm->tm_hour) ||
+            !(s->regs[RTC_ALM] & HOUR_EN)) &&
 
-        next_second_time = qemu_get_clock(vm_clock) + get_ticks_per_sec();
-        qemu_mod_timer(s->second_timer, next_second_time);
-    } else {
-        qemu_del_timer(s->second_timer);
+           ((s->regs[ALM_DAY] & 0x3F) == to_bcd(tm->tm_mday) ||
+            !(s->regs[RTC_ALM] & DAY_EN)) &&
+
+           ((s->regs[ALM_MON]  & 0x1F) == to_bcd(tm->tm_mon) ||
+            !(s->regs[RTC_ALM] & MON_EN)) &&
+
+           (((s->regs[ALM_YEAR] & 0xFF) ==
+                to_bcd((tm->tm_year - 100) % 100) &&
+             ((s->regs[ALM_YEAR] >> 8) & 0xF) ==
+                to_bcd((tm->tm_year - 100) % 1000 / 100)) ||
+            !(s->regs[RTC_ALM] & YEAR_EN));
+}
+
+/* Arm the alarm timer for the next second that matches the alarm, looking
+ * at most a day ahead.  Must be called with current_tm up to date. */
+static void s5pc1xx_rtc_set_alarm(S5pc1xxRTCState *s)
+{
+    struct tm tm = s->current_tm;
+    int i;
+
+    /* check if the alarm is generally enabled */
+    /* then check if an alarm of at least one kind is enabled */
+    if (!(s->regs[RTC_CON] & RTC_EN) || !(s->regs[RTC_ALM] & ALM_EN) ||
+        !(s->regs[RTC_ALM] & (SEC_EN | MIN_EN | HOUR_EN |
+                              DAY_EN | MON_EN | YEAR_EN))) {
+        qemu_del_timer(s->alarm_timer);
+        return;
+    }
+
+    for (i = 1; i <= 24 * 60 * 60; i++) {
+        s5pc1xx_rtc_next_second(&tm);
+        if (s5pc1xx_rtc_alarm_match(s, &tm))
+            break;
+    }
+    s->alarm_due = i <= 24 * 60 * 60;
+    qemu_mod_timer(s->alarm_timer, s->second_base +
+                   (int64_t)MIN(i, 24 * 60 * 60) * get_ticks_per_sec());
+}
+
+static void s5pc1xx_rtc_alarm(void *opaque)
+{
+    S5pc1xxRTCState *s = (S5pc1xxRTCState *)opaque;
+
+    s5pc1xx_rtc_catch_up(s);
+    if (s->alarm_due) {
+        qemu_irq_raise(s->alm_irq);
+        s->regs[INT_PEND] |= INT_ALM;
     }
+    s5pc1xx_rtc_set_alarm(s);
 }
 
 /* Host RTC mappings */
@@ -319,11 +338,13 @@ static uint32_t s5pc1xx_rtc_read(void *opaque, target_phys_addr_t offset)
         case BCD_DAY:
         case BCD_MON:
         case BCD_YEAR:
+            s5pc1xx_rtc_catch_up(s);
             return s->regs[offset];
         case CUR_TIC_CNT:
-            if (s->freq_out && s->last_tick && s->regs[TIC_CNT]) {
+            if (s->freq_out && (s->regs[RTC_CON] & TIC_EN) &&
+                s->regs[TIC_CNT]) {
                 s->cur_tic_cnt = s->regs[TIC_CNT] -
-                    muldiv64(qemu_get_clock(vm_clock) - s->last_tick,
+                    muldiv64(qemu_get_clock(vm_clock) - s->tick_base,
                              s->freq_out, get_ticks_per_sec()) %
                         s->regs[TIC_CNT];
             } else {
@@ -352,32 +373,34 @@ static void s5pc1xx_rtc_write(void *opaque, target_phys_addr_t offset,
 
             /* clear INT_* bits if they are set in value */
             s->regs[INT_PEND] &= ~(value & (INT_TIC | INT_ALM));
+            s5pc1xx_rtc_set_timer(s);
             break;
         case RTC_CON:
+            s5pc1xx_rtc_catch_up(s);
             /* reset tick counter */
             if (value & CLK_RST) {
                 s5pc1xx_rtc_reset(s);
                 value &= ~CLK_RST;
             }
-            /* start second timer */
+            /* start counting seconds */
             if ((value & RTC_EN) > (s->regs[RTC_CON] & RTC_EN)) {
-                s->regs[RTC_CON] |= RTC_EN;
                 s5pc1xx_rtc_get_date_from_host(s);
-                s5pc1xx_rtc_second_update(s);
-            }
-            /* start tick timer */
-            if ((value & TIC_EN) > (s->regs[RTC_CON] & TIC_EN)) {
-                s->regs[RTC_CON] = value;
-                s5pc1xx_rtc_periodic_update(s);
-                s5pc1xx_rtc_set_timer(s);
-                break;
-            } else if ((value & TIC_EN) < (s->regs[RTC_CON] & TIC_EN)) {
-                qemu_del_timer(s->periodic_timer);
+                s->second_base = qemu_get_clock(vm_clock);
             }
+            /* start tick timer, or restart its period at the new rate */
+            if ((value & TIC_EN) > (s->regs[RTC_CON] & TIC_EN) ||
+                ((value ^ s->regs[RTC_CON]) & (0xF << TIC_CK_SEL_SHIFT)))
+                s->tick_base = qemu_get_clock(vm_clock);
             s->regs[RTC_CON] = value;
             s5pc1xx_rtc_periodic_update(s);
+            s5pc1xx_rtc_set_timer(s);
+            s5pc1xx_rtc_set_alarm(s);
             break;
         case TIC_CNT:
+            s->regs[offset] = value;
+            s->tick_base = qemu_get_clock(vm_clock);
+            s5pc1xx_rtc_set_timer(s);
+            break;
         case RTC_ALM:
         case ALM_SEC:
         case ALM_MIN:
@@ -386,6 +409,8 @@ static void s5pc1xx_rtc_write(void *opaque, target_phys_addr_t offset,
         case ALM_MON:
         case ALM_YEAR:
             s->regs[offset] = value;
+            s5pc1xx_rtc_catch_up(s);
+            s5pc1xx_rtc_set_alarm(s);
             break;
         case BCD_SEC:
         case BCD_MIN:
@@ -394,10 +419,13 @@ static void s5pc1xx_rtc_write(void *opaque, target_phys_addr_t offset,
         case BCD_DAY:
         case BCD_MON:
         case BCD_YEAR:
+            s5pc1xx_rtc_catch_up(s);
             s->regs[offset] = value;
             /* if in disabled mode, do not update the time */
-            if (s->regs[RTC_CON] & RTC_EN)
+            if (s->regs[RTC_CON] & RTC_EN) {
                 s5pc1xx_rtc_get_date(s);
+                s5pc1xx_rtc_set_alarm(s);
+            }
             break;
         default:
             hw_error("s5pc1xx_rtc: bad write offset " TARGET_FMT_plx "\n",
@@ -429,8 +457,10 @@ static int s5pc1xx_rtc_init(SysBusDevice *dev)
 
     s->periodic_timer =
         qemu_new_timer(vm_clock, s5pc1xx_rtc_periodic_tick, s);
-    s->second_timer =
-        qemu_new_timer(vm_clock, s5pc1xx_rtc_second_update, s);
+    s->alarm_timer =
+        qemu_new_timer(vm_clock, s5pc1xx_rtc_alarm, s);
+    qemu_timer_set_name(s->periodic_timer, "s5pc1xx,rtc");
+    qemu_timer_set_name(s->alarm_timer, "s5pc1xx,rtc");
 
     iomemory =
         cpu_register_io_memory(s5pc1xx_rtc_mm_read, s5pc1xx_rtc_mm_write, s);
@@ -128,10 +128,9 @@ typedef struct S5pc1xxSpdifState {
         uint32_t  userbit[3];
     } shd;
 
-    QEMUTimer *spdif_timer;
+    S5pc1xxAudioClk *clk;
     uint32_t  sclk_freq;
     int64_t   count;                /* has signed type */
-    uint8_t   updated;
 
     uint32_t  fifo[2][16];
     uint64_t  read_idx, write_idx;
@@ -480,41 +479,134 @@ static void s5pc1xx_spdif_sclk_update(S5pc1xxSpdifState *s)
     default:
         hw_error("s5pc1xx_spdif: frequency id %u is not supported\n", freq_id);
     }
+
+    s5pc1xx_audio_clk_set_freq(s->clk, s->sclk_freq);
 }
 
-/* Sync timer engine */
-static void s5pc1xx_spdif_sync(void *opaque)
+/* Next time slot */
+static void s5pc1xx_spdif_tick(S5pc1xxSpdifState *s)
 {
-    S5pc1xxSpdifState *s = (S5pc1xxSpdifState *)opaque;
-    uint64_t next_spdif_time;
+    s->count++;
 
-    if (s->spdclkcon & POWER_ON) {
-        if (!(s->sclk_freq))
-            s5pc1xx_spdif_sclk_update(s);
+    if (!(s->count % 64))
+        s5pc1xx_spdif_sub_frame(s);
 
-        /* s->updated is used to avoid conflict between two functions
-         * in case of synchronous runs */
-        s->updated = 0;
+    if (!(s->count % 2))
+        s5pc1xx_spdif_channel_coding(s);
+}
 
-        s->count++;
+/* Whole sub-frame at once: the line ends up as channel coding would
+ * leave it, i.e. flipped by the parity of the time slots 2~31 */
+static void s5pc1xx_spdif_skip_sub_frame(S5pc1xxSpdifState *s)
+{
+    uint32_t bits;
+    uint8_t  ones = 0;
 
-        if (!(s->count % 64))
-            s5pc1xx_spdif_sub_frame(s);
+    s->count += 64;
+    s5pc1xx_spdif_sub_frame(s);
 
-        if (!(s->count % 2))
-            s5pc1xx_spdif_channel_coding(s);
+    for (bits = s->sub_frame >> 2; bits; bits >>= 1)
+        ones ^= bits & 0x1;
 
-        s->updated = 1;
+    s->second_state ^= ones;
+    s->first_state = s->second_state ^ (s->sub_frame >> 31);
+}
 
-        next_spdif_time = qemu_get_clock(vm_clock) +
-                          muldiv64(1, get_ticks_per_sec(), s->sclk_freq);
-        qemu_mod_timer(s->spdif_timer, next_spdif_time);
-    } else {
-        s->spdclkcon |= CLK_DWN_READY;
-        qemu_del_timer(s->spdif_timer);
+/* Sub-frames after which the output repeats once FIFO is drained, 0 if
+ * it still depends on data or on burst parameters not loaded yet.  Only
+ * the preamble bits flip the line over a whole sub-frame, as the parity
+ * bit evens out the rest; the preambles repeat every 384 sub-frames, so
+ * the line does every 768, and a non-linear PCM burst every M. */
+static uint64_t s5pc1xx_spdif_period(S5pc1xxSpdifState *s)
+{
+    uint16_t m;
+
+    if (FIFO_DEPTH)
+        return 0;
+    if (!s->non_linear_pcm)
+        return 2 * 384;
+
+    if (s->shd.spdbstas != s->spdbstas || s->shd.spdcnt != s->spdcnt)
+        return 0;
+    /* Burst length, as in s5pc1xx_spdif_tx_block */
+    m = 4;
+    while ((m + 2) * 16 <= s->rep_period)
+        m += 2;
+    if (s->data_sframe_num > m)
+        return 0;
+    return 2 * 384 * m;
+}
+
+/* Catch up with the time slots passed since the last update */
+static void s5pc1xx_spdif_update(S5pc1xxSpdifState *s)
+{
+    uint64_t ticks, period, skip;
+
+    if (!(s->spdclkcon & POWER_ON))
+        return;
+
+    ticks = s5pc1xx_audio_clk_advance(s->clk);
+    while (ticks) {
+        if (s->count % 64 == 63 && ticks >= 64) {
+            /* Whole periods past the drained FIFO change nothing; the
+             * last one is still run for what it latches */
+            if (ticks >= 2 * 2 * 384 * 64 &&
+                (period = s5pc1xx_spdif_period(s) * 64) &&
+                ticks >= 2 * period) {
+                skip = (ticks / period - 1) * period;
+                s->count += skip;
+                ticks -= skip;
+            }
+            s5pc1xx_spdif_skip_sub_frame(s);
+            ticks -= 64;
+        } else {
+            s5pc1xx_spdif_tick(s);
+            ticks--;
+        }
     }
 }
 
+/* Time slots until the sub-frame which may raise an interrupt that
+ * is not pending yet, 0 if there is no such sub-frame */
+static uint64_t s5pc1xx_spdif_next_event(S5pc1xxSpdifState *s)
+{
+    uint64_t sframes = 0, next;
+    uint16_t m;
+
+    if (s->fifo_thr < 0)
+        s5pc1xx_spdif_fifo_thr(s);
+
+    /* At most one sample is taken from FIFO per sub-frame */
+    if (!(s->spdcon & BUF_EMPTY_INT_ST))
+        sframes = FIFO_DEPTH ? 2 * FIFO_DEPTH - s->read_ch : 1;
+
+    if (!(s->spdcon & FIFO_LEVEL_INT_ST) && FIFO_DEPTH > s->fifo_thr)
+        sframes = 1;
+
+    if (s->non_linear_pcm && !(s->spdcon & STREAM_END_INT_ST)) {
+        /* First payload frame whose successor exceeds rep_period */
+        m = MAX(4, s->data_sframe_num + (s->data_sframe_num % 2));
+        while ((m + 2) * 16 <= s->rep_period)
+            m += 2;
+        next = m - s->data_sframe_num + 1;
+        if (!sframes || next < sframes)
+            sframes = next;
+    }
+
+    if (!sframes)
+        return 0;
+    return (s->count / 64 + sframes) * 64 - s->count;
+}
+
+/* Sync timer engine */
+static void s5pc1xx_spdif_sync(void *opaque)
+{
+    S5pc1xxSpdifState *s = (S5pc1xxSpdifState *)opaque;
+
+    s5pc1xx_spdif_update(s);
+    s5pc1xx_audio_clk_wake(s->clk, s5pc1xx_spdif_next_event(s));
+}
+
 /* -=RELATION WITH GPIO AND OS=- */
 
 /* Read SPDIF by GPIO */
@@ -523,15 +615,8 @@ static uint32_t s5pc1xx_spdif_gpio_read(void *opaque, int io_index)
     S5pc1xxSpdifState *s = (S5pc1xxSpdifState *)opaque;
 
     if (io_index == SPDIF_0_OUT) {
-        if (s->count % 2) {
-            return s->second_state;
-        } else {
-            if (s->updated) {
-                return s->first_state;
-            } else {
-                return s->second_state;
-            }
-        }
+        s5pc1xx_spdif_update(s);
+        return (s->count % 2) ? s->second_state : s->first_state;
     }
     return 0;
 }
@@ -544,6 +629,8 @@ static uint32_t s5pc1xx_spdif_read(void *opaque, target_phys_addr_t offset)
 {
     S5pc1xxSpdifState *s = (S5pc1xxSpdifState *)opaque;
 
+    s5pc1xx_spdif_update(s);
+
     switch(offset) {
     case SPDCLKCON:
         return s->spdclkcon;
@@ -581,6 +668,8 @@ static void s5pc1xx_spdif_write(void *opaque, target_phys_addr_t offset,
     uint32_t old_val;
     S5pc1xxSpdifState *s = (S5pc1xxSpdifState *)opaque;
 
+    s5pc1xx_spdif_update(s);
+
     switch(offset) {
     case SPDCLKCON:
         old_val = s->spdclkcon;
@@ -591,9 +680,16 @@ static void s5pc1xx_spdif_write(void *opaque, target_phys_addr_t offset,
 
         if ((value & POWER_ON) > (old_val & POWER_ON)) {
             s5pc1xx_spdif_stream_end(s);
-            s5pc1xx_spdif_sync(s);
+            if (!(s->sclk_freq))
+                s5pc1xx_spdif_sclk_update(s);
+            s5pc1xx_audio_clk_start(s->clk, s->sclk_freq);
+            s5pc1xx_spdif_update(s);
             s->spdclkcon &= ~CLK_DWN_READY;
         }
+        if ((value & POWER_ON) < (old_val & POWER_ON)) {
+            s5pc1xx_audio_clk_stop(s->clk);
+            s->spdclkcon |= CLK_DWN_READY;
+        }
         break;
     case SPDCON:
         old_val = s->spdcon;
@@ -617,7 +713,9 @@ static void s5pc1xx_spdif_write(void *opaque, target_phys_addr_t offset,
         if (value & ALL_STAT)
             s5pc1xx_spdif_irq(s, (value & ALL_STAT), 1);
 
-        break;
+        /* Let the next sub-frame raise what is pending and now enabled */
+        s5pc1xx_audio_clk_wake(s->clk, 64 - s->count % 64);
+        return;
     case SPDBSTAS:
         s->spdbstas = value;
         break;
@@ -647,6 +745,7 @@ static void s5pc1xx_spdif_write(void *opaque, target_phys_addr_t offset,
         hw_error("s5pc1xx_spdif: bad write offset 0x" TARGET_FMT_plx "\n",
                  offset);
     }
+    s5pc1xx_audio_clk_wake(s->clk, s5pc1xx_spdif_next_event(s));
 }
 
 static CPUReadMemoryFunc * const s5pc1xx_spdif_readfn[] = {
@@ -677,7 +776,7 @@ static int s5pc1xx_spdif_init(SysBusDevice *dev)
                                     s5pc1xx_spdif_gpio_readfn,
                                     s5pc1xx_spdif_gpio_writefn, NULL, s);
 
-    s->spdif_timer = qemu_new_timer(vm_clock, s5pc1xx_spdif_sync, s);
+    s->clk = s5pc1xx_audio_clk_new("s5pc1xx,spdif", s5pc1xx_spdif_sync, s);
 
     s5pc1xx_spdif_reset(s);
 
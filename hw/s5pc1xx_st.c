@@ -70,11 +70,12 @@ typedef struct {
     uint8_t  prescaler;
 
     QEMUTimer *st_timer;
+    S5pc1xxClk clks[4];     /* TCLKB_MUX inputs */
     uint32_t freq_out;
     uint64_t tick_interval;
-    uint64_t last_tick;
-    uint64_t next_planned_tick;
+    uint64_t ticks;         /* ticks since base_time already accounted */
     uint64_t base_time;
+    uint8_t  irq_level;
 } S5pc1xxSTState;
 
 
@@ -99,52 +100,98 @@ static void s5pc1xx_st_irq(S5pc1xxSTState *s, uint32_t enab_mask,
     /* raise irq */
     if ((s->int_cstat & INT_ENABLE) && (s->int_cstat & enab_mask)) {
         qemu_irq_raise(s->irq);
+        s->irq_level = 1;
     }
 
     s->int_cstat |= stat_mask;
 }
 
-static void s5pc1xx_st_set_timer(S5pc1xxSTState *s)
+/* Count N ticks down ICNTO at once.  Each tick reloads a zero counter
+ * in auto-reload mode, decrements it and expires when it gets to zero;
+ * without auto-reload a zero counter expires on every tick. */
+static void s5pc1xx_st_count(S5pc1xxSTState *s, uint64_t n)
 {
-    uint64_t last = qemu_get_clock(vm_clock) - s->base_time;
-    /* make a tick each tick_interval'th QEMU timer cycle - this way
-     * system timer is working consistently (1 second for emulated machine
-     * corresponds to 1 second for host); otherwise due to QEMU timer interrupt
-     * handling overhead it will slowly drift towards the past */
-    s->next_planned_tick = last + (s->tick_interval - last % s->tick_interval);
-    qemu_mod_timer(s->st_timer, s->next_planned_tick + s->base_time);
-    s->last_tick = last;
+    int64_t icnto = s->icnto;
+    int expired = 0;
+
+    if (icnto < 0) {
+        icnto = 0;
+        expired = 1;
+        n--;
+    }
+
+    if (icnto > 0) {
+        if (n < icnto) {
+            s->icnto = icnto - n;
+            return;
+        }
+        n -= icnto;
+        icnto = 0;
+        expired = 1;
+    }
+
+    if (n) {
+        if ((s->tcon & INT_AUTO_RELOAD) && s->icntb) {
+            icnto = (s->icntb - n % s->icntb) % s->icntb;
+            if (n >= s->icntb)
+                expired = 1;
+        } else {
+            expired = 1;
+        }
+    }
+
+    s->icnto = icnto;
+    if (expired)
+        s5pc1xx_st_irq(s, ICNTEIE, INTCNT_EXP_STAT);
 }
 
-/* counter step */
-static void s5pc1xx_st_tick(void *opaque)
+/* Account for the ticks passed since the last call.  Ticks happen every
+ * tick_interval since base_time, so the timer does not drift however
+ * late the host timer fires */
+static void s5pc1xx_st_catch_up(S5pc1xxSTState *s)
 {
-    S5pc1xxSTState *s = (S5pc1xxSTState *)opaque;
+    uint64_t ticks;
 
-    /* tick actually happens not every ticnto but rather at icnto update;
-     * if current ticnto value is needed it is calculated in s5pc1xx_st_read */
-    if (s->tcon & TIMER_RUN) {
-        if (s->tcon & INT_RUN) {
-            /* reload count */
-            if (s->icnto == 0 && s->tcon & INT_AUTO_RELOAD)
-                s->icnto = s->icntb;
+    if (!(s->tcon & TIMER_RUN) || !s->tick_interval)
+        return;
 
-            s->icnto--;
+    ticks = (qemu_get_clock(vm_clock) - s->base_time) / s->tick_interval;
+    if (ticks > s->ticks && (s->tcon & INT_RUN))
+        s5pc1xx_st_count(s, ticks - s->ticks);
+    s->ticks = ticks;
+}
 
-            /* time for interrupt */
-            if (s->icnto <= 0) {
-                s->icnto = 0;
-                s5pc1xx_st_irq(s, ICNTEIE, INTCNT_EXP_STAT);
-            }
-        }
+/* Arm the host timer for the next tick that raises the interrupt line;
+ * expiries while it is masked or already raised only show in registers */
+static void s5pc1xx_st_set_timer(S5pc1xxSTState *s)
+{
+    uint64_t n;
 
-        /* schedule next interrupt */
-        s5pc1xx_st_set_timer(s);
-    } else {
-        s->next_planned_tick = 0;
-        s->last_tick = 0;
+    if (!(s->tcon & TIMER_RUN) || !(s->tcon & INT_RUN) ||
+        !s->tick_interval || s->irq_level ||
+        !(s->int_cstat & INT_ENABLE) || !(s->int_cstat & ICNTEIE)) {
         qemu_del_timer(s->st_timer);
+        return;
     }
+
+    if (s->icnto > 0)
+        n = s->icnto;
+    else if ((s->tcon & INT_AUTO_RELOAD) && s->icntb && s->icnto == 0)
+        n = s->icntb;
+    else
+        n = 1;
+
+    qemu_mod_timer(s->st_timer,
+                   s->base_time + (s->ticks + n) * s->tick_interval);
+}
+
+/* counter step */
+static void s5pc1xx_st_tick(void *opaque)
+{
+    S5pc1xxSTState *s = (S5pc1xxSTState *)opaque;
+
+    s5pc1xx_st_catch_up(s);
+    s5pc1xx_st_set_timer(s);
 }
 
 /* set default values for all fields */
@@ -160,8 +207,7 @@ static void s5pc1xx_st_reset(S5pc1xxSTState *s)
     s->icnto     = 0;
     s->int_cstat = 0;
 
-    s->last_tick = 0;
-    s->next_planned_tick = 0;
+    s->ticks     = 0;
     s->freq_out  = 0;
     s->tick_interval = 0;
     s->divider   = 1;
@@ -171,30 +217,65 @@ static void s5pc1xx_st_reset(S5pc1xxSTState *s)
     qemu_del_timer(s->st_timer);
 }
 
+/* rate of the selected input after the prescaler and divider */
+static uint32_t s5pc1xx_st_freq(S5pc1xxSTState *s)
+{
+    return s5pc1xx_clk_getrate(s->clks[(s->tcfg & TCLKB_MUX) >> 12]) /
+           ((s->tcfg & PRESCALER) + 1) / (1 << ((s->tcfg & DIV_MUX) >> 8));
+}
+
 /* update timer frequency */
 static void s5pc1xx_st_update(S5pc1xxSTState *s)
 {
-    S5pc1xxClk clk;
+    /* Ticks at the new rate start from the last one at the old rate */
+    s->base_time += s->ticks * s->tick_interval;
+    s->ticks = 0;
 
     s->divider = 1 << ((s->tcfg & DIV_MUX) >> 8);
     s->prescaler = s->tcfg & PRESCALER;
 
-    clk = s5pc1xx_findclk(st_clks[(s->tcfg & TCLKB_MUX) >> 12]);
-    s->freq_out = s5pc1xx_clk_getrate(clk) / (s->prescaler + 1) / s->divider;
+    s->freq_out = s5pc1xx_st_freq(s);
+    if (!s->freq_out)
+        hw_error("s5pc1xx_st: timer update input frequency is zero\n");
+
     s->tick_interval =
         muldiv64(s->ticntb, get_ticks_per_sec(), s->freq_out) +
         (muldiv64(s->tfcntb, get_ticks_per_sec(), s->freq_out) >> 16);
-    s->next_planned_tick = 0;
+}
 
-    if (!s->freq_out)
-        hw_error("s5pc1xx_st: timer update input frequency is zero\n");
+/* one of the input clocks changed its rate */
+static void s5pc1xx_st_clk_changed(void *opaque)
+{
+    S5pc1xxSTState *s = (S5pc1xxSTState *)opaque;
+
+    s5pc1xx_st_catch_up(s);
+
+    /* the counters hold while the divided input is stopped; a zero
+     * tick interval keeps them from counting */
+    if (!s5pc1xx_st_freq(s)) {
+        s->base_time += s->ticks * s->tick_interval;
+        s->ticks = 0;
+        s->freq_out = 0;
+        s->tick_interval = 0;
+        qemu_del_timer(s->st_timer);
+        return;
+    }
+    if (!s->freq_out) {
+        s->base_time = qemu_get_clock(vm_clock);
+        s->ticks = 0;
+    }
+
+    s5pc1xx_st_update(s);
+    s5pc1xx_st_set_timer(s);
 }
 
 /* System Timer read */
 static uint32_t s5pc1xx_st_read(void *opaque, target_phys_addr_t offset)
 {
     S5pc1xxSTState *s = (S5pc1xxSTState *)opaque;
-    uint64_t cur_clock, tps;
+    uint64_t left, interval;
+
+    s5pc1xx_st_catch_up(s);
 
     switch (offset) {
     case TCFG:
@@ -204,30 +285,17 @@ static uint32_t s5pc1xx_st_read(void *opaque, target_phys_addr_t offset)
     case TICNTB:
         return s->ticntb;
     case TICNTO:
-        if (s->freq_out && s->last_tick && s->ticntb && s->next_planned_tick) {
-            cur_clock = qemu_get_clock(vm_clock) - s->base_time;
-            if (cur_clock < s->next_planned_tick) {
-                if (s->tick_interval > 0xFFFFFFFF) {
-                    /* very large tick interval; muldiv64 can't be used
-                     * in this case directly; avoid 64-bit difference by
-                     * knowing the fact that next_planned_tick and last_tick
-                     * may be represented as "next_planned_tick =
-                     * K * tick_interval" and "last_tick = N * tick_interval"
-                     * assuming that last_tick happened in time */
-                    tps = get_ticks_per_sec();
-                    s->ticnto = muldiv64(s->next_planned_tick - cur_clock,
-                                         s->ticntb,
-                                         (s->next_planned_tick - s->last_tick +
-                                          tps / 2) / tps) / tps;
-                } else {
-                    /* tick interval is 32-bit so both differences
-                     * should be 32-bit too */
-                    s->ticnto = muldiv64(s->next_planned_tick - cur_clock, s->ticntb,
-                                         s->next_planned_tick - s->last_tick);
-                }
-            } else {
-                s->ticnto = 0;
+        if ((s->tcon & TIMER_RUN) && s->ticntb && s->tick_interval) {
+            /* part of the current tick still ahead */
+            interval = s->tick_interval;
+            left = interval -
+                   (qemu_get_clock(vm_clock) - s->base_time) % interval;
+            /* muldiv64 takes a 32-bit divisor */
+            while (interval > 0xFFFFFFFF) {
+                interval >>= 1;
+                left >>= 1;
             }
+            s->ticnto = muldiv64(left, s->ticntb, interval);
         } else {
             s->ticnto = 0;
         }
@@ -251,6 +319,8 @@ static void s5pc1xx_st_write(void *opaque, target_phys_addr_t offset,
 {
     S5pc1xxSTState *s = (S5pc1xxSTState *)opaque;
 
+    s5pc1xx_st_catch_up(s);
+
     switch (offset) {
     case TCFG:
         if (value & TICK_SWRST) {
@@ -266,9 +336,7 @@ static void s5pc1xx_st_write(void *opaque, target_phys_addr_t offset,
 
         if ((value & TIMER_RUN) > (s->tcon & TIMER_RUN)) {
             s->base_time = qemu_get_clock(vm_clock);
-            s5pc1xx_st_set_timer(s);
-        } else if ((value & TIMER_RUN) < (s->tcon & TIMER_RUN)) {
-            qemu_del_timer(s->st_timer);
+            s->ticks = 0;
         }
         s->tcon = value;
         break;
@@ -303,13 +371,17 @@ static void s5pc1xx_st_write(void *opaque, target_phys_addr_t offset,
         /* lower interrupt */
         /* TODO: check if IRQ should be lowered for all cases or
          * only when there are no more stat bits left */
-        if (!(s->int_cstat & ALL_STAT))
+        if (!(s->int_cstat & ALL_STAT)) {
             qemu_irq_lower(s->irq);
+            s->irq_level = 0;
+        }
         break;
 
     default:
         hw_error("s5pc1xx_st: bad write offset " TARGET_FMT_plx "\n", offset);
     }
+
+    s5pc1xx_st_set_timer(s);
 }
 
 static CPUReadMemoryFunc * const s5pc1xx_st_readfn[] = {
@@ -329,8 +401,15 @@ static int s5pc1xx_st_init(SysBusDevice *dev)
 {
     int iomemtype;
     S5pc1xxSTState *s = FROM_SYSBUS(S5pc1xxSTState, dev);
+    int i;
+
+    for (i = 0; i < 4; i++) {
+        s->clks[i] = s5pc1xx_findclk(st_clks[i]);
+        s5pc1xx_clk_subscribe(s->clks[i], s5pc1xx_st_clk_changed, s);
+    }
 
     s->st_timer = qemu_new_timer(vm_clock, s5pc1xx_st_tick, s);
+    qemu_timer_set_name(s->st_timer, "s5pc1xx,st");
     sysbus_init_irq(dev, &s->irq);
     iomemtype =
         cpu_register_io_memory(s5pc1xx_st_readfn, s5pc1xx_st_writefn, s);
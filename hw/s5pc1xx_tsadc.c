@@ -124,6 +124,7 @@ typedef struct S5pc1xxTSADCState {
 
     /* Timer to report conversion data periodically */
     QEMUTimer *timer;
+    S5pc1xxClk clk;
     unsigned int conversion_time;
 } S5pc1xxTSADCState;
 
@@ -239,6 +240,26 @@ static uint32_t s5pc1xx_tsadc_read(void *opaque, target_phys_addr_t offset)
     }
 }
 
+static void s5pc1xx_tsadc_conversion_time(S5pc1xxTSADCState *s)
+{
+    uint32_t freq;
+
+    /* FIXME: choose the correct clock depending on a register value */
+    freq = s5pc1xx_clk_getrate(s->clk) /
+           (s->tsadccon.b.prscen ? s->tsadccon.b.prscvl + 1: 1);
+    if (freq)
+        s->conversion_time =
+            muldiv64(s->tsdly & 0xFFFF, get_ticks_per_sec(), freq);
+
+    /* the driver takes one sample per conversion */
+    touch_input_set_period(s->conversion_time);
+}
+
+static void s5pc1xx_tsadc_clk_changed(void *opaque)
+{
+    s5pc1xx_tsadc_conversion_time((S5pc1xxTSADCState *)opaque);
+}
+
 static void s5pc1xx_tsadc_write(void *opaque, target_phys_addr_t offset,
                                 uint32_t val)
 {
@@ -250,11 +271,7 @@ static void s5pc1xx_tsadc_write(void *opaque, target_phys_addr_t offset,
         if (!s->tsadccon.b.read_start && s->tsadccon.b.enable_start)
             s5pc1xx_tsadc_conversion_start(s, s->conversion_time);
         s->tsadccon.b.enable_start = 0;
-        /* FIXME: choose the correct clock depending on a register value */
-        s->conversion_time =
-            muldiv64(s->tsdly & 0xFFFF, get_ticks_per_sec(),
-                     s5pc1xx_clk_getrate(s5pc1xx_findclk("pclk_66")) /
-                         (s->tsadccon.b.prscen ? s->tsadccon.b.prscvl + 1: 1));
+        s5pc1xx_tsadc_conversion_time(s);
         break;
     case 0x04:
         s->tscon.v = val;
@@ -266,11 +283,7 @@ static void s5pc1xx_tsadc_write(void *opaque, target_phys_addr_t offset,
         break;
     case 0x08:
         s->tsdly = val;
-        /* FIXME: choose the correct clock depending on a register value */
-        s->conversion_time =
-            muldiv64(s->tsdly & 0xFFFF, get_ticks_per_sec(),
-                     s5pc1xx_clk_getrate(s5pc1xx_findclk("pclk_66")) /
-                         (s->tsadccon.b.prscen ? s->tsadccon.b.prscvl + 1: 1));
+        s5pc1xx_tsadc_conversion_time(s);
         break;
     case 0x14:
         s->tspenstat.v = val;
@@ -364,8 +377,12 @@ static int s5pc1xx_tsadc_init1(SysBusDevice *dev)
     sysbus_init_irq(dev, &s->irq_adc);
     sysbus_init_irq(dev, &s->irq_pennd);
     s->timer = qemu_new_timer(vm_clock, s5pc1xx_tsadc_conversion, s);
+    qemu_timer_set_name(s->timer, "s5pc1xx,tsadc");
+
+    s->clk = s5pc1xx_findclk("pclk_66");
+    s5pc1xx_clk_subscribe(s->clk, s5pc1xx_tsadc_clk_changed, s);
 
-    qemu_add_mouse_event_handler(s5pc1xx_touchscreen_event, s, 1, name);
+    touch_input_add_mouse(s5pc1xx_touchscreen_event, s, name);
 
     return 0;
 }
@@ -7,11 +7,19 @@
 
 #include "sysbus.h"
 #include "qemu-char.h"
+#include "qemu-timer.h"
 #include "s5pc1xx.h"
 #include "s5pc1xx_gpio_regs.h"
 
 
-#define QUEUE_SIZE   257
+/* Largest FIFO among the channels (UART0) */
+#define QUEUE_SIZE   256
+
+/* Transmitted bytes are collected here and handed to the character
+ * device in one write */
+#define TX_BUF_SIZE  4096
+/* How long (ns) a transmitted byte may wait for others to join it */
+#define TX_DELAY     20000
 
 #define INT_RXD     (1 << 0)
 #define INT_ERROR   (1 << 1)
@@ -22,23 +30,29 @@
 #define TRSTATUS_BUFFER_EMPTY       (1 << 1)
 #define TRSTATUS_DATA_READY         (1 << 0)
 
-#define UFSTAT_RX_FIFO_FULL         (1 << 8)
+#define UERSTAT_OVERRUN             (1 << 0)
 
-#define UFCON_FIFO_ENABLED          (1 << 0)
-#define UFCON_TX_LEVEL_SHIFT        8
-#define UFCON_TX_LEVEL              (7 << UFCON_TX_LEVEL_SHIFT)
+#define UFSTAT_RX_FIFO_FULL         (1 << 8)
+#define UFSTAT_TX_COUNT_SHIFT       16
 
-#define UFSTAT_TX_COUNT_SHIT        16
-#define UFSTAT_TX_COUNT             (0xFF << UFSTAT_TX_COUNT_SHIT)
+#define UCON_RX_MODE(x)             ((x) & 3)
+#define UCON_TX_MODE(x)             (((x) >> 2) & 3)
+#define UCON_MODE_IRQ               1
+#define UCON_MODE_DMA               2
+#define UCON_RX_TIMEOUT             (1 << 7)
+#define UCON_RX_DMA_BURST(x)        (((x) >> 16) & 7)
 
-#define QI(x) ((x + 1) % QUEUE_SIZE)
-#define QD(x) ((x - 1 + QUEUE_SIZE) % QUEUE_SIZE)
+#define UFCON_FIFO_ENABLED          (1 << 0)
+#define UFCON_RX_RESET              (1 << 1)
+#define UFCON_TX_RESET              (1 << 2)
+#define UFCON_RX_LEVEL(x)           (((x) >> 4) & 7)
+#define UFCON_TX_LEVEL(x)           (((x) >> 8) & 7)
 
 #define S5PC1XX_UART_REG_MEM_SIZE 0x3C
 
 typedef struct UartQueue {
     uint8_t queue[QUEUE_SIZE];
-    uint32_t s, t;
+    uint32_t s, count;
     uint32_t size;
 } UartQueue;
 
@@ -47,6 +61,12 @@ typedef struct S5pc1xxUartState {
 
     UartQueue rx;
 
+    /* The last tx_count bytes of tx_buf are still in the TX FIFO */
+    uint8_t tx_buf[TX_BUF_SIZE];
+    uint32_t tx_len;
+    uint32_t tx_count;
+    QEMUTimer *tx_timer;
+
     uint32_t ulcon;
     uint32_t ucon;
     uint32_t ufcon;
@@ -65,33 +85,38 @@ typedef struct S5pc1xxUartState {
 
     CharDriverState *chr;
     qemu_irq irq;
+    qemu_irq dma_rx_stop;
+    qemu_irq dma_tx_stop;
     uint32_t instance;
 } S5pc1xxUartState;
 
 
 static inline int queue_elem_count(const UartQueue *s)
 {
-    if (s->t >= s->s) {
-        return s->t - s->s;
-    } else {
-        return QUEUE_SIZE - s->s + s->t;
-    }
-}
-
-static inline int queue_empty_count(const UartQueue *s)
-{
-    return s->size - queue_elem_count(s) - 1;
+    return s->count;
 }
 
 static inline int queue_empty(const UartQueue *s)
 {
-    return (queue_elem_count(s) == 0);
+    return (s->count == 0);
 }
 
-static inline void queue_push(UartQueue *s, uint8_t x)
+/* Store up to LEN bytes, return how many fitted in CAPACITY */
+static inline int queue_push_buf(UartQueue *s, const uint8_t *buf, int len,
+                                 int capacity)
 {
-    s->queue[s->t] = x;
-    s->t = QI(s->t);
+    int t, n;
+
+    len = MIN(len, capacity - (int)s->count);
+    if (len <= 0) {
+        return 0;
+    }
+    t = (s->s + s->count) % QUEUE_SIZE;
+    n = MIN(len, QUEUE_SIZE - t);
+    memcpy(s->queue + t, buf, n);
+    memcpy(s->queue, buf + n, len - n);
+    s->count += len;
+    return len;
 }
 
 static inline uint8_t queue_get(UartQueue *s)
@@ -99,25 +124,105 @@ static inline uint8_t queue_get(UartQueue *s)
     uint8_t ret;
 
     ret = s->queue[s->s];
-    s->s = QI(s->s);
+    s->s = (s->s + 1) % QUEUE_SIZE;
+    s->count--;
     return ret;
 }
 
 static inline void queue_reset(UartQueue *s)
 {
     s->s = 0;
-    s->t = 0;
+    s->count = 0;
+}
+
+/* Without the FIFO both directions hold a single character */
+static inline int s5pc1xx_uart_fifo_size(S5pc1xxUartState *s)
+{
+    return (s->ufcon & UFCON_FIFO_ENABLED) ? s->rx.size : 1;
+}
+
+/* Trigger levels step by 1/8 of the FIFO: the RX one from 1/8 to full,
+ * the TX one from empty to 7/8 */
+static int s5pc1xx_uart_rx_level(S5pc1xxUartState *s)
+{
+    if (!(s->ufcon & UFCON_FIFO_ENABLED)) {
+        return 1;
+    }
+    return (UFCON_RX_LEVEL(s->ufcon) + 1) * s->rx.size / 8;
+}
+
+static int s5pc1xx_uart_tx_level(S5pc1xxUartState *s)
+{
+    if (!(s->ufcon & UFCON_FIFO_ENABLED)) {
+        return 0;
+    }
+    return UFCON_TX_LEVEL(s->ufcon) * s->rx.size / 8;
+}
+
+static void s5pc1xx_uart_tx_flush(S5pc1xxUartState *s)
+{
+    if (s->tx_len) {
+        qemu_chr_write(s->chr, s->tx_buf, s->tx_len);
+    }
+    s->tx_len = 0;
+    s->tx_count = 0;
+    qemu_del_timer(s->tx_timer);
+}
+
+static void s5pc1xx_uart_tx(S5pc1xxUartState *s, uint8_t ch)
+{
+    /* What was in the FIFO went out with the rest */
+    if (s->tx_len == TX_BUF_SIZE) {
+        s5pc1xx_uart_tx_flush(s);
+    }
+    if (!s->tx_len) {
+        qemu_mod_timer(s->tx_timer, qemu_get_clock(vm_clock) + TX_DELAY);
+    }
+    s->tx_buf[s->tx_len++] = ch;
+
+    /* The line is faster than the guest: a FIFO that filled up has been
+     * shifted out by the time anybody could look at it */
+    if (++s->tx_count >= s5pc1xx_uart_fifo_size(s)) {
+        s->tx_count = 0;
+    }
 }
 
 static void s5pc1xx_uart_update(S5pc1xxUartState *s)
 {
-    if (s->ufcon && UFCON_FIFO_ENABLED) {
-        if (((s->ufstat && UFSTAT_TX_COUNT) >> UFSTAT_TX_COUNT_SHIT) <=
-            ((s->ufcon && UFCON_TX_LEVEL) >> UFCON_TX_LEVEL_SHIFT) * 2 ) {
-            s->uintsp |= INT_TXD;
-        }
+    int rx_count = queue_elem_count(&s->rx);
+    int rx_burst;
+
+    /* Received data sits in the FIFO only after the line went idle, so
+     * the RX timeout condition is met whenever the FIFO is not empty */
+    if (UCON_RX_MODE(s->ucon) == UCON_MODE_IRQ &&
+        (rx_count >= s5pc1xx_uart_rx_level(s) ||
+         (rx_count && (s->ucon & UCON_RX_TIMEOUT)))) {
+        s->uintsp |= INT_RXD;
+    }
+    if (UCON_TX_MODE(s->ucon) == UCON_MODE_IRQ &&
+        s->tx_count <= s5pc1xx_uart_tx_level(s)) {
+        s->uintsp |= INT_TXD;
+    }
+
+    if (rx_count) {
+        s->utrstat |= TRSTATUS_DATA_READY;
+    } else {
+        s->utrstat &= ~TRSTATUS_DATA_READY;
+    }
+    if (s->tx_count) {
+        s->utrstat &= ~(TRSTATUS_TRANSMITTER_READY | TRSTATUS_BUFFER_EMPTY);
+    } else {
+        s->utrstat |= TRSTATUS_TRANSMITTER_READY | TRSTATUS_BUFFER_EMPTY;
     }
 
+    /* DMA requests: RX once a whole burst is there, TX while the FIFO
+     * has room, which is always */
+    rx_burst = UCON_RX_DMA_BURST(s->ucon) ?
+               2 << UCON_RX_DMA_BURST(s->ucon) : 1;
+    qemu_set_irq(s->dma_rx_stop, UCON_RX_MODE(s->ucon) != UCON_MODE_DMA ||
+                                 rx_count < rx_burst);
+    qemu_set_irq(s->dma_tx_stop, UCON_TX_MODE(s->ucon) != UCON_MODE_DMA);
+
     s->uintp = s->uintsp & ~s->uintm;
     if (s->uintp) {
         qemu_irq_raise(s->irq);
@@ -126,6 +231,14 @@ static void s5pc1xx_uart_update(S5pc1xxUartState *s)
     }
 }
 
+static void s5pc1xx_uart_tx_timer(void *opaque)
+{
+    S5pc1xxUartState *s = (S5pc1xxUartState *)opaque;
+
+    s5pc1xx_uart_tx_flush(s);
+    s5pc1xx_uart_update(s);
+}
+
 /* Read UART by GPIO */
 static uint32_t s5pc1xx_uart_gpio_read(void *opaque,
                                        int io_index)
@@ -171,37 +284,36 @@ static uint32_t s5pc1xx_uart_mm_read(void *opaque, target_phys_addr_t offset)
     case 0x0C:
         return s->umcon;
     case 0x10:
+        /* Somebody waiting for the transmitter: let it finish */
+        if (s->tx_count) {
+            s->tx_count = 0;
+            s5pc1xx_uart_update(s);
+        }
         return s->utrstat;
     case 0x14:
         res = s->uerstat;
         s->uerstat = 0;
         return res;
     case 0x18:
-        s->ufstat = queue_elem_count(&s->rx) & 0xff;
-        if (queue_empty_count(&s->rx) == 0)
+        s->ufstat = (queue_elem_count(&s->rx) & 0xff) |
+                    (s->tx_count << UFSTAT_TX_COUNT_SHIFT);
+        if (queue_elem_count(&s->rx) == s->rx.size)
             s->ufstat |= UFSTAT_RX_FIFO_FULL;
         return s->ufstat;
     case 0x1C:
         return s->umstat;
     case 0x24:
-        if (s->ufcon & 1) {
-            if (! queue_empty(&s->rx)) {
-                res = queue_get(&s->rx);
-                if (queue_empty(&s->rx)) {
-                    s->utrstat &= ~TRSTATUS_DATA_READY;
-                } else {
-                    s->utrstat |= TRSTATUS_DATA_READY;
-                }
-            } else {
-                s->uintsp |= INT_ERROR;
-                s5pc1xx_uart_update(s);
-                res = 0;
+        if (!queue_empty(&s->rx)) {
+            s->urxh = queue_get(&s->rx);
+            if (queue_empty(&s->rx)) {
+                /* Room again for whatever the backend has been holding */
+                qemu_chr_accept_input(s->chr);
             }
-        } else {
-            s->utrstat &= ~TRSTATUS_DATA_READY;
-            res = s->urxh;
+        } else if (s->ufcon & UFCON_FIFO_ENABLED) {
+            s->uintsp |= INT_ERROR;
         }
-        return res;
+        s5pc1xx_uart_update(s);
+        return s->urxh;
     case 0x28:
         return s->ubrdiv;
     case 0x2C:
@@ -221,7 +333,6 @@ static uint32_t s5pc1xx_uart_mm_read(void *opaque, target_phys_addr_t offset)
 static void s5pc1xx_uart_mm_write(void *opaque, target_phys_addr_t offset,
                                   uint32_t val)
 {
-    uint8_t ch;
     S5pc1xxUartState *s = (S5pc1xxUartState *)opaque;
 
     switch (offset) {
@@ -233,22 +344,20 @@ static void s5pc1xx_uart_mm_write(void *opaque, target_phys_addr_t offset,
         break;
     case 0x08:
         s->ufcon = val;
-        if (val & 2) {
+        if (val & UFCON_RX_RESET) {
             queue_reset(&s->rx);
         }
-        s->ufcon &= ~6;
+        if (val & UFCON_TX_RESET) {
+            s->tx_len -= MIN(s->tx_count, s->tx_len);
+            s->tx_count = 0;
+        }
+        s->ufcon &= ~(UFCON_RX_RESET | UFCON_TX_RESET);
         break;
     case 0x0C:
         s->umcon = val;
         break;
     case 0x20:
-        if (s->chr) {
-            s->utrstat &= ~(TRSTATUS_TRANSMITTER_READY | TRSTATUS_BUFFER_EMPTY);
-            ch = (uint8_t)val;
-            qemu_chr_write(s->chr, &ch, 1);
-            s->utrstat |= TRSTATUS_TRANSMITTER_READY | TRSTATUS_BUFFER_EMPTY;
-            s->uintsp |= INT_TXD;
-        }
+        s5pc1xx_uart_tx(s, val);
         break;
     case 0x28:
         s->ubrdiv = val;
@@ -289,39 +398,16 @@ static int s5pc1xx_uart_can_receive(void *opaque)
 {
     S5pc1xxUartState *s = (S5pc1xxUartState *)opaque;
 
-    return queue_empty_count(&s->rx);
-}
-
-static void s5pc1xx_uart_trigger_level(S5pc1xxUartState *s)
-{
-    /* TODO: fix this */
-    if (! queue_empty(&s->rx)) {
-        s->uintsp |= INT_RXD;
-    }
+    return s5pc1xx_uart_fifo_size(s) - queue_elem_count(&s->rx);
 }
 
 static void s5pc1xx_uart_receive(void *opaque, const uint8_t *buf, int size)
 {
-    int i;
     S5pc1xxUartState *s = (S5pc1xxUartState *)opaque;
-    if (s->ufcon & 1) {
-        if (queue_empty_count(&s->rx) < size) {
-            for (i = 0; i < queue_empty_count(&s->rx); i++) {
-                queue_push(&s->rx, buf[i]);
-            }
-            s->uintp |= INT_ERROR;
-            s->utrstat |= TRSTATUS_DATA_READY;
-        } else {
-            for (i = 0; i < size; i++) {
-                queue_push(&s->rx, buf[i]);
-            }
-            s->utrstat |= TRSTATUS_DATA_READY;
-        }
-        s5pc1xx_uart_trigger_level(s);
-    } else {
-        s->urxh = buf[0];
-        s->uintsp |= INT_RXD;
-        s->utrstat |= TRSTATUS_DATA_READY;
+
+    if (queue_push_buf(&s->rx, buf, size, s5pc1xx_uart_fifo_size(s)) < size) {
+        s->uerstat |= UERSTAT_OVERRUN;
+        s->uintsp |= INT_ERROR;
     }
     s5pc1xx_uart_update(s);
 }
@@ -331,9 +417,10 @@ static void s5pc1xx_uart_event(void *opaque, int event)
     /* TODO: implement this */
 }
 
-static void s5pc1xx_uart_reset(void *opaque)
+static void s5pc1xx_uart_reset(DeviceState *d)
 {
-    S5pc1xxUartState *s = (S5pc1xxUartState *)opaque;
+    S5pc1xxUartState *s =
+        FROM_SYSBUS(S5pc1xxUartState, sysbus_from_qdev(d));
 
     s->ulcon    = 0;
     s->ucon     = 0;
@@ -349,10 +436,13 @@ static void s5pc1xx_uart_reset(void *opaque)
     s->uintsp   = 0;
     s->uintm    = 0;
     queue_reset(&s->rx);
+    s5pc1xx_uart_tx_flush(s);
+    s5pc1xx_uart_update(s);
 }
 
 DeviceState *s5pc1xx_uart_init(target_phys_addr_t base, int instance,
                                int queue_size, qemu_irq irq,
+                               qemu_irq dma_rx_stop, qemu_irq dma_tx_stop,
                                CharDriverState *chr)
 {
     DeviceState *dev = qdev_create(NULL, "s5pc1xx,uart");
@@ -368,6 +458,8 @@ DeviceState *s5pc1xx_uart_init(target_phys_addr_t base, int instance,
     qdev_init_nofail(dev);
     sysbus_mmio_map(sysbus_from_qdev(dev), 0, base);
     sysbus_connect_irq(sysbus_from_qdev(dev), 0, irq);
+    sysbus_connect_irq(sysbus_from_qdev(dev), 1, dma_rx_stop);
+    sysbus_connect_irq(sysbus_from_qdev(dev), 2, dma_tx_stop);
     return dev;
 }
 
@@ -376,9 +468,17 @@ static int s5pc1xx_uart_init1(SysBusDevice *dev)
     int iomemtype;
     S5pc1xxUartState *s = FROM_SYSBUS(S5pc1xxUartState, dev);
 
-    s5pc1xx_uart_reset(s);
+    if (s->rx.size < 8 || s->rx.size > QUEUE_SIZE) {
+        hw_error("s5pc1xx_uart: bad queue size %d\n", s->rx.size);
+    }
 
     sysbus_init_irq(dev, &s->irq);
+    sysbus_init_irq(dev, &s->dma_rx_stop);
+    sysbus_init_irq(dev, &s->dma_tx_stop);
+
+    s->tx_timer = qemu_new_timer(vm_clock, s5pc1xx_uart_tx_timer, s);
+    qemu_timer_set_name(s->tx_timer, "s5pc1xx,uart");
+    s5pc1xx_uart_reset(&s->busdev.qdev);
 
     qemu_chr_add_handlers(s->chr, s5pc1xx_uart_can_receive,
                           s5pc1xx_uart_receive, s5pc1xx_uart_event, s);
@@ -397,6 +497,7 @@ static SysBusDeviceInfo s5pc1xx_uart_info = {
     .init = s5pc1xx_uart_init1,
     .qdev.name  = "s5pc1xx,uart",
     .qdev.size  = sizeof(S5pc1xxUartState),
+    .qdev.reset = s5pc1xx_uart_reset,
     .qdev.props = (Property[]) {
         DEFINE_PROP_UINT32("instance",   S5pc1xxUartState, instance, 0),
         DEFINE_PROP_UINT32("queue-size", S5pc1xxUartState, rx.size, 16),
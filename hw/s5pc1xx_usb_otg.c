@@ -69,6 +69,11 @@
 #define OTG_EP_DISABLE      (1 << 30)
 
 #define OTG_EP_COUNT        16
+#define OTG_EP_MPS(ctrl)    ((ctrl) & 0x7ff) /* Maximum packet size */
+
+#define OTG_FRAME_MAX       1600
+#define OTG_RX_QUEUE_LEN    16  /* Frames held while no OUT transfer is armed */
+#define OTG_TX_IOV_MAX      8
 
 
 typedef enum {
@@ -135,9 +140,20 @@ typedef struct S5pc1xxUsbOtgState {
     NICState *nic;
     NICConf conf;
     qemu_irq irq;
-    uint8_t buf[1600];
-    uint32_t buf_size;
-    uint8_t buf_full;
+
+    /* Frames from the network waiting for OUT transfers.  When the queue
+     * is full the net layer holds on to further ones. */
+    struct S5pc1xxUsbOtgRxFrame {
+        uint8_t data[OTG_FRAME_MAX];
+        uint32_t size;
+        uint32_t done;          /* bytes already handed to the guest */
+    } rx_queue[OTG_RX_QUEUE_LEN];
+    uint32_t rx_head;
+    uint32_t rx_count;
+
+    /* Head of a frame that the guest sends in several IN transfers */
+    uint8_t tx_buf[OTG_FRAME_MAX];
+    uint32_t tx_size;
 } S5pc1xxUsbOtgState;
 
 
@@ -188,7 +204,12 @@ static void s5pc1xx_usb_otg_initial_reset(S5pc1xxUsbOtgState *s)
     }
 
     s->state = OTG_STATE_START;
-    s->buf_full = 0;
+    s->rx_head = 0;
+    s->rx_count = 0;
+    s->tx_size = 0;
+    if (s->nic) {
+        qemu_flush_queued_packets(&s->nic->nc);
+    }
 }
 
 static void s5pc1xx_usb_otg_reset(S5pc1xxUsbOtgState *s)
@@ -323,32 +344,105 @@ static void s5pc1xx_usb_otg_act(S5pc1xxUsbOtgState *s)
     }
 }
 
+static void s5pc1xx_usb_otg_tx_copy(S5pc1xxUsbOtgState *s,
+                                    target_phys_addr_t addr, uint32_t size)
+{
+    if (s->tx_size + size > OTG_FRAME_MAX) {
+        size = OTG_FRAME_MAX - s->tx_size;
+    }
+    cpu_physical_memory_read(addr, s->tx_buf + s->tx_size, size);
+    s->tx_size += size;
+}
+
+/* A transfer that ends on a packet boundary does not end the frame, the
+ * rest of it comes in the next transfers (a zero length one if nothing is
+ * left).  The end of the frame is sent straight from guest memory. */
 static void s5pc1xx_usb_otg_data_tx(S5pc1xxUsbOtgEndPoint *s)
 {
-    uint8_t buf[1600];
+    S5pc1xxUsbOtgState *p = s->parent;
+    struct iovec iov[OTG_TX_IOV_MAX];
+    target_phys_addr_t addr = s->dma_addr, len;
     uint32_t size = s->transfer_size & 0x7ffff;
+    uint32_t mps = OTG_EP_MPS(s->ctrl);
+    int i, n = 0;
+
+    if (mps && size && !(size % mps)) {
+        s5pc1xx_usb_otg_tx_copy(p, addr, size);
+        goto done;
+    }
+
+    if (p->tx_size) {
+        iov[n].iov_base = p->tx_buf;
+        iov[n].iov_len = p->tx_size;
+        n++;
+    }
+    while (size && n < OTG_TX_IOV_MAX) {
+        len = size;
+        iov[n].iov_base = cpu_physical_memory_map(addr, &len, 0);
+        if (!iov[n].iov_base) {
+            break;
+        }
+        iov[n].iov_len = len;
+        addr += len;
+        size -= len;
+        n++;
+    }
+
+    if (!size) {
+        if (n) {
+            qemu_sendv_packet(&p->nic->nc, iov, n);
+        }
+    } else {
+        /* Could not map all of it, fall back to a copy */
+        for (i = 0; i < n; i++) {
+            if (iov[i].iov_base != p->tx_buf) {
+                len = MIN(iov[i].iov_len, OTG_FRAME_MAX - p->tx_size);
+                memcpy(p->tx_buf + p->tx_size, iov[i].iov_base, len);
+                p->tx_size += len;
+            }
+        }
+        s5pc1xx_usb_otg_tx_copy(p, addr, size);
+        qemu_send_packet(&p->nic->nc, p->tx_buf, p->tx_size);
+    }
 
-    cpu_physical_memory_read(s->dma_addr, buf, size);
-    qemu_send_packet(&s->parent->nic->nc, buf, size);
+    for (i = 0; i < n; i++) {
+        if (iov[i].iov_base != p->tx_buf) {
+            cpu_physical_memory_unmap(iov[i].iov_base, iov[i].iov_len,
+                                      0, iov[i].iov_len);
+        }
+    }
+    p->tx_size = 0;
+
+done:
     s->interrupt |= EP_INT_XFERCOMPL|EP_INT_TXFEMP;
     s5pc1xx_usb_otg_ep_update_irq(s);
 }
 
+/* Hand the oldest received frame to an armed OUT endpoint.  A frame that
+ * does not fit in the transfer is split on a packet boundary and the rest
+ * goes to the next transfer. */
 static void s5pc1xx_usb_otg_data_rx(S5pc1xxUsbOtgEndPoint *s)
 {
-    uint32_t size = s->parent->buf_size;
-
-    if (s->parent->buf_size > (s->transfer_size & 0x7ffff)) {
-        s->parent->buf_full = 0;
-        /* Packet dropped */
-        return ;
+    S5pc1xxUsbOtgState *p = s->parent;
+    struct S5pc1xxUsbOtgRxFrame *f = &p->rx_queue[p->rx_head];
+    uint32_t size = f->size - f->done;
+    uint32_t avail = s->transfer_size & 0x7ffff;
+    uint32_t mps = OTG_EP_MPS(s->ctrl);
+
+    if (size > avail) {
+        size = (mps && avail >= mps) ? avail - avail % mps : avail;
     }
-    cpu_physical_memory_write(s->dma_addr, s->parent->buf, size);
+    cpu_physical_memory_write(s->dma_addr, f->data + f->done, size);
     s->dma_buf = s->dma_addr + size;
     s->transfer_size -= size;
     s->ctrl &= ~OTG_EP_ENABLE;
     s->interrupt |= EP_INT_XFERCOMPL;
-    s->parent->buf_full = 0;
+
+    f->done += size;
+    if (f->done == f->size) {
+        p->rx_head = (p->rx_head + 1) % OTG_RX_QUEUE_LEN;
+        p->rx_count--;
+    }
     s5pc1xx_usb_otg_ep_update_irq(s);
 }
 
@@ -375,6 +469,8 @@ static uint32_t s5pc1xx_usb_otg_ep_read(S5pc1xxUsbOtgEndPoint *s,
 static uint32_t s5pc1xx_usb_otg_ep_write(S5pc1xxUsbOtgEndPoint *s,
                                          target_phys_addr_t addr, uint32_t val)
 {
+    int full;
+
     switch (addr) {
     case 0x00:
         if ((val & OTG_EP_DISABLE) && (s->ctrl & OTG_EP_ENABLE)) {
@@ -400,9 +496,13 @@ static uint32_t s5pc1xx_usb_otg_ep_write(S5pc1xxUsbOtgEndPoint *s,
                 val &= ~OTG_EP_ENABLE;
             }
             if (s->n != 0 && s->dir == OTG_EP_DIR_OUT &&
-                s->parent->buf_full == 1) {
+                s->parent->rx_count) {
+                full = s->parent->rx_count == OTG_RX_QUEUE_LEN;
                 s5pc1xx_usb_otg_data_rx(s);
                 val &= ~OTG_EP_ENABLE;
+                if (full) {
+                    qemu_flush_queued_packets(&s->parent->nic->nc);
+                }
             }
         }
         val &= ~(0xC << 24); /* TODO: handle NAK? */
@@ -605,22 +705,32 @@ static int s5pc1xx_usb_otg_can_receive(VLANClientState *nc)
 {
     S5pc1xxUsbOtgState *s = (DO_UPCAST(NICState, nc, nc))->opaque;
 
-    return !s->buf_full;
+    return s->rx_count < OTG_RX_QUEUE_LEN;
 }
 
 static ssize_t s5pc1xx_usb_otg_receive(VLANClientState *nc, const uint8_t *buf,
                                        size_t size)
 {
     S5pc1xxUsbOtgState *s = (DO_UPCAST(NICState, nc, nc))->opaque;
+    struct S5pc1xxUsbOtgRxFrame *f;
     int i;
 
-    s->buf_full = 1;
-    s->buf_size = size;
-    memcpy(s->buf, buf, size);
-    for (i = 0; i < OTG_EP_COUNT; i++) {
+    if (s->rx_count == OTG_RX_QUEUE_LEN) {
+        return 0;
+    }
+    if (size > OTG_FRAME_MAX) {
+        /* Frame dropped */
+        return size;
+    }
+
+    f = &s->rx_queue[(s->rx_head + s->rx_count++) % OTG_RX_QUEUE_LEN];
+    f->size = size;
+    f->done = 0;
+    memcpy(f->data, buf, size);
+
+    for (i = 1; i < OTG_EP_COUNT && s->rx_count; i++) {
         if (s->ep_out[i].ctrl & OTG_EP_ENABLE) {
             s5pc1xx_usb_otg_data_rx(&s->ep_out[i]);
-            break;
         }
     }
     return size;
@@ -31,6 +31,7 @@ typedef struct S5pc1xxWDTState {
     uint32_t  regs[WTCNT + 1];
 
     QEMUTimer *wdt_timer;
+    S5pc1xxClk clk;
     uint32_t  freq_out;
     uint64_t  ticnto_last_tick;
 } S5pc1xxWDTState;
@@ -60,23 +61,50 @@ static void s5pc1xx_wdt_tick(void *opaque)
     }
 }
 
-/* Perform timer step, update frequency and compute next time for update */
-static void s5pc1xx_wdt_update(S5pc1xxWDTState *s)
+/* pclk_66 after the prescaler and the division factor */
+static uint32_t s5pc1xx_wdt_freq(S5pc1xxWDTState *s)
 {
     short div_fac;
     short prescaler;
-    S5pc1xxClk clk;
 
-    clk = s5pc1xx_findclk("pclk_66");
     div_fac = 16 << (s->regs[WTCON] >> CLK_SEL_SHIFT & 0x3);
     prescaler = s->regs[WTCON] >> PRESCALER_SHIFT & 0xff;
 
-    s->freq_out = s5pc1xx_clk_getrate(clk) / (prescaler + 1) / div_fac;
+    return s5pc1xx_clk_getrate(s->clk) / (prescaler + 1) / div_fac;
+}
+
+/* Perform timer step, update frequency and compute next time for update */
+static void s5pc1xx_wdt_update(S5pc1xxWDTState *s)
+{
+    s->freq_out = s5pc1xx_wdt_freq(s);
 
     if (!s->freq_out)
         hw_error("s5pc1xx_wdt: timer update input frequency is zero\n");
 }
 
+/* pclk_66 changed, the next period is counted at the new rate */
+static void s5pc1xx_wdt_clk_changed(void *opaque)
+{
+    S5pc1xxWDTState *s = (S5pc1xxWDTState *)opaque;
+    uint32_t old_freq = s->freq_out;
+
+    /* the count stops while the divided clock is, and starts a new
+     * period when it comes back */
+    if (!s5pc1xx_wdt_freq(s)) {
+        s->freq_out = 0;
+        s->ticnto_last_tick = 0;
+        qemu_del_timer(s->wdt_timer);
+        return;
+    }
+
+    s5pc1xx_wdt_update(s);
+    if (!old_freq && (s->regs[WTCON] & WDT_EN)) {
+        s->ticnto_last_tick = qemu_get_clock(vm_clock);
+        qemu_mod_timer(s->wdt_timer, s->ticnto_last_tick +
+            muldiv64(s->regs[WTDAT], get_ticks_per_sec(), s->freq_out));
+    }
+}
+
 /* WDT read */
 static uint32_t s5pc1xx_wdt_read(void *opaque, target_phys_addr_t offset)
 {
@@ -151,6 +179,10 @@ static int s5pc1xx_wdt_init(SysBusDevice *dev)
     sysbus_init_mmio(dev, S5PC1XX_WDT_REG_MEM_SIZE, iomemtype);
 
     s->wdt_timer = qemu_new_timer(vm_clock, s5pc1xx_wdt_tick, s);
+    qemu_timer_set_name(s->wdt_timer, "s5pc1xx,wdt");
+
+    s->clk = s5pc1xx_findclk("pclk_66");
+    s5pc1xx_clk_subscribe(s->clk, s5pc1xx_wdt_clk_changed, s);
 
     s->regs[WTDAT] = 0x00008000;
     s->regs[WTCNT] = 0x00008000;
@@ -1348,6 +1348,11 @@ static void sd_blk_read(SDState *sd, uint64_t addr, uint32_t len)
 
     DPRINTF("sd_blk_read: addr = 0x%08llx, len = %d\n",
             (unsigned long long) addr, len);
+    if (sd->bdrv && !(addr & 511) && len == 512) {
+        if (bdrv_read(sd->bdrv, addr >> 9, sd->data, 1) == -1)
+            fprintf(stderr, "sd_blk_read: read error on host side\n");
+        return;
+    }
     if (!sd->bdrv || bdrv_read(sd->bdrv, addr >> 9, sd->buf, 1) == -1) {
         fprintf(stderr, "sd_blk_read: read error on host side\n");
         return;
@@ -1641,6 +1646,144 @@ uint8_t sd_read_data(SDState *sd)
     return ret;
 }
 
+/* Bulk variants of sd_read_data()/sd_write_data().  Whole 512-byte
+   blocks of a CMD11/17/18/24/25 transfer can be claimed by the caller
+   and moved between memory and the block device in one go; the card
+   state is advanced exactly as the equivalent single-byte calls would
+   have done.  Anything else (partial blocks, odd block lengths,
+   register reads) takes the byte path.  */
+static int sd_bulk_ok(SDState *sd, int state)
+{
+    if (!sd->bdrv || !bdrv_is_inserted(sd->bdrv) || !sd->enable)
+        return 0;
+    if (sd->state != state || sd->data_offset != 0)
+        return 0;
+    if (sd->card_status & (ADDRESS_ERROR | WP_VIOLATION))
+        return 0;
+    return (sd->data_start & 511) == 0;
+}
+
+static int sd_claim_read(SDState *sd, int len)
+{
+    int io_len, nb, max;
+
+    io_len = (sd->ocr & (1 << 30)) ? 512 : sd->blk_len;
+    if (len < 512 || io_len != 512 ||
+        !sd_bulk_ok(sd, sd_sendingdata_state) ||
+        sd->data_start + 512 > sd->size)
+        return 0;
+
+    switch (sd->current_cmd) {
+    case 17:	/* CMD17:  READ_SINGLE_BLOCK */
+        sd->state = sd_transfer_state;
+        return 1;
+
+    case 11:	/* CMD11:  READ_DAT_UNTIL_STOP */
+    case 18:	/* CMD18:  READ_MULTIPLE_BLOCK */
+        max = (sd->size - sd->data_start) >> 9;
+        nb = len >> 9;
+        if (nb > max)
+            nb = max;
+        sd->data_start += nb << 9;
+        if (sd->data_start + 512 > sd->size)
+            sd->card_status |= ADDRESS_ERROR;
+        return nb;
+
+    default:
+        return 0;
+    }
+}
+
+static int sd_claim_write(SDState *sd, int len)
+{
+    uint64_t addr;
+    int nb;
+
+    if (len < 512 || sd->blk_len != 512 ||
+        !sd_bulk_ok(sd, sd_receivingdata_state))
+        return 0;
+
+    switch (sd->current_cmd) {
+    case 24:	/* CMD24:  WRITE_SINGLE_BLOCK */
+        sd->blk_written ++;
+        sd->csd[14] |= 0x40;
+        sd->state = sd_transfer_state;
+        return 1;
+
+    case 25:	/* CMD25:  WRITE_MULTIPLE_BLOCK */
+        /* Stop at the first block that would flag an error.  */
+        nb = 1;
+        addr = sd->data_start + 512;
+        while (((nb + 1) << 9) <= len && addr + 512 <= sd->size &&
+               !sd_wp_addr(sd, addr)) {
+            nb ++;
+            addr += 512;
+        }
+        sd->blk_written += nb;
+        if (nb > 1)
+            sd->csd[14] |= 0x40;
+        sd->data_start = addr;
+        if (addr + 512 > sd->size) {
+            sd->card_status |= ADDRESS_ERROR;
+            sd->state = sd_programming_state;
+        } else if (sd_wp_addr(sd, addr)) {
+            sd->card_status |= WP_VIOLATION;
+            sd->state = sd_programming_state;
+        } else
+            sd->csd[14] |= 0x40;
+        return nb;
+
+    default:
+        return 0;
+    }
+}
+
+/* Claim the leading whole blocks of a LEN-byte data transfer.  Returns
+   the number of bytes claimed and stores the first sector in *SECTOR;
+   the caller is then responsible for moving that data to or from the
+   card's block device.  */
+int sd_claim_blocks(SDState *sd, int is_write, int len, int64_t *sector)
+{
+    *sector = sd->data_start >> 9;
+    return (is_write ? sd_claim_write(sd, len) : sd_claim_read(sd, len)) << 9;
+}
+
+void sd_read_block(SDState *sd, uint8_t *buf, int len)
+{
+    int64_t sector;
+    int n;
+
+    while ((n = sd_claim_blocks(sd, 0, len, &sector)) > 0) {
+        DPRINTF("sd_read_block: sector = %lld, %d bytes\n",
+                (long long) sector, n);
+        if (bdrv_read(sd->bdrv, sector, buf, n >> 9) == -1)
+            fprintf(stderr, "sd_read_block: read error on host side\n");
+        buf += n;
+        len -= n;
+    }
+
+    while (len-- > 0)
+        *buf++ = sd_read_data(sd);
+}
+
+void sd_write_block(SDState *sd, const uint8_t *buf, int len)
+{
+    int64_t sector;
+    int n;
+
+    while ((n = sd_claim_blocks(sd, 1, len, &sector)) > 0) {
+        DPRINTF("sd_write_block: sector = %lld, %d bytes\n",
+                (long long) sector, n);
+        if (bdrv_write(sd->bdrv, sector, buf, n >> 9) == -1)
+            fprintf(stderr, "sd_write_block: write error on host side\n");
+        buf += n;
+        len -= n;
+    }
+
+    while (len-- > 0)
+        sd_write_data(sd, *buf++);
+}
+
 int sd_data_ready(SDState *sd)
 {
     return sd->state == sd_sendingdata_state;
@@ -72,6 +72,9 @@ int sd_do_command(SDState *sd, SDRequest *req,
                   uint8_t *response);
 void sd_write_data(SDState *sd, uint8_t value);
 uint8_t sd_read_data(SDState *sd);
+void sd_write_block(SDState *sd, const uint8_t *buf, int len);
+void sd_read_block(SDState *sd, uint8_t *buf, int len);
+int sd_claim_blocks(SDState *sd, int is_write, int len, int64_t *sector);
 void sd_set_cb(SDState *sd, qemu_irq readonly, qemu_irq insert);
 int sd_data_ready(SDState *sd);
 void sd_enable(SDState *sd, int enable);
@@ -0,0 +1,341 @@
+/*
+ * Coalescing input queue for touch controllers
+ *
+ * A fast host mouse produces many more motion events than a touch panel
+ * reports, and each one would cost the guest an interrupt and an I2C or
+ * ADC transaction.  Touch controllers register here rather than with
+ * the console.  Host events go through one queue, consecutive motion is
+ * merged, and at most one pointer event per sampling period of vm_clock
+ * is handed on.  Key events share the queue but are never merged nor
+ * held back: one behind a pointer event that waits for its sample goes
+ * first.  Keys keep their order against each other.
+ *
+ * Host input can be recorded to a text trace and played back at a fixed
+ * rate, which makes UI benchmarks repeatable:
+ *   m <device> <x> <y> <z> <buttons>
+ *   k <keycode>
+ *
+ * This code is licensed under the GNU GPL v2.
+ */
+
+#include "hw.h"
+#include "console.h"
+#include "monitor.h"
+#include "qemu-timer.h"
+
+#define TOUCH_QUEUE_LEN         64
+#define TOUCH_MAX_SINKS         8
+
+/* Sampling period (ns) until the guest programs one, and the shortest
+ * one accepted: no panel reports faster than 1 kHz */
+#define TOUCH_DEFAULT_PERIOD    10000000
+#define TOUCH_MIN_PERIOD        1000000
+
+#define TOUCH_REPLAY_RATE       100
+
+typedef struct TouchSink {
+    QEMUPutMouseEvent *func;
+    void *opaque;
+    int buttons;                /* state in the last queued event */
+} TouchSink;
+
+typedef struct TouchEvent {
+    TouchSink *sink;            /* NULL for a key event */
+    int x, y, z, buttons;
+    int keycode;
+    int motion;                 /* buttons unchanged, may be merged */
+} TouchEvent;
+
+static struct {
+    TouchSink sinks[TOUCH_MAX_SINKS];
+    int nb_sinks;
+    QEMUPutKBDEvent *kbd_func;
+    void *kbd_opaque;
+
+    TouchEvent queue[TOUCH_QUEUE_LEN];
+    int head, count;
+    QEMUTimer *timer;
+    int64_t period;
+    int64_t next_sample;        /* no pointer event before this time */
+
+    uint64_t received, delivered, merged, dropped;
+
+    FILE *record;
+    FILE *replay;
+    QEMUTimer *replay_timer;
+    int64_t replay_interval;
+    int64_t replay_next;
+    uint64_t replayed;
+} touch;
+
+/* Hand on the queued key events, leaving the pointer events in order */
+static void touch_input_run_keys(void)
+{
+    TouchEvent *ev;
+    int i, n = 0;
+
+    for (i = 0; i < touch.count; i++) {
+        ev = &touch.queue[(touch.head + i) % TOUCH_QUEUE_LEN];
+        if (ev->sink)
+            touch.queue[(touch.head + n++) % TOUCH_QUEUE_LEN] = *ev;
+        else
+            touch.kbd_func(touch.kbd_opaque, ev->keycode);
+    }
+    touch.count = n;
+}
+
+/* Hand on everything at the head of the queue which is due, and keys
+ * wherever they are */
+static void touch_input_run(void)
+{
+    int64_t now = qemu_get_clock(vm_clock);
+    TouchEvent *ev;
+
+    while (touch.count) {
+        ev = &touch.queue[touch.head];
+        if (ev->sink) {
+            if (now < touch.next_sample) {
+                touch_input_run_keys();
+                break;
+            }
+            touch.next_sample = now + touch.period;
+            ev->sink->func(ev->sink->opaque, ev->x, ev->y, ev->z,
+                           ev->buttons);
+            touch.delivered++;
+        } else {
+            touch.kbd_func(touch.kbd_opaque, ev->keycode);
+        }
+        touch.head = (touch.head + 1) % TOUCH_QUEUE_LEN;
+        touch.count--;
+    }
+
+    if (touch.count)
+        qemu_mod_timer(touch.timer, touch.next_sample);
+}
+
+static void touch_input_tick(void *opaque)
+{
+    touch_input_run();
+}
+
+static TouchEvent *touch_input_tail(void)
+{
+    if (!touch.count)
+        return NULL;
+    return &touch.queue[(touch.head + touch.count - 1) % TOUCH_QUEUE_LEN];
+}
+
+static void touch_input_push(TouchEvent *ev)
+{
+    if (touch.count == TOUCH_QUEUE_LEN) {
+        touch.dropped++;
+        return;
+    }
+    touch.queue[(touch.head + touch.count) % TOUCH_QUEUE_LEN] = *ev;
+    touch.count++;
+    touch_input_run();
+}
+
+static void touch_input_queue_mouse(TouchSink *sink,
+                                    int x, int y, int z, int buttons_state)
+{
+    TouchEvent ev, *tail;
+
+    touch.received++;
+    ev.sink = sink;
+    ev.x = x;
+    ev.y = y;
+    ev.z = z;
+    ev.buttons = buttons_state;
+    ev.keycode = 0;
+    ev.motion = buttons_state == sink->buttons;
+    sink->buttons = buttons_state;
+
+    /* Only the last position of a run of motion reaches the device;
+     * presses and releases keep theirs */
+    tail = touch_input_tail();
+    if (ev.motion && tail && tail->motion && tail->sink == sink) {
+        tail->x = x;
+        tail->y = y;
+        tail->z = z;
+        touch.merged++;
+        return;
+    }
+    touch_input_push(&ev);
+}
+
+static void touch_input_queue_key(int keycode)
+{
+    TouchEvent ev;
+
+    if (!touch.kbd_func)
+        return;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.keycode = keycode;
+    touch_input_push(&ev);
+}
+
+static void touch_input_mouse_event(void *opaque,
+                                    int x, int y, int z, int buttons_state)
+{
+    TouchSink *sink = (TouchSink *)opaque;
+
+    /* The host is not listened to while a trace plays */
+    if (touch.replay)
+        return;
+    if (touch.record)
+        fprintf(touch.record, "m %d %d %d %d %d\n",
+                (int) (sink - touch.sinks), x, y, z, buttons_state);
+    touch_input_queue_mouse(sink, x, y, z, buttons_state);
+}
+
+static void touch_input_kbd_event(void *opaque, int keycode)
+{
+    if (touch.replay)
+        return;
+    if (touch.record)
+        fprintf(touch.record, "k %d\n", keycode);
+    touch_input_queue_key(keycode);
+}
+
+static void touch_input_init(void)
+{
+    if (touch.timer)
+        return;
+
+    touch.period = TOUCH_DEFAULT_PERIOD;
+    touch.timer = qemu_new_timer(vm_clock, touch_input_tick, NULL);
+    qemu_timer_set_name(touch.timer, "touch-input");
+}
+
+/* Register an absolute pointer device; it gets its events through the
+ * queue but is listed and selected with "mouse_set" as usual */
+QEMUPutMouseEntry *touch_input_add_mouse(QEMUPutMouseEvent *func,
+                                         void *opaque, const char *name)
+{
+    TouchSink *sink;
+
+    if (touch.nb_sinks == TOUCH_MAX_SINKS)
+        hw_error("touch_input: too many touch devices\n");
+
+    touch_input_init();
+    sink = &touch.sinks[touch.nb_sinks++];
+    sink->func = func;
+    sink->opaque = opaque;
+    return qemu_add_mouse_event_handler(touch_input_mouse_event, sink, 1,
+                                        name);
+}
+
+void touch_input_add_kbd(QEMUPutKBDEvent *func, void *opaque)
+{
+    touch_input_init();
+    touch.kbd_func = func;
+    touch.kbd_opaque = opaque;
+    qemu_add_kbd_event_handler(touch_input_kbd_event, NULL);
+}
+
+/* The guest driver samples the panel every PERIOD ns, 0 if unknown */
+void touch_input_set_period(int64_t period)
+{
+    touch_input_init();
+    if (!period)
+        period = TOUCH_DEFAULT_PERIOD;
+    touch.period = MAX(period, TOUCH_MIN_PERIOD);
+}
+
+static void touch_input_replay_stop(void)
+{
+    if (!touch.replay)
+        return;
+    qemu_del_timer(touch.replay_timer);
+    fclose(touch.replay);
+    touch.replay = NULL;
+}
+
+/* Queue the next record of the trace */
+static void touch_input_replay_tick(void *opaque)
+{
+    char line[64];
+    int n, x, y, z, buttons;
+
+    while (fgets(line, sizeof(line), touch.replay)) {
+        if (sscanf(line, "m %d %d %d %d %d", &n, &x, &y, &z, &buttons) == 5) {
+            if (n >= 0 && n < touch.nb_sinks)
+                touch_input_queue_mouse(&touch.sinks[n], x, y, z, buttons);
+        } else if (sscanf(line, "k %d", &n) == 1) {
+            touch_input_queue_key(n);
+        } else {
+            continue;
+        }
+
+        touch.replayed++;
+        touch.replay_next += touch.replay_interval;
+        qemu_mod_timer(touch.replay_timer, touch.replay_next);
+        return;
+    }
+
+    touch_input_replay_stop();
+}
+
+void do_touch_record(Monitor *mon, const QDict *qdict)
+{
+    const char *path = qdict_get_try_str(qdict, "path");
+
+    if (touch.record) {
+        fclose(touch.record);
+        touch.record = NULL;
+    }
+    if (!path)
+        return;
+
+    touch.record = fopen(path, "w");
+    if (!touch.record)
+        monitor_printf(mon, "could not open '%s'\n", path);
+}
+
+void do_touch_replay(Monitor *mon, const QDict *qdict)
+{
+    const char *path = qdict_get_try_str(qdict, "path");
+    int rate = qdict_get_try_int(qdict, "rate", TOUCH_REPLAY_RATE);
+
+    touch_input_replay_stop();
+    if (!path)
+        return;
+
+    if (rate <= 0) {
+        monitor_printf(mon, "invalid rate %d\n", rate);
+        return;
+    }
+    touch.replay = fopen(path, "r");
+    if (!touch.replay) {
+        monitor_printf(mon, "could not open '%s'\n", path);
+        return;
+    }
+
+    if (!touch.replay_timer) {
+        touch.replay_timer =
+            qemu_new_timer(vm_clock, touch_input_replay_tick, NULL);
+        qemu_timer_set_name(touch.replay_timer, "touch-replay");
+    }
+    touch.replay_interval = get_ticks_per_sec() / rate;
+    touch.replay_next = qemu_get_clock(vm_clock);
+    touch.replayed = 0;
+    touch_input_replay_tick(NULL);
+}
+
+void do_info_touch(Monitor *mon)
+{
+    monitor_printf(mon, "sampling period %" PRId64 " us\n",
+                   touch.period / 1000);
+    monitor_printf(mon, "pointer events: %" PRIu64 " received, %" PRIu64
+                   " delivered, %" PRIu64 " merged, %" PRIu64 " dropped\n",
+                   touch.received, touch.delivered, touch.merged,
+                   touch.dropped);
+    if (touch.record)
+        monitor_printf(mon, "recording\n");
+    if (touch.replay)
+        monitor_printf(mon, "replaying, %" PRIu64 " records at %" PRId64
+                       "/s\n", touch.replayed,
+                       get_ticks_per_sec() / touch.replay_interval);
+}
@@ -9,6 +9,7 @@
 
 #include "i2c-addressable.h"
 #include "audio/audio.h"
+#include "monitor.h"
 #include "wm8994_reg.h"
 
 
@@ -22,14 +23,12 @@ typedef struct WM8994State {
     uint16_t registers[WM8994_REGISTER_MEM_SIZE];
 
     void (*data_req)(void *, int);
+    void (*info)(Monitor *, void *);
     void *opaque;
 
     SWVoiceOut *dac_voice;
     QEMUSoundCard card;
-
-    uint8_t data_out[4 * 4096]; /* magic */
-
-    int idx_out, req_out;
+    int active;                 /* the audio interface is sending samples */
 } WM8994State;
 
 
@@ -87,34 +86,25 @@ static inline audfmt_e wm8994_format(WM8994State *s, uint16_t reg)
     }
 }
 
-static inline void wm8994_out_flush(WM8994State *s)
+/* The audio interface writes straight to the voice from its own buffer */
+static void wm8994_audio_out_cb(void *opaque, int free_b)
 {
-    int sent = 0;
-
-    if (!s->dac_voice)
-        return;
-    while (sent < s->idx_out) {
-        sent +=
-            AUD_write(s->dac_voice, s->data_out + sent, s->idx_out - sent) ?:
-            s->idx_out;
+    WM8994State *s = (WM8994State *) opaque;
+
+    if (s->data_req) {
+        s->data_req(s->opaque, free_b);
     }
-    s->idx_out = 0;
 }
 
-static void wm8994_audio_out_cb(void *opaque, int free_b)
+static void wm8994_card_info(Monitor *mon, void *opaque)
 {
     WM8994State *s = (WM8994State *) opaque;
 
-    if (s->idx_out >= free_b) {
-        s->idx_out = free_b;
-        s->req_out = 0;
-        wm8994_out_flush(s);
-    } else {
-        s->req_out = free_b - s->idx_out;
-    }
-
-    if (s->data_req) {
-        s->data_req(s->opaque, s->req_out >> 2);
+    monitor_printf(mon, "  speaker: %s, %d Hz\n",
+                   s->dac_voice && s->active ? "active" : "inactive",
+                   wm8994_rate(s, WM8994_AIF1_RATE));
+    if (s->info) {
+        s->info(mon, s->opaque);
     }
 }
 
@@ -131,8 +121,6 @@ static void wm8994_set_format(WM8994State *s)
 {
     struct audsettings out_fmt;
 
-    wm8994_out_flush(s);
-
     if (s->dac_voice) {
         AUD_set_active_out(s->dac_voice, 0);
     }
@@ -154,7 +142,7 @@ static void wm8994_set_format(WM8994State *s)
     wm8994_vol_update(s);
 
     if (s->dac_voice) {
-        AUD_set_active_out(s->dac_voice, 1);
+        AUD_set_active_out(s->dac_voice, s->active);
     }
 }
 
@@ -170,10 +158,6 @@ static void wm8994_reset(WM8994State *s)
 
     s->registers[WM8994_AIF1_RATE] = 0x73;
 
-    s->idx_out = 0;
-    s->req_out = 0;
-    s->opaque = NULL;
-    s->data_req = NULL;
     s->dac_voice = NULL;
 
     wm8994_set_format(s);
@@ -233,48 +217,42 @@ static void wm8994_write(void *opaque, uint32_t address, uint8_t offset,
     }
 }
 
+/* DATA_REQ is called with the number of bytes the voice can take, INFO
+ * adds the interface's state to "info audio" */
 void wm8994_data_req_set(DeviceState *dev, void (*data_req)(void *, int),
-                         void *opaque)
+                         void (*info)(Monitor *, void *), void *opaque)
 {
     WM8994State *s =
         FROM_I2CADDR_SLAVE(WM8994State, I2CADDR_SLAVE_FROM_QDEV(dev));
 
     s->data_req = data_req;
+    s->info = info;
     s->opaque = opaque;
 }
 
-void *wm8994_dac_buffer(DeviceState *dev, int samples)
+/* An active voice keeps the audio subsystem polling it, so only have one
+ * while the interface is playing */
+void wm8994_set_active(DeviceState *dev, int active)
 {
     WM8994State *s =
         FROM_I2CADDR_SLAVE(WM8994State, I2CADDR_SLAVE_FROM_QDEV(dev));
 
-    /* XXX: Should check if there are <i>samples</i> free samples available */
-    void *ret = s->data_out + s->idx_out;
-
-    s->idx_out += samples << 2;
-    s->req_out -= samples << 2;
-    return ret;
-}
-
-void wm8994_dac_dat(DeviceState *dev, uint32_t sample)
-{
-    WM8994State *s =
-        FROM_I2CADDR_SLAVE(WM8994State, I2CADDR_SLAVE_FROM_QDEV(dev));
-
-    *(uint32_t *) &s->data_out[s->idx_out] = sample;
-    s->req_out -= 4;
-    s->idx_out += 4;
-    if (s->idx_out >= sizeof(s->data_out) || s->req_out <= 0) {
-        wm8994_out_flush(s);
+    s->active = active;
+    if (s->dac_voice) {
+        AUD_set_active_out(s->dac_voice, active);
     }
 }
 
-void wm8994_dac_commit(DeviceState *dev)
+/* Returns how many of the LEN bytes the voice took */
+int wm8994_dac_write(DeviceState *dev, void *buf, int len)
 {
     WM8994State *s =
         FROM_I2CADDR_SLAVE(WM8994State, I2CADDR_SLAVE_FROM_QDEV(dev));
 
-    return wm8994_out_flush(s);
+    if (!s->dac_voice) {
+        return 0;
+    }
+    return AUD_write(s->dac_voice, buf, len);
 }
 
 static int wm8994_init(I2CAddressableState *i2c)
@@ -282,6 +260,8 @@ static int wm8994_init(I2CAddressableState *i2c)
     WM8994State *s = FROM_I2CADDR_SLAVE(WM8994State, i2c);
 
     AUD_register_card(CODEC, &s->card);
+    s->card.info = wm8994_card_info;
+    s->card.info_opaque = s;
 
     wm8994_reset(s);
 
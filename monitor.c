@@ -1871,6 +1871,17 @@ static void tlb_info(Monitor *mon)
         print_tlb (mon, i, &env->utlb[i]);
 }
 
+#elif !defined(TARGET_I386)
+
+static void tlb_info(Monitor *mon)
+{
+    CPUState *env = mon_get_cpu();
+
+    if (!env)
+        return;
+    dump_tlb_info(env, (FILE *)mon, monitor_fprintf);
+}
+
 #endif
 
 static void do_info_kvm_print(Monitor *mon, const QObject *data)
@@ -2450,6 +2461,14 @@ static const mon_cmd_t info_cmds[] = {
         .help       = "show virtual to physical memory mappings",
         .mhandler.info = tlb_info,
     },
+#else
+    {
+        .name       = "tlb",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show softmmu TLB statistics",
+        .mhandler.info = tlb_info,
+    },
 #endif
 #if defined(TARGET_I386)
     {
@@ -2490,6 +2509,20 @@ static const mon_cmd_t info_cmds[] = {
         .help       = "show NUMA information",
         .mhandler.info = do_info_numa,
     },
+    {
+        .name       = "idle",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show timer wakeups per second of each device",
+        .mhandler.info = do_info_idle,
+    },
+    {
+        .name       = "touch",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show touch input coalescing and replay state",
+        .mhandler.info = do_info_touch,
+    },
     {
         .name       = "usb",
         .args_type  = "",
@@ -2518,6 +2551,13 @@ static const mon_cmd_t info_cmds[] = {
         .help       = "show capture information",
         .mhandler.info = do_info_capture,
     },
+    {
+        .name       = "audio",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show sound cards and their buffering statistics",
+        .mhandler.info = do_info_audio,
+    },
     {
         .name       = "snapshots",
         .args_type  = "",
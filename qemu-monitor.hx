@@ -72,7 +72,8 @@ show i8259 (PIC) state
 @item info pci
 show emulated PCI device info
 @item info tlb
-show virtual to physical memory mappings (i386 only)
+show virtual to physical memory mappings (i386 and SH4), or the number
+of softmmu TLB misses, victim TLB hits and page table walks (other targets)
 @item info mem
 show the active virtual memory mappings (i386 only)
 @item info hpet
@@ -85,8 +86,14 @@ show USB devices plugged on the virtual USB hub
 show all USB host devices
 @item info profile
 show profiling information
+@item info idle
+show how often each device's timers wake the host and when they are next due
+@item info touch
+show how much touch input was coalesced and the trace replay state
 @item info capture
 show information about active capturing
+@item info audio
+show sound cards and their buffering statistics
 @item info snapshots
 show list of VM snapshots
 @item info status
@@ -622,6 +629,35 @@ can be obtained with
 @example
 info mice
 @end example
+ETEXI
+
+    {
+        .name       = "touch_record",
+        .args_type  = "path:F?",
+        .params     = "[path]",
+        .help       = "record touch and key input to a trace file, stop without argument",
+        .mhandler.cmd = do_touch_record,
+    },
+
+STEXI
+@item touch_record [@var{filename}]
+Write the input received by touch controllers to @var{filename}, or stop
+recording if no file is given.
+ETEXI
+
+    {
+        .name       = "touch_replay",
+        .args_type  = "path:F?,rate:i?",
+        .params     = "[path [rate]]",
+        .help       = "replay a touch input trace at rate records per second (default 100), stop without argument",
+        .mhandler.cmd = do_touch_replay,
+    },
+
+STEXI
+@item touch_replay [@var{filename} [@var{rate}]]
+Feed the trace in @var{filename} to the touch controllers, @var{rate}
+records per second of guest time, ignoring host input meanwhile.  Stop
+the replay if no file is given.
 ETEXI
 
 #ifdef HAS_AUDIO
@@ -1619,6 +1619,26 @@ STEXI
 Run the emulation in single step mode.
 ETEXI
 
+DEF("no-tcg-opt", 0, QEMU_OPTION_no_tcg_opt, \
+    "-no-tcg-opt     translate without the TCG optimization pass\n")
+STEXI
+@item -no-tcg-opt
+Do not run constant folding and copy propagation on the translated
+micro ops, e.g. to compare the generated code with @code{-d op_opt,out_asm}.
+ETEXI
+
+DEF("tb-cache", HAS_ARG, QEMU_OPTION_tb_cache, \
+    "-tb-cache file  keep translated code in 'file' across runs\n")
+STEXI
+@item -tb-cache @var{file}
+Reuse the translations of a previous run with the same guest code, saved
+in @var{file}, and save the translations of this run there at exit.
+This speeds up repeated boots of the same image: the guest code is
+neither decoded nor optimized again, though host code is still
+generated.  The file is ignored if it was written by another QEMU binary
+or for another CPU model.
+ETEXI
+
 DEF("S", 0, QEMU_OPTION_S, \
     "-S              freeze CPU at startup (use 'c' to start execution)\n")
 STEXI
@@ -32,6 +32,7 @@ void qemu_del_timer(QEMUTimer *ts);
 void qemu_mod_timer(QEMUTimer *ts, int64_t expire_time);
 int qemu_timer_pending(QEMUTimer *ts);
 int qemu_timer_expired(QEMUTimer *timer_head, int64_t current_time);
+void qemu_timer_set_name(QEMUTimer *ts, const char *name);
 
 static inline int64_t get_ticks_per_sec(void)
 {
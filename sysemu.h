@@ -258,6 +258,8 @@ void do_usb_add(Monitor *mon, const QDict *qdict);
 void do_usb_del(Monitor *mon, const QDict *qdict);
 void usb_info(Monitor *mon);
 
+void do_info_idle(Monitor *mon);
+
 void register_devices(void);
 
 #endif
@@ -251,6 +251,11 @@ void HELPER(wfi)(void)
     cpu_loop_exit();
 }
 
+void *HELPER(lookup_tb_ptr)(void)
+{
+    return tb_lookup_ptr(env);
+}
+
 void HELPER(exception)(uint32_t excp)
 {
     env->exception_index = excp;
@@ -3374,6 +3374,20 @@ static int disas_vfp_insn(CPUState * env, DisasContext *s, uint32_t insn)
     return 0;
 }
 
+/* Continue in the TB for the new PC if it has been translated, otherwise
+   the hash table must be used to find the next TB */
+static inline void gen_goto_ptr(void)
+{
+#ifdef TCG_TARGET_HAS_goto_ptr
+    TCGv_ptr ptr = tcg_temp_new_ptr();
+
+    gen_helper_lookup_tb_ptr(ptr);
+    tcg_gen_goto_ptr(ptr);
+    tcg_temp_free_ptr(ptr);
+#endif
+    tcg_gen_exit_tb(0);
+}
+
 static inline void gen_goto_tb(DisasContext *s, int n, uint32_t dest)
 {
     TranslationBlock *tb;
@@ -9245,8 +9259,7 @@ static inline void gen_intermediate_code_internal(CPUState *env,
         default:
         case DISAS_JUMP:
         case DISAS_UPDATE:
-            /* indicate that the hash table must be used to find the next TB */
-            tcg_gen_exit_tb(0);
+            gen_goto_ptr();
             break;
         case DISAS_TB_JUMP:
             /* nothing more to generate */
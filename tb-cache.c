@@ -0,0 +1,830 @@
+/*
+ * Persistent translation cache
+ *
+ * Every boot of the same image translates the same boot code again.
+ * With -tb-cache, the TCG ops of each translated block, as left by the
+ * optimizer and liveness analysis, are kept along with a hash of the
+ * guest code they came from, and written to a file at exit.  On the
+ * next run, a block whose key and guest code match is rebuilt from the
+ * cached ops; only register allocation and host code generation run.
+ *
+ * Host code is not cached: it has the addresses of helpers and of the
+ * TB itself built in, and TCG does not keep relocations for them.  In
+ * the ops these are the helper addresses loaded by movi, which are
+ * saved by name, and the TB pointer given to exit_tb, saved as an
+ * offset.
+ *
+ * A file is only used by the same QEMU binary with the same CPU model
+ * and TCG globals.  Self-modifying code needs nothing special: blocks
+ * are still invalidated by tb_invalidate_phys_page_range, and a block
+ * whose guest code changed no longer matches its hash.
+ *
+ * This code is licensed under the GNU GPL v2.
+ */
+#include <stdarg.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "config.h"
+#include "cpu.h"
+#include "exec-all.h"
+#include "tcg.h"
+#include "qemu-log.h"
+
+#define TB_CACHE_MAGIC          "QEMUTBC"
+#define TB_CACHE_VERSION        1
+
+#define TB_CACHE_HASH_BITS      15
+#define TB_CACHE_HASH_SIZE      (1 << TB_CACHE_HASH_BITS)
+
+/* Memory and file size limit; blocks past it are not cached */
+#define TB_CACHE_MAX_SIZE       (64 << 20)
+
+#define TB_CACHE_RELOC_TB       0xffffffff
+
+/* The data of each entry is padded to this in the file */
+#define TB_CACHE_ALIGN(n)       (((n) + 7) & ~7)
+
+typedef struct TBCacheFileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t nb_helpers;
+    uint64_t signature;
+    uint32_t nb_entries;
+    uint32_t pad;
+} TBCacheFileHeader;
+
+/* Saved as is; the args, relocations, dead argument masks, ops and
+   temps follow */
+typedef struct TBCacheKey {
+    uint64_t pc;
+    uint64_t cs_base;
+    uint64_t flags;
+    uint64_t phys_pc;
+    uint64_t code_hash;
+    uint16_t cflags;
+    uint16_t size;
+    uint16_t icount;
+    uint16_t nb_ops;
+    uint16_t nb_args;
+    uint16_t nb_temps;
+    uint16_t nb_labels;
+    uint16_t nb_relocs;
+} TBCacheKey;
+
+/* Argument ARG is helper HELPER, or the TB pointer plus the saved
+   value if HELPER is TB_CACHE_RELOC_TB */
+typedef struct TBCacheReloc {
+    uint32_t arg;
+    uint32_t helper;
+} TBCacheReloc;
+
+typedef struct TBCacheEntry {
+    TBCacheKey key;
+    uint8_t *data;
+    struct TBCacheEntry *hash_next;
+} TBCacheEntry;
+
+static struct {
+    const char *filename;
+    int loaded;
+    int dirty;
+    int store_next;             /* the block being translated is wanted */
+    uint64_t signature;
+
+    /* Registered helpers by address; relocations index this.  A pointer
+       sized constant between the first and the last one that is not a
+       helper keeps a block out of the cache.  */
+    TCGHelperInfo *helpers;
+    int nb_helpers;
+    tcg_target_ulong helpers_min, helpers_max;
+
+    /* The file as read; entries from it point into this */
+    uint8_t *file_data;
+    long file_size;
+
+    TBCacheEntry *hash[TB_CACHE_HASH_SIZE];
+    int nb_entries;
+    long size;
+
+    uint64_t hits, misses, stale, stores;
+} tb_cache;
+
+static uint64_t tb_cache_hash(uint64_t h, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    while (len--) {
+        h ^= *p++;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+static uint64_t tb_cache_hash_str(uint64_t h, const char *s)
+{
+    return tb_cache_hash(h, s ? s : "", s ? strlen(s) + 1 : 1);
+}
+
+static uint64_t tb_cache_hash_int(uint64_t h, int64_t v)
+{
+    return tb_cache_hash(h, &v, sizeof(v));
+}
+
+static unsigned int tb_cache_hash_func(target_ulong phys_pc)
+{
+    return (phys_pc ^ (phys_pc >> TB_CACHE_HASH_BITS))
+        & (TB_CACHE_HASH_SIZE - 1);
+}
+
+static long tb_cache_data_size(const TBCacheKey *k)
+{
+    return k->nb_args * sizeof(TCGArg) +
+           k->nb_relocs * sizeof(TBCacheReloc) +
+           k->nb_ops * 2 * sizeof(uint16_t) +
+           k->nb_temps * 3;
+}
+
+/* Everything the ops depend on besides the guest code and TB key */
+static uint64_t tb_cache_signature(CPUState *env)
+{
+    static const char * const op_names[] = {
+#define DEF(s, n, copy_size) #s,
+#include "tcg-opc.h"
+#undef DEF
+    };
+    TCGContext *s = &tcg_ctx;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    int i;
+#ifdef __linux__
+    struct stat st;
+
+    if (stat("/proc/self/exe", &st) == 0) {
+        h = tb_cache_hash_int(h, st.st_size);
+        h = tb_cache_hash_int(h, st.st_mtime);
+    }
+#endif
+
+    h = tb_cache_hash_str(h, QEMU_VERSION);
+    h = tb_cache_hash_str(h, TARGET_ARCH);
+    h = tb_cache_hash_int(h, sizeof(CPUState));
+    h = tb_cache_hash_int(h, sizeof(TCGArg));
+    h = tb_cache_hash_int(h, TARGET_PAGE_BITS);
+    h = tb_cache_hash_int(h, use_icount);
+    h = tb_cache_hash_int(h, tcg_optimize_disabled);
+    h = tb_cache_hash_str(h, env->cpu_model_str);
+    for (i = 0; i < NB_OPS; i++)
+        h = tb_cache_hash_str(h, op_names[i]);
+    for (i = 0; i < s->nb_globals; i++) {
+        h = tb_cache_hash_str(h, s->temps[i].name);
+        h = tb_cache_hash_int(h, s->temps[i].type);
+        h = tb_cache_hash_int(h, s->temps[i].fixed_reg);
+        h = tb_cache_hash_int(h, s->temps[i].mem_offset);
+    }
+    return h;
+}
+
+static int tb_cache_helper_cmp(const void *p1, const void *p2)
+{
+    const TCGHelperInfo *h1 = p1, *h2 = p2;
+
+    if (h1->func < h2->func)
+        return -1;
+    return h1->func > h2->func;
+}
+
+static int tb_cache_find_helper(tcg_target_ulong func)
+{
+    int lo = 0, hi = tb_cache.nb_helpers - 1, mid;
+
+    while (lo <= hi) {
+        mid = (lo + hi) >> 1;
+        if (tb_cache.helpers[mid].func == func)
+            return mid;
+        if (tb_cache.helpers[mid].func < func)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -1;
+}
+
+static int tb_cache_find_helper_name(const char *name)
+{
+    int i;
+
+    for (i = 0; i < tb_cache.nb_helpers; i++)
+        if (!strcmp(tb_cache.helpers[i].name, name))
+            return i;
+    return -1;
+}
+
+static TBCacheEntry *tb_cache_lookup(const TBCacheKey *k)
+{
+    TBCacheEntry *e;
+
+    for (e = tb_cache.hash[tb_cache_hash_func(k->phys_pc)]; e;
+         e = e->hash_next)
+        if (e->key.phys_pc == k->phys_pc && e->key.pc == k->pc &&
+            e->key.cs_base == k->cs_base && e->key.flags == k->flags &&
+            e->key.cflags == k->cflags)
+            return e;
+    return NULL;
+}
+
+static void tb_cache_insert(TBCacheEntry *e)
+{
+    unsigned int h = tb_cache_hash_func(e->key.phys_pc);
+
+    e->hash_next = tb_cache.hash[h];
+    tb_cache.hash[h] = e;
+    tb_cache.nb_entries++;
+    tb_cache.size += sizeof(e->key) + tb_cache_data_size(&e->key);
+}
+
+typedef struct TBCacheOpDef {
+    uint8_t nb_oargs, nb_iargs, nb_cargs;
+} TBCacheOpDef;
+
+static const TBCacheOpDef tb_cache_op_defs[] = {
+#define DEF2(s, oargs, iargs, cargs, flags) { oargs, iargs, cargs },
+#include "tcg-opc.h"
+#undef DEF2
+};
+
+/* Number of arguments of the op at OPC whose arguments start at ARGS */
+static int tb_cache_op_args(int opc, const TCGArg *args)
+{
+    if (opc == INDEX_op_call)
+        return (args[0] >> 16) + (args[0] & 0xffff) + 3;
+    if (opc == INDEX_op_nopn)
+        return args[0];
+    return tb_cache_op_defs[opc].nb_oargs + tb_cache_op_defs[opc].nb_iargs +
+           tb_cache_op_defs[opc].nb_cargs;
+}
+
+/* Check that the ops of a block read from the file only use ops, temps
+   and labels that exist, and end where the key says they do.  */
+static int tb_cache_check_ops(const TBCacheKey *k, const uint8_t *data)
+{
+    const TCGArg *args = (const TCGArg *) data;
+    const uint16_t *ops = (const uint16_t *)
+        ((const TBCacheReloc *) (args + k->nb_args) + k->nb_relocs) +
+        k->nb_ops;
+    const uint8_t *temps = (const uint8_t *) (ops + k->nb_ops);
+    TCGArg nb_temps = tcg_ctx.nb_globals + k->nb_temps;
+    int i, j, opc, nb_args, nb_oargs, nb_iargs, pos = 0;
+
+    if (k->nb_ops == 0 || ops[k->nb_ops - 1] != INDEX_op_end)
+        return -1;
+    for (i = 0; i < k->nb_temps; i++)
+        if (temps[3 * i] >= TCG_TYPE_COUNT ||
+            temps[3 * i + 1] >= TCG_TYPE_COUNT)
+            return -1;
+
+    for (i = 0; i < k->nb_ops - 1; i++) {
+        opc = ops[i];
+        if (opc >= NB_OPS || opc == INDEX_op_end)
+            return -1;
+        if (opc == INDEX_op_call || opc == INDEX_op_nopn) {
+            /* The length is in the first argument and in the last */
+            if (pos >= k->nb_args || (args[pos] >> 16) > k->nb_args ||
+                (args[pos] & 0xffff) > k->nb_args ||
+                (opc == INDEX_op_nopn && args[pos] < 1))
+                return -1;
+            nb_args = tb_cache_op_args(opc, args + pos);
+            if (nb_args > k->nb_args - pos ||
+                args[pos + nb_args - 1] != nb_args)
+                return -1;
+        } else {
+            nb_args = tb_cache_op_args(opc, args + pos);
+            if (nb_args > k->nb_args - pos)
+                return -1;
+        }
+
+        if (opc == INDEX_op_call) {
+            nb_oargs = args[pos] >> 16;
+            nb_iargs = args[pos] & 0xffff;
+            for (j = 1; j <= nb_oargs + nb_iargs; j++)
+                if (args[pos + j] >= nb_temps &&
+                    (j <= nb_oargs || args[pos + j] != TCG_CALL_DUMMY_ARG))
+                    return -1;
+        } else if (opc != INDEX_op_nopn) {
+            nb_oargs = tb_cache_op_defs[opc].nb_oargs;
+            nb_iargs = tb_cache_op_defs[opc].nb_iargs;
+            for (j = 0; j < nb_oargs + nb_iargs; j++)
+                if (args[pos + j] >= nb_temps)
+                    return -1;
+            /* The label is the last constant of the ops that take one */
+            switch (opc) {
+            case INDEX_op_set_label:
+            case INDEX_op_br:
+            case INDEX_op_brcond_i32:
+#if TCG_TARGET_REG_BITS == 32
+            case INDEX_op_brcond2_i32:
+#else
+            case INDEX_op_brcond_i64:
+#endif
+                if (args[pos + nb_args - 1] >= k->nb_labels)
+                    return -1;
+                break;
+            }
+        }
+        pos += nb_args;
+    }
+    return pos == k->nb_args ? 0 : -1;
+}
+
+/* Take the entries of a file read into BUF; they keep pointing there */
+static int tb_cache_parse(uint8_t *buf, long len)
+{
+    TBCacheFileHeader hdr;
+    TBCacheEntry *entries = NULL, *e;
+    TBCacheReloc *r;
+    uint8_t *p = buf, *end = buf + len;
+    int *helper_map;
+    char name[256];
+    uint16_t name_len;
+    long size;
+    uint32_t i, j;
+    int ret = -1, inserted = 0;
+
+    if (len < sizeof(hdr))
+        return -1;
+    memcpy(&hdr, p, sizeof(hdr));
+    p += sizeof(hdr);
+    if (memcmp(hdr.magic, TB_CACHE_MAGIC, sizeof(hdr.magic)) ||
+        hdr.version != TB_CACHE_VERSION || hdr.nb_helpers > 0xffff)
+        return -1;
+    /* Not an error: the file is replaced at exit */
+    if (hdr.signature != tb_cache.signature)
+        return 0;
+
+    helper_map = qemu_malloc((hdr.nb_helpers + 1) * sizeof(int));
+    for (i = 0; i < hdr.nb_helpers; i++) {
+        if (end - p < sizeof(name_len))
+            goto out;
+        memcpy(&name_len, p, sizeof(name_len));
+        p += sizeof(name_len);
+        if (name_len >= sizeof(name) || end - p < name_len)
+            goto out;
+        memcpy(name, p, name_len);
+        name[name_len] = '\0';
+        p += name_len;
+        helper_map[i] = tb_cache_find_helper_name(name);
+    }
+    p = buf + TB_CACHE_ALIGN(p - buf);
+
+    /* Every entry takes at least its key */
+    if (p > end || hdr.nb_entries > (end - p) / sizeof(TBCacheKey))
+        goto out;
+    entries = qemu_malloc(hdr.nb_entries * sizeof(TBCacheEntry));
+    for (i = 0; i < hdr.nb_entries; i++) {
+        e = &entries[i];
+        if (end - p < sizeof(e->key))
+            goto out;
+        memcpy(&e->key, p, sizeof(e->key));
+        p += sizeof(e->key);
+        size = tb_cache_data_size(&e->key);
+        if (e->key.nb_ops > OPC_BUF_SIZE ||
+            e->key.nb_args >= OPPARAM_BUF_SIZE ||
+            tcg_ctx.nb_globals + e->key.nb_temps > TCG_MAX_TEMPS ||
+            e->key.nb_labels > TCG_MAX_LABELS || end - p < size ||
+            tb_cache_check_ops(&e->key, p) < 0)
+            goto out;
+        e->data = p;
+        p += TB_CACHE_ALIGN(size);
+
+        /* Helper numbers in the file are those of the run that wrote it */
+        r = (TBCacheReloc *) (e->data + e->key.nb_args * sizeof(TCGArg));
+        for (j = 0; j < e->key.nb_relocs; j++) {
+            if (r[j].arg >= e->key.nb_args ||
+                (r[j].helper != TB_CACHE_RELOC_TB &&
+                 (r[j].helper >= hdr.nb_helpers ||
+                  helper_map[r[j].helper] < 0)))
+                break;
+            if (r[j].helper != TB_CACHE_RELOC_TB)
+                r[j].helper = helper_map[r[j].helper];
+        }
+        if (j == e->key.nb_relocs && tb_cache.size < TB_CACHE_MAX_SIZE &&
+            !tb_cache_lookup(&e->key)) {
+            tb_cache_insert(e);
+            inserted = 1;
+        }
+    }
+    ret = 0;
+out:
+    /* Inserted entries live as long as the file data */
+    if (!inserted)
+        qemu_free(entries);
+    qemu_free(helper_map);
+    return ret;
+}
+
+static void tb_cache_init(CPUState *env)
+{
+    TCGContext *s = &tcg_ctx;
+    FILE *f;
+    long len;
+
+    tb_cache.loaded = 1;
+
+    tb_cache.nb_helpers = s->nb_helpers;
+    tb_cache.helpers = qemu_malloc(s->nb_helpers * sizeof(TCGHelperInfo));
+    memcpy(tb_cache.helpers, s->helpers,
+           s->nb_helpers * sizeof(TCGHelperInfo));
+    qsort(tb_cache.helpers, tb_cache.nb_helpers, sizeof(TCGHelperInfo),
+          tb_cache_helper_cmp);
+    if (tb_cache.nb_helpers) {
+        tb_cache.helpers_min = tb_cache.helpers[0].func;
+        tb_cache.helpers_max = tb_cache.helpers[tb_cache.nb_helpers - 1].func;
+    } else {
+        tb_cache.helpers_min = 1;
+    }
+
+    tb_cache.signature = tb_cache_signature(env);
+
+    f = fopen(tb_cache.filename, "rb");
+    if (!f)
+        return;
+    if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) > 0) {
+        rewind(f);
+        tb_cache.file_data = qemu_malloc(len);
+        if (fread(tb_cache.file_data, 1, len, f) != len)
+            len = 0;
+        tb_cache.file_size = len;
+        if (tb_cache_parse(tb_cache.file_data, len) < 0)
+            fprintf(stderr, "tb-cache: '%s' is damaged, ignoring the rest "
+                    "of it\n", tb_cache.filename);
+    }
+    fclose(f);
+}
+
+/* Translation that a cached block could not reproduce, or that must
+   not be reused */
+static int tb_cache_usable(CPUState *env)
+{
+    if (!tb_cache.filename || singlestep || env->singlestep_enabled ||
+        !QTAILQ_EMPTY(&env->breakpoints) ||
+        qemu_loglevel_mask(CPU_LOG_TB_IN_ASM | CPU_LOG_TB_OP |
+                           CPU_LOG_TB_OP_OPT))
+        return 0;
+#if defined(TARGET_ARM)
+    /* The translator restores the IT bits of an interrupted block */
+    if (env->thumb && env->saved_condexec_tb == env->regs[15])
+        return 0;
+#endif
+    if (!tb_cache.loaded)
+        tb_cache_init(env);
+    return 1;
+}
+
+static void tb_cache_make_key(TBCacheKey *k, CPUState *env,
+                              TranslationBlock *tb)
+{
+    memset(k, 0, sizeof(*k));
+    k->pc = tb->pc;
+    k->cs_base = tb->cs_base;
+    k->flags = tb->flags;
+    k->cflags = tb->cflags;
+    k->phys_pc = get_phys_addr_code(env, tb->pc);
+}
+
+/* Host address of the guest code at PC, or NULL if its page is not
+   mapped already.  This must not fault: the guest code may have changed
+   so that the block no longer reaches a later page.  */
+static const uint8_t *tb_cache_code_ptr(CPUState *env, target_ulong pc)
+{
+#if defined(CONFIG_USER_ONLY)
+    if (!(page_get_flags(pc) & PAGE_READ))
+        return NULL;
+    return g2h(pc);
+#else
+    CPUTLBEntry *te;
+
+    /* I/O pages have TLB_MMIO set and never match */
+    te = &env->tlb_table[cpu_mmu_index(env)]
+                        [(pc >> TARGET_PAGE_BITS) & (CPU_TLB_SIZE - 1)];
+    if (te->addr_code != (pc & TARGET_PAGE_MASK))
+        return NULL;
+    return (uint8_t *) (unsigned long) pc + te->addend;
+#endif
+}
+
+/* Hash SIZE bytes of guest code at PC into *HASH.  Returns -1 if a page
+   they are on is not mapped, which makes a cached block a miss.  */
+static int tb_cache_code_hash(CPUState *env, target_ulong pc, int size,
+                              uint64_t *hash)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    const uint8_t *p;
+    int len;
+
+    while (size > 0) {
+        len = MIN(size, TARGET_PAGE_SIZE - (pc & ~TARGET_PAGE_MASK));
+        p = tb_cache_code_ptr(env, pc);
+        if (!p)
+            return -1;
+        h = tb_cache_hash(h, p, len);
+        pc += len;
+        size -= len;
+    }
+    *hash = h;
+    return 0;
+}
+
+/* Rebuild the analyzed ops of TB from the cache, which also sets its
+   size and instruction count.  Returns 0 if the TB has to be translated.  */
+int tb_cache_load(CPUState *env, TranslationBlock *tb)
+{
+    TCGContext *s = &tcg_ctx;
+    TBCacheKey k;
+    TBCacheEntry *e;
+    TBCacheReloc *r;
+    TCGTemp *ts;
+    TCGArg *args;
+    uint16_t *dead_iargs, *ops;
+    uint8_t *temps;
+    uint64_t code_hash;
+    int i;
+
+    tb_cache.store_next = 0;
+    if (!tb_cache_usable(env))
+        return 0;
+
+    tb_cache_make_key(&k, env, tb);
+    e = tb_cache_lookup(&k);
+    /* tb_cache_make_key mapped the first page */
+    if (!e || tb_cache_code_hash(env, tb->pc, e->key.size, &code_hash) < 0 ||
+        e->key.code_hash != code_hash) {
+        if (e)
+            tb_cache.stale++;
+        tb_cache.misses++;
+        tb_cache.store_next = 1;
+        return 0;
+    }
+    tb_cache.hits++;
+
+    args = (TCGArg *) e->data;
+    r = (TBCacheReloc *) (args + e->key.nb_args);
+    dead_iargs = (uint16_t *) (r + e->key.nb_relocs);
+    ops = dead_iargs + e->key.nb_ops;
+    temps = (uint8_t *) (ops + e->key.nb_ops);
+
+    /* The end op is included */
+    memcpy(gen_opc_buf, ops, e->key.nb_ops * sizeof(uint16_t));
+    gen_opc_ptr = gen_opc_buf + e->key.nb_ops;
+    s->op_dead_iargs = tcg_malloc(e->key.nb_ops * sizeof(uint16_t));
+    memcpy(s->op_dead_iargs, dead_iargs, e->key.nb_ops * sizeof(uint16_t));
+    memcpy(gen_opparam_buf, args, e->key.nb_args * sizeof(TCGArg));
+    gen_opparam_ptr = gen_opparam_buf + e->key.nb_args;
+    for (i = 0; i < e->key.nb_relocs; i++) {
+        if (r[i].helper == TB_CACHE_RELOC_TB)
+            gen_opparam_buf[r[i].arg] += (tcg_target_long) tb;
+        else
+            gen_opparam_buf[r[i].arg] = tb_cache.helpers[r[i].helper].func;
+    }
+
+    for (i = 0; i < e->key.nb_temps; i++) {
+        ts = &s->temps[s->nb_globals + i];
+        ts->base_type = temps[3 * i];
+        ts->type = temps[3 * i + 1];
+        ts->temp_local = temps[3 * i + 2];
+        ts->temp_allocated = 1;
+        ts->name = NULL;
+    }
+    s->nb_temps = s->nb_globals + e->key.nb_temps;
+    for (i = 0; i < e->key.nb_labels; i++) {
+        s->labels[i].has_value = 0;
+        s->labels[i].u.first_reloc = NULL;
+    }
+    s->nb_labels = e->key.nb_labels;
+
+    tb->size = e->key.size;
+    tb->icount = e->key.icount;
+    return 1;
+}
+
+/* Find the host addresses in the ops of TB.  Returns
+   the number of relocations, or -1 if the ops cannot be cached.  */
+static int tb_cache_relocs(TranslationBlock *tb, TBCacheReloc *r)
+{
+    const uint16_t *opc;
+    const TCGArg *args = gen_opparam_buf;
+    tcg_target_ulong val;
+    int n = 0, h;
+
+    for (opc = gen_opc_buf; opc < gen_opc_ptr; opc++) {
+        switch (*opc) {
+#if TCG_TARGET_REG_BITS == 64
+        case INDEX_op_movi_i64:
+#else
+        case INDEX_op_movi_i32:
+#endif
+            val = args[1];
+            if (val < tb_cache.helpers_min || val > tb_cache.helpers_max)
+                break;
+            h = tb_cache_find_helper(val);
+            if (h < 0)
+                return -1;
+            r[n].arg = args + 1 - gen_opparam_buf;
+            r[n].helper = h;
+            n++;
+            break;
+        case INDEX_op_exit_tb:
+            val = args[0];
+            if (!val)
+                break;
+            if ((val & ~3) != (tcg_target_ulong) tb)
+                return -1;
+            r[n].arg = args - gen_opparam_buf;
+            r[n].helper = TB_CACHE_RELOC_TB;
+            n++;
+            break;
+        }
+        args += tb_cache_op_args(*opc, args);
+    }
+    return n;
+}
+
+/* Remember the ops of TB after tcg_analyze_ops.  Whether the block can
+   be cached was decided by tb_cache_load, before translation could
+   change the CPU state.  */
+void tb_cache_store(CPUState *env, TranslationBlock *tb)
+{
+    static TBCacheReloc relocs[OPC_BUF_SIZE];
+    TCGContext *s = &tcg_ctx;
+    TBCacheKey k;
+    TBCacheEntry *e;
+    TCGArg *args;
+    uint16_t *dead_iargs;
+    uint8_t *temps;
+    int i, nb_relocs;
+
+    if (!tb_cache.store_next || tb_cache.size >= TB_CACHE_MAX_SIZE)
+        return;
+    tb_cache.store_next = 0;
+
+    nb_relocs = tb_cache_relocs(tb, relocs);
+    if (nb_relocs < 0)
+        return;
+
+    tb_cache_make_key(&k, env, tb);
+    if (tb_cache_code_hash(env, tb->pc, tb->size, &k.code_hash) < 0)
+        return;
+    k.size = tb->size;
+    k.icount = tb->icount;
+    k.nb_ops = gen_opc_ptr - gen_opc_buf;
+    k.nb_args = gen_opparam_ptr - gen_opparam_buf;
+    k.nb_temps = s->nb_temps - s->nb_globals;
+    k.nb_labels = s->nb_labels;
+    k.nb_relocs = nb_relocs;
+
+    /* A stale entry is replaced */
+    e = tb_cache_lookup(&k);
+    if (e) {
+        tb_cache.size += tb_cache_data_size(&k) - tb_cache_data_size(&e->key);
+        if (e->data < tb_cache.file_data ||
+            e->data >= tb_cache.file_data + tb_cache.file_size)
+            qemu_free(e->data);
+        e->key = k;
+    } else {
+        e = qemu_malloc(sizeof(*e));
+        e->key = k;
+        tb_cache_insert(e);
+    }
+    e->data = qemu_malloc(tb_cache_data_size(&k));
+
+    args = (TCGArg *) e->data;
+    memcpy(args, gen_opparam_buf, k.nb_args * sizeof(TCGArg));
+    for (i = 0; i < nb_relocs; i++) {
+        if (relocs[i].helper == TB_CACHE_RELOC_TB)
+            args[relocs[i].arg] -= (tcg_target_long) tb;
+        else
+            args[relocs[i].arg] = 0;
+    }
+    memcpy(args + k.nb_args, relocs, nb_relocs * sizeof(TBCacheReloc));
+    dead_iargs = (uint16_t *) ((TBCacheReloc *) (args + k.nb_args) +
+                               nb_relocs);
+    memcpy(dead_iargs, s->op_dead_iargs, k.nb_ops * sizeof(uint16_t));
+    memcpy(dead_iargs + k.nb_ops, gen_opc_buf, k.nb_ops * sizeof(uint16_t));
+    temps = (uint8_t *) (dead_iargs + 2 * k.nb_ops);
+    for (i = 0; i < k.nb_temps; i++) {
+        temps[3 * i] = s->temps[s->nb_globals + i].base_type;
+        temps[3 * i + 1] = s->temps[s->nb_globals + i].type;
+        temps[3 * i + 2] = s->temps[s->nb_globals + i].temp_local;
+    }
+
+    tb_cache.stores++;
+    tb_cache.dirty = 1;
+}
+
+static int tb_cache_write_pad(FILE *f, long len)
+{
+    static const uint8_t zero[8];
+    long pad = TB_CACHE_ALIGN(len) - len;
+
+    return fwrite(zero, 1, pad, f) == pad ? 0 : -1;
+}
+
+static int tb_cache_write_file(FILE *f)
+{
+    TBCacheFileHeader hdr;
+    TBCacheEntry *e;
+    uint16_t len;
+    long pos, size;
+    int i;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TB_CACHE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TB_CACHE_VERSION;
+    hdr.nb_helpers = tb_cache.nb_helpers;
+    hdr.signature = tb_cache.signature;
+    hdr.nb_entries = tb_cache.nb_entries;
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+        return -1;
+    pos = sizeof(hdr);
+
+    for (i = 0; i < tb_cache.nb_helpers; i++) {
+        len = strlen(tb_cache.helpers[i].name);
+        if (fwrite(&len, sizeof(len), 1, f) != 1 ||
+            fwrite(tb_cache.helpers[i].name, 1, len, f) != len)
+            return -1;
+        pos += sizeof(len) + len;
+    }
+    if (tb_cache_write_pad(f, pos) < 0)
+        return -1;
+
+    for (i = 0; i < TB_CACHE_HASH_SIZE; i++) {
+        for (e = tb_cache.hash[i]; e; e = e->hash_next) {
+            size = tb_cache_data_size(&e->key);
+            if (fwrite(&e->key, sizeof(e->key), 1, f) != 1 ||
+                fwrite(e->data, 1, size, f) != size ||
+                tb_cache_write_pad(f, size) < 0)
+                return -1;
+        }
+    }
+    return 0;
+}
+
+/* Replace the file, so that a run killed half way leaves the old one */
+static void tb_cache_save(void)
+{
+    char *tmp;
+    FILE *f;
+    int ret;
+
+    if (!tb_cache.dirty)
+        return;
+
+    tmp = qemu_malloc(strlen(tb_cache.filename) + 5);
+    sprintf(tmp, "%s.tmp", tb_cache.filename);
+    f = fopen(tmp, "wb");
+    if (!f) {
+        fprintf(stderr, "tb-cache: could not create '%s'\n", tmp);
+        qemu_free(tmp);
+        return;
+    }
+    ret = tb_cache_write_file(f);
+    if (fclose(f) != 0)
+        ret = -1;
+    if (ret < 0 || rename(tmp, tb_cache.filename) < 0) {
+        fprintf(stderr, "tb-cache: could not write '%s'\n",
+                tb_cache.filename);
+        unlink(tmp);
+    }
+    qemu_free(tmp);
+}
+
+/* The file is read at the first translation, once the CPU is set up */
+int tb_cache_open(const char *filename)
+{
+#if TCG_TARGET_REG_BITS == 64
+    tb_cache.filename = filename;
+    atexit(tb_cache_save);
+    return 0;
+#else
+    /* Guest constants could not be told from helper addresses */
+    fprintf(stderr, "tb-cache: not supported on 32-bit hosts\n");
+    return -1;
+#endif
+}
+
+void tb_cache_dump_info(FILE *f,
+                        int (*cpu_fprintf)(FILE *f, const char *fmt, ...))
+{
+    uint64_t lookups = tb_cache.hits + tb_cache.misses;
+
+    if (!tb_cache.filename)
+        return;
+    cpu_fprintf(f, "TB cache            %d blocks, %ld KB\n",
+                tb_cache.nb_entries, tb_cache.size >> 10);
+    cpu_fprintf(f, "TB cache hits       %" PRIu64 " (%d%%), %" PRIu64
+                " stale, %" PRIu64 " stored\n", tb_cache.hits,
+                lookups ? (int) (tb_cache.hits * 100 / lookups) : 0,
+                tb_cache.stale, tb_cache.stores);
+}
@@ -1119,6 +1119,9 @@ static inline void tcg_out_qemu_st(TCGContext *s, int cond,
      *  and r0, r8, #(CPU_TLB_SIZE - 1)   @ Assumption: CPU_TLB_BITS <= 8
      *  add r0, env, r0 lsl #CPU_TLB_ENTRY_BITS
      */
+#  if CPU_TLB_BITS > 8
+#   error
+#  endif
     tcg_out_dat_reg(s, COND_AL, ARITH_MOV,
                     8, 0, addr_reg, SHIFT_IMM_LSR(TARGET_PAGE_BITS));
     tcg_out_dat_imm(s, COND_AL, ARITH_AND,
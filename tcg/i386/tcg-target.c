@@ -874,6 +874,7 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args,
 static inline void tcg_out_op(TCGContext *s, int opc, 
                               const TCGArg *args, const int *const_args)
 {
+    uint8_t *label_ptr;
     int c;
     
     switch(opc) {
@@ -896,6 +897,15 @@ static inline void tcg_out_op(TCGContext *s, int opc,
         }
         s->tb_next_offset[args[0]] = s->code_ptr - s->code_buf;
         break;
+    case INDEX_op_goto_ptr:
+        /* test r, r; je 1f; jmp *r; 1: */
+        tcg_out_modrm(s, 0x85, args[0], args[0]);
+        label_ptr = s->code_ptr;
+        tcg_out8(s, 0x70 + JCC_JE);
+        tcg_out8(s, 0);
+        tcg_out_modrm(s, 0xff, 4, args[0]);
+        label_ptr[1] = s->code_ptr - label_ptr - 2;
+        break;
     case INDEX_op_call:
         if (const_args[0]) {
             tcg_out8(s, 0xe8);
@@ -1120,6 +1130,7 @@ static inline void tcg_out_op(TCGContext *s, int opc,
 static const TCGTargetOpDef x86_op_defs[] = {
     { INDEX_op_exit_tb, { } },
     { INDEX_op_goto_tb, { } },
+    { INDEX_op_goto_ptr, { "r" } },
     { INDEX_op_call, { "ri" } },
     { INDEX_op_jmp, { "ri" } },
     { INDEX_op_br, { } },
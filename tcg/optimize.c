@@ -0,0 +1,718 @@
+/*
+ * Optimizations for Tiny Code Generator for QEMU
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+/* Forward pass over the ops of a TB, run before liveness analysis.  It
+   tracks which temps hold a known constant and which hold a copy of
+   another temp, within a basic block:
+
+   - inputs are replaced by the temp they were copied from,
+   - ops whose inputs are all constant become movi,
+   - ops with a neutral or absorbing constant operand become mov/movi,
+   - moves of a value a temp already holds are dropped.
+
+   The ops whose result is no longer used after this are then removed by
+   the liveness analysis.  Op indexes are not changed, only the
+   parameters of rewritten ops are packed, so gen_opc_pc and friends stay
+   valid.  The packed parameters overwrite the ones still to be read, so
+   an op's arguments must all be used before its new ones are stored. */
+
+#include "config.h"
+
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "qemu-common.h"
+
+#define NO_CPU_IO_DEFS
+#include "cpu.h"
+#include "exec-all.h"
+
+#include "tcg-op.h"
+
+/* Set by -no-tcg-opt, for comparing code with and without the pass */
+int tcg_optimize_disabled;
+
+#if TCG_TARGET_REG_BITS == 64
+#define CASE_OP_32_64(x)                        \
+        glue(glue(case INDEX_op_, x), _i32):    \
+        glue(glue(case INDEX_op_, x), _i64)
+#else
+#define CASE_OP_32_64(x)                        \
+        glue(glue(case INDEX_op_, x), _i32)
+#endif
+
+typedef struct TempInfo {
+    int is_const;
+    tcg_target_ulong val;
+    /* Temps holding the same value are linked in a ring; ROOT is the one
+       the others were copied from and the one uses are redirected to. */
+    int next_copy;
+    int prev_copy;
+    int root;
+} TempInfo;
+
+static TempInfo *temps;
+
+static void reset_temp(TCGContext *s, int t)
+{
+    TempInfo *ti = &temps[t];
+    int i, next;
+
+    if (ti->next_copy != t) {
+        next = ti->next_copy;
+        temps[next].prev_copy = ti->prev_copy;
+        temps[ti->prev_copy].next_copy = next;
+        if (ti->root == t) {
+            /* the others keep being copies of each other */
+            i = next;
+            do {
+                temps[i].root = next;
+                i = temps[i].next_copy;
+            } while (i != next);
+        }
+    }
+    ti->is_const = 0;
+    ti->next_copy = t;
+    ti->prev_copy = t;
+    ti->root = t;
+}
+
+static void reset_all_temps(TCGContext *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_temps; i++) {
+        temps[i].is_const = 0;
+        temps[i].next_copy = i;
+        temps[i].prev_copy = i;
+        temps[i].root = i;
+    }
+}
+
+/* Helpers and qemu_ld/st may write the globals back to env and read
+   them again, so nothing is known about them afterwards */
+static void reset_globals(TCGContext *s)
+{
+    int i;
+
+    for (i = 0; i < s->nb_globals; i++) {
+        reset_temp(s, i);
+    }
+}
+
+static int temps_are_copies(int a, int b)
+{
+    return a == b || (temps[a].root == temps[b].root &&
+                      temps[a].next_copy != a);
+}
+
+static void make_copy(TCGContext *s, int dst, int src)
+{
+    int root = temps[src].root;
+
+    reset_temp(s, dst);
+    if (s->temps[dst].fixed_reg || s->temps[src].fixed_reg) {
+        return;
+    }
+    temps[dst].root = root;
+    temps[dst].next_copy = temps[src].next_copy;
+    temps[dst].prev_copy = src;
+    temps[temps[src].next_copy].prev_copy = dst;
+    temps[src].next_copy = dst;
+}
+
+static void make_const(TCGContext *s, int dst, tcg_target_ulong val)
+{
+    reset_temp(s, dst);
+    temps[dst].is_const = 1;
+    temps[dst].val = val;
+}
+
+static int op_bits(TCGContext *s, const TCGArg *args)
+{
+    return s->temps[args[0]].type == TCG_TYPE_I32 ? 32 : 64;
+}
+
+/* i32 constants are kept sign extended, as tcg_gen_movi_i32 emits them */
+static tcg_target_ulong canonical(int bits, tcg_target_ulong x)
+{
+#if TCG_TARGET_REG_BITS == 64
+    if (bits == 32) {
+        return (int32_t)x;
+    }
+#endif
+    return x;
+}
+
+static int op_to_movi(int bits)
+{
+#if TCG_TARGET_REG_BITS == 64
+    if (bits == 64) {
+        return INDEX_op_movi_i64;
+    }
+#endif
+    return INDEX_op_movi_i32;
+}
+
+static int op_to_mov(int bits)
+{
+#if TCG_TARGET_REG_BITS == 64
+    if (bits == 64) {
+        return INDEX_op_mov_i64;
+    }
+#endif
+    return INDEX_op_mov_i32;
+}
+
+static int op_is_commutative(int op)
+{
+    switch (op) {
+    CASE_OP_32_64(add):
+    CASE_OP_32_64(mul):
+    CASE_OP_32_64(and):
+    CASE_OP_32_64(or):
+    CASE_OP_32_64(xor):
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+/* Compute OP on constants, returns 0 if the op is not folded */
+static int do_constant_folding(int op, int bits, tcg_target_ulong x,
+                               tcg_target_ulong y, tcg_target_ulong *res)
+{
+    tcg_target_ulong mask = bits == 32 ? 0xffffffff : (tcg_target_ulong)-1;
+    tcg_target_ulong ux = x & mask;
+
+    switch (op) {
+    CASE_OP_32_64(add):
+        *res = x + y;
+        break;
+    CASE_OP_32_64(sub):
+        *res = x - y;
+        break;
+    CASE_OP_32_64(mul):
+        *res = x * y;
+        break;
+    CASE_OP_32_64(and):
+        *res = x & y;
+        break;
+    CASE_OP_32_64(or):
+        *res = x | y;
+        break;
+    CASE_OP_32_64(xor):
+        *res = x ^ y;
+        break;
+
+    /* shift counts out of range are left to the host */
+    CASE_OP_32_64(shl):
+        if (y >= bits)
+            return 0;
+        *res = x << y;
+        break;
+    CASE_OP_32_64(shr):
+        if (y >= bits)
+            return 0;
+        *res = ux >> y;
+        break;
+    case INDEX_op_sar_i32:
+        if (y >= 32)
+            return 0;
+        *res = (int32_t)x >> y;
+        break;
+#if TCG_TARGET_REG_BITS == 64
+    case INDEX_op_sar_i64:
+        if (y >= 64)
+            return 0;
+        *res = (int64_t)x >> y;
+        break;
+#endif
+#ifdef TCG_TARGET_HAS_rot_i32
+    case INDEX_op_rotl_i32:
+        if (y >= 32)
+            return 0;
+        *res = ((uint32_t)x << y) | ((uint32_t)x >> ((32 - y) & 31));
+        break;
+    case INDEX_op_rotr_i32:
+        if (y >= 32)
+            return 0;
+        *res = ((uint32_t)x >> y) | ((uint32_t)x << ((32 - y) & 31));
+        break;
+#endif
+#if defined(TCG_TARGET_HAS_rot_i64) && TCG_TARGET_REG_BITS == 64
+    case INDEX_op_rotl_i64:
+        if (y >= 64)
+            return 0;
+        *res = (x << y) | (x >> ((64 - y) & 63));
+        break;
+    case INDEX_op_rotr_i64:
+        if (y >= 64)
+            return 0;
+        *res = (x >> y) | (x << ((64 - y) & 63));
+        break;
+#endif
+
+    /* unary ops, Y is not used */
+#ifdef TCG_TARGET_HAS_not_i32
+    case INDEX_op_not_i32:
+#endif
+#if defined(TCG_TARGET_HAS_not_i64) && TCG_TARGET_REG_BITS == 64
+    case INDEX_op_not_i64:
+#endif
+#if defined(TCG_TARGET_HAS_not_i32) || defined(TCG_TARGET_HAS_not_i64)
+        *res = ~x;
+        break;
+#endif
+#ifdef TCG_TARGET_HAS_neg_i32
+    case INDEX_op_neg_i32:
+#endif
+#if defined(TCG_TARGET_HAS_neg_i64) && TCG_TARGET_REG_BITS == 64
+    case INDEX_op_neg_i64:
+#endif
+#if defined(TCG_TARGET_HAS_neg_i32) || defined(TCG_TARGET_HAS_neg_i64)
+        *res = -x;
+        break;
+#endif
+#ifdef TCG_TARGET_HAS_ext8s_i32
+    case INDEX_op_ext8s_i32:
+#endif
+#if defined(TCG_TARGET_HAS_ext8s_i64) && TCG_TARGET_REG_BITS == 64
+    case INDEX_op_ext8s_i64:
+#endif
+#if defined(TCG_TARGET_HAS_ext8s_i32) || defined(TCG_TARGET_HAS_ext8s_i64)
+        *res = (int8_t)x;
+        break;
+#endif
+#ifdef TCG_TARGET_HAS_ext16s_i32
+    case INDEX_op_ext16s_i32:
+#endif
+#if defined(TCG_TARGET_HAS_ext16s_i64) && TCG_TARGET_REG_BITS == 64
+    case INDEX_op_ext16s_i64:
+#endif
+#if defined(TCG_TARGET_HAS_ext16s_i32) || defined(TCG_TARGET_HAS_ext16s_i64)
+        *res = (int16_t)x;
+        break;
+#endif
+#ifdef TCG_TARGET_HAS_ext8u_i32
+    case INDEX_op_ext8u_i32:
+#endif
+#if defined(TCG_TARGET_HAS_ext8u_i64) && TCG_TARGET_REG_BITS == 64
+    case INDEX_op_ext8u_i64:
+#endif
+#if defined(TCG_TARGET_HAS_ext8u_i32) || defined(TCG_TARGET_HAS_ext8u_i64)
+        *res = (uint8_t)x;
+        break;
+#endif
+#ifdef TCG_TARGET_HAS_ext16u_i32
+    case INDEX_op_ext16u_i32:
+#endif
+#if defined(TCG_TARGET_HAS_ext16u_i64) && TCG_TARGET_REG_BITS == 64
+    case INDEX_op_ext16u_i64:
+#endif
+#if defined(TCG_TARGET_HAS_ext16u_i32) || defined(TCG_TARGET_HAS_ext16u_i64)
+        *res = (uint16_t)x;
+        break;
+#endif
+#if defined(TCG_TARGET_HAS_ext32s_i64) && TCG_TARGET_REG_BITS == 64
+    case INDEX_op_ext32s_i64:
+        *res = (int32_t)x;
+        break;
+#endif
+#if defined(TCG_TARGET_HAS_ext32u_i64) && TCG_TARGET_REG_BITS == 64
+    case INDEX_op_ext32u_i64:
+        *res = (uint32_t)x;
+        break;
+#endif
+
+    default:
+        return 0;
+    }
+
+    *res = canonical(bits, *res);
+    return 1;
+}
+
+static int op_is_unary(int op)
+{
+    switch (op) {
+#ifdef TCG_TARGET_HAS_not_i32
+    case INDEX_op_not_i32:
+#endif
+#ifdef TCG_TARGET_HAS_neg_i32
+    case INDEX_op_neg_i32:
+#endif
+#ifdef TCG_TARGET_HAS_ext8s_i32
+    case INDEX_op_ext8s_i32:
+#endif
+#ifdef TCG_TARGET_HAS_ext16s_i32
+    case INDEX_op_ext16s_i32:
+#endif
+#ifdef TCG_TARGET_HAS_ext8u_i32
+    case INDEX_op_ext8u_i32:
+#endif
+#ifdef TCG_TARGET_HAS_ext16u_i32
+    case INDEX_op_ext16u_i32:
+#endif
+#if TCG_TARGET_REG_BITS == 64
+#ifdef TCG_TARGET_HAS_not_i64
+    case INDEX_op_not_i64:
+#endif
+#ifdef TCG_TARGET_HAS_neg_i64
+    case INDEX_op_neg_i64:
+#endif
+#ifdef TCG_TARGET_HAS_ext8s_i64
+    case INDEX_op_ext8s_i64:
+#endif
+#ifdef TCG_TARGET_HAS_ext16s_i64
+    case INDEX_op_ext16s_i64:
+#endif
+#ifdef TCG_TARGET_HAS_ext32s_i64
+    case INDEX_op_ext32s_i64:
+#endif
+#ifdef TCG_TARGET_HAS_ext8u_i64
+    case INDEX_op_ext8u_i64:
+#endif
+#ifdef TCG_TARGET_HAS_ext16u_i64
+    case INDEX_op_ext16u_i64:
+#endif
+#ifdef TCG_TARGET_HAS_ext32u_i64
+    case INDEX_op_ext32u_i64:
+#endif
+#endif
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static int do_constant_folding_cond(TCGCond cond, int bits,
+                                    tcg_target_ulong x, tcg_target_ulong y)
+{
+    tcg_target_ulong mask = bits == 32 ? 0xffffffff : (tcg_target_ulong)-1;
+    tcg_target_long sx = canonical(bits, x), sy = canonical(bits, y);
+
+    x &= mask;
+    y &= mask;
+    switch (cond) {
+    case TCG_COND_EQ:
+        return x == y;
+    case TCG_COND_NE:
+        return x != y;
+    case TCG_COND_LT:
+        return sx < sy;
+    case TCG_COND_GE:
+        return sx >= sy;
+    case TCG_COND_LE:
+        return sx <= sy;
+    case TCG_COND_GT:
+        return sx > sy;
+    case TCG_COND_LTU:
+        return x < y;
+    case TCG_COND_GEU:
+        return x >= y;
+    case TCG_COND_LEU:
+        return x <= y;
+    case TCG_COND_GTU:
+        return x > y;
+    default:
+        tcg_abort();
+    }
+}
+
+/* Simplification with the second operand constant: returns -1 if the op
+   is the identity on its first operand, 1 if it gives *RES whatever the
+   first operand, 0 otherwise */
+static int do_simplify(int op, int bits, tcg_target_ulong y,
+                       tcg_target_ulong *res)
+{
+    tcg_target_ulong ones = canonical(bits, -1);
+
+    y = canonical(bits, y);
+    switch (op) {
+    CASE_OP_32_64(add):
+    CASE_OP_32_64(sub):
+    CASE_OP_32_64(or):
+    CASE_OP_32_64(xor):
+    CASE_OP_32_64(shl):
+    CASE_OP_32_64(shr):
+    CASE_OP_32_64(sar):
+#ifdef TCG_TARGET_HAS_rot_i32
+    case INDEX_op_rotl_i32:
+    case INDEX_op_rotr_i32:
+#endif
+#if defined(TCG_TARGET_HAS_rot_i64) && TCG_TARGET_REG_BITS == 64
+    case INDEX_op_rotl_i64:
+    case INDEX_op_rotr_i64:
+#endif
+        if (y == 0)
+            return -1;
+        if (y == ones && (op == INDEX_op_or_i32
+#if TCG_TARGET_REG_BITS == 64
+                          || op == INDEX_op_or_i64
+#endif
+                )) {
+            *res = ones;
+            return 1;
+        }
+        return 0;
+    CASE_OP_32_64(and):
+        if (y == ones)
+            return -1;
+        if (y == 0) {
+            *res = 0;
+            return 1;
+        }
+        return 0;
+    CASE_OP_32_64(mul):
+        if (y == 1)
+            return -1;
+        if (y == 0) {
+            *res = 0;
+            return 1;
+        }
+        return 0;
+    default:
+        return 0;
+    }
+}
+
+static int nb_call_args(const TCGArg *args)
+{
+    return (args[0] >> 16) + (args[0] & 0xffff) + 3;
+}
+
+/* Optimize the ops from gen_opc_buf up to TCG_OPC_PTR, whose parameters
+   start at ARGS.  The parameters are rewritten in place; returns the new
+   end of them. */
+TCGArg *tcg_optimize(TCGContext *s, uint16_t *tcg_opc_ptr, TCGArg *args,
+                     TCGOpDef *tcg_op_defs)
+{
+    int nb_ops, op_index, op, nb_args, nb_oargs, nb_iargs, i, bits, r;
+    const TCGOpDef *def;
+    TCGArg *gen_args;
+    tcg_target_ulong res;
+
+    nb_ops = tcg_opc_ptr - gen_opc_buf;
+    temps = tcg_malloc(s->nb_temps * sizeof(TempInfo));
+    reset_all_temps(s);
+
+    gen_args = args;
+    for (op_index = 0; op_index < nb_ops; op_index++) {
+        op = gen_opc_buf[op_index];
+        def = &tcg_op_defs[op];
+
+        switch (op) {
+        case INDEX_op_call:
+            /* arguments are left alone, helpers get them as they are */
+            nb_args = nb_call_args(args);
+            nb_oargs = args[0] >> 16;
+            if (!(args[nb_args - 2] & TCG_CALL_CONST)) {
+                reset_globals(s);
+            }
+            for (i = 0; i < nb_oargs; i++) {
+                reset_temp(s, args[i + 1]);
+            }
+            memmove(gen_args, args, nb_args * sizeof(TCGArg));
+            gen_args += nb_args;
+            args += nb_args;
+            continue;
+        case INDEX_op_nopn:
+            nb_args = args[0];
+            memmove(gen_args, args, nb_args * sizeof(TCGArg));
+            gen_args += nb_args;
+            args += nb_args;
+            continue;
+        case INDEX_op_discard:
+            reset_temp(s, args[0]);
+            gen_args[0] = args[0];
+            gen_args += 1;
+            args += 1;
+            continue;
+        default:
+            break;
+        }
+
+        nb_args = def->nb_args;
+        nb_oargs = def->nb_oargs;
+        nb_iargs = def->nb_iargs;
+
+        /* copy propagation */
+        for (i = nb_oargs; i < nb_oargs + nb_iargs; i++) {
+            if (temps[args[i]].next_copy != args[i]) {
+                args[i] = temps[args[i]].root;
+            }
+        }
+
+        switch (op) {
+        CASE_OP_32_64(mov):
+            bits = op_bits(s, args);
+            if (temps_are_copies(args[0], args[1])) {
+                gen_opc_buf[op_index] = INDEX_op_nop;
+                break;
+            }
+            if (temps[args[1]].is_const) {
+                gen_opc_buf[op_index] = op_to_movi(bits);
+                res = temps[args[1]].val;
+                make_const(s, args[0], res);
+                gen_args[0] = args[0];
+                gen_args[1] = res;
+            } else {
+                make_copy(s, args[0], args[1]);
+                gen_args[0] = args[0];
+                gen_args[1] = args[1];
+            }
+            gen_args += 2;
+            break;
+
+        CASE_OP_32_64(movi):
+            bits = op_bits(s, args);
+            res = canonical(bits, args[1]);
+            if (temps[args[0]].is_const && temps[args[0]].val == res) {
+                gen_opc_buf[op_index] = INDEX_op_nop;
+                break;
+            }
+            make_const(s, args[0], res);
+            gen_args[0] = args[0];
+            gen_args[1] = res;
+            gen_args += 2;
+            break;
+
+        case INDEX_op_brcond_i32:
+#if TCG_TARGET_REG_BITS == 64
+        case INDEX_op_brcond_i64:
+#endif
+            if (temps[args[0]].is_const && temps[args[1]].is_const) {
+                bits = s->temps[args[0]].type == TCG_TYPE_I32 ? 32 : 64;
+                if (do_constant_folding_cond(args[2], bits,
+                                             temps[args[0]].val,
+                                             temps[args[1]].val)) {
+                    gen_opc_buf[op_index] = INDEX_op_br;
+                    gen_args[0] = args[3];
+                    gen_args += 1;
+                } else {
+                    gen_opc_buf[op_index] = INDEX_op_nop;
+                    break;
+                }
+            } else {
+                for (i = 0; i < nb_args; i++) {
+                    gen_args[i] = args[i];
+                }
+                gen_args += nb_args;
+            }
+            reset_all_temps(s);
+            break;
+
+        default:
+            /* ops with one output and one or two inputs */
+            if (nb_oargs == 1 && !(def->flags & (TCG_OPF_SIDE_EFFECTS |
+                                                  TCG_OPF_CALL_CLOBBER)) &&
+                def->nb_cargs == 0 &&
+                (nb_iargs == 2 || (nb_iargs == 1 && op_is_unary(op)))) {
+                bits = op_bits(s, args);
+
+                if (nb_iargs == 2 && op_is_commutative(op) &&
+                    temps[args[1]].is_const && !temps[args[2]].is_const) {
+                    TCGArg t = args[1];
+                    args[1] = args[2];
+                    args[2] = t;
+                }
+
+                if (temps[args[1]].is_const &&
+                    (nb_iargs == 1 || temps[args[2]].is_const) &&
+                    do_constant_folding(op, bits, temps[args[1]].val,
+                                        nb_iargs == 1 ? 0 :
+                                        temps[args[2]].val, &res)) {
+                    goto do_movi;
+                }
+
+                if (nb_iargs == 2) {
+                    r = 0;
+                    if (temps[args[2]].is_const) {
+                        r = do_simplify(op, bits, temps[args[2]].val, &res);
+                    } else if (temps_are_copies(args[1], args[2])) {
+                        switch (op) {
+                        CASE_OP_32_64(and):
+                        CASE_OP_32_64(or):
+                            r = -1;
+                            break;
+                        CASE_OP_32_64(sub):
+                        CASE_OP_32_64(xor):
+                            res = 0;
+                            r = 1;
+                            break;
+                        }
+                    }
+                    if (r > 0)
+                        goto do_movi;
+                    if (r < 0) {
+                        if (temps_are_copies(args[0], args[1])) {
+                            gen_opc_buf[op_index] = INDEX_op_nop;
+                        } else {
+                            gen_opc_buf[op_index] = op_to_mov(bits);
+                            make_copy(s, args[0], args[1]);
+                            gen_args[0] = args[0];
+                            gen_args[1] = args[1];
+                            gen_args += 2;
+                        }
+                        break;
+                    }
+                }
+            }
+
+            /* left as it is */
+            if (def->flags & TCG_OPF_BB_END) {
+                reset_all_temps(s);
+            } else {
+                if (def->flags & TCG_OPF_CALL_CLOBBER) {
+                    reset_globals(s);
+                }
+                for (i = 0; i < nb_oargs; i++) {
+                    reset_temp(s, args[i]);
+                }
+            }
+            if (op == INDEX_op_set_label) {
+                reset_all_temps(s);
+            }
+            for (i = 0; i < nb_args; i++) {
+                gen_args[i] = args[i];
+            }
+            gen_args += nb_args;
+            break;
+
+        do_movi:
+            if (temps[args[0]].is_const && temps[args[0]].val == res) {
+                gen_opc_buf[op_index] = INDEX_op_nop;
+                break;
+            }
+            gen_opc_buf[op_index] = op_to_movi(bits);
+            make_const(s, args[0], res);
+            gen_args[0] = args[0];
+            gen_args[1] = res;
+            gen_args += 2;
+            break;
+        }
+        args += nb_args;
+    }
+
+    return gen_args;
+}
@@ -1878,14 +1878,10 @@ static void dump_op_count(void)
 #endif
 
 
-static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
-                                      long search_pc)
+/* Optimize the ops and compute their liveness.  Must be called once
+   before tcg_gen_code or tcg_gen_code_search_pc.  */
+void tcg_analyze_ops(TCGContext *s)
 {
-    int opc, op_index;
-    const TCGOpDef *def;
-    unsigned int dead_iargs;
-    const TCGArg *args;
-
 #ifdef DEBUG_DISAS
     if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP))) {
         qemu_log("OP:\n");
@@ -1894,6 +1890,17 @@ static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
     }
 #endif
 
+    if (!tcg_optimize_disabled) {
+#ifdef CONFIG_PROFILER
+        s->opt_time -= profile_getclock();
+#endif
+        gen_opparam_ptr =
+            tcg_optimize(s, gen_opc_ptr, gen_opparam_buf, tcg_op_defs);
+#ifdef CONFIG_PROFILER
+        s->opt_time += profile_getclock();
+#endif
+    }
+
 #ifdef CONFIG_PROFILER
     s->la_time -= profile_getclock();
 #endif
@@ -1904,11 +1911,20 @@ static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
 
 #ifdef DEBUG_DISAS
     if (unlikely(qemu_loglevel_mask(CPU_LOG_TB_OP_OPT))) {
-        qemu_log("OP after liveness analysis:\n");
+        qemu_log("OP after optimization and liveness analysis:\n");
         tcg_dump_ops(s, logfile);
         qemu_log("\n");
     }
 #endif
+}
+
+static inline int tcg_gen_code_common(TCGContext *s, uint8_t *gen_code_buf,
+                                      long search_pc)
+{
+    int opc, op_index;
+    const TCGOpDef *def;
+    unsigned int dead_iargs;
+    const TCGArg *args;
 
     tcg_reg_alloc_start(s);
 
@@ -2067,6 +2083,8 @@ void tcg_dump_info(FILE *f,
                 (double)s->interm_time / tot * 100.0);
     cpu_fprintf(f, "  gen_code time     %0.1f%%\n", 
                 (double)s->code_time / tot * 100.0);
+    cpu_fprintf(f, "optim./code time    %0.1f%%\n",
+                (double)s->opt_time / (s->code_time ? s->code_time : 1) * 100.0);
     cpu_fprintf(f, "liveness/code time  %0.1f%%\n", 
                 (double)s->la_time / (s->code_time ? s->code_time : 1) * 100.0);
     cpu_fprintf(f, "cpu_restore count   %" PRId64 "\n",
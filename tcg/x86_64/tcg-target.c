@@ -882,6 +882,7 @@ static void tcg_out_qemu_st(TCGContext *s, const TCGArg *args,
 static inline void tcg_out_op(TCGContext *s, int opc, const TCGArg *args,
                               const int *const_args)
 {
+    uint8_t *label_ptr;
     int c;
     
     switch(opc) {
@@ -904,6 +905,15 @@ static inline void tcg_out_op(TCGContext *s, int opc, const TCGArg *args,
         }
         s->tb_next_offset[args[0]] = s->code_ptr - s->code_buf;
         break;
+    case INDEX_op_goto_ptr:
+        /* test r, r; je 1f; jmp *r; 1: */
+        tcg_out_modrm(s, 0x85 | P_REXW, args[0], args[0]);
+        label_ptr = s->code_ptr;
+        tcg_out8(s, 0x70 + JCC_JE);
+        tcg_out8(s, 0);
+        tcg_out_modrm(s, 0xff, 4, args[0]);
+        label_ptr[1] = s->code_ptr - label_ptr - 2;
+        break;
     case INDEX_op_call:
         if (const_args[0]) {
             tcg_out_goto(s, 1, (void *) args[0]);
@@ -1290,6 +1300,7 @@ void tcg_target_qemu_prologue(TCGContext *s)
 static const TCGTargetOpDef x86_64_op_defs[] = {
     { INDEX_op_exit_tb, { } },
     { INDEX_op_goto_tb, { } },
+    { INDEX_op_goto_ptr, { "r" } },
     { INDEX_op_call, { "ri" } }, /* XXX: might need a specific constant constraint */
     { INDEX_op_jmp, { "ri" } }, /* XXX: might need a specific constant constraint */
     { INDEX_op_br, { } },
@@ -78,6 +78,7 @@ enum {
 
 #define TCG_TARGET_HAS_rot_i32
 #define TCG_TARGET_HAS_rot_i64
+#define TCG_TARGET_HAS_goto_ptr
 
 #define TCG_TARGET_HAS_GUEST_BASE
 
@@ -0,0 +1,165 @@
+/* Test the bulk block path of the SD card model against a RAM disk */
+#include "../hw/sd.c"
+
+#define DISK_SECTORS	64
+
+static uint8_t disk[DISK_SECTORS * 512];
+static BlockDriverState *dummy_bs = (BlockDriverState *) disk;
+
+int bdrv_read(BlockDriverState *bs, int64_t sector_num,
+              uint8_t *buf, int nb_sectors)
+{
+    if (sector_num < 0 || sector_num + nb_sectors > DISK_SECTORS)
+        return -1;
+    memcpy(buf, disk + sector_num * 512, nb_sectors * 512);
+    return 0;
+}
+
+int bdrv_write(BlockDriverState *bs, int64_t sector_num,
+               const uint8_t *buf, int nb_sectors)
+{
+    if (sector_num < 0 || sector_num + nb_sectors > DISK_SECTORS)
+        return -1;
+    memcpy(disk + sector_num * 512, buf, nb_sectors * 512);
+    return 0;
+}
+
+void bdrv_get_geometry(BlockDriverState *bs, uint64_t *nb_sectors_ptr)
+{
+    *nb_sectors_ptr = DISK_SECTORS;
+}
+
+int bdrv_is_read_only(BlockDriverState *bs)
+{
+    return 0;
+}
+
+int bdrv_is_inserted(BlockDriverState *bs)
+{
+    return 1;
+}
+
+void bdrv_set_change_cb(BlockDriverState *bs,
+                        void (*change_cb)(void *opaque), void *opaque)
+{
+}
+
+void qemu_set_irq(qemu_irq irq, int level)
+{
+}
+
+void *qemu_mallocz(size_t size)
+{
+    return calloc(1, size);
+}
+
+void qemu_free(void *ptr)
+{
+    free(ptr);
+}
+
+void *qemu_memalign(size_t alignment, size_t size)
+{
+    void *ptr;
+
+    if (posix_memalign(&ptr, alignment, size))
+        abort();
+    return ptr;
+}
+
+static void command(SDState *sd, int cmd, uint32_t arg)
+{
+    SDRequest req;
+    uint8_t response[16];
+
+    req.cmd = cmd;
+    req.arg = arg;
+    req.crc = 0;
+    sd_do_command(sd, &req, response);
+}
+
+static SDState *card_select(void)
+{
+    SDState *sd = sd_init(dummy_bs, 0);
+
+    command(sd, 0, 0);
+    command(sd, 55, 0);
+    command(sd, 41, 0x00ff8000);
+    command(sd, 2, 0);
+    command(sd, 3, 0);
+    command(sd, 7, sd->rca << 16);
+    return sd;
+}
+
+/* A CMD25 transfer whose length is not a multiple of the block size:
+   only the whole blocks may be claimed, the tail goes byte by byte and
+   nothing beyond the caller's buffer is written.  */
+static unsigned int test_write_partial(void)
+{
+    SDState *sd = card_select();
+    uint8_t buf[1024];
+    int i;
+
+    if (sd->state != sd_transfer_state)
+        return __LINE__;
+
+    memset(disk, 0, sizeof(disk));
+    for (i = 0; i < 1000; i++)
+        buf[i] = i * 7;
+    memset(buf + 1000, 0xaa, sizeof(buf) - 1000);
+
+    command(sd, 25, 0);
+    sd_write_block(sd, buf, 1000);
+    if (sd->blk_written != 1)
+        return __LINE__;
+    for (i = 0; i < 24; i++)
+        sd_write_data(sd, 0x55);
+    command(sd, 12, 0);
+
+    if (memcmp(disk, buf, 1000) != 0)
+        return __LINE__;
+    for (i = 1000; i < 1024; i++)
+        if (disk[i] != 0x55)
+            return __LINE__;
+    for (i = 1024; i < sizeof(disk); i++)
+        if (disk[i] != 0)
+            return __LINE__;
+    return 0;
+}
+
+static unsigned int test_read_partial(void)
+{
+    SDState *sd = card_select();
+    uint8_t buf[1000];
+    int i;
+
+    for (i = 0; i < sizeof(disk); i++)
+        disk[i] = i * 13;
+
+    command(sd, 18, 0);
+    sd_read_block(sd, buf, 1000);
+    if (memcmp(disk, buf, 1000) != 0)
+        return __LINE__;
+    for (i = 1000; i < 1024; i++)
+        if (sd_read_data(sd) != disk[i])
+            return __LINE__;
+    command(sd, 12, 0);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned int ret;
+
+    ret = test_write_partial();
+    if (ret) {
+        fprintf(stderr, "test_sd: write failed on line %i\n", ret);
+        return 1;
+    }
+    ret = test_read_partial();
+    if (ret) {
+        fprintf(stderr, "test_sd: read failed on line %i\n", ret);
+        return 1;
+    }
+    return 0;
+}
@@ -81,7 +81,7 @@ int cpu_gen_code(CPUState *env, TranslationBlock *tb, int *gen_code_size_ptr)
 {
     TCGContext *s = &tcg_ctx;
     uint8_t *gen_code_buf;
-    int gen_code_size;
+    int gen_code_size, cached;
 #ifdef CONFIG_PROFILER
     int64_t ti;
 #endif
@@ -93,7 +93,9 @@ int cpu_gen_code(CPUState *env, TranslationBlock *tb, int *gen_code_size_ptr)
 #endif
     tcg_func_start(s);
 
-    gen_intermediate_code(env, tb);
+    cached = tb_cache_load(env, tb);
+    if (!cached)
+        gen_intermediate_code(env, tb);
 
     /* generate machine code */
     gen_code_buf = tb->tc_ptr;
@@ -117,6 +119,11 @@ int cpu_gen_code(CPUState *env, TranslationBlock *tb, int *gen_code_size_ptr)
     s->interm_time += profile_getclock() - ti;
     s->code_time -= profile_getclock();
 #endif
+    /* Cached ops have already been through this */
+    if (!cached) {
+        tcg_analyze_ops(s);
+        tb_cache_store(env, tb);
+    }
     gen_code_size = tcg_gen_code(s, gen_code_buf);
     *gen_code_size_ptr = gen_code_size;
 #ifdef CONFIG_PROFILER
@@ -155,6 +162,7 @@ int cpu_restore_state(TranslationBlock *tb,
     tcg_func_start(s);
 
     gen_intermediate_code_pc(env, tb);
+    tcg_analyze_ops(s);
 
     if (use_icount) {
         /* Reset the cycle counter to the start of the block.  */
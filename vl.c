@@ -161,6 +161,7 @@ int main(int argc, char **argv)
 #include "disas.h"
 
 #include "exec-all.h"
+#include "tcg.h"
 
 #include "qemu_socket.h"
 
@@ -779,6 +780,11 @@ struct QEMUTimer {
     QEMUTimerCB *cb;
     void *opaque;
     struct QEMUTimer *next;
+    /* idle accounting, see do_info_idle */
+    const char *name;
+    uint64_t wakeups;
+    uint64_t wakeups_reported;
+    struct QEMUTimer *next_named;
 };
 
 struct qemu_alarm_timer {
@@ -1001,6 +1007,11 @@ QEMUClock *host_clock;
 
 static QEMUTimer *active_timers[QEMU_NUM_CLOCKS];
 
+/* Timers that were given a name, and wakeups of all the other ones */
+static QEMUTimer *named_timers;
+static uint64_t unnamed_wakeups, unnamed_wakeups_reported;
+static int64_t idle_reported_time;
+
 static QEMUClock *qemu_new_clock(int type)
 {
     QEMUClock *clock;
@@ -1022,9 +1033,30 @@ QEMUTimer *qemu_new_timer(QEMUClock *clock, QEMUTimerCB *cb, void *opaque)
 
 void qemu_free_timer(QEMUTimer *ts)
 {
+    QEMUTimer **pt;
+
+    if (ts->name) {
+        for (pt = &named_timers; *pt != ts; pt = &(*pt)->next_named);
+        *pt = ts->next_named;
+        unnamed_wakeups += ts->wakeups;
+        unnamed_wakeups_reported += ts->wakeups_reported;
+    }
     qemu_free(ts);
 }
 
+/* Account the wakeups of TS to NAME in "info idle".  Timers of the same
+   device should share a name so that they are reported together.  */
+void qemu_timer_set_name(QEMUTimer *ts, const char *name)
+{
+    QEMUTimer **pt;
+
+    if (!ts->name) {
+        for (pt = &named_timers; *pt; pt = &(*pt)->next_named);
+        *pt = ts;
+    }
+    ts->name = name;
+}
+
 /* stop a timer, but do not dealloc it */
 void qemu_del_timer(QEMUTimer *ts)
 {
@@ -1109,6 +1141,11 @@ static void qemu_run_timers(QEMUTimer **ptimer_head, int64_t current_time)
         *ptimer_head = ts->next;
         ts->next = NULL;
 
+        if (ts->name)
+            ts->wakeups++;
+        else
+            unnamed_wakeups++;
+
         /* run the callback (the timer list can be modified) */
         ts->cb(ts->opaque);
     }
@@ -1139,6 +1176,7 @@ static void init_clocks(void)
     host_clock = qemu_new_clock(QEMU_CLOCK_HOST);
 
     rtc_clock = host_clock;
+    idle_reported_time = qemu_get_clock(rt_clock);
 }
 
 /* save a timer */
@@ -1166,6 +1204,60 @@ void qemu_get_timer(QEMUFile *f, QEMUTimer *ts)
     }
 }
 
+/* Wakeups per second of each named timer since the previous call, and
+   when it is next due.  Between them, the machine's devices should only
+   wake the host when something the guest can see is going to happen.  */
+void do_info_idle(Monitor *mon)
+{
+    QEMUTimer *ts, *t;
+    int64_t now = qemu_get_clock(rt_clock);
+    int64_t deadline, left;
+    uint64_t total, recent;
+    double secs;
+
+    secs = (now - idle_reported_time) / 1000.0;
+    idle_reported_time = now;
+    if (secs <= 0)
+        secs = 1;
+
+    monitor_printf(mon, "%-24s %10s %10s  %s\n",
+                   "device", "wakeups/s", "total", "next deadline");
+    for (ts = named_timers; ts; ts = ts->next_named) {
+        /* Report each name once, at its first timer */
+        for (t = named_timers; t != ts && strcmp(t->name, ts->name);
+             t = t->next_named);
+        if (t != ts)
+            continue;
+
+        total = recent = 0;
+        deadline = INT64_MAX;
+        for (t = ts; t; t = t->next_named) {
+            if (strcmp(t->name, ts->name))
+                continue;
+            total += t->wakeups;
+            recent += t->wakeups - t->wakeups_reported;
+            t->wakeups_reported = t->wakeups;
+            if (qemu_timer_pending(t)) {
+                left = t->expire_time - qemu_get_clock(t->clock);
+                if (t->clock->type != QEMU_CLOCK_REALTIME)
+                    left /= 1000000;
+                deadline = MIN(deadline, left);
+            }
+        }
+        monitor_printf(mon, "%-24s %10.2f %10" PRIu64, ts->name,
+                       recent / secs, total);
+        if (deadline == INT64_MAX)
+            monitor_printf(mon, "  none\n");
+        else
+            monitor_printf(mon, "  %" PRId64 " ms\n", MAX(deadline, 0));
+    }
+
+    recent = unnamed_wakeups - unnamed_wakeups_reported;
+    unnamed_wakeups_reported = unnamed_wakeups;
+    monitor_printf(mon, "%-24s %10.2f %10" PRIu64 "\n", "(other)",
+                   recent / secs, unnamed_wakeups);
+}
+
 static const VMStateDescription vmstate_timers = {
     .name = "timer",
     .version_id = 2,
@@ -5289,6 +5381,13 @@ int main(int argc, char **argv, char **envp)
             case QEMU_OPTION_singlestep:
                 singlestep = 1;
                 break;
+            case QEMU_OPTION_no_tcg_opt:
+                tcg_optimize_disabled = 1;
+                break;
+            case QEMU_OPTION_tb_cache:
+                if (tb_cache_open(optarg) < 0)
+                    exit(1);
+                break;
             case QEMU_OPTION_S:
                 autostart = 0;
                 break;
@@ -6037,6 +6136,7 @@ int main(int argc, char **argv, char **envp)
     while (dcl != NULL) {
         if (dcl->dpy_refresh != NULL) {
             ds->gui_timer = qemu_new_timer(rt_clock, gui_update, ds);
+            qemu_timer_set_name(ds->gui_timer, "display");
             qemu_mod_timer(ds->gui_timer, qemu_get_clock(rt_clock));
         }
         dcl = dcl->next;
@@ -6044,6 +6144,7 @@ int main(int argc, char **argv, char **envp)
 
     if (display_type == DT_NOGRAPHIC || display_type == DT_VNC) {
         nographic_timer = qemu_new_timer(rt_clock, nographic_update, NULL);
+        qemu_timer_set_name(nographic_timer, "display");
         qemu_mod_timer(nographic_timer, qemu_get_clock(rt_clock));
     }
 